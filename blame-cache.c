@@ -0,0 +1,358 @@
+#include "git-compat-util.h"
+#include "blame-cache.h"
+#include "config.h"
+#include "dir.h"
+#include "gettext.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "path.h"
+#include "quote.h"
+#include "refs.h"
+#include "replace-object.h"
+#include "repository.h"
+#include "strbuf.h"
+#include "wrapper.h"
+
+/*
+ * An entry is a text file:
+ *
+ *   blame-cache 1 <commit> <number of lines>
+ *   origin <commit> <path>
+ *   previous <commit> <path>
+ *   lines <lno> <number of lines> <origin> <line in origin>
+ *   ...
+ *
+ * A "previous" line belongs to the "origin" line before it. Paths are
+ * quoted like in the output of diff when needed.
+ */
+#define BLAME_CACHE_VERSION 1
+
+/* The default for blame.cacheLimit. */
+#define BLAME_CACHE_DEFAULT_LIMIT (16 * 1024 * 1024)
+
+struct blame_cache {
+	struct repository *repo;
+	/* everything but the blob and path that goes into the entry name */
+	struct strbuf key;
+	/* the total size of the entries to keep, or 0 for no limit */
+	unsigned long limit;
+};
+
+static int add_replace_to_key(const char *refname,
+			      const char *referent UNUSED,
+			      const struct object_id *oid, int flag UNUSED,
+			      void *cb_data)
+{
+	strbuf_addf(cb_data, "replace %s %s\n", oid_to_hex(oid), refname);
+	return 0;
+}
+
+struct blame_cache *blame_cache_new(struct repository *r, const char *options)
+{
+	struct blame_cache *cache;
+
+	CALLOC_ARRAY(cache, 1);
+	cache->repo = r;
+	strbuf_init(&cache->key, 0);
+	if (repo_config_get_ulong(r, "blame.cachelimit", &cache->limit))
+		cache->limit = BLAME_CACHE_DEFAULT_LIMIT;
+	strbuf_addf(&cache->key, "blame-cache %d\n%s\n", BLAME_CACHE_VERSION,
+		    options);
+	/* replacing a commit may change who is to blame */
+	if (replace_refs_enabled(r))
+		refs_for_each_replace_ref(get_main_ref_store(r),
+					  add_replace_to_key, &cache->key);
+	return cache;
+}
+
+void blame_cache_free(struct blame_cache *cache)
+{
+	if (!cache)
+		return;
+	strbuf_release(&cache->key);
+	free(cache);
+}
+
+static char *entry_path(struct blame_cache *cache,
+			const struct object_id *blob, const char *path)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct git_hash_ctx ctx;
+	struct object_id oid;
+
+	strbuf_addbuf(&key, &cache->key);
+	strbuf_addf(&key, "blob %s\n", oid_to_hex(blob));
+	strbuf_add(&key, path, strlen(path) + 1);
+
+	cache->repo->hash_algo->init_fn(&ctx);
+	git_hash_update(&ctx, key.buf, key.len);
+	git_hash_final_oid(&oid, &ctx);
+	strbuf_release(&key);
+
+	return repo_common_path(cache->repo, "blame-cache/%s",
+				oid_to_hex(&oid));
+}
+
+size_t blame_cache_add_origin(struct blame_cache_entry *entry,
+			      const struct object_id *commit, const char *path,
+			      const struct object_id *previous,
+			      const char *previous_path)
+{
+	struct blame_cache_origin *o;
+
+	ALLOC_GROW(entry->origins, entry->origins_nr + 1,
+		   entry->origins_alloc);
+	o = &entry->origins[entry->origins_nr];
+	memset(o, 0, sizeof(*o));
+	oidcpy(&o->commit, commit);
+	o->path = xstrdup(path);
+	if (previous) {
+		oidcpy(&o->previous, previous);
+		o->previous_path = xstrdup(previous_path);
+	}
+	return entry->origins_nr++;
+}
+
+void blame_cache_entry_release(struct blame_cache_entry *entry)
+{
+	for (size_t i = 0; i < entry->origins_nr; i++) {
+		free(entry->origins[i].path);
+		free(entry->origins[i].previous_path);
+	}
+	free(entry->origins);
+	free(entry->ranges);
+	memset(entry, 0, sizeof(*entry));
+}
+
+/* Parse "<oid> <path>", where the path may be quoted. */
+static int parse_oid_and_path(struct repository *r, const char *p,
+			      struct object_id *oid, struct strbuf *path)
+{
+	const char *end;
+
+	if (parse_oid_hex_algop(p, oid, &p, r->hash_algo) || *p++ != ' ')
+		return -1;
+	strbuf_reset(path);
+	if (*p != '"') {
+		strbuf_addstr(path, p);
+		return 0;
+	}
+	if (unquote_c_style(path, p, &end) || *end)
+		return -1;
+	return 0;
+}
+
+static int parse_entry(struct repository *r, FILE *fp,
+		       struct blame_cache_entry *entry)
+{
+	struct strbuf line = STRBUF_INIT, path = STRBUF_INIT;
+	int version, next_lno = 0, ret = -1;
+	const char *p;
+	char *end;
+
+	if (strbuf_getline(&line, fp) ||
+	    !skip_prefix(line.buf, "blame-cache ", &p))
+		goto out;
+	version = strtol(p, &end, 10);
+	if (version != BLAME_CACHE_VERSION || *end != ' ' ||
+	    parse_oid_hex_algop(end + 1, &entry->commit, &p, r->hash_algo) ||
+	    *p != ' ')
+		goto out;
+	entry->num_lines = strtol(p + 1, &end, 10);
+	if (*end || entry->num_lines < 0)
+		goto out;
+
+	while (!strbuf_getline(&line, fp)) {
+		struct object_id oid;
+
+		if (skip_prefix(line.buf, "origin ", &p)) {
+			if (parse_oid_and_path(r, p, &oid, &path))
+				goto out;
+			blame_cache_add_origin(entry, &oid, path.buf, NULL, NULL);
+		} else if (skip_prefix(line.buf, "previous ", &p)) {
+			struct blame_cache_origin *o;
+
+			if (!entry->origins_nr ||
+			    parse_oid_and_path(r, p, &oid, &path))
+				goto out;
+			o = &entry->origins[entry->origins_nr - 1];
+			if (o->previous_path)
+				goto out;
+			oidcpy(&o->previous, &oid);
+			o->previous_path = strbuf_detach(&path, NULL);
+		} else if (skip_prefix(line.buf, "lines ", &p)) {
+			struct blame_cache_range *range;
+			unsigned long origin;
+
+			ALLOC_GROW(entry->ranges, entry->ranges_nr + 1,
+				   entry->ranges_alloc);
+			range = &entry->ranges[entry->ranges_nr++];
+			range->lno = strtol(p, &end, 10);
+			if (*end != ' ')
+				goto out;
+			range->num_lines = strtol(end + 1, &end, 10);
+			if (*end != ' ')
+				goto out;
+			origin = strtoul(end + 1, &end, 10);
+			if (*end != ' ')
+				goto out;
+			range->origin = origin;
+			range->s_lno = strtol(end + 1, &end, 10);
+			if (*end || range->lno != next_lno ||
+			    range->num_lines <= 0 || range->s_lno < 0 ||
+			    range->origin >= entry->origins_nr)
+				goto out;
+			next_lno += range->num_lines;
+		} else {
+			goto out;
+		}
+	}
+	if (next_lno == entry->num_lines)
+		ret = 0;
+
+out:
+	strbuf_release(&line);
+	strbuf_release(&path);
+	return ret;
+}
+
+int blame_cache_read(struct blame_cache *cache, const struct object_id *blob,
+		     const char *path, struct blame_cache_entry *entry)
+{
+	char *file = entry_path(cache, blob, path);
+	FILE *fp = fopen(file, "r");
+	int ret = -1;
+
+	memset(entry, 0, sizeof(*entry));
+	if (fp) {
+		ret = parse_entry(cache->repo, fp, entry);
+		fclose(fp);
+		if (ret) {
+			warning(_("ignoring corrupt blame cache entry '%s'"),
+				file);
+			blame_cache_entry_release(entry);
+		} else {
+			/* keep recently used entries when pruning */
+			utime(file, NULL);
+		}
+	}
+	free(file);
+	return ret;
+}
+
+static void add_oid_and_path(struct strbuf *sb, const char *prefix,
+			     const struct object_id *oid, const char *path)
+{
+	strbuf_addf(sb, "%s %s ", prefix, oid_to_hex(oid));
+	quote_c_style(path, sb, NULL, 0);
+	strbuf_addch(sb, '\n');
+}
+
+struct cache_file {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int cache_file_cmp(const void *va, const void *vb)
+{
+	const struct cache_file *a = va, *b = vb;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Remove the least recently used entries until all of them together
+ * fit in the limit again. The entry in `keep` was just written and is
+ * never removed, even if it alone is over the limit.
+ */
+static void prune_blame_cache(struct blame_cache *cache, const char *keep)
+{
+	struct cache_file *files = NULL;
+	size_t files_nr = 0, files_alloc = 0;
+	struct strbuf path = STRBUF_INIT;
+	uintmax_t total = 0;
+	size_t dirlen;
+	struct dirent *de;
+	DIR *dir;
+
+	if (!cache->limit)
+		return;
+	repo_common_path_append(cache->repo, &path, "blame-cache/");
+	dir = opendir(path.buf);
+	if (!dir)
+		goto out;
+	dirlen = path.len;
+	while ((de = readdir(dir))) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		total += st.st_size;
+		if (!strcmp(path.buf, keep))
+			continue;
+		ALLOC_GROW(files, files_nr + 1, files_alloc);
+		files[files_nr].path = xstrdup(path.buf);
+		files[files_nr].mtime = st.st_mtime;
+		files[files_nr].size = st.st_size;
+		files_nr++;
+	}
+	closedir(dir);
+
+	QSORT(files, files_nr, cache_file_cmp);
+	for (size_t i = 0; i < files_nr && total > cache->limit; i++)
+		if (!unlink(files[i].path))
+			total -= files[i].size;
+
+	for (size_t i = 0; i < files_nr; i++)
+		free(files[i].path);
+	free(files);
+out:
+	strbuf_release(&path);
+}
+
+void blame_cache_write(struct blame_cache *cache, const struct object_id *blob,
+		       const char *path, const struct blame_cache_entry *entry)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	char *file = entry_path(cache, blob, path);
+
+	if (safe_create_leading_directories(cache->repo, file) != SCLD_OK ||
+	    hold_lock_file_for_update(&lk, file, 0) < 0)
+		goto out;
+
+	strbuf_addf(&buf, "blame-cache %d %s %d\n", BLAME_CACHE_VERSION,
+		    oid_to_hex(&entry->commit), entry->num_lines);
+	for (size_t i = 0; i < entry->origins_nr; i++) {
+		const struct blame_cache_origin *o = &entry->origins[i];
+
+		add_oid_and_path(&buf, "origin", &o->commit, o->path);
+		if (o->previous_path)
+			add_oid_and_path(&buf, "previous", &o->previous,
+					 o->previous_path);
+	}
+	for (size_t i = 0; i < entry->ranges_nr; i++) {
+		const struct blame_cache_range *range = &entry->ranges[i];
+
+		strbuf_addf(&buf, "lines %d %d %"PRIuMAX" %d\n",
+			    range->lno, range->num_lines,
+			    (uintmax_t)range->origin, range->s_lno);
+	}
+
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lk))
+		rollback_lock_file(&lk);
+	else
+		prune_blame_cache(cache, file);
+
+out:
+	strbuf_release(&buf);
+	free(file);
+}
@@ -0,0 +1,82 @@
+#ifndef BLAME_CACHE_H
+#define BLAME_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * An on-disk cache of blame results, enabled with blame.cache.
+ *
+ * Each entry records who is to blame for every line of one blob at one
+ * path, as computed by a blame that started at a given commit. Entries
+ * are named after a hash of the blob, the path, the options that affect
+ * the result and the replace refs, and live in $GIT_DIR/blame-cache.
+ * See setup_blame_cache() in blame.c for how they are used.
+ *
+ * Reading an entry updates its mtime. Whenever an entry is written, the
+ * least recently used ones are removed until the cache is no larger
+ * than blame.cacheLimit.
+ */
+struct blame_cache;
+
+struct blame_cache_origin {
+	struct object_id commit;
+	char *path;
+	/* the origin this one was blamed against, if any */
+	struct object_id previous;
+	char *previous_path;
+};
+
+/* A group of lines of the cached blob, with 0-based line numbers. */
+struct blame_cache_range {
+	int lno;
+	int num_lines;
+	/* index into `origins` of the blamed origin */
+	size_t origin;
+	/* the line number of the first line in the blamed origin */
+	int s_lno;
+};
+
+struct blame_cache_entry {
+	/* the commit the blame started from */
+	struct object_id commit;
+	int num_lines;
+
+	struct blame_cache_origin *origins;
+	size_t origins_nr, origins_alloc;
+	/* sorted by line number, covering every line exactly once */
+	struct blame_cache_range *ranges;
+	size_t ranges_nr, ranges_alloc;
+};
+
+/*
+ * Prepare to use the cache. `options` describes the blame options that
+ * affect the result; entries made with different options do not match.
+ */
+struct blame_cache *blame_cache_new(struct repository *r, const char *options);
+void blame_cache_free(struct blame_cache *cache);
+
+/*
+ * Read the entry for `blob` at `path` into `entry`. Returns 0 on
+ * success, or -1 if there is no usable entry.
+ */
+int blame_cache_read(struct blame_cache *cache, const struct object_id *blob,
+		     const char *path, struct blame_cache_entry *entry);
+
+/*
+ * Store `entry` as the entry for `blob` at `path`, replacing any
+ * existing one. Errors are ignored, as the cache is only an optimization.
+ */
+void blame_cache_write(struct blame_cache *cache, const struct object_id *blob,
+		       const char *path, const struct blame_cache_entry *entry);
+
+/* Append an origin to `entry` and return its index. */
+size_t blame_cache_add_origin(struct blame_cache_entry *entry,
+			      const struct object_id *commit, const char *path,
+			      const struct object_id *previous,
+			      const char *previous_path);
+
+void blame_cache_entry_release(struct blame_cache_entry *entry);
+
+#endif /* BLAME_CACHE_H */
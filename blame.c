@@ -17,12 +17,16 @@
 #include "revision.h"
 #include "setup.h"
 #include "tag.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "blame.h"
+#include "blame-cache.h"
 #include "alloc.h"
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "strmap.h"
+#include "userdiff.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -1258,22 +1262,34 @@ static int fill_blob_sha1_and_mode(struct repository *r,
 struct blame_bloom_data {
 	/*
 	 * Changed-path Bloom filter keys. These can help prevent
-	 * computing diffs against first parents, but we need to
-	 * expand the list as code is moved or files are renamed.
+	 * computing diffs against first parents. Each origin is
+	 * checked against the keys for its own path and its leading
+	 * directories, which we compute once per path, so that a
+	 * renamed file is followed with the keys of its old name.
 	 */
 	struct bloom_filter_settings *settings;
-	struct bloom_key **keys;
-	int nr;
-	int alloc;
+	struct strmap keys;
 };
 
 static int bloom_count_queries = 0;
 static int bloom_count_no = 0;
+
+static struct bloom_keyvec *get_bloom_keys(struct blame_bloom_data *bd,
+					   const char *path)
+{
+	struct bloom_keyvec *keys = strmap_get(&bd->keys, path);
+
+	if (!keys) {
+		keys = bloom_keyvec_new(path, strlen(path), bd->settings);
+		strmap_put(&bd->keys, path, keys);
+	}
+	return keys;
+}
+
 static int maybe_changed_path(struct repository *r,
 			      struct blame_origin *origin,
 			      struct blame_bloom_data *bd)
 {
-	int i;
 	struct bloom_filter *filter;
 
 	if (!bd)
@@ -1288,33 +1304,15 @@ static int maybe_changed_path(struct repository *r,
 		return 1;
 
 	bloom_count_queries++;
-	for (i = 0; i < bd->nr; i++) {
-		if (bloom_filter_contains(filter,
-					  bd->keys[i],
-					  bd->settings))
-			return 1;
-	}
+	if (bloom_filter_contains_vec(filter,
+				      get_bloom_keys(bd, origin->path),
+				      bd->settings))
+		return 1;
 
 	bloom_count_no++;
 	return 0;
 }
 
-static void add_bloom_key(struct blame_bloom_data *bd,
-			  const char *path)
-{
-	if (!bd)
-		return;
-
-	if (bd->nr >= bd->alloc) {
-		bd->alloc *= 2;
-		REALLOC_ARRAY(bd->keys, bd->alloc);
-	}
-
-	bd->keys[bd->nr] = xmalloc(sizeof(struct bloom_key));
-	bloom_key_fill(bd->keys[bd->nr], path, strlen(path), bd->settings);
-	bd->nr++;
-}
-
 /*
  * We have an origin -- check if the same path exists in the
  * parent and return an origin structure to represent it.
@@ -1418,8 +1416,7 @@ static struct blame_origin *find_origin(struct repository *r,
  */
 static struct blame_origin *find_rename(struct repository *r,
 					struct commit *parent,
-					struct blame_origin *origin,
-					struct blame_bloom_data *bd)
+					struct blame_origin *origin)
 {
 	struct blame_origin *porigin = NULL;
 	struct diff_options diff_opts;
@@ -1444,7 +1441,6 @@ static struct blame_origin *find_rename(struct repository *r,
 		struct diff_filepair *p = diff_queued_diff.queue[i];
 		if ((p->status == 'R' || p->status == 'C') &&
 		    !strcmp(p->two->path, origin->path)) {
-			add_bloom_key(bd, p->one->path);
 			porigin = get_origin(parent, p->one->path);
 			oidcpy(&porigin->blob_oid, &p->one->oid);
 			porigin->mode = p->one->mode;
@@ -2149,6 +2145,213 @@ static struct blame_entry **filter_small(struct blame_scoreboard *sb,
 	return small;
 }
 
+/*
+ * Looking for moves and copies diffs every remaining blame entry
+ * against one or more blobs from the parent, which is what makes "-C"
+ * slow. With sb->num_threads, the blobs are read and the diffs are run
+ * on several threads up front, keeping only the resulting hunks. The
+ * hunks are then fed to handle_split_cb() on the main thread in the
+ * same order as find_copy_in_blob() would, so the result does not
+ * depend on the number of threads.
+ */
+#define MAX_BLAME_THREADS 32
+
+/* do not bother with threads for fewer diffs than this */
+#define BLAME_THREAD_MIN_DIFFS 64
+
+/* how many blobs to look for copies in at once */
+#define BLAME_COPY_BATCH 256
+
+struct blame_hunks {
+	struct blame_hunk {
+		long start_a, count_a, start_b, count_b;
+	} *v;
+	size_t nr, alloc;
+};
+
+struct blame_diff_job {
+	struct blame_scoreboard *sb;
+	int nr_threads;
+
+	/* the blobs to diff against; those with a `load` oid are read first */
+	mmfile_t *files;
+	const struct object_id **load;
+	int files_nr;
+
+	struct blame_entry **ents;
+	int ents_nr;
+
+	/* the hunks of entry j against blob i are in hunks[i * ents_nr + j] */
+	struct blame_hunks *hunks;
+
+	/* set after the threads are joined if any of them failed */
+	int failed;
+};
+
+struct blame_thread {
+	pthread_t pthread;
+	struct blame_diff_job *job;
+	int nr;
+	int failed;
+};
+
+static int blame_threads(struct blame_scoreboard *sb)
+{
+	if (!HAVE_THREADS || sb->num_threads < 2)
+		return 1;
+	return sb->num_threads < MAX_BLAME_THREADS ?
+		sb->num_threads : MAX_BLAME_THREADS;
+}
+
+static int record_hunk_cb(long start_a, long count_a,
+			  long start_b, long count_b, void *data)
+{
+	struct blame_hunks *h = data;
+
+	ALLOC_GROW(h->v, h->nr + 1, h->alloc);
+	h->v[h->nr].start_a = start_a;
+	h->v[h->nr].count_a = count_a;
+	h->v[h->nr].start_b = start_b;
+	h->v[h->nr].count_b = count_b;
+	h->nr++;
+	return 0;
+}
+
+static void *read_blobs_thread(void *data)
+{
+	struct blame_thread *t = data;
+	struct blame_diff_job *job = t->job;
+
+	trace2_thread_start("blame-read");
+	for (int i = t->nr; i < job->files_nr; i += job->nr_threads) {
+		enum object_type type;
+		unsigned long size;
+
+		if (!job->load[i])
+			continue;
+		job->files[i].ptr = odb_read_object(the_repository->objects,
+						    job->load[i], &type, &size);
+		job->files[i].size = size;
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void *diff_entries_thread(void *data)
+{
+	struct blame_thread *t = data;
+	struct blame_diff_job *job = t->job;
+	struct blame_scoreboard *sb = job->sb;
+	int nr = job->files_nr * job->ents_nr;
+
+	trace2_thread_start("blame-diff");
+	for (int k = t->nr; k < nr; k += job->nr_threads) {
+		mmfile_t *file_p = &job->files[k / job->ents_nr];
+		struct blame_entry *ent = job->ents[k % job->ents_nr];
+		mmfile_t file_o;
+
+		if (!file_p->ptr)
+			continue;
+		file_o.ptr = (char *)blame_nth_line(sb, ent->lno);
+		file_o.size = blame_nth_line(sb, ent->lno + ent->num_lines) -
+			      file_o.ptr;
+		if (diff_hunks(file_p, &file_o, record_hunk_cb,
+			       &job->hunks[k], sb->xdl_opts))
+			t->failed = 1;
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void run_blame_threads(struct blame_diff_job *job, void *(*fn)(void *))
+{
+	struct blame_thread *threads;
+
+	CALLOC_ARRAY(threads, job->nr_threads);
+	for (int i = 0; i < job->nr_threads; i++) {
+		int err;
+
+		threads[i].job = job;
+		threads[i].nr = i;
+		err = pthread_create(&threads[i].pthread, NULL, fn, &threads[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (int i = 0; i < job->nr_threads; i++) {
+		if (pthread_join(threads[i].pthread, NULL))
+			die(_("unable to join thread"));
+		job->failed |= threads[i].failed;
+	}
+	free(threads);
+}
+
+static void read_blame_job_blobs(struct blame_diff_job *job)
+{
+	int use_lock = !obj_read_use_lock;
+
+	if (use_lock)
+		enable_obj_read_lock();
+	run_blame_threads(job, read_blobs_thread);
+	if (use_lock)
+		disable_obj_read_lock();
+}
+
+static void diff_blame_job_entries(struct blame_diff_job *job)
+{
+	int nr = job->files_nr * job->ents_nr;
+
+	CALLOC_ARRAY(job->hunks, nr);
+	run_blame_threads(job, diff_entries_thread);
+	if (job->failed)
+		die("unable to generate diff");
+}
+
+static void clear_blame_job_hunks(struct blame_diff_job *job)
+{
+	for (int k = 0; k < job->files_nr * job->ents_nr; k++)
+		free(job->hunks[k].v);
+	FREE_AND_NULL(job->hunks);
+}
+
+/*
+ * Like find_copy_in_blob(), but with the hunks of a diff that has
+ * already been run.
+ */
+static void find_copy_in_hunks(struct blame_scoreboard *sb,
+			       struct blame_entry *ent,
+			       struct blame_origin *parent,
+			       struct blame_entry *split,
+			       const struct blame_hunks *hunks)
+{
+	struct handle_split_cb_data d;
+
+	memset(&d, 0, sizeof(d));
+	d.sb = sb; d.ent = ent; d.parent = parent; d.split = split;
+	memset(split, 0, sizeof(struct blame_entry [3]));
+	for (size_t i = 0; i < hunks->nr; i++)
+		handle_split_cb(hunks->v[i].start_a, hunks->v[i].count_a,
+				hunks->v[i].start_b, hunks->v[i].count_b, &d);
+	/* remainder, if any, all match the preimage */
+	handle_split(sb, ent, d.tlno, d.plno, ent->num_lines, parent, split);
+}
+
+/*
+ * Whether reading the blob of o has to go through textconv, which is
+ * left to the main thread.
+ */
+static int blame_needs_textconv(struct blame_scoreboard *sb,
+				struct blame_origin *o)
+{
+	struct userdiff_driver *drv;
+
+	if (!sb->revs->diffopt.flags.allow_textconv || !S_ISREG(o->mode))
+		return 0;
+	drv = userdiff_find_by_path(sb->repo->index, o->path);
+	if (!drv)
+		drv = userdiff_find_by_name("default");
+	return drv && drv->textconv;
+}
+
 /*
  * See if lines currently target is suspected for can be attributed to
  * parent.
@@ -2163,6 +2366,7 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
 	mmfile_t file_p;
+	int nr_threads = blame_threads(sb);
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -2180,9 +2384,31 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		struct blame_entry *next;
+		struct blame_diff_job job = { 0 };
+		int i = 0;
+
+		if (nr_threads > 1) {
+			for (e = unblamed; e; e = e->next)
+				job.ents_nr++;
+			if (job.ents_nr >= BLAME_THREAD_MIN_DIFFS) {
+				job.sb = sb;
+				job.nr_threads = nr_threads;
+				job.files = &file_p;
+				job.files_nr = 1;
+				ALLOC_ARRAY(job.ents, job.ents_nr);
+				for (e = unblamed; e; e = e->next)
+					job.ents[i++] = e;
+				diff_blame_job_entries(&job);
+				i = 0;
+			}
+		}
 		for (e = unblamed; e; e = next) {
 			next = e->next;
-			find_copy_in_blob(sb, e, parent, split, &file_p);
+			if (job.hunks)
+				find_copy_in_hunks(sb, e, parent, split,
+						   &job.hunks[i++]);
+			else
+				find_copy_in_blob(sb, e, parent, split, &file_p);
 			if (split[1].suspect &&
 			    sb->move_score < blame_entry_score(sb, &split[1])) {
 				split_blame(blamed, &unblamedtail, split, e);
@@ -2192,6 +2418,9 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 			}
 			decref_split(split);
 		}
+		if (job.hunks)
+			clear_blame_job_hunks(&job);
+		free(job.ents);
 		*unblamedtail = NULL;
 		toosmall = filter_small(sb, toosmall, &unblamed, sb->move_score);
 	} while (unblamed);
@@ -2225,6 +2454,155 @@ static struct blame_list *setup_blame_list(struct blame_entry *unblamed,
 	return blame_list;
 }
 
+/*
+ * Whether the preimage of p is worth looking for copies in; porigin is
+ * the path in the parent find_move_in_parent() already tried.
+ */
+static int is_copy_source(struct diff_filepair *p, struct blame_origin *porigin)
+{
+	if (!DIFF_FILE_VALID(p->one))
+		return 0; /* does not exist in parent */
+	if (S_ISGITLINK(p->one->mode))
+		return 0; /* ignore git links */
+	if (porigin && !strcmp(p->one->path, porigin->path))
+		return 0; /* find_move already dealt with this path */
+	return 1;
+}
+
+/*
+ * The part of find_copy_in_parent() that finds the best split for each
+ * entry in blame_list among the paths in the diff queue.
+ */
+static void find_copies(struct blame_scoreboard *sb,
+			struct blame_list *blame_list, int num_ents,
+			struct commit *parent, struct blame_origin *porigin)
+{
+	int i, j;
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+		struct blame_origin *norigin;
+		mmfile_t file_p;
+		struct blame_entry potential[3];
+
+		if (!is_copy_source(p, porigin))
+			continue;
+
+		norigin = get_origin(parent, p->one->path);
+		oidcpy(&norigin->blob_oid, &p->one->oid);
+		norigin->mode = p->one->mode;
+		fill_origin_blob(&sb->revs->diffopt, norigin, &file_p,
+				 &sb->num_read_blob, 0);
+		if (!file_p.ptr)
+			continue;
+
+		for (j = 0; j < num_ents; j++) {
+			find_copy_in_blob(sb, blame_list[j].ent,
+					  norigin, potential, &file_p);
+			copy_split_if_better(sb, blame_list[j].split,
+					     potential);
+			decref_split(potential);
+		}
+		blame_origin_decref(norigin);
+	}
+}
+
+/*
+ * Like find_copies(), but with the blobs read and diffed on several
+ * threads, a batch of them at a time.
+ */
+static void find_copies_threaded(struct blame_scoreboard *sb,
+				 struct blame_list *blame_list, int num_ents,
+				 struct commit *parent,
+				 struct blame_origin *porigin, int nr_threads)
+{
+	struct blame_diff_job job = { 0 };
+	struct blame_origin **origins;
+	int i = 0;
+
+	job.sb = sb;
+	job.nr_threads = nr_threads;
+	job.ents_nr = num_ents;
+	ALLOC_ARRAY(job.ents, num_ents);
+	for (int j = 0; j < num_ents; j++)
+		job.ents[j] = blame_list[j].ent;
+	ALLOC_ARRAY(job.files, BLAME_COPY_BATCH);
+	ALLOC_ARRAY(job.load, BLAME_COPY_BATCH);
+	ALLOC_ARRAY(origins, BLAME_COPY_BATCH);
+
+	while (i < diff_queued_diff.nr) {
+		int to_load = 0;
+
+		job.files_nr = 0;
+		for (; i < diff_queued_diff.nr && job.files_nr < BLAME_COPY_BATCH; i++) {
+			struct diff_filepair *p = diff_queued_diff.queue[i];
+			struct blame_origin *norigin;
+			int n;
+
+			if (!is_copy_source(p, porigin))
+				continue;
+			norigin = get_origin(parent, p->one->path);
+			oidcpy(&norigin->blob_oid, &p->one->oid);
+			norigin->mode = p->one->mode;
+
+			n = job.files_nr++;
+			origins[n] = norigin;
+			job.load[n] = NULL;
+			if (norigin->file.ptr || blame_needs_textconv(sb, norigin)) {
+				fill_origin_blob(&sb->revs->diffopt, norigin,
+						 &job.files[n], &sb->num_read_blob, 0);
+			} else {
+				job.load[n] = &norigin->blob_oid;
+				sb->num_read_blob++;
+				to_load++;
+			}
+		}
+		if (!job.files_nr)
+			break;
+
+		if (to_load)
+			read_blame_job_blobs(&job);
+		for (int n = 0; n < job.files_nr; n++) {
+			struct blame_origin *norigin = origins[n];
+
+			if (!job.load[n])
+				continue;
+			if (!job.files[n].ptr)
+				die("Cannot read blob %s for path %s",
+				    oid_to_hex(&norigin->blob_oid),
+				    norigin->path);
+			/* the same preimage may appear more than once */
+			if (norigin->file.ptr) {
+				free(job.files[n].ptr);
+				job.files[n] = norigin->file;
+			} else {
+				norigin->file = job.files[n];
+			}
+		}
+
+		diff_blame_job_entries(&job);
+		for (int n = 0; n < job.files_nr; n++) {
+			for (int j = 0; job.files[n].ptr && j < num_ents; j++) {
+				struct blame_entry potential[3];
+
+				find_copy_in_hunks(sb, blame_list[j].ent, origins[n],
+						   potential,
+						   &job.hunks[n * num_ents + j]);
+				copy_split_if_better(sb, blame_list[j].split,
+						     potential);
+				decref_split(potential);
+			}
+			blame_origin_decref(origins[n]);
+		}
+		clear_blame_job_hunks(&job);
+	}
+
+	free(origins);
+	free(job.load);
+	free(job.files);
+	free(job.ents);
+}
+
 /*
  * For lines target is suspected for, see if we can find code movement
  * across file boundary from the parent commit.  porigin is the path
@@ -2244,6 +2622,8 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 	int num_ents;
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	int nr_threads = blame_threads(sb);
+	int num_sources = 0;
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -2276,41 +2656,21 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 	if (!diff_opts.flags.find_copies_harder)
 		diffcore_std(&diff_opts);
 
+	if (nr_threads > 1)
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			num_sources += is_copy_source(diff_queued_diff.queue[i],
+						      porigin);
+
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		blame_list = setup_blame_list(unblamed, &num_ents);
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			struct diff_filepair *p = diff_queued_diff.queue[i];
-			struct blame_origin *norigin;
-			mmfile_t file_p;
-			struct blame_entry potential[3];
-
-			if (!DIFF_FILE_VALID(p->one))
-				continue; /* does not exist in parent */
-			if (S_ISGITLINK(p->one->mode))
-				continue; /* ignore git links */
-			if (porigin && !strcmp(p->one->path, porigin->path))
-				/* find_move already dealt with this path */
-				continue;
-
-			norigin = get_origin(parent, p->one->path);
-			oidcpy(&norigin->blob_oid, &p->one->oid);
-			norigin->mode = p->one->mode;
-			fill_origin_blob(&sb->revs->diffopt, norigin, &file_p,
-					 &sb->num_read_blob, 0);
-			if (!file_p.ptr)
-				continue;
-
-			for (j = 0; j < num_ents; j++) {
-				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, potential, &file_p);
-				copy_split_if_better(sb, blame_list[j].split,
-						     potential);
-				decref_split(potential);
-			}
-			blame_origin_decref(norigin);
-		}
+		if (nr_threads > 1 &&
+		    (uint64_t)num_sources * num_ents >= BLAME_THREAD_MIN_DIFFS)
+			find_copies_threaded(sb, blame_list, num_ents, parent,
+					     porigin, nr_threads);
+		else
+			find_copies(sb, blame_list, num_ents, parent, porigin);
 
 		for (j = 0; j < num_ents; j++) {
 			struct blame_entry *split = blame_list[j].split;
@@ -2356,6 +2716,130 @@ static void pass_whole_blame(struct blame_scoreboard *sb,
 	queue_blames(sb, porigin, suspects);
 }
 
+struct blame_cache_data {
+	struct blame_cache *cache;
+	/* the blob we started from, or the null oid if it is not cached */
+	struct object_id final_blob;
+	int hits;
+};
+
+static struct blame_origin *get_cached_origin(struct blame_scoreboard *sb,
+					      const struct object_id *oid,
+					      const char *path)
+{
+	struct commit *commit = lookup_commit(sb->repo, oid);
+	struct blame_origin *o;
+
+	if (!commit || repo_parse_commit(sb->repo, commit))
+		return NULL;
+	o = get_origin(commit, path);
+	if (is_null_oid(&o->blob_oid) && fill_blob_sha1_and_mode(sb->repo, o)) {
+		blame_origin_decref(o);
+		return NULL;
+	}
+	/* treat root commit as boundary, like assign_blame() does */
+	if (!commit->parents && !sb->show_root)
+		commit->object.flags |= UNINTERESTING;
+	return o;
+}
+
+static const struct blame_cache_range *find_cached_range(
+	const struct blame_cache_entry *entry, int lno)
+{
+	size_t lo = 0, hi = entry->ranges_nr;
+
+	while (lo + 1 < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		if (entry->ranges[mi].lno <= lno)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	return &entry->ranges[lo];
+}
+
+/*
+ * If a previous blame that started at this very origin left its result
+ * in the blame cache, take the blame for all suspects of the origin from
+ * there instead of passing it to the parents, and return 0.
+ */
+static int pass_blame_from_cache(struct blame_scoreboard *sb,
+				 struct blame_origin *origin)
+{
+	struct blame_cache_data *cd = sb->cache_data;
+	struct blame_cache_entry entry;
+	struct blame_origin **origins;
+	struct blame_entry *e, *next;
+	int ret = -1;
+
+	if (blame_cache_read(cd->cache, &origin->blob_oid, origin->path,
+			     &entry))
+		return -1;
+	if (!oideq(&entry.commit, &origin->commit->object.oid))
+		goto out_entry;
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > entry.num_lines)
+			goto out_entry;
+
+	CALLOC_ARRAY(origins, entry.origins_nr);
+	for (size_t nr = 0; nr < entry.origins_nr; nr++) {
+		const struct blame_cache_origin *co = &entry.origins[nr];
+
+		origins[nr] = get_cached_origin(sb, &co->commit, co->path);
+		if (!origins[nr])
+			goto out;
+		if (co->previous_path && !origins[nr]->previous) {
+			origins[nr]->previous =
+				get_cached_origin(sb, &co->previous,
+						  co->previous_path);
+			if (!origins[nr]->previous)
+				goto out;
+		}
+	}
+
+	for (e = origin->suspects; e; e = next) {
+		int s_lno = e->s_lno, end = e->s_lno + e->num_lines;
+
+		next = e->next;
+		while (s_lno < end) {
+			const struct blame_cache_range *range =
+				find_cached_range(&entry, s_lno);
+			struct blame_entry *n;
+
+			CALLOC_ARRAY(n, 1);
+			n->lno = e->lno + s_lno - e->s_lno;
+			n->num_lines = range->lno + range->num_lines - s_lno;
+			if (n->num_lines > end - s_lno)
+				n->num_lines = end - s_lno;
+			n->s_lno = range->s_lno + s_lno - range->lno;
+			n->suspect = blame_origin_incref(origins[range->origin]);
+			n->suspect->guilty = 1;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(n, sb->found_guilty_entry_data);
+			n->next = sb->ent;
+			sb->ent = n;
+			s_lno += n->num_lines;
+		}
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+
+	cd->hits++;
+	/* there is nothing new to store if we started from here */
+	if (origin->commit == sb->final)
+		oidclr(&cd->final_blob, sb->repo->hash_algo);
+	ret = 0;
+
+out:
+	for (size_t i = 0; i < entry.origins_nr; i++)
+		blame_origin_decref(origins[i]);
+	free(origins);
+out_entry:
+	blame_cache_entry_release(&entry);
+	return ret;
+}
+
 /*
  * We pass blame from the current commit to its parents.  We keep saying
  * "parent" (and "porigin"), but what we mean is to find scapegoat to
@@ -2405,11 +2889,6 @@ static void distribute_blame(struct blame_scoreboard *sb, struct blame_entry *bl
 
 #define MAXSG 16
 
-typedef struct blame_origin *(*blame_find_alg)(struct repository *,
-					       struct commit *,
-					       struct blame_origin *,
-					       struct blame_bloom_data *);
-
 static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin, int opt)
 {
 	struct rev_info *revs = sb->revs;
@@ -2421,6 +2900,9 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	struct blame_entry *toosmall = NULL;
 	struct blame_entry *blames, **blametail = &blames;
 
+	if (sb->cache_data && !pass_blame_from_cache(sb, origin))
+		return;
+
 	num_sg = num_scapegoats(revs, commit, sb->reverse);
 	if (!num_sg)
 		goto finish;
@@ -2434,8 +2916,6 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	 * common cases, then we look for renames in the second pass.
 	 */
 	for (pass = 0; pass < 2 - sb->no_whole_file_rename; pass++) {
-		blame_find_alg find = pass ? find_rename : find_origin;
-
 		for (i = 0, sg = first_scapegoat(revs, commit, sb->reverse);
 		     i < num_sg && sg;
 		     sg = sg->next, i++) {
@@ -2446,7 +2926,11 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 				continue;
 			if (repo_parse_commit(the_repository, p))
 				continue;
-			porigin = find(sb->repo, p, origin, sb->bloom_data);
+			if (pass)
+				porigin = find_rename(sb->repo, p, origin);
+			else
+				porigin = find_origin(sb->repo, p, origin,
+						      sb->bloom_data);
 			if (!porigin)
 				continue;
 			if (oideq(&porigin->blob_oid, &origin->blob_oid)) {
@@ -2919,14 +3403,103 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb)
 	bd = xmalloc(sizeof(struct blame_bloom_data));
 
 	bd->settings = bs;
+	strmap_init(&bd->keys);
 
-	bd->alloc = 4;
-	bd->nr = 0;
-	ALLOC_ARRAY(bd->keys, bd->alloc);
+	sb->bloom_data = bd;
+}
 
-	add_bloom_key(bd, sb->path);
+void setup_blame_cache(struct blame_scoreboard *sb, int opt)
+{
+	struct blame_cache_data *cd;
+	struct blame_origin *o;
+	struct userdiff_driver *drv;
+	struct strbuf options = STRBUF_INIT;
 
-	sb->bloom_data = bd;
+	/*
+	 * Only cache results that depend on nothing but the commit and
+	 * the path we start from: a bottom commit or a date limit stops
+	 * the walk early, and with ignored revisions or move and copy
+	 * detection the blame for a line depends on how lines are
+	 * grouped further up in history.
+	 */
+	if (sb->reverse || sb->revs->limited || sb->revs->max_age != -1 ||
+	    oidset_size(&sb->ignore_list) ||
+	    (opt & (PICKAXE_BLAME_MOVE | PICKAXE_BLAME_COPY)))
+		return;
+	/* grafts and shallow boundaries rewrite history, too */
+	prepare_commit_graft(sb->repo);
+	if (sb->repo->parsed_objects->grafts_nr)
+		return;
+	drv = userdiff_find_by_path(sb->repo->index, sb->path);
+	if (sb->revs->diffopt.flags.allow_textconv && drv && drv->textconv)
+		return;
+
+	strbuf_addf(&options, "xdl-opts %d\nshow-root %d\nfirst-parent %d\n"
+		    "no-whole-file-rename %d\n",
+		    sb->xdl_opts, sb->show_root, sb->revs->first_parent_only,
+		    sb->no_whole_file_rename);
+
+	CALLOC_ARRAY(cd, 1);
+	cd->cache = blame_cache_new(sb->repo, options.buf);
+	strbuf_release(&options);
+	if (!is_null_oid(&sb->final->object.oid))
+		for (o = get_blame_suspects(sb->final); o; o = o->next)
+			if (!strcmp(o->path, sb->path))
+				oidcpy(&cd->final_blob, &o->blob_oid);
+	sb->cache_data = cd;
+}
+
+void save_blame_cache(struct blame_scoreboard *sb)
+{
+	struct blame_cache_data *cd = sb->cache_data;
+	struct blame_cache_entry entry = { 0 };
+	struct strintmap origins;
+	struct strbuf key = STRBUF_INIT;
+	struct blame_entry *e;
+	int lno = 0;
+
+	if (!cd || is_null_oid(&cd->final_blob) || !sb->num_lines)
+		return;
+
+	oidcpy(&entry.commit, &sb->final->object.oid);
+	entry.num_lines = sb->num_lines;
+	strintmap_init(&origins, -1);
+	for (e = sb->ent; e; e = e->next) {
+		struct blame_origin *o = e->suspect, *prev = o->previous;
+		struct blame_cache_range *range;
+		int i;
+
+		/* only store complete results, not those of "-L" */
+		if (e->lno != lno)
+			goto out;
+		lno += e->num_lines;
+
+		strbuf_reset(&key);
+		strbuf_addf(&key, "%s %s", oid_to_hex(&o->commit->object.oid),
+			    o->path);
+		i = strintmap_get(&origins, key.buf);
+		if (i < 0) {
+			i = blame_cache_add_origin(&entry, &o->commit->object.oid,
+						   o->path,
+						   prev ? &prev->commit->object.oid : NULL,
+						   prev ? prev->path : NULL);
+			strintmap_set(&origins, key.buf, i);
+		}
+
+		ALLOC_GROW(entry.ranges, entry.ranges_nr + 1, entry.ranges_alloc);
+		range = &entry.ranges[entry.ranges_nr++];
+		range->lno = e->lno;
+		range->num_lines = e->num_lines;
+		range->origin = i;
+		range->s_lno = e->s_lno;
+	}
+	if (lno == sb->num_lines)
+		blame_cache_write(cd->cache, &cd->final_blob, sb->path, &entry);
+
+out:
+	strbuf_release(&key);
+	strintmap_clear(&origins);
+	blame_cache_entry_release(&entry);
 }
 
 void cleanup_scoreboard(struct blame_scoreboard *sb)
@@ -2936,13 +3509,20 @@ void cleanup_scoreboard(struct blame_scoreboard *sb)
 	clear_prio_queue(&sb->commits);
 	oidset_clear(&sb->ignore_list);
 
+	if (sb->cache_data) {
+		blame_cache_free(sb->cache_data->cache);
+		trace2_data_intmax("blame", sb->repo, "cache/hits",
+				   sb->cache_data->hits);
+		FREE_AND_NULL(sb->cache_data);
+	}
+
 	if (sb->bloom_data) {
-		int i;
-		for (i = 0; i < sb->bloom_data->nr; i++) {
-			free(sb->bloom_data->keys[i]->hashes);
-			free(sb->bloom_data->keys[i]);
-		}
-		free(sb->bloom_data->keys);
+		struct hashmap_iter iter;
+		struct strmap_entry *e;
+
+		strmap_for_each_entry(&sb->bloom_data->keys, &iter, e)
+			bloom_keyvec_free(e->value);
+		strmap_clear(&sb->bloom_data->keys, 0);
 		FREE_AND_NULL(sb->bloom_data);
 
 		trace2_data_intmax("blame", sb->repo,
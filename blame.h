@@ -98,6 +98,7 @@ struct blame_entry {
 };
 
 struct blame_bloom_data;
+struct blame_cache_data;
 
 /*
  * The current state of the blame assignment.
@@ -150,12 +151,16 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/* threads to diff with when looking for moves and copies */
+	int num_threads;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
 
 	void *found_guilty_entry_data;
 	struct blame_bloom_data *bloom_data;
+	struct blame_cache_data *cache_data;
 };
 
 /*
@@ -180,6 +185,20 @@ void init_scoreboard(struct blame_scoreboard *sb);
 void setup_scoreboard(struct blame_scoreboard *sb,
 		      struct blame_origin **orig);
 void setup_blame_bloom_data(struct blame_scoreboard *sb);
+
+/*
+ * Use the blame cache (see blame-cache.h) while assigning blame, if
+ * the options `opt` and those in the scoreboard allow it. Must be
+ * called after setup_scoreboard() and before the origin it returned is
+ * released.
+ */
+void setup_blame_cache(struct blame_scoreboard *sb, int opt);
+
+/*
+ * Store the blame of the whole final image in the blame cache, if it
+ * is in use. The blame entries must be sorted by blame_sort_final().
+ */
+void save_blame_cache(struct blame_scoreboard *sb);
 void cleanup_scoreboard(struct blame_scoreboard *sb);
 
 struct blame_entry *blame_entry_prepend(struct blame_entry *head,
@@ -16,6 +16,7 @@
 #include "run-command.h"
 #include "parse-options.h"
 #include "path.h"
+#include "prehash-index.h"
 #include "preload-index.h"
 #include "diff.h"
 #include "read-cache.h"
@@ -339,6 +340,7 @@ static int add_files(struct repository *repo, struct dir_struct *dir, int flags)
 {
 	int i, exit_status = 0;
 	struct string_list matched_sparse_paths = STRING_LIST_INIT_NODUP;
+	struct string_list paths = STRING_LIST_INIT_NODUP;
 
 	if (dir->ignored_nr) {
 		fprintf(stderr, _(ignore_error));
@@ -349,6 +351,13 @@ static int add_files(struct repository *repo, struct dir_struct *dir, int flags)
 		exit_status = 1;
 	}
 
+	for (i = 0; i < dir->nr; i++)
+		if (include_sparse ||
+		    path_in_sparse_checkout(dir->entries[i]->name, repo->index))
+			string_list_append(&paths, dir->entries[i]->name);
+	prehash_index_paths(repo->index, &paths, flags);
+	string_list_clear(&paths, 0);
+
 	for (i = 0; i < dir->nr; i++) {
 		if (!include_sparse &&
 		    !path_in_sparse_checkout(dir->entries[i]->name, repo->index)) {
@@ -364,6 +373,7 @@ static int add_files(struct repository *repo, struct dir_struct *dir, int flags)
 			check_embedded_repo(dir->entries[i]->name);
 		}
 	}
+	clear_prehashed_paths(repo->index);
 
 	if (matched_sparse_paths.nr) {
 		advise_on_updating_sparse_paths(&matched_sparse_paths);
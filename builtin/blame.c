@@ -34,6 +34,7 @@
 #include "refs.h"
 #include "setup.h"
 #include "tag.h"
+#include "thread-utils.h"
 #include "write-or-die.h"
 
 static const char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
@@ -65,6 +66,8 @@ static int incremental;
 static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
+static int use_blame_cache;
+static int blame_threads;
 static int show_progress;
 static char repeated_meta_color[COLOR_MAXLEN];
 static int coloring_mode;
@@ -714,6 +717,17 @@ static int git_blame_config(const char *var, const char *value,
 		show_root = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "blame.threads")) {
+		blame_threads = git_config_int(var, value, ctx->kvi);
+		if (blame_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    blame_threads, "blame.threads");
+		return 0;
+	}
 	if (!strcmp(var, "blame.blankboundary")) {
 		blank_boundary = git_config_bool(var, value);
 		return 0;
@@ -1196,6 +1210,9 @@ int cmd_blame(int argc,
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.num_threads = blame_threads ? blame_threads : online_cpus();
+	if (use_blame_cache)
+		setup_blame_cache(&sb, opt);
 
 	read_mailmap(&mailmap);
 
@@ -1210,15 +1227,17 @@ int cmd_blame(int argc,
 
 	stop_progress(&pi.progress);
 
+	blame_sort_final(&sb);
+
+	blame_coalesce(&sb);
+
+	save_blame_cache(&sb);
+
 	if (!incremental)
 		setup_pager(the_repository);
 	else
 		goto cleanup;
 
-	blame_sort_final(&sb);
-
-	blame_coalesce(&sb);
-
 	if (!(output_option & (OUTPUT_COLOR_LINE | OUTPUT_SHOW_AGE_WITH_COLOR)))
 		output_option |= coloring_mode;
 
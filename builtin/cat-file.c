@@ -29,6 +29,7 @@
 #include "promisor-remote.h"
 #include "mailmap.h"
 #include "write-or-die.h"
+#include "thread-utils.h"
 
 enum batch_mode {
 	BATCH_MODE_CONTENTS,
@@ -48,6 +49,8 @@ struct batch_options {
 	char input_delim;
 	char output_delim;
 	const char *format;
+	int parallel;
+	int read_ahead;
 };
 
 static const char *force_path;
@@ -306,6 +309,14 @@ struct expand_data {
 	 * optimized out.
 	 */
 	unsigned skip_object_info : 1;
+
+	/*
+	 * Object contents read ahead of time by a --parallel worker, to be
+	 * printed instead of reading the object again; NULL otherwise.
+	 */
+	void *contents;
+	enum object_type contents_type;
+	unsigned long contents_size;
 };
 #define EXPAND_DATA_INIT  { .mode = S_IFINVALID }
 
@@ -415,6 +426,9 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 				BUG("invalid transform_mode: %c", opt->transform_mode);
 			batch_write(opt, contents, size);
 			free(contents);
+		} else if (data->contents) {
+			batch_write(opt, data->contents, data->contents_size);
+			FREE_AND_NULL(data->contents);
 		} else {
 			stream_blob(oid);
 		}
@@ -424,8 +438,15 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 		unsigned long size;
 		void *contents;
 
-		contents = odb_read_object(the_repository->objects, oid,
-					   &type, &size);
+		if (data->contents) {
+			contents = data->contents;
+			type = data->contents_type;
+			size = data->contents_size;
+			data->contents = NULL;
+		} else {
+			contents = odb_read_object(the_repository->objects, oid,
+						   &type, &size);
+		}
 		if (!contents)
 			die("object %s disappeared", oid_to_hex(oid));
 
@@ -464,35 +485,54 @@ static void report_object_status(struct batch_options *opt,
 }
 
 /*
- * If "pack" is non-NULL, then "offset" is the byte offset within the pack from
- * which the object may be accessed (though note that we may also rely on
- * data->oid, too). If "pack" is NULL, then offset is ignored.
+ * Return 1 if the object described by "data" is excluded by the objects
+ * filter, 0 otherwise.
  */
-static void batch_object_write(const char *obj_name,
+static int batch_object_excluded(struct batch_options *opt,
+				 struct expand_data *data)
+{
+	switch (opt->objects_filter.choice) {
+	case LOFC_DISABLED:
+		return 0;
+	case LOFC_BLOB_NONE:
+		return data->type == OBJ_BLOB;
+	case LOFC_BLOB_LIMIT:
+		return data->type == OBJ_BLOB &&
+			data->size >= opt->objects_filter.blob_limit_value;
+	case LOFC_OBJECT_TYPE:
+		return data->type != opt->objects_filter.object_type;
+	default:
+		BUG("unsupported objects filter");
+	}
+}
+
+/*
+ * Point data->info at the fields that the objects filter and mailmap
+ * need, on top of those requested by the format.
+ */
+static void batch_object_prepare_info(struct batch_options *opt,
+				      struct expand_data *data)
+{
+	if (use_mailmap ||
+	    opt->objects_filter.choice == LOFC_BLOB_NONE ||
+	    opt->objects_filter.choice == LOFC_BLOB_LIMIT ||
+	    opt->objects_filter.choice == LOFC_OBJECT_TYPE)
+		data->info.typep = &data->type;
+	if (opt->objects_filter.choice == LOFC_BLOB_LIMIT)
+		data->info.sizep = &data->size;
+}
+
+/*
+ * Print the result of looking up an object, where "ret" is the return
+ * value of the lookup (ignored with data->skip_object_info).
+ */
+static void batch_object_print(const char *obj_name,
 			       struct strbuf *scratch,
 			       struct batch_options *opt,
 			       struct expand_data *data,
-			       struct packed_git *pack,
-			       off_t offset)
+			       int ret)
 {
 	if (!data->skip_object_info) {
-		int ret;
-
-		if (use_mailmap ||
-		    opt->objects_filter.choice == LOFC_BLOB_NONE ||
-		    opt->objects_filter.choice == LOFC_BLOB_LIMIT ||
-		    opt->objects_filter.choice == LOFC_OBJECT_TYPE)
-			data->info.typep = &data->type;
-		if (opt->objects_filter.choice == LOFC_BLOB_LIMIT)
-			data->info.sizep = &data->size;
-
-		if (pack)
-			ret = packed_object_info(the_repository, pack,
-						 offset, &data->info);
-		else
-			ret = odb_read_object_info_extended(the_repository->objects,
-							    &data->oid, &data->info,
-							    OBJECT_INFO_LOOKUP_REPLACE);
 		if (ret < 0) {
 			if (data->mode == S_IFGITLINK)
 				report_object_status(opt, oid_to_hex(&data->oid), &data->oid, "submodule");
@@ -501,36 +541,11 @@ static void batch_object_write(const char *obj_name,
 			return;
 		}
 
-		switch (opt->objects_filter.choice) {
-		case LOFC_DISABLED:
-			break;
-		case LOFC_BLOB_NONE:
-			if (data->type == OBJ_BLOB) {
-				if (!opt->all_objects)
-					report_object_status(opt, obj_name,
-							     &data->oid, "excluded");
-				return;
-			}
-			break;
-		case LOFC_BLOB_LIMIT:
-			if (data->type == OBJ_BLOB &&
-			    data->size >= opt->objects_filter.blob_limit_value) {
-				if (!opt->all_objects)
-					report_object_status(opt, obj_name,
-							     &data->oid, "excluded");
-				return;
-			}
-			break;
-		case LOFC_OBJECT_TYPE:
-			if (data->type != opt->objects_filter.object_type) {
-				if (!opt->all_objects)
-					report_object_status(opt, obj_name,
-							     &data->oid, "excluded");
-				return;
-			}
-			break;
-		default:
-			BUG("unsupported objects filter");
+		if (batch_object_excluded(opt, data)) {
+			if (!opt->all_objects)
+				report_object_status(opt, obj_name,
+						     &data->oid, "excluded");
+			return;
 		}
 
 		if (use_mailmap && (data->type == OBJ_COMMIT || data->type == OBJ_TAG)) {
@@ -565,65 +580,115 @@ static void batch_object_write(const char *obj_name,
 	}
 }
 
-static void batch_one_object(const char *obj_name,
-			     struct strbuf *scratch,
-			     struct batch_options *opt,
-			     struct expand_data *data)
+/*
+ * If "pack" is non-NULL, then "offset" is the byte offset within the pack from
+ * which the object may be accessed (though note that we may also rely on
+ * data->oid, too). If "pack" is NULL, then offset is ignored.
+ */
+static void batch_object_write(const char *obj_name,
+			       struct strbuf *scratch,
+			       struct batch_options *opt,
+			       struct expand_data *data,
+			       struct packed_git *pack,
+			       off_t offset)
+{
+	int ret = 0;
+
+	if (!data->skip_object_info) {
+		batch_object_prepare_info(opt, data);
+
+		if (pack)
+			ret = packed_object_info(the_repository, pack,
+						 offset, &data->info);
+		else
+			ret = odb_read_object_info_extended(the_repository->objects,
+							    &data->oid, &data->info,
+							    OBJECT_INFO_LOOKUP_REPLACE);
+	}
+
+	batch_object_print(obj_name, scratch, opt, data, ret);
+}
+
+/*
+ * Resolve "obj_name" into data->oid and data->mode. If that fails, the
+ * line to report instead is added to "status" and -1 is returned.
+ */
+static int batch_resolve_object(const char *obj_name,
+				struct batch_options *opt,
+				struct expand_data *data,
+				struct strbuf *status)
 {
 	struct object_context ctx = {0};
 	int flags =
 		GET_OID_HASH_ANY |
 		(opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0);
 	enum get_oid_result result;
+	int ret = -1;
 
 	result = get_oid_with_context(the_repository, obj_name,
 				      flags, &data->oid, &ctx);
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
-			report_object_status(opt, obj_name, &data->oid, "missing");
+			strbuf_addf(status, "%s missing%c",
+				    obj_name, opt->output_delim);
 			break;
 		case SHORT_NAME_AMBIGUOUS:
-			report_object_status(opt, obj_name, &data->oid, "ambiguous");
+			strbuf_addf(status, "%s ambiguous%c",
+				    obj_name, opt->output_delim);
 			break;
 		case DANGLING_SYMLINK:
-			printf("dangling %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
+			strbuf_addf(status, "dangling %"PRIuMAX"%c%s%c",
+				    (uintmax_t)strlen(obj_name),
+				    opt->output_delim, obj_name, opt->output_delim);
 			break;
 		case SYMLINK_LOOP:
-			printf("loop %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
+			strbuf_addf(status, "loop %"PRIuMAX"%c%s%c",
+				    (uintmax_t)strlen(obj_name),
+				    opt->output_delim, obj_name, opt->output_delim);
 			break;
 		case NOT_DIR:
-			printf("notdir %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
+			strbuf_addf(status, "notdir %"PRIuMAX"%c%s%c",
+				    (uintmax_t)strlen(obj_name),
+				    opt->output_delim, obj_name, opt->output_delim);
 			break;
 		default:
 			BUG("unknown get_sha1_with_context result %d\n",
 			       result);
 			break;
 		}
-		fflush(stdout);
-
 		goto out;
 	}
 
 	if (ctx.mode == 0) {
-		printf("symlink %"PRIuMAX"%c%s%c",
-		       (uintmax_t)ctx.symlink_path.len,
-		       opt->output_delim, ctx.symlink_path.buf, opt->output_delim);
-		fflush(stdout);
+		strbuf_addf(status, "symlink %"PRIuMAX"%c%s%c",
+			    (uintmax_t)ctx.symlink_path.len,
+			    opt->output_delim, ctx.symlink_path.buf, opt->output_delim);
 		goto out;
 	}
 
 	data->mode = ctx.mode;
-	batch_object_write(obj_name, scratch, opt, data, NULL, 0);
+	ret = 0;
 
 out:
 	object_context_release(&ctx);
+	return ret;
+}
+
+static void batch_one_object(const char *obj_name,
+			     struct strbuf *scratch,
+			     struct batch_options *opt,
+			     struct expand_data *data)
+{
+	struct strbuf status = STRBUF_INIT;
+
+	if (batch_resolve_object(obj_name, opt, data, &status) < 0) {
+		fwrite(status.buf, 1, status.len, stdout);
+		fflush(stdout);
+	} else {
+		batch_object_write(obj_name, scratch, opt, data, NULL, 0);
+	}
+	strbuf_release(&status);
 }
 
 struct object_cb_data {
@@ -869,6 +934,241 @@ static void batch_each_object(struct batch_options *opt,
 	free_bitmap_index(bitmap);
 }
 
+/*
+ * With --parallel, requests are read from stdin in batches. The names are
+ * resolved on the main thread, the objects are then looked up and read by
+ * the worker threads, and finally the results are printed in input order.
+ */
+#define PARALLEL_BATCH_PER_THREAD 64
+
+struct parallel_request {
+	char *line;
+	struct expand_data data;
+	struct strbuf status;
+	int resolved;
+	int ret;
+
+	/* where the object lives, if --read-ahead sorts the batch */
+	struct packed_git *pack;
+	off_t offset;
+};
+
+struct parallel_batch {
+	struct batch_options *opt;
+	unsigned long big_file_threshold;
+
+	struct parallel_request *req;
+	size_t nr;
+
+	/* the order in which the requests are handed out to the workers */
+	struct parallel_request **order;
+	size_t next;
+	pthread_mutex_t mutex;
+};
+
+/*
+ * Copy the prepared expand_data, pointing the object_info at the fields
+ * of the copy.
+ */
+static void copy_expand_data(struct expand_data *dst,
+			     const struct expand_data *src)
+{
+	*dst = *src;
+	if (src->info.typep)
+		dst->info.typep = &dst->type;
+	if (src->info.sizep)
+		dst->info.sizep = &dst->size;
+	if (src->info.disk_sizep)
+		dst->info.disk_sizep = &dst->disk_size;
+	if (src->info.delta_base_oid)
+		dst->info.delta_base_oid = &dst->delta_base_oid;
+}
+
+static void parallel_add_request(struct parallel_batch *b,
+				 const struct expand_data *data,
+				 struct strbuf *input)
+{
+	struct parallel_request *r = &b->req[b->nr++];
+
+	copy_expand_data(&r->data, data);
+	r->line = strbuf_detach(input, NULL);
+	if (r->data.split_on_whitespace) {
+		char *p = strpbrk(r->line, " \t");
+		if (p) {
+			while (*p && strchr(" \t", *p))
+				*p++ = '\0';
+		}
+		r->data.rest = p;
+	}
+
+	strbuf_init(&r->status, 0);
+	r->resolved = !batch_resolve_object(r->line, b->opt, &r->data,
+					    &r->status);
+	r->ret = 0;
+	r->pack = NULL;
+	r->offset = 0;
+
+	if (b->opt->read_ahead && r->resolved) {
+		struct pack_entry e;
+
+		if (find_pack_entry(the_repository, &r->data.oid, &e)) {
+			r->pack = e.p;
+			r->offset = e.offset;
+		}
+	}
+}
+
+static int compare_request_offset(const void *va, const void *vb)
+{
+	const struct parallel_request *a = *(const struct parallel_request **)va;
+	const struct parallel_request *b = *(const struct parallel_request **)vb;
+
+	if (a->pack != b->pack)
+		return (uintptr_t)a->pack < (uintptr_t)b->pack ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+static void parallel_read_object(struct parallel_batch *b,
+				 struct parallel_request *r)
+{
+	struct expand_data *data = &r->data;
+
+	if (!r->resolved)
+		return;
+
+	if (!data->skip_object_info)
+		r->ret = odb_read_object_info_extended(the_repository->objects,
+						       &data->oid, &data->info,
+						       OBJECT_INFO_LOOKUP_REPLACE);
+
+	if (b->opt->batch_mode != BATCH_MODE_CONTENTS || r->ret < 0 ||
+	    batch_object_excluded(b->opt, data))
+		return;
+	/* large blobs are streamed when printing */
+	if (data->type == OBJ_BLOB && data->size > b->big_file_threshold)
+		return;
+
+	/*
+	 * If this fails, printing tries again and reports the error.
+	 */
+	data->contents = odb_read_object(the_repository->objects, &data->oid,
+					 &data->contents_type,
+					 &data->contents_size);
+}
+
+static void *parallel_worker(void *arg)
+{
+	struct parallel_batch *b = arg;
+
+	for (;;) {
+		struct parallel_request *r = NULL;
+
+		pthread_mutex_lock(&b->mutex);
+		if (b->next < b->nr)
+			r = b->order[b->next++];
+		pthread_mutex_unlock(&b->mutex);
+		if (!r)
+			break;
+
+		parallel_read_object(b, r);
+	}
+	return NULL;
+}
+
+static void parallel_run(struct parallel_batch *b)
+{
+	int nr_threads = b->opt->parallel;
+
+	for (size_t i = 0; i < b->nr; i++)
+		b->order[i] = &b->req[i];
+	if (b->opt->read_ahead)
+		QSORT(b->order, b->nr, compare_request_offset);
+	b->next = 0;
+
+	if (nr_threads > b->nr)
+		nr_threads = b->nr;
+
+	if (nr_threads > 1) {
+		pthread_t *threads;
+		int i;
+
+		CALLOC_ARRAY(threads, nr_threads);
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++) {
+			int err = pthread_create(&threads[i], NULL,
+						 parallel_worker, b);
+			if (err)
+				die(_("cat-file: unable to create thread: %s"),
+				    strerror(err));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		disable_obj_read_lock();
+		free(threads);
+	} else {
+		parallel_worker(b);
+	}
+}
+
+static void batch_objects_parallel(struct batch_options *opt,
+				   struct strbuf *input,
+				   struct strbuf *output,
+				   const struct expand_data *data)
+{
+	struct parallel_batch b = { .opt = opt };
+	struct expand_data tmpl;
+	size_t batch_size;
+	int eof = 0;
+
+	batch_size = opt->read_ahead ? opt->read_ahead :
+		PARALLEL_BATCH_PER_THREAD * opt->parallel;
+	b.big_file_threshold = repo_settings_get_big_file_threshold(the_repository);
+	ALLOC_ARRAY(b.req, batch_size);
+	ALLOC_ARRAY(b.order, batch_size);
+	pthread_mutex_init(&b.mutex, NULL);
+
+	/* the workers need the size to decide whether to read a blob */
+	copy_expand_data(&tmpl, data);
+	if (opt->batch_mode == BATCH_MODE_CONTENTS)
+		tmpl.info.sizep = &tmpl.size;
+
+	while (!eof) {
+		b.nr = 0;
+		while (b.nr < batch_size) {
+			if (strbuf_getdelim_strip_crlf(input, stdin,
+						       opt->input_delim) == EOF) {
+				eof = 1;
+				break;
+			}
+			parallel_add_request(&b, &tmpl, input);
+		}
+
+		parallel_run(&b);
+
+		for (size_t i = 0; i < b.nr; i++) {
+			struct parallel_request *r = &b.req[i];
+
+			if (r->resolved) {
+				batch_object_print(r->line, output, opt,
+						   &r->data, r->ret);
+			} else {
+				fwrite(r->status.buf, 1, r->status.len, stdout);
+				fflush(stdout);
+			}
+
+			free(r->data.contents);
+			strbuf_release(&r->status);
+			free(r->line);
+		}
+	}
+
+	pthread_mutex_destroy(&b.mutex);
+	free(b.order);
+	free(b.req);
+}
+
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf input = STRBUF_INIT;
@@ -954,6 +1254,11 @@ static int batch_objects(struct batch_options *opt)
 		goto cleanup;
 	}
 
+	if (opt->parallel > 1 || opt->read_ahead) {
+		batch_objects_parallel(opt, &input, &output, &data);
+		goto cleanup;
+	}
+
 	while (strbuf_getdelim_strip_crlf(&input, stdin, opt->input_delim) != EOF) {
 		if (data.split_on_whitespace) {
 			/*
@@ -1027,6 +1332,7 @@ int cmd_cat_file(int argc,
 	const char *exp_type = NULL, *obj_name = NULL;
 	struct batch_options batch = {
 		.objects_filter = LIST_OBJECTS_FILTER_INIT,
+		.parallel = 1,
 	};
 	int unknown_type = 0;
 	int input_nul_terminated = 0;
@@ -1040,6 +1346,7 @@ int cmd_cat_file(int argc,
 		   "             [<rev>:<path|tree-ish> | --path=<path|tree-ish> <rev>]"),
 		N_("git cat-file (--batch | --batch-check | --batch-command) [--batch-all-objects]\n"
 		   "             [--buffer] [--follow-symlinks] [--unordered]\n"
+		   "             [--parallel=<n>] [--read-ahead=<n>]\n"
 		   "             [--textconv | --filters] [-Z]"),
 		NULL
 	};
@@ -1083,6 +1390,10 @@ int cmd_cat_file(int argc,
 			 N_("follow in-tree symlinks")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order objects before emitting them")),
+		OPT_INTEGER(0, "parallel", &batch.parallel,
+			    N_("read objects on <n> threads")),
+		OPT_INTEGER(0, "read-ahead", &batch.read_ahead,
+			    N_("read <n> requests ahead and handle them in pack order")),
 		/* Textconv options, stand-ole*/
 		OPT_GROUP(N_("Emit object (blob or tree) with conversion or filter (stand-alone, or with batch)")),
 		OPT_CMDMODE(0, "textconv", &opt,
@@ -1149,6 +1460,40 @@ int cmd_cat_file(int argc,
 	else if (nul_terminated)
 		usage_msg_optf(_("'%s' requires a batch mode"), builtin_catfile_usage,
 			       options, "-Z");
+	else if (batch.parallel != 1)
+		usage_msg_optf(_("'%s' requires a batch mode"), builtin_catfile_usage,
+			       options, "--parallel");
+	else if (batch.read_ahead)
+		usage_msg_optf(_("'%s' requires a batch mode"), builtin_catfile_usage,
+			       options, "--read-ahead");
+
+	if (batch.parallel != 1 || batch.read_ahead) {
+		const char *opt_name = batch.parallel != 1 ? "--parallel" : "--read-ahead";
+
+		if (batch.batch_mode == BATCH_MODE_QUEUE_AND_DISPATCH)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    opt_name, "--batch-command");
+		if (opt == 'b')
+			die(_("options '%s' and '%s' cannot be used together"),
+			    opt_name, "--batch-all-objects");
+		if (opt_cw)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    opt_name, opt == 'c' ? "--textconv" : "--filters");
+		if (use_mailmap)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    opt_name, "--use-mailmap");
+	}
+	if (batch.read_ahead < 0)
+		die(_("invalid value for '%s': '%d'"), "--read-ahead",
+		    batch.read_ahead);
+	if (batch.parallel < 0)
+		die(_("invalid number of threads specified (%d)"), batch.parallel);
+	else if (!batch.parallel)
+		batch.parallel = HAVE_THREADS ? online_cpus() : 1;
+	else if (!HAVE_THREADS && batch.parallel > 1) {
+		warning(_("no threads support, ignoring %s"), "--parallel");
+		batch.parallel = 1;
+	}
 
 	batch.input_delim = batch.output_delim = '\n';
 	if (input_nul_terminated)
@@ -1158,7 +1503,8 @@ int cmd_cat_file(int argc,
 
 	/* Batch defaults */
 	if (batch.buffer_output < 0)
-		batch.buffer_output = batch.all_objects;
+		batch.buffer_output = batch.all_objects ||
+			batch.parallel > 1 || batch.read_ahead;
 
 	prepare_repo_settings(the_repository);
 	the_repository->settings.command_requires_full_index = 0;
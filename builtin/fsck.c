@@ -48,6 +48,7 @@ static int errors_found;
 static int write_lost_and_found;
 static int verbose;
 static int show_progress = -1;
+static int nr_threads = -1;
 static int show_dangling = 1;
 static int name_objects;
 static int check_references = 1;
@@ -928,7 +929,8 @@ static char const * const fsck_usage[] = {
 	N_("git fsck [--tags] [--root] [--unreachable] [--cache] [--no-reflogs]\n"
 	   "         [--[no-]full] [--strict] [--verbose] [--lost-found]\n"
 	   "         [--[no-]dangling] [--[no-]progress] [--connectivity-only]\n"
-	   "         [--[no-]name-objects] [--[no-]references] [<object>...]"),
+	   "         [--[no-]name-objects] [--[no-]references] [--threads=<n>]\n"
+	   "         [<object>...]"),
 	NULL
 };
 
@@ -948,6 +950,7 @@ static struct option fsck_opts[] = {
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
 	OPT_BOOL(0, "references", &check_references, N_("check reference database consistency")),
+	OPT_INTEGER(0, "threads", &nr_threads, N_("use <n> threads to verify packs")),
 	OPT_END(),
 };
 
@@ -988,6 +991,11 @@ int cmd_fsck(int argc,
 		fsck_enable_object_names(&fsck_walk_options);
 
 	repo_config(the_repository, git_fsck_config, &fsck_obj_options);
+	if (nr_threads < 0 &&
+	    repo_config_get_int(the_repository, "pack.threads", &nr_threads))
+		nr_threads = 0;
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
 	prepare_repo_settings(the_repository);
 
 	if (check_references)
@@ -1024,7 +1032,7 @@ int cmd_fsck(int argc,
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -52,6 +52,12 @@ struct base_data {
 	/* Initialized by make_base(). */
 	struct base_data *base;
 	struct object_entry *obj;
+	/*
+	 * The thread that created this struct. It lives on that thread's
+	 * work_head or done_head, and all of the fields below are guarded
+	 * by that thread's work_mutex.
+	 */
+	struct thread_local_data *owner;
 	int ref_first, ref_last;
 	int ofs_first, ofs_last;
 	/*
@@ -75,36 +81,43 @@ struct base_data {
 };
 
 /*
- * Stack of struct base_data that have unprocessed children.
- * threaded_second_pass() uses this as a source of work (the other being the
- * objects array).
- *
- * Guarded by work_mutex.
- */
-static LIST_HEAD(work_head);
-
-/*
- * Stack of struct base_data that have children, all of whom have been
- * processed or are being processed, and at least one child is being processed.
- * These struct base_data must be kept around until the last child is
- * processed.
- *
- * Guarded by work_mutex.
- */
-static LIST_HEAD(done_head);
-
-/*
- * All threads share one delta base cache.
- *
- * base_cache_used is guarded by work_mutex, and base_cache_limit is read-only
- * in a thread.
+ * Each thread has its own delta base cache of at most base_cache_limit
+ * bytes, which is read-only in a thread.
  */
-static size_t base_cache_used;
 static size_t base_cache_limit;
 
 struct thread_local_data {
 	pthread_t thread;
 	int pack_fd;
+
+	/*
+	 * Stack of struct base_data created by this thread that have
+	 * unprocessed children. threaded_second_pass() takes work from the
+	 * top of its own stack; a thread that runs out of work steals from
+	 * the bottom of another thread's stack, where the bases with the
+	 * largest remaining subtrees tend to be.
+	 *
+	 * Guarded by work_mutex.
+	 */
+	struct list_head work_head;
+
+	/*
+	 * Stack of struct base_data created by this thread that have
+	 * children, all of whom have been processed or are being processed,
+	 * and at least one child is being processed. These struct base_data
+	 * must be kept around until the last child is processed.
+	 *
+	 * Guarded by work_mutex.
+	 */
+	struct list_head done_head;
+
+	/*
+	 * Size of the data held by the struct base_data in the two lists
+	 * above. Guarded by work_mutex.
+	 */
+	size_t base_cache_used;
+
+	pthread_mutex_t work_mutex;
 };
 
 /* Remember to update object flag allocation in object.h */
@@ -164,9 +177,18 @@ static struct oidset outgoing_links = OIDSET_INIT;
 static int record_outgoing_links;
 
 static struct thread_local_data *thread_data;
-static int nr_dispatched;
 static int threads_active;
 
+/*
+ * nr_dispatched, nr_idle_threads and work_generation are guarded by
+ * work_mutex. Threads that have run out of work wait on work_cond until
+ * another thread pushes a new base or everybody is idle.
+ */
+static int nr_dispatched;
+static int nr_idle_threads;
+static unsigned work_generation;
+static pthread_cond_t work_cond;
+
 static pthread_mutex_t read_mutex;
 #define read_lock()		lock_mutex(&read_mutex)
 #define read_unlock()		unlock_mutex(&read_mutex)
@@ -197,6 +219,13 @@ static inline void unlock_mutex(pthread_mutex_t *mutex)
 		pthread_mutex_unlock(mutex);
 }
 
+static void init_thread_local_data(struct thread_local_data *data)
+{
+	INIT_LIST_HEAD(&data->work_head);
+	INIT_LIST_HEAD(&data->done_head);
+	data->base_cache_used = 0;
+}
+
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
  */
@@ -206,13 +235,17 @@ static void init_thread(void)
 	init_recursive_mutex(&read_mutex);
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
 	if (show_stat)
 		pthread_mutex_init(&deepest_delta_mutex, NULL);
 	pthread_key_create(&key, NULL);
 	CALLOC_ARRAY(thread_data, nr_threads);
 	for (i = 0; i < nr_threads; i++) {
 		thread_data[i].pack_fd = xopen(curr_pack, O_RDONLY);
+		init_thread_local_data(&thread_data[i]);
+		pthread_mutex_init(&thread_data[i].work_mutex, NULL);
 	}
+	nr_idle_threads = 0;
 
 	threads_active = 1;
 }
@@ -226,10 +259,13 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&counter_mutex);
 	pthread_mutex_destroy(&work_mutex);
+	pthread_cond_destroy(&work_cond);
 	if (show_stat)
 		pthread_mutex_destroy(&deepest_delta_mutex);
-	for (i = 0; i < nr_threads; i++)
+	for (i = 0; i < nr_threads; i++) {
 		close(thread_data[i].pack_fd);
+		pthread_mutex_destroy(&thread_data[i].work_mutex);
+	}
 	pthread_key_delete(key);
 	free(thread_data);
 }
@@ -426,39 +462,42 @@ static void set_thread_data(struct thread_local_data *data)
 		pthread_setspecific(key, data);
 }
 
+/* The caller must hold c->owner->work_mutex. */
 static void free_base_data(struct base_data *c)
 {
 	if (c->data) {
 		FREE_AND_NULL(c->data);
-		base_cache_used -= c->size;
+		c->owner->base_cache_used -= c->size;
 	}
 }
 
-static void prune_base_data(struct base_data *retain)
+/* The caller must hold data->work_mutex. */
+static void prune_base_data(struct thread_local_data *data,
+			    struct base_data *retain)
 {
 	struct list_head *pos;
 
-	if (base_cache_used <= base_cache_limit)
+	if (data->base_cache_used <= base_cache_limit)
 		return;
 
-	list_for_each_prev(pos, &done_head) {
+	list_for_each_prev(pos, &data->done_head) {
 		struct base_data *b = list_entry(pos, struct base_data, list);
 		if (b->retain_data || b == retain)
 			continue;
 		if (b->data) {
 			free_base_data(b);
-			if (base_cache_used <= base_cache_limit)
+			if (data->base_cache_used <= base_cache_limit)
 				return;
 		}
 	}
 
-	list_for_each_prev(pos, &work_head) {
+	list_for_each_prev(pos, &data->work_head) {
 		struct base_data *b = list_entry(pos, struct base_data, list);
 		if (b->retain_data || b == retain)
 			continue;
 		if (b->data) {
 			free_base_data(b);
-			if (base_cache_used <= base_cache_limit)
+			if (data->base_cache_used <= base_cache_limit)
 				return;
 		}
 	}
@@ -980,6 +1019,26 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 	free(new_data);
 }
 
+/*
+ * Store reconstructed data in c, unless another thread beat us to it, and
+ * return whichever data c ends up with.
+ */
+static void *set_base_data(struct base_data *c, void *data, unsigned long size)
+{
+	lock_mutex(&c->owner->work_mutex);
+	if (c->data) {
+		free(data);
+	} else {
+		c->data = data;
+		c->size = size;
+		c->owner->base_cache_used += size;
+		prune_base_data(c->owner, c);
+	}
+	data = c->data;
+	unlock_mutex(&c->owner->work_mutex);
+	return data;
+}
+
 /*
  * Ensure that this node has been reconstructed and return its contents.
  *
@@ -990,44 +1049,65 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
  * ancestor with reconstructed data that has not been pruned (or if there is
  * none, the ultimate base object), and reconstruct each node in the delta
  * chain in order to generate the reconstructed data for this node.
+ *
+ * The caller must have incremented c->retain_data and must not hold any
+ * work_mutex. The ancestors may belong to other threads, so each of them is
+ * retained while we work our way back down the chain.
  */
 static void *get_base_data(struct base_data *c)
 {
-	if (!c->data) {
-		struct object_entry *obj = c->obj;
-		struct base_data **delta = NULL;
-		int delta_nr = 0, delta_alloc = 0;
-
-		while (is_delta_type(c->obj->type) && !c->data) {
-			ALLOC_GROW(delta, delta_nr + 1, delta_alloc);
-			delta[delta_nr++] = c;
-			c = c->base;
-		}
-		if (!delta_nr) {
-			c->data = get_data_from_pack(obj);
-			c->size = obj->size;
-			base_cache_used += c->size;
-			prune_base_data(c);
-		}
-		for (; delta_nr > 0; delta_nr--) {
-			void *base, *raw;
-			c = delta[delta_nr - 1];
-			obj = c->obj;
-			base = get_base_data(c->base);
-			raw = get_data_from_pack(obj);
-			c->data = patch_delta(
-				base, c->base->size,
-				raw, obj->size,
-				&c->size);
-			free(raw);
-			if (!c->data)
-				bad_object(obj->idx.offset, _("failed to apply delta"));
-			base_cache_used += c->size;
-			prune_base_data(c);
-		}
-		free(delta);
+	struct base_data **chain = NULL;
+	int chain_nr = 0, chain_alloc = 0;
+	struct base_data *b = c;
+	void *data;
+
+	for (;;) {
+		lock_mutex(&b->owner->work_mutex);
+		data = b->data;
+		if (b != c)
+			b->retain_data++;
+		unlock_mutex(&b->owner->work_mutex);
+
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = b;
+
+		if (data || !is_delta_type(b->obj->type))
+			break;
+		b = b->base;
+	}
+
+	if (!data)
+		data = set_base_data(b, get_data_from_pack(b->obj),
+				     b->obj->size);
+
+	for (int i = chain_nr - 2; i >= 0; i--) {
+		struct base_data *delta = chain[i];
+		void *raw, *result;
+		unsigned long result_size;
+
+		/*
+		 * delta->base is retained and has data, so neither its data
+		 * nor its size can change under us.
+		 */
+		raw = get_data_from_pack(delta->obj);
+		result = patch_delta(data, delta->base->size,
+				     raw, delta->obj->size, &result_size);
+		free(raw);
+		if (!result)
+			bad_object(delta->obj->idx.offset,
+				   _("failed to apply delta"));
+		data = set_base_data(delta, result, result_size);
 	}
-	return c->data;
+
+	for (int i = 1; i < chain_nr; i++) {
+		b = chain[i];
+		lock_mutex(&b->owner->work_mutex);
+		b->retain_data--;
+		unlock_mutex(&b->owner->work_mutex);
+	}
+	free(chain);
+
+	return data;
 }
 
 static struct base_data *make_base(struct object_entry *obj,
@@ -1036,6 +1116,7 @@ static struct base_data *make_base(struct object_entry *obj,
 	struct base_data *base = xcalloc(1, sizeof(struct base_data));
 	base->base = parent;
 	base->obj = obj;
+	base->owner = get_thread_data();
 	find_ref_delta_children(&obj->idx.oid,
 				&base->ref_first, &base->ref_last);
 	find_ofs_delta_children(obj->idx.offset,
@@ -1103,119 +1184,215 @@ static int compare_ref_delta_entry(const void *a, const void *b)
 	return oidcmp(&delta_a->oid, &delta_b->oid);
 }
 
-static void *threaded_second_pass(void *data)
+/*
+ * Take the next child from the base at the top of data's work stack (or the
+ * bottom, if we are stealing from another thread) and return it. The base is
+ * returned in *parent with its data retained.
+ */
+static struct object_entry *take_child(struct thread_local_data *data,
+				       int steal, struct base_data **parent)
 {
-	if (data)
-		set_thread_data(data);
-	for (;;) {
-		struct base_data *parent = NULL;
-		struct object_entry *child_obj = NULL;
-		struct base_data *child = NULL;
+	struct object_entry *child_obj = NULL;
 
-		counter_lock();
-		display_progress(progress, nr_resolved_deltas);
-		counter_unlock();
+	lock_mutex(&data->work_mutex);
+	while (!child_obj && !list_empty(&data->work_head)) {
+		struct base_data *p;
 
-		work_lock();
-		if (list_empty(&work_head)) {
-			/*
-			 * Take an object from the object array.
-			 */
-			while (nr_dispatched < nr_objects &&
-			       is_delta_type(objects[nr_dispatched].type))
-				nr_dispatched++;
-			if (nr_dispatched >= nr_objects) {
-				work_unlock();
-				break;
-			}
-			child_obj = &objects[nr_dispatched++];
-		} else {
-			/*
-			 * Peek at the top of the stack, and take a child from
-			 * it.
-			 */
-			parent = list_first_entry(&work_head, struct base_data,
-						  list);
+		if (steal)
+			p = list_entry(data->work_head.prev,
+				       struct base_data, list);
+		else
+			p = list_first_entry(&data->work_head,
+					     struct base_data, list);
 
-			while (parent->ref_first <= parent->ref_last) {
-				int offset = ref_deltas[parent->ref_first++].obj_no;
+		/*
+		 * The same REF_DELTA may be claimed through duplicate bases
+		 * owned by different threads, so claim it under work_mutex.
+		 */
+		if (p->ref_first <= p->ref_last) {
+			work_lock();
+			while (p->ref_first <= p->ref_last) {
+				int offset = ref_deltas[p->ref_first++].obj_no;
 				child_obj = objects + offset;
 				if (child_obj->real_type != OBJ_REF_DELTA) {
 					child_obj = NULL;
 					continue;
 				}
-				child_obj->real_type = parent->obj->real_type;
+				child_obj->real_type = p->obj->real_type;
 				break;
 			}
+			work_unlock();
+		}
 
-			if (!child_obj && parent->ofs_first <= parent->ofs_last) {
-				child_obj = objects +
-					ofs_deltas[parent->ofs_first++].obj_no;
-				assert(child_obj->real_type == OBJ_OFS_DELTA);
-				child_obj->real_type = parent->obj->real_type;
-			}
-
-			if (parent->ref_first > parent->ref_last &&
-			    parent->ofs_first > parent->ofs_last) {
-				/*
-				 * This parent has run out of children, so move
-				 * it to done_head.
-				 */
-				list_del(&parent->list);
-				list_add(&parent->list, &done_head);
-			}
+		if (!child_obj && p->ofs_first <= p->ofs_last) {
+			child_obj = objects + ofs_deltas[p->ofs_first++].obj_no;
+			assert(child_obj->real_type == OBJ_OFS_DELTA);
+			child_obj->real_type = p->obj->real_type;
+		}
 
+		if (p->ref_first > p->ref_last &&
+		    p->ofs_first > p->ofs_last) {
 			/*
-			 * Ensure that the parent has data, since we will need
-			 * it later.
-			 *
-			 * NEEDSWORK: If parent data needs to be reloaded, this
-			 * prolongs the time that the current thread spends in
-			 * the mutex. A mitigating factor is that parent data
-			 * needs to be reloaded only if the delta base cache
-			 * limit is exceeded, so in the typical case, this does
-			 * not happen.
+			 * This parent has run out of children, so move
+			 * it to done_head.
 			 */
-			get_base_data(parent);
-			parent->retain_data++;
+			list_del(&p->list);
+			list_add(&p->list, &data->done_head);
 		}
-		work_unlock();
 
 		if (child_obj) {
-			if (parent) {
-				child = resolve_delta(child_obj, parent);
-				if (!child->children_remaining)
-					FREE_AND_NULL(child->data);
-			} else{
-				child = make_base(child_obj, NULL);
-				if (child->children_remaining) {
-					/*
-					 * Since this child has its own delta children,
-					 * we will need this data in the future.
-					 * Inflate now so that future iterations will
-					 * have access to this object's data while
-					 * outside the work mutex.
-					 */
-					child->data = get_data_from_pack(child_obj);
-					child->size = child_obj->size;
-				}
-			}
+			p->retain_data++;
+			*parent = p;
 		}
+	}
+	unlock_mutex(&data->work_mutex);
+
+	return child_obj;
+}
 
+/*
+ * Take a non-delta object from the object array.
+ */
+static struct object_entry *dispatch_object(void)
+{
+	struct object_entry *obj = NULL;
+
+	work_lock();
+	while (nr_dispatched < nr_objects &&
+	       is_delta_type(objects[nr_dispatched].type))
+		nr_dispatched++;
+	if (nr_dispatched < nr_objects)
+		obj = &objects[nr_dispatched++];
+	work_unlock();
+
+	return obj;
+}
+
+/*
+ * We are out of work of our own; try to take a child from another thread.
+ * If there is nothing to steal, wait until some thread pushes a new base.
+ * Returns NULL once all threads are out of work.
+ */
+static struct object_entry *steal_child(struct thread_local_data *self,
+					struct base_data **parent)
+{
+	int me = self - thread_data;
+
+	for (;;) {
+		struct object_entry *child_obj;
+		unsigned generation;
+
+		work_lock();
+		generation = work_generation;
+		work_unlock();
+
+		for (int i = 1; i < nr_threads; i++) {
+			struct thread_local_data *victim =
+				&thread_data[(me + i) % nr_threads];
+			child_obj = take_child(victim, 1, parent);
+			if (child_obj)
+				return child_obj;
+		}
+
+		/*
+		 * Our own stack is empty, and only we push to it, so once
+		 * every thread is idle there is no work left anywhere.
+		 */
 		work_lock();
-		if (parent)
+		if (generation != work_generation) {
+			work_unlock();
+			continue;
+		}
+		if (++nr_idle_threads == nr_threads) {
+			pthread_cond_broadcast(&work_cond);
+			work_unlock();
+			return NULL;
+		}
+		pthread_cond_wait(&work_cond, &work_mutex);
+		if (nr_idle_threads == nr_threads) {
+			work_unlock();
+			return NULL;
+		}
+		nr_idle_threads--;
+		work_unlock();
+	}
+}
+
+static void *threaded_second_pass(void *data)
+{
+	struct thread_local_data *self;
+
+	if (data)
+		set_thread_data(data);
+	self = get_thread_data();
+
+	for (;;) {
+		struct base_data *parent = NULL;
+		struct object_entry *child_obj;
+		struct base_data *child;
+
+		counter_lock();
+		display_progress(progress, nr_resolved_deltas);
+		counter_unlock();
+
+		child_obj = take_child(self, 0, &parent);
+		if (!child_obj)
+			child_obj = dispatch_object();
+		if (!child_obj && threads_active)
+			child_obj = steal_child(self, &parent);
+		if (!child_obj)
+			break;
+
+		if (parent) {
+			/*
+			 * Ensure that the parent has data, since we will
+			 * need it now. It has only been pruned if the delta
+			 * base cache limit was exceeded, so in the typical
+			 * case this is cheap.
+			 */
+			get_base_data(parent);
+			child = resolve_delta(child_obj, parent);
+			if (!child->children_remaining)
+				FREE_AND_NULL(child->data);
+
+			lock_mutex(&parent->owner->work_mutex);
 			parent->retain_data--;
+			unlock_mutex(&parent->owner->work_mutex);
+		} else {
+			child = make_base(child_obj, NULL);
+			if (child->children_remaining) {
+				/*
+				 * Since this child has its own delta children,
+				 * we will need this data in the future.
+				 * Inflate now so that future iterations will
+				 * have access to this object's data while
+				 * outside the work mutex.
+				 */
+				child->data = get_data_from_pack(child_obj);
+				child->size = child_obj->size;
+			}
+		}
 
-		if (child && child->data) {
+		if (child->data) {
 			/*
 			 * This child has its own children, so add it to
-			 * work_head.
+			 * our work_head, and wake up a thread that is
+			 * waiting for work to steal.
 			 */
-			list_add(&child->list, &work_head);
-			base_cache_used += child->size;
-			prune_base_data(NULL);
-			free_base_data(child);
-		} else if (child) {
+			lock_mutex(&self->work_mutex);
+			list_add(&child->list, &self->work_head);
+			self->base_cache_used += child->size;
+			prune_base_data(self, child);
+			unlock_mutex(&self->work_mutex);
+
+			if (threads_active) {
+				work_lock();
+				work_generation++;
+				if (nr_idle_threads)
+					pthread_cond_signal(&work_cond);
+				work_unlock();
+			}
+		} else {
 			/*
 			 * This child does not have its own children. It may be
 			 * the last descendant of its ancestors; free those
@@ -1224,22 +1401,26 @@ static void *threaded_second_pass(void *data)
 			struct base_data *p = parent;
 
 			while (p) {
+				struct thread_local_data *owner = p->owner;
 				struct base_data *next_p;
 
+				lock_mutex(&owner->work_mutex);
 				p->children_remaining--;
-				if (p->children_remaining)
+				if (p->children_remaining) {
+					unlock_mutex(&owner->work_mutex);
 					break;
+				}
 
 				next_p = p->base;
 				free_base_data(p);
 				list_del(&p->list);
+				unlock_mutex(&owner->work_mutex);
 				free(p);
 
 				p = next_p;
 			}
 			FREE_AND_NULL(child);
 		}
-		work_unlock();
 	}
 	return NULL;
 }
@@ -1333,6 +1514,8 @@ static void resolve_deltas(struct pack_idx_option *opts)
 {
 	int i;
 
+	init_thread_local_data(&nothread_data);
+
 	if (!nr_ofs_deltas && !nr_ref_deltas)
 		return;
 
@@ -1346,7 +1529,7 @@ static void resolve_deltas(struct pack_idx_option *opts)
 					  nr_ref_deltas + nr_ofs_deltas);
 
 	nr_dispatched = 0;
-	base_cache_limit = opts->delta_base_cache_limit * nr_threads;
+	base_cache_limit = opts->delta_base_cache_limit;
 	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
 		init_thread();
 		for (i = 0; i < nr_threads; i++) {
@@ -2058,21 +2241,14 @@ int cmd_index_pack(int argc,
 	if (HAVE_THREADS && !nr_threads) {
 		nr_threads = online_cpus();
 		/*
-		 * Experiments show that going above 20 threads doesn't help,
-		 * no matter how many cores you have. Below that, we tend to
-		 * max at half the number of online_cpus(), presumably because
-		 * half of those are hyperthreads rather than full cores. We'll
-		 * never reduce the level below "3", though, to match a
-		 * historical value that nobody complained about.
+		 * Each thread resolves the deltas below the bases it has
+		 * reconstructed itself and only steals work when it runs
+		 * dry, so delta resolution keeps scaling with the number
+		 * of cores. Cap it anyway, as every thread may hold up to
+		 * core.deltaBaseCacheLimit bytes of base objects.
 		 */
-		if (nr_threads < 4)
-			; /* too few cores to consider capping */
-		else if (nr_threads < 6)
-			nr_threads = 3; /* historic cap */
-		else if (nr_threads < 40)
-			nr_threads /= 2;
-		else
-			nr_threads = 20; /* hard cap */
+		if (nr_threads > 32)
+			nr_threads = 32;
 	}
 
 	curr_pack = open_pack_file(pack_name);
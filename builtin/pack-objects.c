@@ -226,6 +226,7 @@ static int window = 10;
 static unsigned long pack_size_limit;
 static int depth = 50;
 static int delta_search_threads;
+static int hash_thread = -1;
 static int pack_to_stdout;
 static int sparse;
 static int thin;
@@ -1333,8 +1334,11 @@ static void write_pack_file(void)
 		if (pack_to_stdout)
 			f = hashfd_throughput(the_repository->hash_algo, 1,
 					      "<stdout>", progress_state);
-		else
+		else {
 			f = create_tmp_packfile(the_repository, &pack_tmp_name);
+			if (hash_thread)
+				hashfile_start_thread(f);
+		}
 
 		offset = write_pack_header(f, nr_remaining);
 
@@ -3648,6 +3652,17 @@ static int git_pack_config(const char *k, const char *v,
 			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
 	}
 
+	if (!strcmp(k, "pack.writebitmaproaring")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_ROARING;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_ROARING;
+	}
+
+	if (!strcmp(k, "pack.hashthread")) {
+		hash_thread = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -5119,6 +5134,8 @@ int cmd_pack_objects(int argc,
 
 	if (!HAVE_THREADS && delta_search_threads != 1)
 		warning(_("no threads support, ignoring --threads"));
+	if (hash_thread < 0)
+		hash_thread = online_cpus() > 1;
 	if (!pack_to_stdout && !pack_size_limit)
 		pack_size_limit = pack_size_limit_cfg;
 	if (pack_to_stdout && pack_size_limit)
@@ -530,7 +530,7 @@ static int try_bitmap_count(struct rev_info *revs,
 		 tag_count = 0,
 		 tree_count = 0,
 		 blob_count = 0;
-	int max_count;
+	int max_count, marked;
 	struct bitmap_index *bitmap_git;
 
 	/* This function only handles counting, not general traversal. */
@@ -538,19 +538,31 @@ static int try_bitmap_count(struct rev_info *revs,
 		return -1;
 
 	/*
-	 * A bitmap result can't know left/right, etc, because we don't
-	 * actually traverse.
+	 * A bitmap result can't know which commits are patch-equivalent,
+	 * because we don't actually traverse. It can only tell left from
+	 * right by reachability; see prepare_bitmap_walk().
 	 */
-	if (revs->left_right || revs->cherry_mark)
+	if (revs->cherry_mark || revs->cherry_pick)
+		return -1;
+	marked = revs->left_right || revs->left_only || revs->right_only;
+
+	/*
+	 * Only commits are split into left and right below; leave counting
+	 * the objects of one side to the regular traversal.
+	 */
+	if (marked &&
+	    (revs->tag_objects || revs->tree_objects || revs->blob_objects))
 		return -1;
 
 	/*
 	 * If we're counting reachable objects, we can't handle a max count of
 	 * commits to traverse, since we don't know which objects go with which
-	 * commit.
+	 * commit. The same goes for which side the commits we would stop
+	 * at are on.
 	 */
 	if (revs->max_count >= 0 &&
-	    (revs->tag_objects || revs->tree_objects || revs->blob_objects))
+	    (marked ||
+	     revs->tag_objects || revs->tree_objects || revs->blob_objects))
 		return -1;
 
 	/*
@@ -563,6 +575,22 @@ static int try_bitmap_count(struct rev_info *revs,
 	if (!bitmap_git)
 		return -1;
 
+	if (marked) {
+		uint32_t left, right;
+
+		count_bitmap_left_right(bitmap_git, &left, &right);
+		if (revs->left_only)
+			right = 0;
+		if (revs->right_only)
+			left = 0;
+		if (revs->left_right)
+			printf("%d\t%d\n", left, right);
+		else
+			printf("%d\n", left + right);
+		free_bitmap_index(bitmap_git);
+		return 0;
+	}
+
 	count_bitmap_commit_list(bitmap_git, &commit_count,
 				 revs->tree_objects ? &tree_count : NULL,
 				 revs->blob_objects ? &blob_count : NULL,
@@ -591,7 +619,7 @@ static int try_bitmap_traversal(struct rev_info *revs,
 	 * We can't know which commits were left/right in a single traversal,
 	 * and we don't yet know how to traverse them separately.
 	 */
-	if (revs->left_right)
+	if (revs->left_right || revs->left_only || revs->right_only)
 		return -1;
 
 	bitmap_git = prepare_bitmap_walk(revs, filter_provided_objects);
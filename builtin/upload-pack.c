@@ -1,6 +1,7 @@
 #define USE_THE_REPOSITORY_VARIABLE
 
 #include "builtin.h"
+#include "abspath.h"
 #include "exec-cmd.h"
 #include "gettext.h"
 #include "pkt-line.h"
@@ -11,14 +12,349 @@
 #include "upload-pack.h"
 #include "serve.h"
 #include "commit.h"
+#include "commit-graph.h"
+#include "config.h"
+#include "dir.h"
 #include "environment.h"
+#include "odb.h"
+#include "packfile.h"
+#include "string-list.h"
+#include "trace2.h"
+#include "write-or-die.h"
 
 static const char * const upload_pack_usage[] = {
 	N_("git-upload-pack [--[no-]strict] [--timeout=<n>] [--stateless-rpc]\n"
 	   "                [--advertise-refs] <directory>"),
+	N_("git-upload-pack [--[no-]strict] --listen=<socket> <directory>"),
 	NULL
 };
 
+#ifndef NO_UNIX_SOCKETS
+
+#include "unix-socket.h"
+#include "unix-stream-server.h"
+
+/*
+ * A server started with --listen keeps the object store of the
+ * repository open and forks a child for each connection, which then
+ * runs the protocol v2 command loop. An upload-pack started the usual
+ * way (by ssh, git-daemon or git-http-backend) finds the socket of the
+ * server in uploadpack.serverSocket and, instead of opening the
+ * repository itself, relays between its client and a child of the
+ * server.
+ *
+ * Before the relay starts, it introduces itself with a pkt-line
+ * "upload-pack <gitdir>", optionally followed by "stateless-rpc" and
+ * "namespace <namespace>" (from $GIT_NAMESPACE), and a flush packet.
+ * The server answers "ok" if it serves that repository.
+ */
+
+static char *real_git_dir(void)
+{
+	return real_pathdup(repo_get_git_dir(the_repository), 1);
+}
+
+/*
+ * Relay until the server hangs up. With a non-zero `timeout`, give up
+ * after that many seconds without data in either direction.
+ */
+static int relay_to_server(int fd, int timeout)
+{
+	struct pollfd pfd[2];
+	char buf[LARGE_PACKET_MAX];
+	int in_open = 1;
+
+	while (1) {
+		int nr = 0, sock, ret;
+		ssize_t len;
+
+		if (in_open) {
+			pfd[nr].fd = 0;
+			pfd[nr].events = POLLIN;
+			nr++;
+		}
+		sock = nr;
+		pfd[nr].fd = fd;
+		pfd[nr].events = POLLIN;
+		nr++;
+
+		ret = poll(pfd, nr, timeout ? timeout * 1000 : -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return error_errno(_("poll failed"));
+		}
+		if (!ret)
+			die(_("timed out after %d seconds of inactivity"),
+			    timeout);
+
+		if (in_open && (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+			len = xread(0, buf, sizeof(buf));
+			if (len < 0)
+				return error_errno(_("read error"));
+			if (!len) {
+				in_open = 0;
+				shutdown(fd, SHUT_WR);
+			} else if (write_in_full(fd, buf, len) < 0) {
+				return error_errno(_("unable to write to upload-pack server"));
+			}
+		}
+		if (pfd[sock].revents & (POLLIN | POLLHUP | POLLERR)) {
+			len = xread(fd, buf, sizeof(buf));
+			if (len < 0)
+				return error_errno(_("unable to read from upload-pack server"));
+			if (!len)
+				return 0;
+			write_or_die(1, buf, len);
+		}
+	}
+}
+
+/*
+ * Hand the request over to the server configured in
+ * uploadpack.serverSocket, if there is one that will take it. Returns
+ * -1 if there is not and we have to serve the request ourselves.
+ *
+ * --strict has already been enforced by enter_repo(), and the server
+ * only takes requests for the repository we ended up in. --timeout is
+ * enforced while relaying.
+ */
+static int serve_from_server(int stateless_rpc, int timeout)
+{
+	char *path = NULL, *gitdir, *line;
+	const char *namespace = getenv(GIT_NAMESPACE_ENVIRONMENT);
+	int fd, ret = -1;
+
+	if (repo_config_get_pathname(the_repository, "uploadpack.serversocket",
+				     &path))
+		return -1;
+
+	fd = unix_stream_connect(path, 0);
+	if (fd < 0) {
+		trace2_data_string("upload-pack", the_repository,
+				   "server-unavailable", path);
+		free(path);
+		return -1;
+	}
+
+	gitdir = real_git_dir();
+	if (packet_write_fmt_gently(fd, "upload-pack %s\n", gitdir) ||
+	    (stateless_rpc &&
+	     packet_write_fmt_gently(fd, "stateless-rpc\n")) ||
+	    (namespace && *namespace &&
+	     packet_write_fmt_gently(fd, "namespace %s\n", namespace)) ||
+	    packet_flush_gently(fd) ||
+	    packet_read_line_gently(fd, NULL, &line) < 0 ||
+	    !line || strcmp(line, "ok")) {
+		trace2_data_string("upload-pack", the_repository,
+				   "server-refused", path);
+		goto out;
+	}
+
+	trace2_data_string("upload-pack", the_repository, "server", path);
+	if (relay_to_server(fd, timeout))
+		die(_("lost connection to upload-pack server"));
+	ret = 0;
+
+out:
+	close(fd);
+	free(gitdir);
+	free(path);
+	return ret;
+}
+
+static void serve_connection(int fd, const char *gitdir)
+{
+	char *line, *dir = NULL, *namespace = NULL;
+	const char *arg;
+	int stateless_rpc = 0, ret;
+
+	if (dup2(fd, 0) < 0 || dup2(fd, 1) < 0)
+		die_errno(_("unable to set up connection"));
+	close(fd);
+
+	while ((ret = packet_read_line_gently(0, NULL, &line)) > 0) {
+		if (skip_prefix(line, "upload-pack ", &arg)) {
+			free(dir);
+			dir = xstrdup(arg);
+		} else if (!strcmp(line, "stateless-rpc")) {
+			stateless_rpc = 1;
+		} else if (skip_prefix(line, "namespace ", &arg)) {
+			free(namespace);
+			namespace = xstrdup(arg);
+		}
+	}
+
+	/* a client that only checks whether we are alive hangs up early */
+	if (ret >= 0 && dir) {
+		if (strcmp(dir, gitdir)) {
+			packet_write_fmt_gently(1, "ERR not serving '%s'\n", dir);
+		} else {
+			if (namespace)
+				xsetenv(GIT_NAMESPACE_ENVIRONMENT, namespace, 1);
+			packet_write_fmt(1, "ok\n");
+			protocol_v2_serve_loop(the_repository, stateless_rpc);
+		}
+	}
+	free(dir);
+	free(namespace);
+}
+
+static void add_dir_signature(struct string_list *signature, const char *path)
+{
+	DIR *dir = opendir(path);
+	struct dirent *de;
+	struct strbuf name = STRBUF_INIT;
+
+	if (!dir)
+		return;
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		struct stat st;
+
+		strbuf_reset(&name);
+		strbuf_addf(&name, "%s/%s", path, de->d_name);
+		if (lstat(name.buf, &st))
+			continue;
+		strbuf_addf(&name, " %"PRIuMAX" %"PRIuMAX" %"PRIuMAX,
+			    (uintmax_t)st.st_ino, (uintmax_t)st.st_size,
+			    (uintmax_t)st.st_mtime);
+		string_list_append(signature, name.buf);
+	}
+	closedir(dir);
+	strbuf_release(&name);
+}
+
+/*
+ * Describe the files of the object store that we keep open, so that we
+ * notice when they are replaced.
+ */
+static void object_store_signature(struct strbuf *out)
+{
+	const char *objdir = repo_get_object_directory(the_repository);
+	struct string_list signature = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_addf(&path, "%s/pack", objdir);
+	add_dir_signature(&signature, path.buf);
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/info", objdir);
+	add_dir_signature(&signature, path.buf);
+	strbuf_addstr(&path, "/commit-graphs");
+	add_dir_signature(&signature, path.buf);
+	string_list_sort(&signature);
+
+	strbuf_reset(out);
+	for (size_t i = 0; i < signature.nr; i++)
+		strbuf_addf(out, "%s\n", signature.items[i].string);
+
+	string_list_clear(&signature, 0);
+	strbuf_release(&path);
+}
+
+static void warm_object_store(struct strbuf *signature)
+{
+	struct packed_git *p;
+
+	object_store_signature(signature);
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		open_pack_index(p);
+	generation_numbers_enabled(the_repository);
+}
+
+static void serve_listen(const char *path)
+{
+	struct unix_stream_listen_opts opts = UNIX_STREAM_LISTEN_OPTS_INIT;
+	struct unix_ss_socket *server;
+	struct strbuf signature = STRBUF_INIT, current = STRBUF_INIT;
+	char *gitdir = real_git_dir();
+
+	opts.listen_backlog_size = 50;
+	switch (unix_ss_create(path, &opts, -1, &server)) {
+	case 0:
+		break;
+	case -2:
+		die(_("another server is listening on '%s'"), path);
+	default:
+		die_errno(_("unable to listen on '%s'"), path);
+	}
+
+	/*
+	 * Each connection brings its own namespace, which the children
+	 * set before anything looks at refs.
+	 */
+	unsetenv(GIT_NAMESPACE_ENVIRONMENT);
+
+	/*
+	 * Read the configuration once; every child inherits it. Refs are
+	 * left alone, as their caches are not revalidated.
+	 */
+	repo_config(the_repository, git_default_config, NULL);
+	warm_object_store(&signature);
+
+	while (!unix_ss_was_stolen(server)) {
+		struct pollfd pfd;
+		pid_t pid;
+		int fd;
+
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			; /* reap finished children */
+
+		pfd.fd = server->fd_socket;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1000) < 0) {
+			if (errno != EINTR)
+				die_errno(_("poll failed"));
+			continue;
+		}
+		if (!(pfd.revents & POLLIN))
+			continue;
+
+		fd = accept(server->fd_socket, NULL, NULL);
+		if (fd < 0) {
+			warning_errno(_("accept failed"));
+			continue;
+		}
+
+		object_store_signature(&current);
+		if (strcmp(current.buf, signature.buf)) {
+			trace2_region_enter("upload-pack", "reload", the_repository);
+			reload_packed_git(the_repository);
+			warm_object_store(&signature);
+			trace2_region_leave("upload-pack", "reload", the_repository);
+		}
+
+		fflush(NULL);
+		pid = fork();
+		if (pid < 0) {
+			warning_errno(_("unable to fork"));
+		} else if (!pid) {
+			close(server->fd_socket);
+			serve_connection(fd, gitdir);
+			exit(0);
+		}
+		close(fd);
+	}
+
+	unix_ss_free(server);
+	strbuf_release(&signature);
+	strbuf_release(&current);
+	free(gitdir);
+}
+
+#else
+
+static int serve_from_server(int stateless_rpc UNUSED, int timeout UNUSED)
+{
+	return -1;
+}
+
+static NORETURN void serve_listen(const char *path UNUSED)
+{
+	die(_("upload-pack --listen unavailable; no unix socket support"));
+}
+
+#endif /* NO_UNIX_SOCKETS */
+
 int cmd_upload_pack(int argc,
 		    const char **argv,
 		    const char *prefix,
@@ -29,6 +365,7 @@ int cmd_upload_pack(int argc,
 	int advertise_refs = 0;
 	int stateless_rpc = 0;
 	int timeout = 0;
+	const char *listen_path = NULL;
 	struct option options[] = {
 		OPT_BOOL(0, "stateless-rpc", &stateless_rpc,
 			 N_("quit after a single request/response exchange")),
@@ -39,6 +376,8 @@ int cmd_upload_pack(int argc,
 			 N_("do not try <directory>/.git/ if <directory> is no Git directory")),
 		OPT_INTEGER(0, "timeout", &timeout,
 			    N_("interrupt transfer after <n> seconds of inactivity")),
+		OPT_STRING(0, "listen", &listen_path, N_("socket"),
+			   N_("serve protocol v2 connections on a unix socket")),
 		OPT_END()
 	};
 	unsigned enter_repo_flags = ENTER_REPO_ANY_OWNER_OK;
@@ -62,11 +401,20 @@ int cmd_upload_pack(int argc,
 	if (!enter_repo(dir, enter_repo_flags))
 		die("'%s' does not appear to be a git repository", dir);
 
+	if (listen_path) {
+		if (advertise_refs || stateless_rpc || timeout)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--listen", advertise_refs ? "--advertise-refs" :
+			    stateless_rpc ? "--stateless-rpc" : "--timeout");
+		serve_listen(listen_path);
+		return 0;
+	}
+
 	switch (determine_protocol_version_server()) {
 	case protocol_v2:
 		if (advertise_refs)
 			protocol_v2_advertise_capabilities(the_repository);
-		else
+		else if (serve_from_server(stateless_rpc, timeout))
 			protocol_v2_serve_loop(the_repository, stateless_rpc);
 		break;
 	case protocol_v1:
@@ -372,8 +372,14 @@ void begin_odb_transaction(void)
 	odb_transaction_nesting += 1;
 }
 
+int odb_transaction_pending(void)
+{
+	return odb_transaction_nesting > 0;
+}
+
 void flush_odb_transaction(void)
 {
+	finish_loose_object_writes();
 	flush_batch_fsync();
 	flush_bulk_checkin_packfile(&bulk_checkin_packfile);
 }
@@ -37,6 +37,9 @@ int index_blob_bulk_checkin(struct object_id *oid,
  */
 void begin_odb_transaction(void);
 
+/* Return whether an object database transaction is in progress. */
+int odb_transaction_pending(void);
+
 /*
  * Make any objects that are currently part of a pending object
  * database transaction visible. It is valid to call this function
@@ -350,6 +350,7 @@ linux32)
 	;;
 linux-meson)
 	MESONFLAGS="$MESONFLAGS -Dcredential_helpers=libsecret,netrc"
+	MESONFLAGS="$MESONFLAGS -Dinflate_backend=libdeflate"
 	;;
 linux-musl-meson)
 	MESONFLAGS="$MESONFLAGS -Dtest_utf8_locale=C.UTF-8"
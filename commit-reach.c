@@ -3,12 +3,16 @@
 #include "git-compat-util.h"
 #include "commit.h"
 #include "commit-graph.h"
+#include "config.h"
 #include "decorate.h"
+#include "gettext.h"
 #include "hex.h"
 #include "prio-queue.h"
 #include "ref-filter.h"
 #include "revision.h"
 #include "tag.h"
+#include "thread-utils.h"
+#include "trace2.h"
 #include "commit-reach.h"
 #include "ewah/ewok.h"
 
@@ -1044,16 +1048,144 @@ static void free_bit_array(struct commit *c)
 	*bitmap = NULL;
 }
 
+/*
+ * Updating every count for every commit we walk is what makes
+ * ahead_behind() slow with many tips. With several threads, the walk
+ * itself stays on the main thread, but the bit arrays of the commits
+ * it leaves behind are collected in batches, and the counts are split
+ * into one shard per thread, each of which is updated from the whole
+ * batch.
+ */
+#define MAX_AHEAD_BEHIND_THREADS 32
+
+/* without core.aheadBehindThreads, start one thread per this many counts */
+#define AHEAD_BEHIND_THREAD_COST 1024
+
+/* how many bit arrays to collect before updating the counts */
+#define AHEAD_BEHIND_BATCH 512
+
+struct ahead_behind_batch {
+	struct bitmap *bitmaps[AHEAD_BEHIND_BATCH];
+	size_t nr;
+	struct ahead_behind_count *counts;
+	size_t counts_nr;
+	int nr_threads;
+};
+
+struct ahead_behind_thread {
+	pthread_t pthread;
+	struct ahead_behind_batch *batch;
+	size_t start, end;
+};
+
+static int ahead_behind_threads(struct repository *r, size_t counts_nr)
+{
+	int nr = 0;
+
+	if (!HAVE_THREADS)
+		return 1;
+	repo_config_get_int(r, "core.aheadbehindthreads", &nr);
+	if (nr < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr, "core.aheadBehindThreads");
+	if (!nr) {
+		nr = online_cpus();
+		if ((size_t)nr > counts_nr / AHEAD_BEHIND_THREAD_COST)
+			nr = counts_nr / AHEAD_BEHIND_THREAD_COST;
+	}
+	if (nr > MAX_AHEAD_BEHIND_THREADS)
+		nr = MAX_AHEAD_BEHIND_THREADS;
+	if ((size_t)nr > counts_nr)
+		nr = counts_nr;
+	return nr ? nr : 1;
+}
+
+static void update_ahead_behind(struct bitmap *bitmap,
+				struct ahead_behind_count *counts,
+				size_t start, size_t end)
+{
+	for (size_t i = start; i < end; i++) {
+		int reach_from_tip = !!bitmap_get(bitmap, counts[i].tip_index);
+		int reach_from_base = !!bitmap_get(bitmap, counts[i].base_index);
+
+		if (reach_from_tip ^ reach_from_base) {
+			if (reach_from_base)
+				counts[i].behind++;
+			else
+				counts[i].ahead++;
+		}
+	}
+}
+
+static void *ahead_behind_thread(void *data)
+{
+	struct ahead_behind_thread *t = data;
+	struct ahead_behind_batch *batch = t->batch;
+
+	trace2_thread_start("ahead-behind");
+	for (size_t i = 0; i < batch->nr; i++)
+		update_ahead_behind(batch->bitmaps[i], batch->counts,
+				    t->start, t->end);
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void flush_ahead_behind_batch(struct ahead_behind_batch *batch)
+{
+	struct ahead_behind_thread *threads;
+	size_t shard = DIV_ROUND_UP(batch->counts_nr, batch->nr_threads);
+
+	if (!batch->nr)
+		return;
+
+	CALLOC_ARRAY(threads, batch->nr_threads);
+	for (int i = 0; i < batch->nr_threads; i++) {
+		int err;
+
+		threads[i].batch = batch;
+		threads[i].start = st_mult(i, shard);
+		threads[i].end = threads[i].start + shard;
+		if (threads[i].start > batch->counts_nr)
+			threads[i].start = batch->counts_nr;
+		if (threads[i].end > batch->counts_nr)
+			threads[i].end = batch->counts_nr;
+		err = pthread_create(&threads[i].pthread, NULL,
+				     ahead_behind_thread, &threads[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (int i = 0; i < batch->nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die(_("unable to join thread"));
+	free(threads);
+
+	for (size_t i = 0; i < batch->nr; i++)
+		bitmap_free(batch->bitmaps[i]);
+	batch->nr = 0;
+}
+
 void ahead_behind(struct repository *r,
 		  struct commit **commits, size_t commits_nr,
 		  struct ahead_behind_count *counts, size_t counts_nr)
 {
 	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
 	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
+	struct ahead_behind_batch *batch = NULL;
+	int nr_threads;
 
 	if (!commits_nr || !counts_nr)
 		return;
 
+	nr_threads = ahead_behind_threads(r, counts_nr);
+	if (nr_threads > 1) {
+		CALLOC_ARRAY(batch, 1);
+		batch->counts = counts;
+		batch->counts_nr = counts_nr;
+		batch->nr_threads = nr_threads;
+		trace2_data_intmax("commit-reach", r, "ahead-behind/threads",
+				   nr_threads);
+	}
+
 	for (size_t i = 0; i < counts_nr; i++) {
 		counts[i].ahead = 0;
 		counts[i].behind = 0;
@@ -1076,17 +1208,8 @@ void ahead_behind(struct repository *r,
 		struct commit_list *p;
 		struct bitmap *bitmap_c = get_bit_array(c, width);
 
-		for (size_t i = 0; i < counts_nr; i++) {
-			int reach_from_tip = !!bitmap_get(bitmap_c, counts[i].tip_index);
-			int reach_from_base = !!bitmap_get(bitmap_c, counts[i].base_index);
-
-			if (reach_from_tip ^ reach_from_base) {
-				if (reach_from_base)
-					counts[i].behind++;
-				else
-					counts[i].ahead++;
-			}
-		}
+		if (!batch)
+			update_ahead_behind(bitmap_c, counts, 0, counts_nr);
 
 		for (p = c->parents; p; p = p->next) {
 			struct bitmap *bitmap_p;
@@ -1109,7 +1232,19 @@ void ahead_behind(struct repository *r,
 			insert_no_dup(&queue, p->item);
 		}
 
-		free_bit_array(c);
+		if (batch) {
+			/* the counts are updated from it later */
+			*bit_arrays_at(&bit_arrays, c) = NULL;
+			batch->bitmaps[batch->nr++] = bitmap_c;
+			if (batch->nr == AHEAD_BEHIND_BATCH)
+				flush_ahead_behind_batch(batch);
+		} else {
+			free_bit_array(c);
+		}
+	}
+	if (batch) {
+		flush_ahead_behind_batch(batch);
+		free(batch);
 	}
 
 	/* STALE is used here, PARENT2 is used by insert_no_dup(). */
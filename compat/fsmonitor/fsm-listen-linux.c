@@ -0,0 +1,621 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "fsmonitor-ll.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "simple-ipc.h"
+#include "string-list.h"
+#include "trace.h"
+#include <sys/inotify.h>
+#include <poll.h>
+
+/*
+ * The Linux backend uses inotify(7).  Unlike FSEvents on macOS and
+ * ReadDirectoryChangesW() on Windows, inotify is not recursive: each
+ * directory in the worktree needs its own watch.  We crawl the tree
+ * once at startup and then add a watch for every directory that
+ * appears while we are running.
+ *
+ * fanotify(7) with FAN_REPORT_DFID_NAME could watch a whole
+ * filesystem with a single mark, but filesystem and mount marks
+ * require CAP_SYS_ADMIN, which the daemon (started implicitly by
+ * ordinary commands) does not have.
+ *
+ * When the kernel event queue overflows we lose sync with the
+ * filesystem.  We then tell the daemon to flush its cached data and
+ * re-crawl the tree so that we pick up any directories that were
+ * created while events were being dropped.
+ */
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+		    IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DELETE_SELF | IN_MOVE_SELF | \
+		    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	unsigned is_root:1;
+	char path[FLEX_ARRAY]; /* absolute path of the watched directory */
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+
+	/* maps watch descriptors to `struct watch_entry` */
+	struct hashmap watches;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+static int watch_entry_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata UNUSED)
+{
+	const struct watch_entry *a, *b;
+
+	a = container_of(eptr, const struct watch_entry, ent);
+	b = container_of(entry_or_key, const struct watch_entry, ent);
+
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ACCESS)
+		strbuf_addstr(&msg, "IN_ACCESS|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+	if (mask & IN_UNMOUNT)
+		strbuf_addstr(&msg, "IN_UNMOUNT|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+/*
+ * Add a watch for a single directory.  Returns 0 on success (or when
+ * the directory vanished before we could watch it) and -1 if we could
+ * not create the watch.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *path,
+		     int is_root)
+{
+	struct watch_entry *w;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, path, WATCH_MASK);
+	if (wd < 0) {
+		if (!is_root && (errno == ENOENT || errno == ENOTDIR))
+			return 0;
+		if (errno == ENOSPC)
+			return error(_("inotify watch limit reached; "
+				       "consider increasing "
+				       "/proc/sys/fs/inotify/max_user_watches"));
+		return error_errno(_("inotify_add_watch('%s') failed"), path);
+	}
+
+	/*
+	 * inotify returns the existing descriptor if the directory is
+	 * already watched (for example when we re-crawl after a queue
+	 * overflow).  Make sure our pathname is current.
+	 */
+	w = find_watch(data, wd);
+	if (w) {
+		if (!strcmp(w->path, path))
+			return 0;
+		hashmap_remove(&data->watches, &w->ent, NULL);
+		is_root |= w->is_root;
+		free(w);
+	}
+
+	FLEX_ALLOC_STR(w, path, path);
+	w->wd = wd;
+	w->is_root = !!is_root;
+	hashmap_entry_init(&w->ent, memhash(&wd, sizeof(wd)));
+	hashmap_add(&data->watches, &w->ent);
+	return 0;
+}
+
+/*
+ * Stop watching a directory and everything below it.  This is used
+ * when a directory is moved away; the watches would otherwise still
+ * report events under the old pathname.
+ */
+static void remove_watch_tree(struct fsm_listen_data *data, const char *path)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	size_t len = strlen(path);
+	int *wds = NULL;
+	size_t nr = 0, alloc = 0;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (w->is_root || strncmp(w->path, path, len) ||
+		    (w->path[len] && w->path[len] != '/'))
+			continue;
+		ALLOC_GROW(wds, nr + 1, alloc);
+		wds[nr++] = w->wd;
+	}
+
+	for (size_t k = 0; k < nr; k++) {
+		w = find_watch(data, wds[k]);
+		hashmap_remove(&data->watches, &w->ent, NULL);
+		inotify_rm_watch(data->fd_inotify, wds[k]);
+		free(w);
+	}
+
+	free(wds);
+}
+
+/*
+ * Recursively watch the directory `path` (an absolute pathname in the
+ * worktree) and its subdirectories.  If `batch` is given, every path
+ * that we find is also added to it; this catches files that were
+ * created in a new directory before we had a chance to watch it.
+ *
+ * We do not descend into ".git"; the cookie directory is watched
+ * separately.
+ */
+static int add_watch_tree(struct fsmonitor_daemon_state *state,
+			  struct strbuf *path,
+			  struct fsmonitor_batch **batch)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	size_t len = path->len;
+	struct dirent *de;
+	DIR *dir;
+	int ret = 0;
+
+	if (add_watch(data, path->buf, 0))
+		return -1;
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return 0;
+
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		int is_dir;
+
+		strbuf_setlen(path, len);
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, de->d_name);
+
+		switch (fsmonitor_classify_path_absolute(state, path->buf)) {
+		case IS_WORKDIR_PATH:
+			break;
+		default:
+			continue;
+		}
+
+		is_dir = get_dtype(de, path, 0) == DT_DIR;
+
+		if (batch) {
+			if (!*batch)
+				*batch = fsmonitor_batch__new();
+			if (is_dir)
+				strbuf_addch(path, '/');
+			fsmonitor_batch__add_path(*batch, path->buf +
+				state->path_worktree_watch.len + 1);
+			if (is_dir)
+				strbuf_setlen(path, path->len - 1);
+		}
+
+		if (is_dir && add_watch_tree(state, path, batch)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	closedir(dir);
+	strbuf_setlen(path, len);
+	return ret;
+}
+
+/*
+ * Crawl the worktree and set up all of our watches.  This is also
+ * used to re-sync after the kernel dropped events.
+ */
+static int add_all_watches(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf path = STRBUF_INIT;
+	int ret = 0;
+
+	if (add_watch(data, state->path_worktree_watch.buf, 1))
+		ret = -1;
+
+	/*
+	 * If <gitdir> is outside of the worktree, watch it (but not its
+	 * contents) so that we notice if it is deleted or moved.
+	 */
+	if (!ret && state->nr_paths_watching > 1 &&
+	    add_watch(data, state->path_gitdir_watch.buf, 1))
+		ret = -1;
+
+	/* The cookie directory lives inside <gitdir>. */
+	strbuf_addbuf(&path, &state->path_cookie_prefix);
+	strbuf_strip_suffix(&path, "/");
+	if (!ret && add_watch(data, path.buf, 0))
+		ret = -1;
+
+	strbuf_reset(&path);
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	if (!ret && add_watch_tree(state, &path, NULL))
+		ret = -1;
+
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * Handle one inotify event.  Returns 0 to keep going or one of the
+ * shutdown styles if we need to stop.
+ */
+static enum shutdown_style handle_event(struct fsmonitor_daemon_state *state,
+					const struct inotify_event *ev,
+					struct fsmonitor_batch **batch,
+					struct string_list *cookie_list,
+					struct strbuf *path)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct watch_entry *w;
+	const char *rel;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		/*
+		 * The kernel dropped events.  Discard the batch that we
+		 * were building (since it is relative to the token that
+		 * we are about to flush) and re-crawl the tree, in case
+		 * we missed the creation of some directories.
+		 */
+		if (trace_pass_fl(&trace_fsmonitor))
+			log_mask_set("", ev->mask);
+
+		fsmonitor_force_resync(state);
+		fsmonitor_batch__free_list(*batch);
+		*batch = NULL;
+		string_list_clear(cookie_list, 0);
+
+		if (add_all_watches(state))
+			return FORCE_ERROR_STOP;
+		return 0;
+	}
+
+	w = find_watch(data, ev->wd);
+	if (!w)
+		return 0; /* a stale event for a watch we already removed */
+
+	if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF |
+			IN_UNMOUNT)) {
+		if (trace_pass_fl(&trace_fsmonitor))
+			log_mask_set(w->path, ev->mask);
+
+		/*
+		 * The worktree root (or external <gitdir>) was deleted,
+		 * moved or unmounted.  Clients will not be able to
+		 * rendezvous with us any more, so shut down.
+		 */
+		if (w->is_root) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: root changed");
+			return FORCE_SHUTDOWN;
+		}
+
+		if (ev->mask & IN_IGNORED) {
+			hashmap_remove(&data->watches, &w->ent, NULL);
+			free(w);
+		}
+		return 0;
+	}
+
+	if (!ev->len)
+		return 0;
+
+	strbuf_reset(path);
+	strbuf_addstr(path, w->path);
+	strbuf_addch(path, '/');
+	strbuf_addstr(path, ev->name);
+
+	/*
+	 * If you want to debug inotify, log them to GIT_TRACE_FSMONITOR.
+	 * Please don't log them to Trace2.
+	 */
+
+	switch (fsmonitor_classify_path_absolute(state, path->buf)) {
+
+	case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+	case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+		/* special case cookie files within .git or gitdir */
+
+		/* Use just the filename of the cookie file. */
+		string_list_append(cookie_list, ev->name);
+		break;
+
+	case IS_INSIDE_DOT_GIT:
+	case IS_INSIDE_GITDIR:
+		/* ignore all other paths inside of .git or gitdir */
+		break;
+
+	case IS_DOT_GIT:
+	case IS_GITDIR:
+		/*
+		 * If .git directory is deleted or renamed away,
+		 * we have to quit.
+		 */
+		if (ev->mask & IN_DELETE) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: gitdir removed");
+			return FORCE_SHUTDOWN;
+		}
+		if (ev->mask & IN_MOVED_FROM) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: gitdir renamed");
+			return FORCE_SHUTDOWN;
+		}
+		break;
+
+	case IS_WORKDIR_PATH:
+		/* try to queue normal pathnames */
+
+		if (trace_pass_fl(&trace_fsmonitor))
+			log_mask_set(path->buf, ev->mask);
+
+		if (!*batch)
+			*batch = fsmonitor_batch__new();
+
+		if (!(ev->mask & IN_ISDIR)) {
+			rel = path->buf + state->path_worktree_watch.len + 1;
+			fsmonitor_batch__add_path(*batch, rel);
+			break;
+		}
+
+		/*
+		 * Report directories with a trailing slash so that the
+		 * client knows to invalidate everything below it.
+		 */
+		strbuf_addch(path, '/');
+		rel = path->buf + state->path_worktree_watch.len + 1;
+		fsmonitor_batch__add_path(*batch, rel);
+		strbuf_setlen(path, path->len - 1);
+
+		if (ev->mask & IN_MOVED_FROM)
+			remove_watch_tree(data, path->buf);
+		if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+		    add_watch_tree(state, path, batch))
+			return FORCE_ERROR_STOP;
+		break;
+
+	case IS_OUTSIDE_CONE:
+	default:
+		trace_printf_key(&trace_fsmonitor,
+				 "ignoring '%s'", path->buf);
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Drain the inotify descriptor and publish what we found as a single
+ * batch.
+ */
+static enum shutdown_style process_events(struct fsmonitor_daemon_state *state,
+					  char *buf, size_t buf_len)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	enum shutdown_style style = 0;
+
+	for (;;) {
+		ssize_t len = read(data->fd_inotify, buf, buf_len);
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				error_errno(_("could not read inotify events"));
+				style = FORCE_ERROR_STOP;
+			}
+			break;
+		}
+		if (!len)
+			break;
+
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (void *)p;
+
+			style = handle_event(state, ev, &batch, &cookie_list,
+					     &path);
+			if (style)
+				goto done;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+
+done:
+	if (style) {
+		fsmonitor_batch__free_list(batch);
+	} else {
+		fsmonitor_publish(state, batch, &cookie_list);
+	}
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return style;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	CALLOC_ARRAY(data, 1);
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+	state->listen_data = data;
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("inotify_init1() failed"));
+		goto failed;
+	}
+
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create pipe"));
+		goto failed;
+	}
+
+	/*
+	 * Set up all of the watches now, before the IPC socket is
+	 * created.  Clients may connect (and start changing files) as
+	 * soon as the socket exists; the kernel queues any events until
+	 * the listener thread reads them.
+	 */
+	if (add_all_watches(state))
+		goto failed;
+
+	trace_printf_key(&trace_fsmonitor, "inotify: watching %u directories",
+			 hashmap_get_size(&data->watches));
+
+	return 0;
+
+failed:
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = state->listen_data;
+
+	if (write(data->fd_stop[1], "x", 1) < 0)
+		error_errno(_("could not stop the inotify listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct pollfd pfd[2];
+	size_t buf_len = 64 * 1024;
+	char *buf;
+
+	data = state->listen_data;
+	data->shutdown_style = SHUTDOWN_EVENT;
+
+	/*
+	 * Our fs event listener is now running, so it's safe to start
+	 * serving client requests.
+	 */
+	ipc_server_start_async(state->ipc_server_data);
+
+	buf = xmalloc(buf_len);
+
+	pfd[0].fd = data->fd_inotify;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = data->fd_stop[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("poll() on inotify descriptor failed"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (pfd[1].revents)
+			break;
+
+		if (pfd[0].revents & POLLIN) {
+			data->shutdown_style = process_events(state, buf,
+							      buf_len);
+			if (data->shutdown_style)
+				break;
+		} else if (pfd[0].revents) {
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+	}
+
+	free(buf);
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
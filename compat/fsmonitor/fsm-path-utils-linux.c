@@ -0,0 +1,113 @@
+#include "git-compat-util.h"
+#include "fsmonitor-ll.h"
+#include "fsmonitor-path-utils.h"
+#include "gettext.h"
+#include "trace.h"
+#include <sys/vfs.h>
+
+/*
+ * Magic numbers from <linux/magic.h> (and the individual filesystem
+ * sources for those that are not exported there) for the filesystems
+ * that we care about.  We spell them out here rather than rely on the
+ * kernel headers being installed.
+ */
+#define FSM_NFS_SUPER_MAGIC	0x6969
+#define FSM_SMB_SUPER_MAGIC	0x517b
+#define FSM_CIFS_MAGIC_NUMBER	0xff534d42
+#define FSM_SMB2_MAGIC_NUMBER	0xfe534d42
+#define FSM_AFS_SUPER_MAGIC	0x5346414f
+#define FSM_CODA_SUPER_MAGIC	0x73757245
+#define FSM_V9FS_MAGIC		0x01021997
+#define FSM_CEPH_SUPER_MAGIC	0x00c36400
+#define FSM_MSDOS_SUPER_MAGIC	0x4d44
+#define FSM_NTFS_SB_MAGIC	0x5346544e
+#define FSM_NTFS3_SUPER_MAGIC	0x7366746e
+#define FSM_FUSE_SUPER_MAGIC	0x65735546
+
+static const struct {
+	uint32_t magic;
+	const char *typename;
+	int is_remote;
+} fs_types[] = {
+	{ FSM_NFS_SUPER_MAGIC, "nfs", 1 },
+	{ FSM_SMB_SUPER_MAGIC, "smb", 1 },
+	{ FSM_CIFS_MAGIC_NUMBER, "cifs", 1 },
+	{ FSM_SMB2_MAGIC_NUMBER, "smb2", 1 },
+	{ FSM_AFS_SUPER_MAGIC, "afs", 1 },
+	{ FSM_CODA_SUPER_MAGIC, "coda", 1 },
+	{ FSM_V9FS_MAGIC, "v9fs", 1 },
+	{ FSM_CEPH_SUPER_MAGIC, "ceph", 1 },
+	{ FSM_MSDOS_SUPER_MAGIC, "msdos", 0 },
+	{ FSM_NTFS_SB_MAGIC, "ntfs", 0 },
+	{ FSM_NTFS3_SUPER_MAGIC, "ntfs", 0 },
+	{ FSM_FUSE_SUPER_MAGIC, "fuse", 0 },
+};
+
+int fsmonitor__get_fs_info(const char *path, struct fs_info *fs_info)
+{
+	struct statfs fs;
+	uint32_t magic;
+
+	if (statfs(path, &fs) == -1) {
+		int saved_errno = errno;
+		trace_printf_key(&trace_fsmonitor, "statfs('%s') failed: %s",
+				 path, strerror(saved_errno));
+		errno = saved_errno;
+		return -1;
+	}
+
+	/*
+	 * `f_type` is a signed type on some architectures; the magic
+	 * numbers are all 32-bit values.
+	 */
+	magic = (uint32_t)fs.f_type;
+
+	trace_printf_key(&trace_fsmonitor,
+			 "statfs('%s') [type 0x%08"PRIx32"]", path, magic);
+
+	fs_info->is_remote = 0;
+	fs_info->typename = NULL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(fs_types); i++) {
+		if (fs_types[i].magic != magic)
+			continue;
+		fs_info->is_remote = fs_types[i].is_remote;
+		fs_info->typename = xstrdup(fs_types[i].typename);
+		break;
+	}
+
+	if (!fs_info->typename)
+		fs_info->typename = xstrfmt("0x%08"PRIx32, magic);
+
+	trace_printf_key(&trace_fsmonitor,
+				"'%s' is_remote: %d",
+				path, fs_info->is_remote);
+	return 0;
+}
+
+int fsmonitor__is_fs_remote(const char *path)
+{
+	struct fs_info fs;
+	if (fsmonitor__get_fs_info(path, &fs))
+		return -1;
+
+	free(fs.typename);
+
+	return fs.is_remote;
+}
+
+/*
+ * Linux does not have the synthetic firmlinks that macOS uses, so
+ * there is never an alias for the path.
+ */
+int fsmonitor__get_alias(const char *path UNUSED,
+			 struct alias_info *info UNUSED)
+{
+	return 0;
+}
+
+char *fsmonitor__resolve_alias(const char *path UNUSED,
+			       const struct alias_info *info UNUSED)
+{
+	return NULL;
+}
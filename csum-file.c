@@ -13,6 +13,28 @@
 #include "git-zlib.h"
 #include "hash.h"
 #include "progress.h"
+#include "thread-utils.h"
+
+struct hashfile_thread {
+#ifndef NO_PTHREADS
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+
+	/*
+	 * The hashfile's buffer is swapped between these two, so that the
+	 * caller can fill one while the helper thread works on the other.
+	 */
+	unsigned char *buffers[2];
+
+	/* buffer handed to the helper thread; NULL while it is idle */
+	const unsigned char *pending;
+	unsigned int pending_len;
+
+	int write_errno;
+	int done;
+};
 
 static void verify_buffer_or_die(struct hashfile *f,
 				 const void *buf,
@@ -43,20 +65,166 @@ static void flush(struct hashfile *f, const void *buf, unsigned int count)
 	display_throughput(f->tp, f->total);
 }
 
-void hashflush(struct hashfile *f)
+#ifndef NO_PTHREADS
+static void *hashfile_thread_main(void *data)
+{
+	struct hashfile *f = data;
+	struct hashfile_thread *t = f->thread;
+
+	pthread_mutex_lock(&t->mutex);
+	for (;;) {
+		const unsigned char *buf;
+		unsigned int len;
+
+		while (!t->pending && !t->done)
+			pthread_cond_wait(&t->cond, &t->mutex);
+		if (!t->pending)
+			break;
+		buf = t->pending;
+		len = t->pending_len;
+		pthread_mutex_unlock(&t->mutex);
+
+		/*
+		 * The caller does not touch the hash context or the file
+		 * descriptor until it has waited for us to become idle.
+		 */
+		if (!f->skip_hash)
+			git_hash_update(&f->ctx, buf, len);
+		if (!t->write_errno && write_in_full(f->fd, buf, len) < 0)
+			t->write_errno = errno ? errno : EIO;
+
+		pthread_mutex_lock(&t->mutex);
+		t->pending = NULL;
+		pthread_cond_broadcast(&t->cond);
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	return NULL;
+}
+#endif
+
+/*
+ * Wait for the helper thread to finish the buffer it is working on, and
+ * die if writing it out failed.
+ */
+static void hashfile_thread_wait(struct hashfile *f)
+{
+#ifndef NO_PTHREADS
+	struct hashfile_thread *t = f->thread;
+
+	pthread_mutex_lock(&t->mutex);
+	while (t->pending)
+		pthread_cond_wait(&t->cond, &t->mutex);
+	pthread_mutex_unlock(&t->mutex);
+
+	if (t->write_errno) {
+		errno = t->write_errno;
+		if (errno == ENOSPC)
+			die("sha1 file '%s' write error. Out of diskspace", f->name);
+		die_errno("sha1 file '%s' write error", f->name);
+	}
+#endif
+}
+
+/*
+ * Hand the filled buffer to the helper thread and continue with the
+ * other one.
+ */
+static void hashfile_thread_submit(struct hashfile *f)
+{
+#ifndef NO_PTHREADS
+	struct hashfile_thread *t = f->thread;
+
+	hashfile_thread_wait(f);
+
+	pthread_mutex_lock(&t->mutex);
+	t->pending = f->buffer;
+	t->pending_len = f->offset;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+
+	f->buffer = f->buffer == t->buffers[0] ? t->buffers[1] : t->buffers[0];
+	f->total += f->offset;
+	display_throughput(f->tp, f->total);
+	f->offset = 0;
+#endif
+}
+
+static void hashfile_thread_stop(struct hashfile *f)
+{
+#ifndef NO_PTHREADS
+	struct hashfile_thread *t = f->thread;
+
+	pthread_mutex_lock(&t->mutex);
+	t->done = 1;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+	pthread_join(t->thread, NULL);
+
+	pthread_cond_destroy(&t->cond);
+	pthread_mutex_destroy(&t->mutex);
+
+	/* f->buffer is one of ours; free the other one */
+	free(f->buffer == t->buffers[0] ? t->buffers[1] : t->buffers[0]);
+	FREE_AND_NULL(f->thread);
+#endif
+}
+
+void hashfile_start_thread(struct hashfile *f)
+{
+#ifndef NO_PTHREADS
+	struct hashfile_thread *t;
+
+	if (f->thread || 0 <= f->check_fd)
+		return;
+
+	CALLOC_ARRAY(t, 1);
+	t->buffers[0] = f->buffer;
+	t->buffers[1] = xmalloc(f->buffer_len);
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_cond_init(&t->cond, NULL);
+
+	f->thread = t;
+	if (pthread_create(&t->thread, NULL, hashfile_thread_main, f)) {
+		pthread_cond_destroy(&t->cond);
+		pthread_mutex_destroy(&t->mutex);
+		free(t->buffers[1]);
+		FREE_AND_NULL(f->thread);
+	}
+#endif
+}
+
+/*
+ * Hash and write out the buffer. With a helper thread, this only hands
+ * the buffer over; see hashflush() for a full flush.
+ */
+static void hashflush_buffer(struct hashfile *f)
 {
 	unsigned offset = f->offset;
 
-	if (offset) {
-		if (!f->skip_hash)
-			git_hash_update(&f->ctx, f->buffer, offset);
-		flush(f, f->buffer, offset);
-		f->offset = 0;
+	if (!offset)
+		return;
+	if (f->thread) {
+		hashfile_thread_submit(f);
+		return;
 	}
+	if (!f->skip_hash)
+		git_hash_update(&f->ctx, f->buffer, offset);
+	flush(f, f->buffer, offset);
+	f->offset = 0;
+}
+
+void hashflush(struct hashfile *f)
+{
+	hashflush_buffer(f);
+	if (f->thread)
+		hashfile_thread_wait(f);
 }
 
 void free_hashfile(struct hashfile *f)
 {
+	if (f->thread)
+		hashfile_thread_stop(f);
 	free(f->buffer);
 	free(f->check_buffer);
 	free(f);
@@ -68,6 +236,8 @@ int finalize_hashfile(struct hashfile *f, unsigned char *result,
 	int fd;
 
 	hashflush(f);
+	if (f->thread)
+		hashfile_thread_stop(f);
 
 	if (f->skip_hash)
 		hashclr(f->buffer, f->algop);
@@ -103,6 +273,8 @@ int finalize_hashfile(struct hashfile *f, unsigned char *result,
 
 void discard_hashfile(struct hashfile *f)
 {
+	if (f->thread)
+		hashfile_thread_stop(f);
 	if (0 <= f->check_fd)
 		close(f->check_fd);
 	if (0 <= f->fd)
@@ -119,12 +291,13 @@ void hashwrite(struct hashfile *f, const void *buf, unsigned int count)
 		if (f->do_crc)
 			f->crc32 = crc32(f->crc32, buf, nr);
 
-		if (nr == f->buffer_len) {
+		if (nr == f->buffer_len && !f->thread) {
 			/*
 			 * Flush a full batch worth of data directly
 			 * from the input, skipping the memcpy() to
 			 * the hashfile's buffer. In this block,
-			 * f->offset is necessarily zero.
+			 * f->offset is necessarily zero. The helper
+			 * thread needs a buffer of its own, though.
 			 */
 			if (!f->skip_hash)
 				git_hash_update(&f->ctx, buf, nr);
@@ -138,7 +311,7 @@ void hashwrite(struct hashfile *f, const void *buf, unsigned int count)
 			f->offset += nr;
 			left -= nr;
 			if (!left)
-				hashflush(f);
+				hashflush_buffer(f);
 		}
 
 		count -= nr;
@@ -175,6 +348,7 @@ static struct hashfile *hashfd_internal(const struct git_hash_algo *algop,
 	f->name = name;
 	f->do_crc = 0;
 	f->skip_hash = 0;
+	f->thread = NULL;
 
 	f->algop = unsafe_hash_algo(algop);
 	f->algop->init_fn(&f->ctx);
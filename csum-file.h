@@ -28,6 +28,9 @@ struct hashfile {
 	 * instead only use it as a buffered write.
 	 */
 	int skip_hash;
+
+	/* see hashfile_start_thread() */
+	struct hashfile_thread *thread;
 };
 
 /* Checkpoint */
@@ -52,6 +55,19 @@ struct hashfile *hashfd_check(const struct git_hash_algo *algop,
 struct hashfile *hashfd_throughput(const struct git_hash_algo *algop,
 				   int fd, const char *name, struct progress *tp);
 
+/*
+ * Hash and write out full buffers on a helper thread, so that both overlap
+ * with the caller producing the next buffer. This pays off for large files
+ * whose contents take some work to generate, like packfiles. The file
+ * contents and the resulting hash are the same as without the thread.
+ *
+ * Data is only guaranteed to have reached the file descriptor after
+ * hashflush(), hashfile_checkpoint() or finalize_hashfile(). Does nothing
+ * if threads are not supported, or if the hashfile verifies its contents
+ * (see hashfd_check()).
+ */
+void hashfile_start_thread(struct hashfile *f);
+
 /*
  * Free the hashfile without flushing its contents to disk. This only
  * needs to be called when not calling `finalize_hashfile()`.
@@ -0,0 +1,440 @@
+#include "git-compat-util.h"
+#include "delta-base-cache.h"
+#include "git-zlib.h"
+#include "hash.h"
+#include "lockfile.h"
+#include "odb.h"
+#include "packfile.h"
+#include "repository.h"
+#include "trace2.h"
+#include "wrapper.h"
+
+/*
+ * On-disk layout, all integers in network byte order:
+ *
+ *   header:  4-byte signature "DBC2", 4-byte number of index sets,
+ *            8-byte arena size, 8-byte write position ("head"),
+ *            padded to DBC_HEADER_SIZE bytes.
+ *
+ *   index:   nr_sets sets of DBC_WAYS slots. Each slot holds the
+ *            write position of a record plus one (zero meaning
+ *            "empty") and the pack offset of the base it holds.
+ *
+ *   arena:   a ring buffer of records. Each record is a header of
+ *            the pack checksum, pack offset, write position, object
+ *            type, CRC32 and size of the data, followed by the data.
+ *            The CRC32 covers the rest of the record header as well
+ *            as the data.
+ *
+ * The write position only ever grows; a record's place in the arena is
+ * its position modulo the arena size. New records overwrite the oldest
+ * ones, so to approximate LRU, a record that is read while it is in the
+ * older half of the arena is written out again at the head.
+ */
+#define DBC_SIGNATURE 0x44424332 /* "DBC2" */
+#define DBC_HEADER_SIZE 64
+#define DBC_HEAD_OFFSET 16
+#define DBC_WAYS 4
+#define DBC_SLOT_SIZE 16
+#define DBC_RECORD_HEADER_SIZE (GIT_MAX_RAWSZ + 32)
+#define DBC_RECORD_CRC_OFFSET (GIT_MAX_RAWSZ + 20)
+
+/* used to size the index for a given cache limit */
+#define DBC_EXPECTED_RECORD_SIZE 8192
+#define DBC_MIN_ARENA_SIZE (1024 * 1024)
+
+static int stats_atexit_registered;
+static unsigned int count_hits;
+static unsigned int count_misses;
+static unsigned int count_rejected;
+
+static void trace2_stats_atexit(void)
+{
+	trace2_data_intmax("delta-base-cache", NULL,
+			   "hits", count_hits);
+	trace2_data_intmax("delta-base-cache", NULL,
+			   "misses", count_misses);
+	trace2_data_intmax("delta-base-cache", NULL,
+			   "rejected", count_rejected);
+}
+
+struct shared_delta_base_cache {
+	/* -1 if the cache could not be opened */
+	int fd;
+	char *path;
+	uint32_t nr_sets;
+	uint64_t arena_size;
+	off_t arena_start;
+};
+
+static off_t index_start(void)
+{
+	return DBC_HEADER_SIZE;
+}
+
+static int read_at(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t ret = pread_in_full(fd, buf, len, offset);
+
+	return ret < 0 || (size_t)ret != len ? -1 : 0;
+}
+
+static int write_at(int fd, const void *buf, size_t len, off_t offset)
+{
+	if (lseek(fd, offset, SEEK_SET) != offset ||
+	    write_in_full(fd, buf, len) < 0)
+		return -1;
+	return 0;
+}
+
+static void compute_geometry(uint64_t limit, uint32_t *nr_sets,
+			     uint64_t *arena_size)
+{
+	uint64_t sets = limit / (DBC_EXPECTED_RECORD_SIZE * DBC_WAYS);
+	uint64_t index_size;
+
+	if (!sets)
+		sets = 1;
+	if (sets > UINT32_MAX)
+		sets = UINT32_MAX;
+	index_size = sets * DBC_WAYS * DBC_SLOT_SIZE;
+
+	*nr_sets = sets;
+	*arena_size = limit > DBC_HEADER_SIZE + index_size ?
+		limit - DBC_HEADER_SIZE - index_size : 0;
+}
+
+static void set_geometry(struct shared_delta_base_cache *cache,
+			 uint32_t nr_sets, uint64_t arena_size)
+{
+	cache->nr_sets = nr_sets;
+	cache->arena_size = arena_size;
+	cache->arena_start = index_start() +
+		(off_t)nr_sets * DBC_WAYS * DBC_SLOT_SIZE;
+}
+
+/*
+ * Open an existing cache file and check that it has the geometry we
+ * want. Returns the file descriptor, or -1.
+ */
+static int open_cache(struct shared_delta_base_cache *cache,
+		      uint32_t nr_sets, uint64_t arena_size)
+{
+	unsigned char hdr[DBC_HEADER_SIZE];
+	struct stat st;
+	int fd = open(cache->path, O_RDWR);
+
+	if (fd < 0)
+		return -1;
+	if (read_at(fd, hdr, sizeof(hdr), 0) ||
+	    get_be32(hdr) != DBC_SIGNATURE ||
+	    get_be32(hdr + 4) != nr_sets ||
+	    get_be64(hdr + 8) != arena_size ||
+	    fstat(fd, &st) ||
+	    st.st_size != index_start() +
+			  (off_t)nr_sets * DBC_WAYS * DBC_SLOT_SIZE +
+			  (off_t)arena_size) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * (Re)create the cache file with the given geometry. The new file is
+ * prepared under the lock and renamed into place, so readers only ever
+ * see a complete file. Returns 0 on success.
+ */
+static int create_cache(struct shared_delta_base_cache *cache,
+			uint32_t nr_sets, uint64_t arena_size)
+{
+	struct lock_file lk = LOCK_INIT;
+	unsigned char hdr[DBC_HEADER_SIZE] = { 0 };
+	off_t total = index_start() +
+		(off_t)nr_sets * DBC_WAYS * DBC_SLOT_SIZE + (off_t)arena_size;
+	int fd;
+
+	if (hold_lock_file_for_update_timeout(&lk, cache->path, 0, 0) < 0)
+		return -1;
+	fd = get_lock_file_fd(&lk);
+
+	put_be32(hdr, DBC_SIGNATURE);
+	put_be32(hdr + 4, nr_sets);
+	put_be64(hdr + 8, arena_size);
+	put_be64(hdr + DBC_HEAD_OFFSET, 0);
+
+	/* the index starts out all zeroes, i.e. empty */
+	if (write_in_full(fd, hdr, sizeof(hdr)) < 0 ||
+	    ftruncate(fd, total) ||
+	    commit_lock_file(&lk)) {
+		rollback_lock_file(&lk);
+		return -1;
+	}
+	trace2_data_intmax("delta-base-cache", NULL, "created", total);
+	return 0;
+}
+
+static struct shared_delta_base_cache *get_cache(struct packed_git *p)
+{
+	struct repository *r = p->repo;
+	struct shared_delta_base_cache *cache;
+	uint32_t nr_sets;
+	uint64_t arena_size;
+
+	if (!r->settings.shared_delta_base_cache_limit)
+		return NULL;
+
+	cache = r->objects->shared_delta_base_cache;
+	if (cache)
+		return cache->fd < 0 ? NULL : cache;
+
+	CALLOC_ARRAY(cache, 1);
+	cache->fd = -1;
+	cache->path = xstrfmt("%s/info/delta-base-cache",
+			      r->objects->sources->path);
+	r->objects->shared_delta_base_cache = cache;
+
+	compute_geometry(r->settings.shared_delta_base_cache_limit,
+			 &nr_sets, &arena_size);
+	if (arena_size < DBC_MIN_ARENA_SIZE)
+		return NULL;
+	set_geometry(cache, nr_sets, arena_size);
+
+	cache->fd = open_cache(cache, nr_sets, arena_size);
+	if (cache->fd < 0 && !create_cache(cache, nr_sets, arena_size))
+		cache->fd = open_cache(cache, nr_sets, arena_size);
+	if (cache->fd < 0)
+		return NULL;
+
+	if (trace2_is_enabled() && !stats_atexit_registered) {
+		atexit(trace2_stats_atexit);
+		stats_atexit_registered = 1;
+	}
+	return cache;
+}
+
+/*
+ * The pack checksum is the trailer of the pack; the .idx file carries
+ * a copy of it right before its own checksum.
+ */
+static const unsigned char *pack_checksum(struct packed_git *p)
+{
+	size_t rawsz = p->repo->hash_algo->rawsz;
+
+	if (!p->index_data || p->index_size < 2 * rawsz)
+		return NULL;
+	return (const unsigned char *)p->index_data + p->index_size - 2 * rawsz;
+}
+
+static uint32_t set_for(struct shared_delta_base_cache *cache,
+			const unsigned char *checksum, off_t offset)
+{
+	uint64_t h = get_be64(checksum) ^ (uint64_t)offset;
+
+	h *= 0x9e3779b97f4a7c15ull;
+	return (h >> 32) % cache->nr_sets;
+}
+
+static off_t set_offset(uint32_t set)
+{
+	return index_start() + (off_t)set * DBC_WAYS * DBC_SLOT_SIZE;
+}
+
+static int read_head(struct shared_delta_base_cache *cache, uint64_t *head)
+{
+	unsigned char buf[8];
+
+	if (read_at(cache->fd, buf, sizeof(buf), DBC_HEAD_OFFSET))
+		return -1;
+	*head = get_be64(buf);
+	return 0;
+}
+
+/* Checksum everything in the record but the checksum itself. */
+static uint32_t record_crc(const unsigned char *hdr,
+			   const void *data, unsigned long size)
+{
+	uint32_t crc = crc32(0, NULL, 0);
+
+	crc = crc32(crc, hdr, DBC_RECORD_CRC_OFFSET);
+	crc = crc32(crc, hdr + DBC_RECORD_CRC_OFFSET + 4,
+		    DBC_RECORD_HEADER_SIZE - DBC_RECORD_CRC_OFFSET - 4);
+	return crc32(crc, data, size);
+}
+
+static void *read_record(struct shared_delta_base_cache *cache,
+			 const unsigned char *checksum, size_t rawsz,
+			 off_t offset, uint64_t pos,
+			 enum object_type *type, unsigned long *size)
+{
+	unsigned char hdr[DBC_RECORD_HEADER_SIZE];
+	const unsigned char *p = hdr + GIT_MAX_RAWSZ;
+	uint64_t at = pos % cache->arena_size;
+	uint64_t len;
+	uint32_t t;
+	void *data;
+
+	if (at + sizeof(hdr) > cache->arena_size ||
+	    read_at(cache->fd, hdr, sizeof(hdr), cache->arena_start + at) ||
+	    memcmp(hdr, checksum, rawsz) ||
+	    get_be64(p) != (uint64_t)offset ||
+	    get_be64(p + 8) != pos)
+		return NULL;
+
+	/* only the result of resolving a delta can be a base */
+	t = get_be32(p + 16);
+	if (t != OBJ_COMMIT && t != OBJ_TREE && t != OBJ_BLOB && t != OBJ_TAG)
+		return NULL;
+
+	len = get_be64(p + 24);
+	if (len > cache->arena_size - at - sizeof(hdr) ||
+	    len != (uInt)len)
+		return NULL;
+
+	data = xmallocz(len);
+	if (read_at(cache->fd, data, len, cache->arena_start + at + sizeof(hdr)) ||
+	    record_crc(hdr, data, len) != get_be32(p + 20)) {
+		free(data);
+		return NULL;
+	}
+
+	*type = t;
+	*size = len;
+	return data;
+}
+
+void *shared_delta_base_cache_get(struct packed_git *p, off_t offset,
+				  unsigned long expected_size,
+				  enum object_type *type, unsigned long *size)
+{
+	struct shared_delta_base_cache *cache = get_cache(p);
+	const unsigned char *checksum;
+	unsigned char slots[DBC_WAYS * DBC_SLOT_SIZE];
+
+	if (!cache || !(checksum = pack_checksum(p)))
+		return NULL;
+
+	if (read_at(cache->fd, slots, sizeof(slots),
+		    set_offset(set_for(cache, checksum, offset))))
+		return NULL;
+
+	for (size_t i = 0; i < DBC_WAYS; i++) {
+		const unsigned char *slot = slots + i * DBC_SLOT_SIZE;
+		uint64_t pos = get_be64(slot), head;
+		enum object_type t;
+		unsigned long s;
+		void *data;
+
+		if (!pos || get_be64(slot + 8) != (uint64_t)offset)
+			continue;
+		data = read_record(cache, checksum, p->repo->hash_algo->rawsz,
+				   offset, pos - 1, &t, &s);
+		if (!data)
+			continue;
+		if (s != expected_size) {
+			free(data);
+			count_rejected++;
+			continue;
+		}
+
+		/* keep hot entries from falling off the end of the ring */
+		if (!read_head(cache, &head) &&
+		    head - (pos - 1) > cache->arena_size / 2)
+			shared_delta_base_cache_put(p, offset, t, data, s);
+
+		*type = t;
+		*size = s;
+		count_hits++;
+		return data;
+	}
+	count_misses++;
+	return NULL;
+}
+
+void shared_delta_base_cache_put(struct packed_git *p, off_t offset,
+				 enum object_type type,
+				 const void *data, unsigned long size)
+{
+	struct shared_delta_base_cache *cache = get_cache(p);
+	struct lock_file lk = LOCK_INIT;
+	const unsigned char *checksum;
+	unsigned char hdr[DBC_RECORD_HEADER_SIZE] = { 0 };
+	unsigned char slots[DBC_WAYS * DBC_SLOT_SIZE];
+	unsigned char buf[8];
+	uint64_t head, at, len;
+	off_t slot_offset;
+	size_t victim = 0;
+
+	if (!cache || !(checksum = pack_checksum(p)))
+		return;
+
+	/* a single base should not be able to flush most of the cache */
+	len = st_add(DBC_RECORD_HEADER_SIZE, size);
+	len = (len + 7) & ~(uint64_t)7;
+	if (len > cache->arena_size / 8 || size != (uInt)size)
+		return;
+
+	/* never wait; someone else is already busy filling the cache */
+	if (hold_lock_file_for_update_timeout(&lk, cache->path, 0, 0) < 0)
+		return;
+
+	if (read_head(cache, &head))
+		goto out;
+	at = head % cache->arena_size;
+	if (at + len > cache->arena_size) {
+		head += cache->arena_size - at;
+		at = 0;
+	}
+
+	memcpy(hdr, checksum, p->repo->hash_algo->rawsz);
+	put_be64(hdr + GIT_MAX_RAWSZ, offset);
+	put_be64(hdr + GIT_MAX_RAWSZ + 8, head);
+	put_be32(hdr + GIT_MAX_RAWSZ + 16, type);
+	put_be64(hdr + GIT_MAX_RAWSZ + 24, size);
+	put_be32(hdr + DBC_RECORD_CRC_OFFSET, record_crc(hdr, data, size));
+
+	if (write_at(cache->fd, hdr, sizeof(hdr), cache->arena_start + at) ||
+	    write_in_full(cache->fd, data, size) < 0)
+		goto out;
+
+	/*
+	 * Replace the slot that already refers to this offset, if any,
+	 * or else an empty one, or else the one written longest ago.
+	 */
+	slot_offset = set_offset(set_for(cache, checksum, offset));
+	if (read_at(cache->fd, slots, sizeof(slots), slot_offset))
+		goto out;
+	for (size_t i = 0; i < DBC_WAYS; i++) {
+		const unsigned char *slot = slots + i * DBC_SLOT_SIZE;
+		const unsigned char *best = slots + victim * DBC_SLOT_SIZE;
+
+		if (get_be64(slot) && get_be64(slot + 8) == (uint64_t)offset) {
+			victim = i;
+			break;
+		}
+		if (get_be64(slot) < get_be64(best))
+			victim = i;
+	}
+	put_be64(slots + victim * DBC_SLOT_SIZE, head + 1);
+	put_be64(slots + victim * DBC_SLOT_SIZE + 8, offset);
+	if (write_at(cache->fd, slots + victim * DBC_SLOT_SIZE, DBC_SLOT_SIZE,
+		     slot_offset + victim * DBC_SLOT_SIZE))
+		goto out;
+
+	put_be64(buf, head + len);
+	write_at(cache->fd, buf, sizeof(buf), DBC_HEAD_OFFSET);
+
+out:
+	/* the lock only serializes writers; never commit it */
+	rollback_lock_file(&lk);
+}
+
+void shared_delta_base_cache_free(struct shared_delta_base_cache *cache)
+{
+	if (!cache)
+		return;
+	if (cache->fd >= 0)
+		close(cache->fd);
+	free(cache->path);
+	free(cache);
+}
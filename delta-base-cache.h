@@ -0,0 +1,51 @@
+#ifndef DELTA_BASE_CACHE_H
+#define DELTA_BASE_CACHE_H
+
+#include "object.h"
+
+struct packed_git;
+struct shared_delta_base_cache;
+
+/*
+ * The shared delta base cache keeps reconstructed delta bases in a
+ * size-bounded file, "$GIT_DIR/objects/info/delta-base-cache", so that
+ * many short-lived processes reading the same repository (think
+ * upload-pack, cat-file or blame on a busy server) do not each have to
+ * inflate the same hot delta chains again. It complements the
+ * in-process cache in packfile.c and is only used when
+ * core.sharedDeltaBaseCacheLimit is set.
+ *
+ * Entries are keyed by the checksum of the pack and the offset of the
+ * base within it, so they never go stale when packs are rewritten.
+ * Any number of processes may read the cache concurrently without
+ * locking; every entry is checked against its key, the expected size
+ * and a checksum of its header and contents before it is returned, so
+ * an entry that is being overwritten or was damaged is merely a cache
+ * miss. Writers serialize on a lockfile, and simply
+ * skip storing an entry if another process holds it.
+ */
+
+/*
+ * Return a copy of the cached base at `offset` in pack `p`, or NULL if
+ * it is not in the cache. The entry is only used if it is of a base
+ * object type and `expected_size` long, which the caller reads from
+ * the header of the delta at `offset`. On success, `type` and `size`
+ * are filled in and the returned buffer is NUL-terminated like the
+ * result of unpack_entry().
+ */
+void *shared_delta_base_cache_get(struct packed_git *p, off_t offset,
+				  unsigned long expected_size,
+				  enum object_type *type, unsigned long *size);
+
+/*
+ * Store the base at `offset` in pack `p`. Errors are not reported; the
+ * cache is best-effort.
+ */
+void shared_delta_base_cache_put(struct packed_git *p, off_t offset,
+				 enum object_type type,
+				 const void *data, unsigned long size);
+
+/* Close the cache and release its memory. */
+void shared_delta_base_cache_free(struct shared_delta_base_cache *cache);
+
+#endif /* DELTA_BASE_CACHE_H */
@@ -56,6 +56,7 @@
 static int diff_detect_rename_default;
 static int diff_indent_heuristic = 1;
 static int diff_rename_limit_default = 1000;
+static int diff_rename_threads_default;
 static int diff_suppress_blank_empty;
 static int diff_use_color_default = -1;
 static int diff_color_moved_default;
@@ -483,6 +484,13 @@ int git_diff_basic_config(const char *var, const char *value,
 		diff_rename_limit_default = git_config_int(var, value, ctx->kvi);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renamethreads")) {
+		diff_rename_threads_default = git_config_int(var, value, ctx->kvi);
+		if (diff_rename_threads_default < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    diff_rename_threads_default, var);
+		return 0;
+	}
 
 	if (userdiff_config(var, value) < 0)
 		return -1;
@@ -4780,6 +4788,7 @@ void repo_diff_setup(struct repository *r, struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->rename_threads = diff_rename_threads_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = diff_context_default;
 	options->interhunkcontext = diff_interhunk_context_default;
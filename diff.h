@@ -309,6 +309,12 @@ struct diff_options {
 	int rename_score;
 	int rename_limit;
 
+	/*
+	 * Number of threads for inexact rename detection, 0 meaning
+	 * one per CPU. Set from diff.renameThreads.
+	 */
+	int rename_threads;
+
 	int needed_rename_limit;
 	int degraded_cc_to_c;
 	int show_rename_progress;
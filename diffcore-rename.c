@@ -16,6 +16,7 @@
 #include "promisor-remote.h"
 #include "string-list.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
 
 /* Table of rename/copy destinations */
@@ -129,6 +130,46 @@ static void inexact_prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation below would not have a
+ * divide-by-zero issue.
+ */
+static int sizes_too_different(unsigned long src_size, unsigned long dst_size,
+			       int minimum_score)
+{
+	unsigned long max_size = src_size > dst_size ? src_size : dst_size;
+	unsigned long base_size = src_size < dst_size ? src_size : dst_size;
+	unsigned long delta_size = max_size - base_size;
+
+	return max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE;
+}
+
+/*
+ * How similar are they?  What percentage of material in dst are from
+ * source?  Both must have their "cnt_data" filled in, or be populated.
+ */
+static int count_similarity(struct repository *r,
+			    struct diff_filespec *src,
+			    struct diff_filespec *dst,
+			    unsigned long max_size)
+{
+	unsigned long src_copied, literal_added;
+
+	if (diffcore_count_changes(r, src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   &src_copied, &literal_added))
+		return 0;
+
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
@@ -148,8 +189,7 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	int score;
+	unsigned long max_size;
 
 	/* We deal only with regular files.  Symlink renames are handled
 	 * only when they are exact matches --- in other words, no edits
@@ -177,18 +217,7 @@ static int estimate_similarity(struct repository *r,
 		return 0;
 
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (sizes_too_different(src->size, dst->size, minimum_score))
 		return 0;
 
 	dpf_opt->check_size_only = 0;
@@ -198,19 +227,7 @@ static int estimate_similarity(struct repository *r,
 	if (!dst->cnt_data && diff_populate_filespec(r, dst, dpf_opt))
 		return 0;
 
-	if (diffcore_count_changes(r, src, dst,
-				   &src->cnt_data, &dst->cnt_data,
-				   &src_copied, &literal_added))
-		return 0;
-
-	/* How similar are they?
-	 * what percentage of material in dst are from source?
-	 */
-	if (!dst->size)
-		score = 0; /* should not happen */
-	else
-		score = (int)(src_copied * MAX_SCORE / max_size);
-	return score;
+	return count_similarity(r, src, dst, max_size);
 }
 
 static void record_rename_pair(int dst_index, int src_index, int score)
@@ -1377,6 +1394,414 @@ void pool_diff_free_filepair(struct mem_pool *pool,
 	free_filespec_data(p->two);
 }
 
+static int fill_rename_matrix(struct diff_options *options,
+			      struct diff_score *mx,
+			      int minimum_score, int skip_unmodified,
+			      int want_copies,
+			      struct diff_populate_filespec_options *dpf_options,
+			      struct progress *progress)
+{
+	int i, j, dst_cnt;
+
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].p->two;
+		struct diff_score *m;
+
+		if (rename_dst[i].is_rename)
+			continue; /* exact or basename match already handled */
+
+		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		for (j = 0; j < rename_src_nr; j++) {
+			struct diff_filespec *one = rename_src[j].p->one;
+			struct diff_score this_src;
+
+			assert(!one->rename_used || want_copies || break_idx);
+
+			if (skip_unmodified &&
+			    diff_unmodified_pair(rename_src[j].p))
+				continue;
+
+			this_src.score = estimate_similarity(options->repo,
+							     one, two,
+							     minimum_score,
+							     dpf_options);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = i;
+			this_src.src = j;
+			record_if_better(m, &this_src);
+			/*
+			 * Once we run estimate_similarity,
+			 * We do not need the text anymore.
+			 */
+			diff_free_filespec_blob(one);
+			diff_free_filespec_blob(two);
+		}
+		dst_cnt++;
+		display_progress(progress,
+				 (uint64_t)dst_cnt * (uint64_t)rename_src_nr);
+	}
+	return dst_cnt;
+}
+
+/*
+ * Once every filespec involved has its size and span hash ("cnt_data")
+ * computed, each row of the rename matrix depends only on read-only
+ * data, so the rows can be filled in parallel.  Reading blobs and
+ * attributes is not thread-safe, so the main thread loads the blobs,
+ * and the threads only compute the span hashes and fill the rows.  The
+ * result is exactly what fill_rename_matrix() would produce.
+ */
+#define MAX_RENAME_THREADS 32
+
+/*
+ * Starting the threads costs about as much as comparing a thousand
+ * pairs of small files, so smaller matrices are filled serially.
+ */
+#define RENAME_THREAD_MIN_PAIRS 1024
+
+/* how much blob data to keep in memory at once while hashing */
+#define RENAME_HASH_BATCH_SIZE (64 * 1024 * 1024)
+
+static int rename_threads(struct diff_options *options,
+			  int num_destinations, int num_sources)
+{
+	int nr = options->rename_threads;
+
+	if (!HAVE_THREADS ||
+	    st_mult(num_destinations, num_sources) < RENAME_THREAD_MIN_PAIRS)
+		return 1;
+	if (!nr)
+		nr = online_cpus();
+	return nr < MAX_RENAME_THREADS ? nr : MAX_RENAME_THREADS;
+}
+
+struct rename_matrix {
+	struct repository *repo;
+	struct diff_score *mx;
+	int *rows; /* index into rename_dst of each row */
+	int rows_nr;
+	int minimum_score;
+	int skip_unmodified;
+
+	/* span hashes to compute */
+	struct diff_filespec **specs;
+	int specs_nr;
+
+	struct progress *progress;
+	uint64_t progress_nr;
+	pthread_mutex_t progress_mutex;
+};
+
+struct rename_thread {
+	pthread_t pthread;
+	struct rename_matrix *matrix;
+	int nr, nr_threads;
+};
+
+static void *hash_specs_thread(void *data)
+{
+	struct rename_thread *t = data;
+	struct rename_matrix *m = t->matrix;
+
+	for (int i = t->nr; i < m->specs_nr; i += t->nr_threads)
+		m->specs[i]->cnt_data = diffcore_count_prepare(m->repo,
+							       m->specs[i]);
+	return NULL;
+}
+
+/*
+ * The same as estimate_similarity(), but without populating anything.
+ * A filespec without "cnt_data" either could not be read, or is too
+ * different in size from every candidate to be considered at all.
+ */
+static int prepared_similarity(struct repository *r,
+			       struct diff_filespec *src,
+			       struct diff_filespec *dst,
+			       int minimum_score)
+{
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
+		return 0;
+	if (!src->cnt_data || !dst->cnt_data)
+		return 0;
+	if (sizes_too_different(src->size, dst->size, minimum_score))
+		return 0;
+	return count_similarity(r, src, dst,
+				src->size > dst->size ? src->size : dst->size);
+}
+
+static void *fill_rows_thread(void *data)
+{
+	struct rename_thread *t = data;
+	struct rename_matrix *m = t->matrix;
+
+	for (int k = t->nr; k < m->rows_nr; k += t->nr_threads) {
+		struct diff_filespec *two = rename_dst[m->rows[k]].p->two;
+		struct diff_score *row = &m->mx[k * NUM_CANDIDATE_PER_DST];
+
+		for (int j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			row[j].dst = -1;
+
+		for (int j = 0; j < rename_src_nr; j++) {
+			struct diff_filespec *one = rename_src[j].p->one;
+			struct diff_score this_src;
+
+			if (m->skip_unmodified &&
+			    diff_unmodified_pair(rename_src[j].p))
+				continue;
+
+			this_src.score = prepared_similarity(m->repo, one, two,
+							     m->minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = m->rows[k];
+			this_src.src = j;
+			record_if_better(row, &this_src);
+		}
+
+		if (m->progress) {
+			pthread_mutex_lock(&m->progress_mutex);
+			m->progress_nr += rename_src_nr;
+			display_progress(m->progress, m->progress_nr);
+			pthread_mutex_unlock(&m->progress_mutex);
+		}
+	}
+	return NULL;
+}
+
+static void run_rename_threads(struct rename_matrix *m, int nr_threads,
+			       void *(*fn)(void *))
+{
+	struct rename_thread *threads;
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++) {
+		int err;
+
+		threads[i].matrix = m;
+		threads[i].nr = i;
+		threads[i].nr_threads = nr_threads;
+		err = pthread_create(&threads[i].pthread, NULL, fn, &threads[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (int i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die(_("unable to join thread"));
+	free(threads);
+}
+
+static int ulong_cmp(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static int ptr_cmp(const void *a_, const void *b_)
+{
+	uintptr_t a = (uintptr_t)*(void * const *)a_;
+	uintptr_t b = (uintptr_t)*(void * const *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Is there a size among the sorted `sizes` for which the size check in
+ * estimate_similarity() would pass?  The sizes that pass form a range
+ * around `size`, so it is enough to look at the closest one on either
+ * side.
+ */
+static int has_size_candidate(unsigned long size,
+			      const unsigned long *sizes, size_t nr,
+			      int minimum_score)
+{
+	size_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		if (sizes[mi] < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	if (lo < nr && !sizes_too_different(size, sizes[lo], minimum_score))
+		return 1;
+	if (lo && !sizes_too_different(size, sizes[lo - 1], minimum_score))
+		return 1;
+	return 0;
+}
+
+/*
+ * Populate the sizes of `specs`, dropping those that are not regular
+ * files or cannot be read, and collect their sorted sizes.
+ */
+static void prepare_sizes(struct repository *r,
+			  struct diff_filespec **specs, size_t *nr,
+			  unsigned long *sizes,
+			  struct diff_populate_filespec_options *dpf_options)
+{
+	size_t kept = 0;
+
+	dpf_options->check_size_only = 1;
+	for (size_t i = 0; i < *nr; i++) {
+		struct diff_filespec *spec = specs[i];
+
+		if (!S_ISREG(spec->mode))
+			continue;
+		if (!spec->cnt_data && diff_populate_filespec(r, spec, dpf_options))
+			continue;
+		specs[kept] = spec;
+		sizes[kept++] = spec->size;
+	}
+	*nr = kept;
+	QSORT(sizes, kept, ulong_cmp);
+}
+
+/*
+ * Compute the span hashes of all `m->specs` in batches, so that we do
+ * not hold all the blobs in memory at the same time.
+ */
+static void hash_specs(struct rename_matrix *m, int nr_threads,
+		       struct diff_populate_filespec_options *dpf_options)
+{
+	struct diff_filespec **all = m->specs;
+	int all_nr = m->specs_nr;
+	int i = 0;
+
+	dpf_options->check_size_only = 0;
+	while (i < all_nr) {
+		size_t batch_size = 0;
+
+		m->specs = all + i;
+		m->specs_nr = 0;
+		for (; i < all_nr && batch_size < RENAME_HASH_BATCH_SIZE; i++) {
+			struct diff_filespec *spec = all[i];
+
+			if (diff_populate_filespec(m->repo, spec, dpf_options))
+				continue;
+			/* this may look at attributes; do it here */
+			diff_filespec_is_binary(m->repo, spec);
+			batch_size += spec->size;
+			m->specs[m->specs_nr++] = spec;
+		}
+
+		run_rename_threads(m, nr_threads, hash_specs_thread);
+
+		for (int j = 0; j < m->specs_nr; j++)
+			diff_free_filespec_blob(m->specs[j]);
+	}
+	m->specs = all;
+}
+
+/*
+ * Fill the rename matrix like fill_rename_matrix() does, but using
+ * `nr_threads` threads.  Returns -1 without having done anything if
+ * the serial code has to be used instead.
+ */
+static int fill_rename_matrix_threaded(struct diff_options *options,
+				       struct diff_score *mx,
+				       int minimum_score, int skip_unmodified,
+				       struct diff_populate_filespec_options *dpf_options,
+				       struct progress *progress,
+				       int nr_threads, int *dst_cnt)
+{
+	struct rename_matrix m = {
+		.repo = options->repo,
+		.mx = mx,
+		.minimum_score = minimum_score,
+		.skip_unmodified = skip_unmodified,
+		.progress = progress,
+	};
+	struct diff_filespec **srcs, **dsts;
+	unsigned long *src_sizes, *dst_sizes;
+	size_t srcs_nr = 0, dsts_nr = 0;
+
+	ALLOC_ARRAY(m.rows, rename_dst_nr);
+	ALLOC_ARRAY(dsts, rename_dst_nr);
+	ALLOC_ARRAY(srcs, rename_src_nr);
+	for (int i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].is_rename)
+			continue; /* exact or basename match already handled */
+		m.rows[m.rows_nr++] = i;
+		dsts[dsts_nr++] = rename_dst[i].p->two;
+	}
+	for (int j = 0; j < rename_src_nr; j++) {
+		if (skip_unmodified && diff_unmodified_pair(rename_src[j].p))
+			continue;
+		srcs[srcs_nr++] = rename_src[j].p->one;
+	}
+
+	/*
+	 * Files from the working tree may change size when they are
+	 * converted while being read, which makes the result of the
+	 * serial code depend on the order in which it looks at them.
+	 * Leave those cases to it.
+	 */
+	for (size_t i = 0; i < srcs_nr; i++)
+		if (!srcs[i]->oid_valid)
+			goto serial;
+	for (size_t i = 0; i < dsts_nr; i++)
+		if (!dsts[i]->oid_valid)
+			goto serial;
+
+	ALLOC_ARRAY(src_sizes, srcs_nr);
+	ALLOC_ARRAY(dst_sizes, dsts_nr);
+	prepare_sizes(m.repo, srcs, &srcs_nr, src_sizes, dpf_options);
+	prepare_sizes(m.repo, dsts, &dsts_nr, dst_sizes, dpf_options);
+
+	/*
+	 * Only hash files that have at least one candidate of a
+	 * similar enough size, like estimate_similarity() would.
+	 */
+	ALLOC_ARRAY(m.specs, st_add(srcs_nr, dsts_nr));
+	for (size_t i = 0; i < srcs_nr; i++)
+		if (!srcs[i]->cnt_data &&
+		    has_size_candidate(srcs[i]->size, dst_sizes, dsts_nr,
+				       minimum_score))
+			m.specs[m.specs_nr++] = srcs[i];
+	for (size_t i = 0; i < dsts_nr; i++)
+		if (!dsts[i]->cnt_data &&
+		    has_size_candidate(dsts[i]->size, src_sizes, srcs_nr,
+				       minimum_score))
+			m.specs[m.specs_nr++] = dsts[i];
+	free(src_sizes);
+	free(dst_sizes);
+
+	/* the same filespec must not be hashed by two threads */
+	QSORT(m.specs, m.specs_nr, ptr_cmp);
+	if (m.specs_nr) {
+		int nr = 1;
+		for (int i = 1; i < m.specs_nr; i++)
+			if (m.specs[i] != m.specs[nr - 1])
+				m.specs[nr++] = m.specs[i];
+		m.specs_nr = nr;
+	}
+
+	hash_specs(&m, nr_threads, dpf_options);
+
+	if (progress)
+		pthread_mutex_init(&m.progress_mutex, NULL);
+	run_rename_threads(&m, nr_threads, fill_rows_thread);
+	if (progress)
+		pthread_mutex_destroy(&m.progress_mutex);
+
+	*dst_cnt = m.rows_nr;
+	free(m.specs);
+	free(m.rows);
+	free(srcs);
+	free(dsts);
+	return 0;
+
+serial:
+	free(m.rows);
+	free(srcs);
+	free(dsts);
+	return -1;
+}
+
 void diffcore_rename_extended(struct diff_options *options,
 			      struct mem_pool *pool,
 			      struct strintmap *relevant_sources,
@@ -1389,8 +1814,8 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq = DIFF_QUEUE_INIT;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_destinations, dst_cnt;
+	int i, rename_count, skip_unmodified = 0;
+	int num_destinations, dst_cnt, nr_threads;
 	int num_sources, want_copies;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
@@ -1580,46 +2005,14 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
-	}
+	nr_threads = rename_threads(options, num_destinations, num_sources);
+	if (nr_threads < 2 ||
+	    fill_rename_matrix_threaded(options, mx, minimum_score,
+					skip_unmodified, &dpf_options,
+					progress, nr_threads, &dst_cnt) < 0)
+		dst_cnt = fill_rename_matrix(options, mx, minimum_score,
+					     skip_unmodified, want_copies,
+					     &dpf_options, progress);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
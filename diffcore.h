@@ -225,6 +225,14 @@ int diffcore_count_changes(struct repository *r,
 			   unsigned long *src_copied,
 			   unsigned long *literal_added);
 
+/*
+ * Compute what diffcore_count_changes() would store in `*src_count_p`
+ * or `*dst_count_p` for `one`, so that it can be filled in ahead of
+ * time. The data of `one` must be populated, and its `is_binary`
+ * already determined if this is to be called from multiple threads.
+ */
+void *diffcore_count_prepare(struct repository *r, struct diff_filespec *one);
+
 /*
  * If filespec contains an OID and if that object is missing from the given
  * repository, add that OID to to_fetch.
@@ -22,6 +22,38 @@
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
 
+/*
+ * The loops over uncompressed words below are kept free of branches, so
+ * that the compiler can vectorize them.
+ */
+static inline void words_or(eword_t *dst,
+			    const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		dst[i] |= src[i];
+}
+
+static inline void words_and_not(eword_t *dst,
+				 const eword_t *src, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		dst[i] &= ~src[i];
+}
+
+static size_t words_popcount(const eword_t *words, size_t nr)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < nr; i++)
+		count += ewah_bit_popcount64(words[i]);
+
+	return count;
+}
+
 struct bitmap *bitmap_word_alloc(size_t word_alloc)
 {
 	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
@@ -102,19 +134,28 @@ struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
 
 struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
 {
-	struct bitmap *bitmap = bitmap_new();
-	struct ewah_iterator it;
-	eword_t blowup;
+	struct bitmap *bitmap;
+	struct ewah_run_iterator it;
 	size_t i = 0;
 
-	ewah_iterator_init(&it, ewah);
-
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
+	/* Size the result up front by looking at the marker words only. */
+	ewah_run_iterator_init(&it, ewah);
+	while (ewah_run_iterator_next(&it))
+		i += it.run_len + it.literal_len;
+
+	bitmap = bitmap_word_alloc(i);
+
+	i = 0;
+	ewah_run_iterator_init(&it, ewah);
+	while (ewah_run_iterator_next(&it)) {
+		if (it.run_bit)
+			memset(bitmap->words + i, 0xff,
+			       st_mult(it.run_len, sizeof(eword_t)));
+		i += it.run_len;
+		COPY_ARRAY(bitmap->words + i, it.literals, it.literal_len);
+		i += it.literal_len;
 	}
 
-	bitmap->word_alloc = i;
 	return bitmap;
 }
 
@@ -123,60 +164,53 @@ void bitmap_and_not(struct bitmap *self, struct bitmap *other)
 	const size_t count = (self->word_alloc < other->word_alloc) ?
 		self->word_alloc : other->word_alloc;
 
-	size_t i;
-
-	for (i = 0; i < count; ++i)
-		self->words[i] &= ~other->words[i];
+	words_and_not(self->words, other->words, count);
 }
 
 void bitmap_or(struct bitmap *self, const struct bitmap *other)
 {
-	size_t i;
-
 	bitmap_grow(self, other->word_alloc);
-	for (i = 0; i < other->word_alloc; i++)
-		self->words[i] |= other->words[i];
+	words_or(self->words, other->words, other->word_alloc);
 }
 
 int ewah_bitmap_is_subset(struct ewah_bitmap *self, struct bitmap *other)
 {
-	struct ewah_iterator it;
-	eword_t word;
-	size_t i;
-
-	ewah_iterator_init(&it, self);
-
-	for (i = 0; i < other->word_alloc; i++) {
-		if (!ewah_iterator_next(&word, &it)) {
-			/*
-			 * If we reached the end of `self`, and haven't
-			 * rejected `self` as a possible subset of
-			 * `other` yet, then we are done and `self` is
-			 * indeed a subset of `other`.
-			 */
-			return 1;
+	struct ewah_run_iterator it;
+	size_t i = 0, j;
+
+	ewah_run_iterator_init(&it, self);
+
+	while (ewah_run_iterator_next(&it)) {
+		/*
+		 * A run of zero words is trivially a subset of anything,
+		 * but a run of ones needs every word of `other` in that
+		 * range to be full, and in particular needs `other` to
+		 * be long enough.
+		 */
+		if (it.run_bit && it.run_len) {
+			if (i >= other->word_alloc ||
+			    it.run_len > other->word_alloc - i)
+				return 0;
+			for (j = 0; j < it.run_len; j++)
+				if (~other->words[i + j])
+					return 0;
 		}
-		if (word & ~other->words[i]) {
-			/*
-			 * Otherwise, compare the next two pairs of
-			 * words. If the word from `self` has bit(s) not
-			 * in the word from `other`, `self` is not a
-			 * subset of `other`.
-			 */
-			return 0;
+		i += it.run_len;
+
+		/*
+		 * If a literal word from `self` has bit(s) not in the
+		 * corresponding word from `other` (or there is no such
+		 * word), `self` is not a subset of `other`.
+		 */
+		for (j = 0; j < it.literal_len; j++, i++) {
+			eword_t word = it.literals[j];
+			if (i < other->word_alloc)
+				word &= ~other->words[i];
+			if (word)
+				return 0;
 		}
 	}
 
-	/*
-	 * If we got to this point, there may be zero or more words
-	 * remaining in `self`, with no remaining words left in `other`.
-	 * If there are any bits set in the remaining word(s) in `self`,
-	 * then `self` is not a subset of `other`.
-	 */
-	while (ewah_iterator_next(&word, &it))
-		if (word)
-			return 0;
-
 	/* `self` is definitely a subset of `other` */
 	return 1;
 }
@@ -186,8 +220,7 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
 	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
+	struct ewah_run_iterator it;
 
 	if (self->word_alloc < other_final) {
 		self->word_alloc = other_final;
@@ -196,32 +229,43 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 			(self->word_alloc - original_size) * sizeof(eword_t));
 	}
 
-	ewah_iterator_init(&it, other);
+	ewah_run_iterator_init(&it, other);
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	while (ewah_run_iterator_next(&it)) {
+		size_t end = st_add3(i, it.run_len, it.literal_len);
+
+		/* the marker words may describe more than bit_size */
+		if (end > self->word_alloc)
+			bitmap_grow(self, end);
+
+		/* a run of zeroes leaves `self` as it is */
+		if (it.run_bit)
+			memset(self->words + i, 0xff,
+			       st_mult(it.run_len, sizeof(eword_t)));
+		i += it.run_len;
+
+		words_or(self->words + i, it.literals, it.literal_len);
+		i += it.literal_len;
+	}
 }
 
 size_t bitmap_popcount(struct bitmap *self)
 {
-	size_t i, count = 0;
-
-	for (i = 0; i < self->word_alloc; ++i)
-		count += ewah_bit_popcount64(self->words[i]);
-
-	return count;
+	return words_popcount(self->words, self->word_alloc);
 }
 
 size_t ewah_bitmap_popcount(struct ewah_bitmap *self)
 {
-	struct ewah_iterator it;
-	eword_t word;
+	struct ewah_run_iterator it;
 	size_t count = 0;
 
-	ewah_iterator_init(&it, self);
+	ewah_run_iterator_init(&it, self);
 
-	while (ewah_iterator_next(&word, &it))
-		count += ewah_bit_popcount64(word);
+	while (ewah_run_iterator_next(&it)) {
+		if (it.run_bit)
+			count += it.run_len * BITS_IN_EWORD;
+		count += words_popcount(it.literals, it.literal_len);
+	}
 
 	return count;
 }
@@ -371,6 +371,38 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
 		read_new_rlw(it);
 }
 
+void ewah_run_iterator_init(struct ewah_run_iterator *it,
+			    struct ewah_bitmap *parent)
+{
+	memset(it, 0, sizeof(*it));
+	it->buffer = parent->buffer;
+	it->buffer_size = parent->buffer_size;
+}
+
+int ewah_run_iterator_next(struct ewah_run_iterator *it)
+{
+	const eword_t *word;
+	size_t available;
+
+	if (it->pointer >= it->buffer_size)
+		return 0;
+
+	word = &it->buffer[it->pointer++];
+	available = it->buffer_size - it->pointer;
+
+	it->run_len = rlw_get_running_len(word);
+	it->run_bit = rlw_get_run_bit(word);
+	it->literals = it->buffer + it->pointer;
+	it->literal_len = rlw_get_literal_words(word);
+
+	/* do not trust a truncated bitmap to hold all of its literals */
+	if (it->literal_len > available)
+		it->literal_len = available;
+	it->pointer += it->literal_len;
+
+	return 1;
+}
+
 void ewah_or_iterator_init(struct ewah_or_iterator *it,
 			   struct ewah_bitmap **parents, size_t nr)
 {
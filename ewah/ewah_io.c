@@ -135,3 +135,368 @@ ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len)
 
 	return ptr - (const uint8_t *)map;
 }
+
+/*
+ * Roaring-style serialization: the bitmap is cut into containers of
+ * 2^16 bits (1024 words), and each non-empty container is stored in
+ * whichever of the following encodings is smallest:
+ *
+ *   - an array of the 16-bit offsets of its set bits,
+ *   - the raw 1024 words of the container,
+ *   - a list of (start, length - 1) pairs of 16-bit values, one per
+ *     run of set bits.
+ */
+#define ROARING_CONTAINER_WORDS 1024
+#define ROARING_CONTAINER_BITS (ROARING_CONTAINER_WORDS * BITS_IN_EWORD)
+#define ROARING_HEADER_SIZE 5
+#define ROARING_ARRAY_MAX 4096
+
+enum roaring_container_type {
+	ROARING_ARRAY = 0,
+	ROARING_BITMAP = 1,
+	ROARING_RUN = 2,
+};
+
+struct roaring_writer {
+	struct strbuf headers;
+	struct strbuf payload;
+	uint32_t nr;
+
+	eword_t chunk[ROARING_CONTAINER_WORDS];
+	size_t key;
+};
+
+static void strbuf_add_be16(struct strbuf *sb, uint16_t v)
+{
+	v = htons(v);
+	strbuf_add(sb, &v, sizeof(v));
+}
+
+/*
+ * Return the position of the first bit at or after `pos` in `chunk`
+ * whose value is `bit`, or ROARING_CONTAINER_BITS if there is none.
+ */
+static size_t roaring_next_bit(const eword_t *chunk, size_t pos, int bit)
+{
+	while (pos < ROARING_CONTAINER_BITS) {
+		eword_t word = chunk[pos / BITS_IN_EWORD];
+		if (!bit)
+			word = ~word;
+		word >>= pos % BITS_IN_EWORD;
+		if (word)
+			return pos + ewah_bit_ctz64(word);
+		pos += BITS_IN_EWORD - pos % BITS_IN_EWORD;
+	}
+	return ROARING_CONTAINER_BITS;
+}
+
+static void roaring_flush(struct roaring_writer *rw)
+{
+	size_t card = 0, runs = 0, i;
+	eword_t carry = 0;
+	enum roaring_container_type type;
+	size_t size;
+
+	for (i = 0; i < ROARING_CONTAINER_WORDS; i++) {
+		eword_t word = rw->chunk[i];
+		card += ewah_bit_popcount64(word);
+		runs += ewah_bit_popcount64(word & ~((word << 1) | carry));
+		carry = word >> (BITS_IN_EWORD - 1);
+	}
+	if (!card)
+		return;
+
+	if (card <= ROARING_ARRAY_MAX) {
+		type = ROARING_ARRAY;
+		size = card * 2;
+	} else {
+		type = ROARING_BITMAP;
+		size = ROARING_CONTAINER_WORDS * sizeof(eword_t);
+	}
+	if (runs * 4 < size)
+		type = ROARING_RUN;
+
+	strbuf_add_be16(&rw->headers, rw->key);
+	strbuf_addch(&rw->headers, type);
+
+	switch (type) {
+	case ROARING_ARRAY:
+		strbuf_add_be16(&rw->headers, card - 1);
+		for (i = 0; i < ROARING_CONTAINER_WORDS; i++) {
+			eword_t word = rw->chunk[i];
+			while (word) {
+				strbuf_add_be16(&rw->payload,
+						i * BITS_IN_EWORD + ewah_bit_ctz64(word));
+				word &= word - 1;
+			}
+		}
+		break;
+	case ROARING_BITMAP:
+		strbuf_add_be16(&rw->headers, card - 1);
+		for (i = 0; i < ROARING_CONTAINER_WORDS; i++) {
+			uint64_t word = htonll(rw->chunk[i]);
+			strbuf_add(&rw->payload, &word, sizeof(word));
+		}
+		break;
+	case ROARING_RUN: {
+		size_t start = roaring_next_bit(rw->chunk, 0, 1);
+
+		strbuf_add_be16(&rw->headers, runs - 1);
+		while (start < ROARING_CONTAINER_BITS) {
+			size_t end = roaring_next_bit(rw->chunk, start, 0);
+			strbuf_add_be16(&rw->payload, start);
+			strbuf_add_be16(&rw->payload, end - start - 1);
+			start = roaring_next_bit(rw->chunk, end, 1);
+		}
+		break;
+	}
+	}
+
+	rw->nr++;
+	memset(rw->chunk, 0, sizeof(rw->chunk));
+}
+
+/*
+ * Store `len` words starting at word position `pos`, taking them from
+ * `words`, or using all-ones words if `words` is NULL.
+ */
+static void roaring_add_words(struct roaring_writer *rw, size_t pos,
+			      const eword_t *words, size_t len)
+{
+	while (len) {
+		size_t off = pos % ROARING_CONTAINER_WORDS;
+		size_t n = ROARING_CONTAINER_WORDS - off;
+
+		if (pos / ROARING_CONTAINER_WORDS != rw->key) {
+			roaring_flush(rw);
+			rw->key = pos / ROARING_CONTAINER_WORDS;
+		}
+
+		if (n > len)
+			n = len;
+		if (words) {
+			memcpy(rw->chunk + off, words, n * sizeof(eword_t));
+			words += n;
+		} else {
+			memset(rw->chunk + off, 0xff, n * sizeof(eword_t));
+		}
+		pos += n;
+		len -= n;
+	}
+}
+
+int ewah_serialize_roaring_to(struct ewah_bitmap *self,
+			      int (*write_fun)(void *, const void *, size_t),
+			      void *data)
+{
+	struct roaring_writer *rw;
+	struct ewah_run_iterator it;
+	size_t pos = 0;
+	uint32_t header[2];
+	int ret = -1;
+
+	CALLOC_ARRAY(rw, 1);
+	strbuf_init(&rw->headers, 0);
+	strbuf_init(&rw->payload, 0);
+
+	ewah_run_iterator_init(&it, self);
+	while (ewah_run_iterator_next(&it)) {
+		if (it.run_len && it.run_bit)
+			roaring_add_words(rw, pos, NULL, it.run_len);
+		pos += it.run_len;
+		roaring_add_words(rw, pos, it.literals, it.literal_len);
+		pos += it.literal_len;
+	}
+	roaring_flush(rw);
+
+	/* 32 bit -- bit size for the map, and number of containers */
+	header[0] = htonl((uint32_t)self->bit_size);
+	header[1] = htonl(rw->nr);
+
+	if (write_fun(data, header, sizeof(header)) != sizeof(header) ||
+	    write_fun(data, rw->headers.buf, rw->headers.len) != rw->headers.len ||
+	    write_fun(data, rw->payload.buf, rw->payload.len) != rw->payload.len)
+		goto out;
+
+	ret = sizeof(header) + rw->headers.len + rw->payload.len;
+
+out:
+	strbuf_release(&rw->headers);
+	strbuf_release(&rw->payload);
+	free(rw);
+	return ret;
+}
+
+int ewah_serialize_roaring_strbuf(struct ewah_bitmap *self, struct strbuf *sb)
+{
+	return ewah_serialize_roaring_to(self, write_strbuf, sb);
+}
+
+/*
+ * Roaring bitmaps are decoded straight into the EWAH representation,
+ * one set bit or run at a time, so that loading a bitmap costs time in
+ * proportion to its serialized size rather than to the number of words
+ * it covers, like ewah_read_mmap().
+ */
+struct roaring_reader {
+	struct ewah_bitmap *self;
+	/* words in the whole bitmap, and the number added so far */
+	size_t words, next_word;
+	/* a word whose bits are still being collected */
+	size_t pending_pos;
+	eword_t pending;
+	int has_pending;
+};
+
+static int roaring_emit(struct roaring_reader *rr, size_t pos, eword_t word)
+{
+	if (pos < rr->next_word || pos >= rr->words)
+		return error("corrupt roaring bitmap: bits out of order or past end of bitmap");
+	ewah_add_empty_words(rr->self, 0, pos - rr->next_word);
+	ewah_add(rr->self, word);
+	rr->next_word = pos + 1;
+	return 0;
+}
+
+static int roaring_flush_pending(struct roaring_reader *rr)
+{
+	if (!rr->has_pending)
+		return 0;
+	rr->has_pending = 0;
+	return roaring_emit(rr, rr->pending_pos, rr->pending);
+}
+
+static int roaring_or_word(struct roaring_reader *rr, size_t pos, eword_t word)
+{
+	if (rr->has_pending && rr->pending_pos == pos) {
+		rr->pending |= word;
+		return 0;
+	}
+	if (roaring_flush_pending(rr))
+		return -1;
+	rr->pending_pos = pos;
+	rr->pending = word;
+	rr->has_pending = 1;
+	return 0;
+}
+
+static int roaring_set_range(struct roaring_reader *rr, size_t start, size_t end)
+{
+	while (start < end) {
+		size_t pos = start / BITS_IN_EWORD;
+		size_t bit = start % BITS_IN_EWORD;
+		size_t n = BITS_IN_EWORD - bit;
+		eword_t mask;
+
+		if (!bit && end - start >= BITS_IN_EWORD) {
+			n = (end - start) / BITS_IN_EWORD;
+			if (roaring_flush_pending(rr))
+				return -1;
+			if (pos < rr->next_word || n > rr->words - pos)
+				return error("corrupt roaring bitmap: bits out of order or past end of bitmap");
+			ewah_add_empty_words(rr->self, 0, pos - rr->next_word);
+			ewah_add_empty_words(rr->self, 1, n);
+			rr->next_word = pos + n;
+			start += n * BITS_IN_EWORD;
+			continue;
+		}
+
+		if (n > end - start)
+			n = end - start;
+		mask = (((eword_t)1 << n) - 1) << bit;
+		if (roaring_or_word(rr, pos, mask))
+			return -1;
+		start += n;
+	}
+	return 0;
+}
+
+ssize_t ewah_read_roaring_mmap(struct ewah_bitmap *self, const void *map,
+			       size_t len)
+{
+	const uint8_t *ptr = map;
+	const uint8_t *headers;
+	struct roaring_reader rr = { .self = self };
+	size_t bit_size;
+	uint32_t nr, i;
+
+	if (len < 2 * sizeof(uint32_t))
+		return error("corrupt roaring bitmap: eof before header");
+	bit_size = get_be32(ptr);
+	nr = get_be32(ptr + 4);
+	ptr += 2 * sizeof(uint32_t);
+	len -= 2 * sizeof(uint32_t);
+
+	if (len / ROARING_HEADER_SIZE < nr)
+		return error("corrupt roaring bitmap: eof in container headers");
+	headers = ptr;
+	ptr += (size_t)nr * ROARING_HEADER_SIZE;
+	len -= (size_t)nr * ROARING_HEADER_SIZE;
+
+	rr.words = DIV_ROUND_UP(bit_size, BITS_IN_EWORD);
+
+	for (i = 0; i < nr; i++) {
+		const uint8_t *h = headers + (size_t)i * ROARING_HEADER_SIZE;
+		size_t base = (size_t)get_be16(h) * ROARING_CONTAINER_WORDS;
+		size_t n = (size_t)get_be16(h + 3) + 1;
+		size_t j;
+
+		if (base < rr.next_word || base >= rr.words)
+			return error("corrupt roaring bitmap: container %"PRIu32" out of order",
+				     i);
+
+		switch (h[2]) {
+		case ROARING_ARRAY:
+			if (len / 2 < n)
+				goto eof;
+			for (j = 0; j < n; j++) {
+				uint16_t bit = get_be16(ptr + 2 * j);
+				if (roaring_or_word(&rr, base + bit / BITS_IN_EWORD,
+						    (eword_t)1 << (bit % BITS_IN_EWORD)))
+					return -1;
+			}
+			n *= 2;
+			break;
+		case ROARING_BITMAP:
+			n = ROARING_CONTAINER_WORDS * sizeof(eword_t);
+			if (len < n)
+				goto eof;
+			for (j = 0; j < ROARING_CONTAINER_WORDS; j++) {
+				eword_t word = get_be64(ptr + j * sizeof(eword_t));
+				if (word && roaring_or_word(&rr, base + j, word))
+					return -1;
+			}
+			break;
+		case ROARING_RUN:
+			if (len / 4 < n)
+				goto eof;
+			for (j = 0; j < n; j++) {
+				size_t start = get_be16(ptr + 4 * j);
+				size_t run = (size_t)get_be16(ptr + 4 * j + 2) + 1;
+				if (start + run > ROARING_CONTAINER_BITS)
+					return error("corrupt roaring bitmap: run past end of container");
+				start += base * BITS_IN_EWORD;
+				if (roaring_set_range(&rr, start, start + run))
+					return -1;
+			}
+			n *= 4;
+			break;
+		default:
+			return error("corrupt roaring bitmap: unknown container type %d",
+				     h[2]);
+		}
+		ptr += n;
+		len -= n;
+
+		if (roaring_flush_pending(&rr))
+			return -1;
+	}
+
+	ewah_add_empty_words(self, 0, rr.words - rr.next_word);
+	self->bit_size = bit_size;
+
+	return ptr - (const uint8_t *)map;
+
+eof:
+	return error("corrupt roaring bitmap: eof in container %"PRIu32, i);
+}
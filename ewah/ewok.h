@@ -24,11 +24,15 @@ typedef uint64_t eword_t;
 #define BITS_IN_EWORD (sizeof(eword_t) * 8)
 
 /**
- * Do not use __builtin_popcountll. The GCC implementation
- * is notoriously slow on all platforms.
+ * Do not use __builtin_popcountll unless the target is known to have a
+ * population count instruction. Otherwise, the GCC implementation is
+ * notoriously slow on all platforms.
  *
  * See: http://gcc.gnu.org/bugzilla/show_bug.cgi?id=36041
  */
+#if defined(__GNUC__) && (defined(__POPCNT__) || defined(__aarch64__))
+#define ewah_bit_popcount64(x) ((uint32_t)__builtin_popcountll(x))
+#else
 static inline uint32_t ewah_bit_popcount64(uint64_t x)
 {
 	x = (x & 0x5555555555555555ULL) + ((x >>  1) & 0x5555555555555555ULL);
@@ -36,6 +40,7 @@ static inline uint32_t ewah_bit_popcount64(uint64_t x)
 	x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >>  4) & 0x0F0F0F0F0F0F0F0FULL);
 	return (x * 0x0101010101010101ULL) >> 56;
 }
+#endif
 
 /* __builtin_ctzll was not available until 3.4.0 */
 #if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3  && __GNUC_MINOR > 3))
@@ -84,6 +89,22 @@ int ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *);
 
 ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len);
 
+/**
+ * Serialize and load bitmaps in a roaring-style layout, where the bits
+ * are split into containers of 2^16 bits and every non-empty container
+ * is stored as an array of set bits, as raw words, or as a list of
+ * runs, whichever is smallest. This compresses sparse and clustered
+ * bitmaps much better than EWAH does. The bitmap is still loaded into
+ * an EWAH bitmap in memory; `self` must be empty when loading.
+ */
+int ewah_serialize_roaring_to(struct ewah_bitmap *self,
+			      int (*write_fun)(void *out, const void *buf, size_t len),
+			      void *out);
+int ewah_serialize_roaring_strbuf(struct ewah_bitmap *self, struct strbuf *);
+
+ssize_t ewah_read_roaring_mmap(struct ewah_bitmap *self, const void *map,
+			       size_t len);
+
 uint32_t ewah_checksum(struct ewah_bitmap *self);
 
 /**
@@ -148,6 +169,33 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
  */
 int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
 
+/**
+ * Walk the bitmap one marker word at a time. Each step yields a run of
+ * `run_len` words that are all zeroes or all ones (depending on
+ * `run_bit`), followed by `literal_len` words stored verbatim at
+ * `literals`; either may be empty.
+ *
+ * Operations that can handle a whole run at once, or loop over the
+ * literal words directly, are much faster this way than by expanding
+ * every word with ewah_iterator_next().
+ *
+ * Return: true if a step was yielded, false if there are no words left
+ */
+struct ewah_run_iterator {
+	const eword_t *buffer;
+	size_t buffer_size;
+	size_t pointer;
+
+	size_t run_len;
+	int run_bit;
+	const eword_t *literals;
+	size_t literal_len;
+};
+
+void ewah_run_iterator_init(struct ewah_run_iterator *it,
+			    struct ewah_bitmap *parent);
+int ewah_run_iterator_next(struct ewah_run_iterator *it);
+
 struct ewah_or_iterator {
 	struct ewah_iterator *its;
 	size_t nr;
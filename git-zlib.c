@@ -4,6 +4,11 @@
  */
 #include "git-compat-util.h"
 #include "git-zlib.h"
+#include "thread-utils.h"
+
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 static const char *zerr_to_string(int status)
 {
@@ -153,6 +158,89 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+#ifdef HAVE_LIBDEFLATE
+/*
+ * Setting up a decompressor costs about as much as inflating a small
+ * object, so each thread keeps its own around for all of its calls.
+ */
+static int inflate_buffer_initialized;
+#ifdef NO_PTHREADS
+static struct libdeflate_decompressor *inflate_buffer_decompressor;
+
+void git_inflate_buffer_init(void)
+{
+	inflate_buffer_initialized = 1;
+}
+
+static struct libdeflate_decompressor *get_decompressor(void)
+{
+	if (!inflate_buffer_decompressor)
+		inflate_buffer_decompressor = libdeflate_alloc_decompressor();
+	return inflate_buffer_decompressor;
+}
+#else
+static pthread_key_t inflate_buffer_key;
+
+static void free_decompressor(void *d)
+{
+	libdeflate_free_decompressor(d);
+}
+
+void git_inflate_buffer_init(void)
+{
+	if (inflate_buffer_initialized)
+		return;
+	pthread_key_create(&inflate_buffer_key, free_decompressor);
+	inflate_buffer_initialized = 1;
+}
+
+static struct libdeflate_decompressor *get_decompressor(void)
+{
+	struct libdeflate_decompressor *d;
+
+	d = pthread_getspecific(inflate_buffer_key);
+	if (!d) {
+		d = libdeflate_alloc_decompressor();
+		if (d)
+			pthread_setspecific(inflate_buffer_key, d);
+	}
+	return d;
+}
+#endif
+
+int git_inflate_buffer(const void *in, size_t in_len,
+		       void *out, size_t out_len, size_t *in_used)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result res;
+
+	if (!inflate_buffer_initialized)
+		BUG("git_inflate_buffer_init() was not called");
+	d = get_decompressor();
+	if (!d)
+		return -1;
+	/*
+	 * Passing a non-NULL in_used allows trailing data after the
+	 * stream, and a NULL actual_out_nbytes_ret insists on exactly
+	 * out_len bytes of output.
+	 */
+	res = libdeflate_zlib_decompress_ex(d, in, in_len, out, out_len,
+					    in_used, NULL);
+	return res == LIBDEFLATE_SUCCESS ? 0 : -1;
+}
+#else
+void git_inflate_buffer_init(void)
+{
+}
+
+int git_inflate_buffer(const void *in UNUSED, size_t in_len UNUSED,
+		       void *out UNUSED, size_t out_len UNUSED,
+		       size_t *in_used UNUSED)
+{
+	return -1;
+}
+#endif
+
 unsigned long git_deflate_bound(git_zstream *strm, unsigned long size)
 {
 	return deflateBound(&strm->z, size);
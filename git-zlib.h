@@ -18,6 +18,34 @@ void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
 int git_inflate(git_zstream *, int flush);
 
+/*
+ * Inflate a complete zlib stream from "in" into "out" in a single call,
+ * for callers that know the exact size of the result up front. "in" may
+ * extend past the end of the stream; the number of bytes the stream took
+ * up is stored in "in_used".
+ *
+ * Returns 0 if exactly "out_len" bytes were inflated. Returns -1 if the
+ * stream is corrupt, does not fit "out_len" exactly, is truncated in
+ * "in", or if Git was built without a backend for this, in which case
+ * HAVE_INFLATE_BUFFER is 0 (see USE_LIBDEFLATE in the Makefile). No
+ * error is reported either way; callers are expected to fall back to
+ * git_inflate(), which produces the same result and proper diagnostics.
+ *
+ * git_inflate_buffer() may be called from several threads at once, but
+ * git_inflate_buffer_init() must have been called first, in a way that
+ * does not race with other callers (e.g. under the object read lock).
+ * It is cheap to call it again.
+ */
+void git_inflate_buffer_init(void);
+int git_inflate_buffer(const void *in, size_t in_len,
+		       void *out, size_t out_len, size_t *in_used);
+
+#ifdef HAVE_LIBDEFLATE
+#define HAVE_INFLATE_BUFFER 1
+#else
+#define HAVE_INFLATE_BUFFER 0
+#endif
+
 void git_deflate_init(git_zstream *, int level);
 void git_deflate_init_gzip(git_zstream *, int level);
 void git_deflate_init_raw(git_zstream *, int level);
@@ -18,6 +18,8 @@
 #include "setup.h"
 #include "strvec.h"
 #include "bloom.h"
+#include "strmap.h"
+#include "trace2.h"
 #include "tree-walk.h"
 
 static void range_set_grow(struct range_set *rs, size_t extra)
@@ -1153,13 +1155,37 @@ int line_log_print(struct rev_info *rev, struct commit *commit)
 	return 1;
 }
 
+static int bloom_count_queries;
+static int bloom_count_no;
+
+/*
+ * The keys for a path and its leading directories, which we compute
+ * once for every path we follow, including the ones we find by
+ * following renames.
+ */
+static struct bloom_keyvec *get_bloom_keys(struct rev_info *rev,
+					   const char *path)
+{
+	struct bloom_keyvec *keys;
+
+	if (!rev->line_log_bloom_keys) {
+		CALLOC_ARRAY(rev->line_log_bloom_keys, 1);
+		strmap_init(rev->line_log_bloom_keys);
+	}
+	keys = strmap_get(rev->line_log_bloom_keys, path);
+	if (!keys) {
+		keys = bloom_keyvec_new(path, strlen(path),
+					rev->bloom_filter_settings);
+		strmap_put(rev->line_log_bloom_keys, path, keys);
+	}
+	return keys;
+}
+
 static int bloom_filter_check(struct rev_info *rev,
 			      struct commit *commit,
 			      struct line_log_data *range)
 {
 	struct bloom_filter *filter;
-	struct bloom_key key;
-	int result = 0;
 
 	if (!commit->parents)
 		return 1;
@@ -1168,21 +1194,15 @@ static int bloom_filter_check(struct rev_info *rev,
 	    !(filter = get_bloom_filter(rev->repo, commit)))
 		return 1;
 
-	if (!range)
-		return 0;
-
-	while (!result && range) {
-		bloom_key_fill(&key, range->path, strlen(range->path),
-			       rev->bloom_filter_settings);
-
-		if (bloom_filter_contains(filter, &key, rev->bloom_filter_settings))
-			result = 1;
-
-		bloom_key_clear(&key);
-		range = range->next;
-	}
+	bloom_count_queries++;
+	for (; range; range = range->next)
+		if (bloom_filter_contains_vec(filter,
+					      get_bloom_keys(rev, range->path),
+					      rev->bloom_filter_settings))
+			return 1;
 
-	return result;
+	bloom_count_no++;
+	return 0;
 }
 
 static int process_ranges_ordinary_commit(struct rev_info *rev, struct commit *commit,
@@ -1280,9 +1300,19 @@ int line_log_process_ranges_arbitrary_commit(struct rev_info *rev, struct commit
 
 	if (range) {
 		if (commit->parents && !bloom_filter_check(rev, commit, range)) {
-			struct line_log_data *prange = line_log_data_copy(range);
-			add_line_range(rev, commit->parents->item, prange);
+			struct commit *parent = commit->parents->item;
+
+			add_line_range(rev, parent, range);
 			clear_commit_line_range(rev, commit);
+			/*
+			 * The filter is for the diff against the first
+			 * parent, so like in process_ranges_merge_commit()
+			 * it takes all the blame for a merge.
+			 */
+			if (commit->parents->next) {
+				free_commit_list(commit->parents);
+				commit_list_append(parent, &commit->parents);
+			}
 		} else if (!commit->parents || !commit->parents->next)
 			changed = process_ranges_ordinary_commit(rev, commit, range);
 		else
@@ -1347,4 +1377,18 @@ static void free_void_line_log_data(void *data)
 void line_log_free(struct rev_info *rev)
 {
 	clear_decoration(&rev->line_log_data, free_void_line_log_data);
+	if (rev->line_log_bloom_keys) {
+		struct hashmap_iter iter;
+		struct strmap_entry *e;
+
+		strmap_for_each_entry(rev->line_log_bloom_keys, &iter, e)
+			bloom_keyvec_free(e->value);
+		strmap_clear(rev->line_log_bloom_keys, 0);
+		FREE_AND_NULL(rev->line_log_bloom_keys);
+
+		trace2_data_intmax("line-log", rev->repo,
+				   "bloom/queries", bloom_count_queries);
+		trace2_data_intmax("line-log", rev->repo,
+				   "bloom/response-no", bloom_count_no);
+	}
 }
@@ -48,6 +48,7 @@
 #include "revision.h"
 #include "sparse-index.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 #include "unpack-trees.h"
@@ -78,6 +79,43 @@ struct traversal_callback_data {
 	struct name_entry names[3];
 };
 
+/*
+ * A top-level directory that collect_merge_info() leaves for a worker
+ * thread to recurse into, together with what is needed to do so as
+ * collect_merge_info_callback() would have.
+ */
+struct collect_subtree {
+	struct name_entry names[3];
+	int p; /* index of the entry naming the directory in names */
+	unsigned long dirmask;
+	unsigned side1_matches_mbase:1,
+		 side2_matches_mbase:1,
+		 sides_match:1;
+	unsigned dir_rename_mask;
+	const char *dir_name;
+
+	/*
+	 * Where the pairs found under this directory belong in the
+	 * pairs[] of the main thread, and where they ended up in the
+	 * pairs[] of the thread that collected them.
+	 */
+	struct collect_thread *thread;
+	int pairs_pos[3];
+	int pairs_begin[3];
+	int pairs_end[3];
+};
+
+struct collect_subtrees {
+	struct collect_subtree *items;
+	size_t nr, alloc;
+
+	/* handed out to the worker threads in order */
+	size_t next;
+	int failed;
+	pthread_mutex_t mutex;
+	struct traverse_info *info;
+};
+
 struct deferred_traversal_data {
 	/*
 	 * possible_trivial_merges: directories to be explored only when needed
@@ -408,6 +446,15 @@ struct merge_options_internal {
 	/* call_depth: recursion level counter for merging merge bases */
 	int call_depth;
 
+	/*
+	 * subtrees: top-level directories left for worker threads
+	 *
+	 * Only set while collect_merge_info() walks the top-level trees
+	 * with more than one thread; collect_merge_info_callback() then
+	 * queues directories here instead of recursing into them.
+	 */
+	struct collect_subtrees *subtrees;
+
 	/* field that holds submodule conflict information */
 	struct string_list conflicted_submodules;
 };
@@ -1242,6 +1289,100 @@ static void collect_rename_info(struct merge_options *opt,
 	}
 }
 
+static void queue_subtree(struct merge_options *opt,
+			  struct name_entry *names,
+			  struct name_entry *p,
+			  unsigned long dirmask,
+			  unsigned side1_matches_mbase,
+			  unsigned side2_matches_mbase,
+			  unsigned sides_match,
+			  const char *dir_name)
+{
+	struct collect_subtrees *subtrees = opt->priv->subtrees;
+	struct rename_info *renames = &opt->priv->renames;
+	struct collect_subtree *st;
+	int side;
+
+	ALLOC_GROW(subtrees->items, subtrees->nr + 1, subtrees->alloc);
+	st = &subtrees->items[subtrees->nr++];
+	memset(st, 0, sizeof(*st));
+	COPY_ARRAY(st->names, names, 3);
+	st->p = p - names;
+	st->dirmask = dirmask;
+	st->side1_matches_mbase = side1_matches_mbase;
+	st->side2_matches_mbase = side2_matches_mbase;
+	st->sides_match = sides_match;
+	st->dir_rename_mask = renames->dir_rename_mask;
+	st->dir_name = dir_name;
+	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++)
+		st->pairs_pos[side] = renames->pairs[side].nr;
+}
+
+static int collect_subtree_info(struct merge_options *opt,
+				struct traverse_info *info,
+				struct name_entry *names,
+				struct name_entry *p,
+				unsigned long dirmask,
+				unsigned side1_matches_mbase,
+				unsigned side2_matches_mbase,
+				unsigned sides_match,
+				const char *dir_name)
+{
+	struct merge_options_internal *opti = opt->priv;
+	struct rename_info *renames = &opti->renames;
+	struct traverse_info newinfo;
+	struct tree_desc t[3];
+	void *buf[3] = {NULL, NULL, NULL};
+	const char *original_dir_name;
+	int i, ret;
+
+	newinfo = *info;
+	newinfo.prev = info;
+	newinfo.name = p->path;
+	newinfo.namelen = p->pathlen;
+	newinfo.pathlen = st_add3(newinfo.pathlen, p->pathlen, 1);
+	/*
+	 * If this directory we are about to recurse into cared about
+	 * its parent directory (the current directory) having a D/F
+	 * conflict, then we'd propagate the masks in this way:
+	 *    newinfo.df_conflicts |= (mask & ~dirmask);
+	 * But we don't worry about propagating D/F conflicts.  (See
+	 * comment near setting of local df_conflict variable near
+	 * the beginning of collect_merge_info_callback()).
+	 */
+
+	for (i = MERGE_BASE; i <= MERGE_SIDE2; i++) {
+		if (i == 1 && side1_matches_mbase)
+			t[1] = t[0];
+		else if (i == 2 && side2_matches_mbase)
+			t[2] = t[0];
+		else if (i == 2 && sides_match)
+			t[2] = t[1];
+		else {
+			const struct object_id *oid = NULL;
+			if (dirmask & 1)
+				oid = &names[i].oid;
+			buf[i] = fill_tree_descriptor(opt->repo,
+						      t + i, oid);
+		}
+		dirmask >>= 1;
+	}
+
+	original_dir_name = opti->current_dir_name;
+	opti->current_dir_name = dir_name;
+	if (renames->dir_rename_mask == 0 ||
+	    renames->dir_rename_mask == 0x07)
+		ret = traverse_trees(NULL, 3, t, &newinfo);
+	else
+		ret = traverse_trees_wrapper(NULL, 3, t, &newinfo);
+	opti->current_dir_name = original_dir_name;
+
+	for (i = MERGE_BASE; i <= MERGE_SIDE2; i++)
+		free(buf[i]);
+
+	return ret;
+}
+
 static int collect_merge_info_callback(int n,
 				       unsigned long mask,
 				       unsigned long dirmask,
@@ -1410,11 +1551,7 @@ static int collect_merge_info_callback(int n,
 
 	/* If dirmask, recurse into subdirectories */
 	if (dirmask) {
-		struct traverse_info newinfo;
-		struct tree_desc t[3];
-		void *buf[3] = {NULL, NULL, NULL};
-		const char *original_dir_name;
-		int i, ret, side;
+		int ret, side;
 
 		/*
 		 * Check for whether we can avoid recursing due to one side
@@ -1445,51 +1582,23 @@ static int collect_merge_info_callback(int n,
 
 		/* We need to recurse */
 		ci->match_mask &= filemask;
-		newinfo = *info;
-		newinfo.prev = info;
-		newinfo.name = p->path;
-		newinfo.namelen = p->pathlen;
-		newinfo.pathlen = st_add3(newinfo.pathlen, p->pathlen, 1);
+
 		/*
-		 * If this directory we are about to recurse into cared about
-		 * its parent directory (the current directory) having a D/F
-		 * conflict, then we'd propagate the masks in this way:
-		 *    newinfo.df_conflicts |= (mask & ~dirmask);
-		 * But we don't worry about propagating D/F conflicts.  (See
-		 * comment near setting of local df_conflict variable near
-		 * the beginning of this function).
+		 * When walking the top-level tree in parallel, leave the
+		 * subtree for a worker thread; see collect_merge_info().
 		 */
-
-		for (i = MERGE_BASE; i <= MERGE_SIDE2; i++) {
-			if (i == 1 && side1_matches_mbase)
-				t[1] = t[0];
-			else if (i == 2 && side2_matches_mbase)
-				t[2] = t[0];
-			else if (i == 2 && sides_match)
-				t[2] = t[1];
-			else {
-				const struct object_id *oid = NULL;
-				if (dirmask & 1)
-					oid = &names[i].oid;
-				buf[i] = fill_tree_descriptor(opt->repo,
-							      t + i, oid);
-			}
-			dirmask >>= 1;
+		if (opti->subtrees) {
+			queue_subtree(opt, names, p, dirmask, side1_matches_mbase,
+				      side2_matches_mbase, sides_match, pi.string);
+			renames->dir_rename_mask = prev_dir_rename_mask;
+			return mask;
 		}
 
-		original_dir_name = opti->current_dir_name;
-		opti->current_dir_name = pi.string;
-		if (renames->dir_rename_mask == 0 ||
-		    renames->dir_rename_mask == 0x07)
-			ret = traverse_trees(NULL, 3, t, &newinfo);
-		else
-			ret = traverse_trees_wrapper(NULL, 3, t, &newinfo);
-		opti->current_dir_name = original_dir_name;
+		ret = collect_subtree_info(opt, info, names, p, dirmask,
+					   side1_matches_mbase,
+					   side2_matches_mbase,
+					   sides_match, pi.string);
 		renames->dir_rename_mask = prev_dir_rename_mask;
-
-		for (i = MERGE_BASE; i <= MERGE_SIDE2; i++)
-			free(buf[i]);
-
 		if (ret < 0)
 			return -1;
 	}
@@ -1522,6 +1631,8 @@ static int handle_deferred_entries(struct merge_options *opt,
 	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++) {
 		unsigned optimization_okay = 1;
 		struct strintmap copy;
+		struct string_list deferred = STRING_LIST_INIT_NODUP;
+		struct string_list_item *item;
 
 		/* Loop over the set of paths we need to know rename info for */
 		strintmap_for_each_entry(&renames->relevant_sources[side],
@@ -1585,9 +1696,18 @@ static int handle_deferred_entries(struct merge_options *opt,
 					    0,
 					    &opt->priv->pool,
 					    0);
-		strintmap_for_each_entry(&copy, &iter, entry) {
-			const char *path = entry->key;
-			unsigned dir_rename_mask = (intptr_t)entry->value;
+		/*
+		 * Visit the directories in sorted order, so that the order
+		 * of the pairs found under them does not depend on the
+		 * order in which they were added to the map (which differs
+		 * when collect_merge_info() uses several threads).
+		 */
+		strintmap_for_each_entry(&copy, &iter, entry)
+			string_list_append(&deferred, entry->key)->util = entry->value;
+		string_list_sort(&deferred);
+		for_each_string_list_item(item, &deferred) {
+			const char *path = item->string;
+			unsigned dir_rename_mask = (intptr_t)item->util;
 			struct conflict_info *ci;
 			unsigned dirmask;
 			struct tree_desc t[3];
@@ -1637,9 +1757,13 @@ static int handle_deferred_entries(struct merge_options *opt,
 			for (i = MERGE_BASE; i <= MERGE_SIDE2; i++)
 				free(buf[i]);
 
-			if (ret < 0)
+			if (ret < 0) {
+				string_list_clear(&deferred, 0);
+				strintmap_clear(&copy);
 				return ret;
+			}
 		}
+		string_list_clear(&deferred, 0);
 		strintmap_clear(&copy);
 		strintmap_for_each_entry(&renames->deferred[side].possible_trivial_merges,
 					 &iter, entry) {
@@ -1683,14 +1807,247 @@ static int handle_deferred_entries(struct merge_options *opt,
 	return ret;
 }
 
+struct collect_thread {
+	pthread_t thread;
+	struct collect_subtrees *subtrees;
+
+	/*
+	 * A copy of the merge options whose priv shares everything that
+	 * collect_merge_info_callback() only reads with the main thread,
+	 * but has its own copy of everything that it writes.
+	 */
+	struct merge_options opt;
+	struct merge_options_internal priv;
+	int depth;
+};
+
+static void init_collect_thread(struct collect_thread *ct,
+				struct merge_options *opt,
+				struct collect_subtrees *subtrees)
+{
+	struct rename_info *renames = &ct->priv.renames;
+	int side;
+
+	ct->subtrees = subtrees;
+	ct->opt = *opt;
+	ct->opt.priv = &ct->priv;
+	ct->priv = *opt->priv;
+	ct->priv.subtrees = NULL;
+
+	mem_pool_init(&ct->priv.pool, 0);
+	strmap_init_with_options(&ct->priv.paths, NULL, 0);
+	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++) {
+		diff_queue_init(&renames->pairs[side]);
+		strintmap_init_with_options(&renames->dirs_removed[side],
+					    NOT_RELEVANT, NULL, 0);
+		strintmap_init_with_options(&renames->relevant_sources[side],
+					    -1, NULL, 0);
+		strintmap_init_with_options(&renames->deferred[side].possible_trivial_merges,
+					    0, NULL, 0);
+	}
+	renames->callback_data = NULL;
+	renames->callback_data_nr = renames->callback_data_alloc = 0;
+	renames->callback_data_traverse_path = NULL;
+}
+
+static void *collect_subtrees_thread(void *data)
+{
+	struct collect_thread *ct = data;
+	struct collect_subtrees *subtrees = ct->subtrees;
+	struct rename_info *renames = &ct->priv.renames;
+	struct traverse_info info = *subtrees->info;
+
+	/*
+	 * We are one level below the top-level traverse_trees() call,
+	 * which has already returned; count the depth of our own
+	 * traversals from there.
+	 */
+	ct->depth = 1;
+	info.depth = &ct->depth;
+	info.data = &ct->opt;
+
+	for (;;) {
+		struct collect_subtree *st = NULL;
+		int side, ret;
+
+		pthread_mutex_lock(&subtrees->mutex);
+		if (!subtrees->failed && subtrees->next < subtrees->nr)
+			st = &subtrees->items[subtrees->next++];
+		pthread_mutex_unlock(&subtrees->mutex);
+		if (!st)
+			break;
+
+		st->thread = ct;
+		for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++)
+			st->pairs_begin[side] = renames->pairs[side].nr;
+		renames->dir_rename_mask = st->dir_rename_mask;
+		ret = collect_subtree_info(&ct->opt, &info, st->names,
+					   st->names + st->p, st->dirmask,
+					   st->side1_matches_mbase,
+					   st->side2_matches_mbase,
+					   st->sides_match, st->dir_name);
+		for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++)
+			st->pairs_end[side] = renames->pairs[side].nr;
+
+		if (ret < 0) {
+			pthread_mutex_lock(&subtrees->mutex);
+			subtrees->failed = 1;
+			pthread_mutex_unlock(&subtrees->mutex);
+		}
+	}
+	return NULL;
+}
+
+static void merge_strintmap(struct strintmap *dst, struct strintmap *src)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *entry;
+
+	strintmap_for_each_entry(src, &iter, entry)
+		strintmap_set(dst, entry->key, (intptr_t)entry->value);
+	strintmap_clear(src);
+}
+
+/*
+ * Splice the pairs found by the worker threads into the pairs of the main
+ * thread, in the order in which a serial traversal would have found them.
+ */
+static void merge_collected_pairs(struct rename_info *renames,
+				  struct collect_subtrees *subtrees,
+				  int side)
+{
+	struct diff_queue_struct *main_pairs = &renames->pairs[side];
+	struct diff_queue_struct pairs = DIFF_QUEUE_INIT;
+	int pos = 0;
+
+	for (size_t i = 0; i < subtrees->nr; i++) {
+		struct collect_subtree *st = &subtrees->items[i];
+		struct diff_queue_struct *q = &st->thread->priv.renames.pairs[side];
+
+		for (; pos < st->pairs_pos[side]; pos++)
+			diff_q(&pairs, main_pairs->queue[pos]);
+		for (int j = st->pairs_begin[side]; j < st->pairs_end[side]; j++)
+			diff_q(&pairs, q->queue[j]);
+	}
+	for (; pos < main_pairs->nr; pos++)
+		diff_q(&pairs, main_pairs->queue[pos]);
+
+	free(main_pairs->queue);
+	*main_pairs = pairs;
+}
+
+static void merge_collect_thread(struct merge_options *opt,
+				 struct collect_thread *ct)
+{
+	struct rename_info *renames = &opt->priv->renames;
+	struct rename_info *thread_renames = &ct->priv.renames;
+	struct hashmap_iter iter;
+	struct strmap_entry *entry;
+	int side;
+
+	strmap_for_each_entry(&ct->priv.paths, &iter, entry)
+		strmap_put(&opt->priv->paths, entry->key, entry->value);
+	strmap_clear(&ct->priv.paths, 0);
+
+	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++) {
+		merge_strintmap(&renames->dirs_removed[side],
+				&thread_renames->dirs_removed[side]);
+		merge_strintmap(&renames->relevant_sources[side],
+				&thread_renames->relevant_sources[side]);
+		merge_strintmap(&renames->deferred[side].possible_trivial_merges,
+				&thread_renames->deferred[side].possible_trivial_merges);
+	}
+	free(thread_renames->callback_data);
+
+	/* Paths and filepairs were allocated from the pool of the thread */
+	mem_pool_combine(&opt->priv->pool, &ct->priv.pool);
+	mem_pool_discard(&ct->priv.pool, 0);
+}
+
+/*
+ * Recurse into the top-level directories queued by the main thread, using
+ * up to nr_threads threads. Each thread collects into its own maps and
+ * memory pool, which are folded into those of the main thread afterwards.
+ * Directories under different top-level directories never touch the same
+ * entries, except that a subdirectory may upgrade the dirs_removed
+ * relevance of its top-level directory, which we apply after the value
+ * recorded by the main thread just as a serial traversal would.
+ */
+static int collect_subtrees(struct merge_options *opt,
+			    struct collect_subtrees *subtrees,
+			    int nr_threads)
+{
+	struct collect_thread *threads;
+	int i, side, ret = 0;
+
+	if (!subtrees->nr)
+		return 0;
+	if (nr_threads > subtrees->nr)
+		nr_threads = subtrees->nr;
+	trace2_data_intmax("merge", opt->repo, "collect_threads", nr_threads);
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		init_collect_thread(&threads[i], opt, subtrees);
+
+	if (nr_threads == 1) {
+		collect_subtrees_thread(&threads[0]);
+	} else {
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i].thread, NULL,
+					   collect_subtrees_thread, &threads[i]))
+				die(_("unable to create thread"));
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i].thread, NULL);
+		disable_obj_read_lock();
+	}
+
+	if (subtrees->failed) {
+		ret = -1;
+	} else {
+		for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++)
+			merge_collected_pairs(&opt->priv->renames, subtrees,
+					      side);
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		merge_collect_thread(opt, &threads[i]);
+		for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++)
+			free(threads[i].priv.renames.pairs[side].queue);
+	}
+	free(threads);
+	return ret;
+}
+
+static int collect_merge_info_threads(struct merge_options *opt)
+{
+	struct rename_info *renames = &opt->priv->renames;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	/*
+	 * add_pair() may remove entries from cached_irrelevant, which the
+	 * worker threads share; leave merges that reuse cached renames
+	 * from a previous merge to a single thread.
+	 */
+	if (strset_get_size(&renames->cached_irrelevant[MERGE_SIDE1]) ||
+	    strset_get_size(&renames->cached_irrelevant[MERGE_SIDE2]))
+		return 1;
+
+	return opt->threads ? opt->threads : online_cpus();
+}
+
 static int collect_merge_info(struct merge_options *opt,
 			      struct tree *merge_base,
 			      struct tree *side1,
 			      struct tree *side2)
 {
-	int ret;
+	int ret, nr_threads;
 	struct tree_desc t[3];
 	struct traverse_info info;
+	struct collect_subtrees subtrees = { 0 };
 
 	opt->priv->toplevel_dir = "";
 	opt->priv->current_dir_name = opt->priv->toplevel_dir;
@@ -1708,8 +2065,27 @@ static int collect_merge_info(struct merge_options *opt,
 	init_tree_desc(t + 1, &side1->object.oid, side1->buffer, side1->size);
 	init_tree_desc(t + 2, &side2->object.oid, side2->buffer, side2->size);
 
+	/*
+	 * With more than one thread, walk only the top-level trees here,
+	 * and leave the directories that need recursing into to worker
+	 * threads.
+	 */
+	nr_threads = collect_merge_info_threads(opt);
+	if (nr_threads > 1) {
+		subtrees.info = &info;
+		pthread_mutex_init(&subtrees.mutex, NULL);
+		opt->priv->subtrees = &subtrees;
+	}
+
 	trace2_region_enter("merge", "traverse_trees", opt->repo);
 	ret = traverse_trees(NULL, 3, t, &info);
+	if (opt->priv->subtrees) {
+		opt->priv->subtrees = NULL;
+		if (ret == 0)
+			ret = collect_subtrees(opt, &subtrees, nr_threads);
+		pthread_mutex_destroy(&subtrees.mutex);
+		free(subtrees.items);
+	}
 	if (ret == 0)
 		ret = handle_deferred_entries(opt, &info);
 	trace2_region_leave("merge", "traverse_trees", opt->repo);
@@ -5383,6 +5759,10 @@ static void merge_recursive_config(struct merge_options *opt, int ui)
 	repo_config_get_int(the_repository, "diff.renamelimit", &opt->rename_limit);
 	repo_config_get_int(the_repository, "merge.renamelimit", &opt->rename_limit);
 	repo_config_get_bool(the_repository, "merge.renormalize", &renormalize);
+	repo_config_get_int(the_repository, "merge.threads", &opt->threads);
+	if (opt->threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    opt->threads, "merge.threads");
 	opt->renormalize = renormalize;
 	if (!repo_config_get_string(the_repository, "diff.renames", &value)) {
 		opt->detect_renames = git_config_rename("diff.renames", value);
@@ -11,6 +11,7 @@
 
 #include "git-compat-util.h"
 #include "bulk-checkin.h"
+#include "config.h"
 #include "convert.h"
 #include "dir.h"
 #include "environment.h"
@@ -21,6 +22,7 @@
 #include "object-file-convert.h"
 #include "object-file.h"
 #include "odb.h"
+#include "oidset.h"
 #include "oidtree.h"
 #include "pack.h"
 #include "packfile.h"
@@ -28,6 +30,8 @@
 #include "read-cache-ll.h"
 #include "setup.h"
 #include "streaming.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 /* The maximum size for an object header. */
 #define MAX_HEADER_LEN 32
@@ -297,14 +301,52 @@ enum unpack_loose_header_result unpack_loose_header(git_zstream *stream,
 	return ULHR_TOO_LONG;
 }
 
+/*
+ * Inflate the whole object again from the start of "map" in a single
+ * call, since the stream cannot be picked up where the header left off.
+ * The header is already known to be "hdr_len" bytes long.
+ */
+static void *unpack_loose_whole(const void *map, unsigned long mapsize,
+				size_t hdr_len, unsigned long size)
+{
+	unsigned char *buf = xmallocz(st_add(hdr_len, size));
+	size_t used;
+	int ret;
+
+	git_inflate_buffer_init();
+	obj_read_unlock();
+	ret = git_inflate_buffer(map, mapsize, buf, hdr_len + size, &used);
+	obj_read_lock();
+	if (ret || used != mapsize) {
+		free(buf);
+		return NULL;
+	}
+	memmove(buf, buf + hdr_len, size);
+	buf[size] = '\0';
+	return buf;
+}
+
 static void *unpack_loose_rest(git_zstream *stream,
+			       const void *map, unsigned long mapsize,
 			       void *buffer, unsigned long size,
 			       const struct object_id *oid)
 {
 	size_t bytes = strlen(buffer) + 1, n;
-	unsigned char *buf = xmallocz(size);
+	unsigned char *buf;
 	int status = Z_OK;
 
+	/*
+	 * Corrupt objects and garbage at the end are left to the streaming
+	 * code below, which knows how to complain about them.
+	 */
+	if (HAVE_INFLATE_BUFFER) {
+		buf = unpack_loose_whole(map, mapsize, bytes, size);
+		if (buf)
+			return buf;
+	}
+
+	buf = xmallocz(size);
+
 	n = stream->total_out - bytes;
 	if (n > size)
 		n = size;
@@ -469,7 +511,8 @@ int loose_object_info(struct repository *r,
 
 		if (!oi->contentp)
 			break;
-		*oi->contentp = unpack_loose_rest(&stream, hdr, *oi->sizep, oid);
+		*oi->contentp = unpack_loose_rest(&stream, map, mapsize,
+						  hdr, *oi->sizep, oid);
 		if (*oi->contentp)
 			goto cleanup;
 
@@ -838,25 +881,21 @@ static int end_loose_object_common(struct odb_source *source,
 	return Z_OK;
 }
 
-static int write_loose_object(struct odb_source *source,
-			      const struct object_id *oid, char *hdr,
-			      int hdrlen, const void *buf, unsigned long len,
-			      time_t mtime, unsigned flags)
+static int write_loose_object_to(struct odb_source *source,
+				 const struct object_id *oid, char *hdr,
+				 int hdrlen, const void *buf, unsigned long len,
+				 time_t mtime, unsigned flags,
+				 struct strbuf *tmp_file, struct strbuf *filename)
 {
 	int fd, ret;
 	unsigned char compressed[4096];
 	git_zstream stream;
 	struct git_hash_ctx c;
 	struct object_id parano_oid;
-	static struct strbuf tmp_file = STRBUF_INIT;
-	static struct strbuf filename = STRBUF_INIT;
 
-	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
-		prepare_loose_object_bulk_checkin();
+	odb_loose_path(source, filename, oid);
 
-	odb_loose_path(source, &filename, oid);
-
-	fd = start_loose_object_common(source, &tmp_file, filename.buf, flags,
+	fd = start_loose_object_common(source, tmp_file, filename->buf, flags,
 				       &stream, compressed, sizeof(compressed),
 				       &c, NULL, hdr, hdrlen);
 	if (fd < 0)
@@ -883,21 +922,242 @@ static int write_loose_object(struct odb_source *source,
 		die(_("confused by unstable object source data for %s"),
 		    oid_to_hex(oid));
 
-	close_loose_object(source, fd, tmp_file.buf);
+	close_loose_object(source, fd, tmp_file->buf);
 
 	if (mtime) {
 		struct utimbuf utb;
 		utb.actime = mtime;
 		utb.modtime = mtime;
-		if (utime(tmp_file.buf, &utb) < 0 &&
+		if (utime(tmp_file->buf, &utb) < 0 &&
 		    !(flags & WRITE_OBJECT_SILENT))
-			warning_errno(_("failed utime() on %s"), tmp_file.buf);
+			warning_errno(_("failed utime() on %s"), tmp_file->buf);
 	}
 
-	return finalize_object_file_flags(source->odb->repo, tmp_file.buf, filename.buf,
+	return finalize_object_file_flags(source->odb->repo, tmp_file->buf, filename->buf,
 					  FOF_SKIP_COLLISION_CHECK);
 }
 
+static int write_loose_object(struct odb_source *source,
+			      const struct object_id *oid, char *hdr,
+			      int hdrlen, const void *buf, unsigned long len,
+			      time_t mtime, unsigned flags)
+{
+	static struct strbuf tmp_file = STRBUF_INIT;
+	static struct strbuf filename = STRBUF_INIT;
+
+	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+		prepare_loose_object_bulk_checkin();
+
+	return write_loose_object_to(source, oid, hdr, hdrlen, buf, len,
+				     mtime, flags, &tmp_file, &filename);
+}
+
+/*
+ * While an object database transaction is open, loose objects may be
+ * handed to a pool of threads that compress, write, sync and rename
+ * them, so that the caller can go on hashing the next object. The
+ * caller only waits when the queue holds too much data, when it reads
+ * an object that is still queued, and when the transaction is flushed.
+ */
+#define LOOSE_WRITE_QUEUE_MAX (32 * 1024 * 1024)
+
+struct loose_write_job {
+	struct odb_source *source;
+	struct object_id oid;
+	char hdr[MAX_HEADER_LEN];
+	int hdrlen;
+	void *buf;
+	unsigned long len;
+	unsigned flags;
+	struct loose_write_job *next;
+};
+
+static struct loose_writer {
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	struct loose_write_job *head, **tail;
+	struct oidset pending;
+	size_t queued_bytes;
+	int errors;
+	unsigned shutdown : 1;
+} loose_writer;
+
+static void *loose_writer_thread(void *data UNUSED)
+{
+	struct loose_writer *w = &loose_writer;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
+
+	trace2_thread_start("loose-writer");
+
+	pthread_mutex_lock(&w->mutex);
+	while (1) {
+		struct loose_write_job *job;
+		int ret;
+
+		while (!w->head && !w->shutdown)
+			pthread_cond_wait(&w->work, &w->mutex);
+		job = w->head;
+		if (!job)
+			break;
+		w->head = job->next;
+		if (!w->head)
+			w->tail = &w->head;
+		pthread_mutex_unlock(&w->mutex);
+
+		ret = write_loose_object_to(job->source, &job->oid, job->hdr,
+					    job->hdrlen, job->buf, job->len, 0,
+					    job->flags, &tmp_file, &filename);
+
+		pthread_mutex_lock(&w->mutex);
+		if (ret)
+			w->errors++;
+		oidset_remove(&w->pending, &job->oid);
+		w->queued_bytes -= job->len;
+		pthread_cond_broadcast(&w->done);
+		free(job->buf);
+		free(job);
+	}
+	pthread_mutex_unlock(&w->mutex);
+
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	trace2_thread_exit();
+	return NULL;
+}
+
+static int loose_writer_threads(struct repository *r)
+{
+	static int nr_threads = -1;
+
+	if (nr_threads < 0) {
+		if (repo_config_get_int(r, "core.looseobjectwritethreads",
+					&nr_threads))
+			nr_threads = 1;
+		if (!nr_threads)
+			nr_threads = online_cpus();
+		if (!HAVE_THREADS || nr_threads < 1)
+			nr_threads = 1;
+	}
+	return nr_threads;
+}
+
+static void start_loose_writer(struct repository *r, int nr_threads)
+{
+	struct loose_writer *w = &loose_writer;
+
+	/* initialize lazily computed settings the threads rely on */
+	repo_settings_get_shared_repository(r);
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->work, NULL);
+	pthread_cond_init(&w->done, NULL);
+	oidset_init(&w->pending, 0);
+	w->head = NULL;
+	w->tail = &w->head;
+	w->queued_bytes = 0;
+	w->errors = 0;
+	w->shutdown = 0;
+
+	CALLOC_ARRAY(w->threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++)
+		if (pthread_create(&w->threads[i], NULL,
+				   loose_writer_thread, NULL))
+			die(_("unable to create thread"));
+	w->nr_threads = nr_threads;
+	trace2_data_intmax("object-file", r, "loose-writer/threads",
+			   nr_threads);
+}
+
+int loose_object_write_pending(const struct object_id *oid)
+{
+	struct loose_writer *w = &loose_writer;
+	int ret;
+
+	if (!w->threads)
+		return 0;
+	pthread_mutex_lock(&w->mutex);
+	ret = oidset_contains(&w->pending, oid);
+	pthread_mutex_unlock(&w->mutex);
+	return ret;
+}
+
+void finish_loose_object_writes(void)
+{
+	struct loose_writer *w = &loose_writer;
+	int errors;
+
+	if (!w->threads)
+		return;
+
+	pthread_mutex_lock(&w->mutex);
+	w->shutdown = 1;
+	pthread_cond_broadcast(&w->work);
+	pthread_mutex_unlock(&w->mutex);
+	for (int i = 0; i < w->nr_threads; i++)
+		pthread_join(w->threads[i], NULL);
+
+	errors = w->errors;
+	FREE_AND_NULL(w->threads);
+	w->nr_threads = 0;
+	oidset_clear(&w->pending);
+	pthread_cond_destroy(&w->work);
+	pthread_cond_destroy(&w->done);
+	pthread_mutex_destroy(&w->mutex);
+
+	if (errors)
+		die(_("unable to write %d loose objects"), errors);
+}
+
+/*
+ * Queue a loose object for writing by the thread pool if that is what
+ * we want to do. Returns 0 if the object was queued.
+ */
+static int queue_loose_object(struct odb_source *source,
+			      const struct object_id *oid, char *hdr,
+			      int hdrlen, const void *buf, unsigned long len,
+			      unsigned flags)
+{
+	struct repository *r = source->odb->repo;
+	struct loose_writer *w = &loose_writer;
+	struct loose_write_job *job;
+	int nr_threads;
+
+	if (!odb_transaction_pending() || r->compat_hash_algo)
+		return -1;
+	nr_threads = loose_writer_threads(r);
+	if (nr_threads < 2)
+		return -1;
+
+	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+		prepare_loose_object_bulk_checkin();
+	if (!w->threads)
+		start_loose_writer(r, nr_threads);
+
+	CALLOC_ARRAY(job, 1);
+	job->source = source;
+	oidcpy(&job->oid, oid);
+	memcpy(job->hdr, hdr, hdrlen);
+	job->hdrlen = hdrlen;
+	job->buf = xmemdupz(buf, len);
+	job->len = len;
+	job->flags = flags;
+
+	pthread_mutex_lock(&w->mutex);
+	while (w->queued_bytes && w->queued_bytes + len > LOOSE_WRITE_QUEUE_MAX)
+		pthread_cond_wait(&w->done, &w->mutex);
+	w->queued_bytes += len;
+	oidset_insert(&w->pending, oid);
+	*w->tail = job;
+	w->tail = &job->next;
+	pthread_cond_signal(&w->work);
+	pthread_mutex_unlock(&w->mutex);
+	return 0;
+}
+
 static int freshen_loose_object(struct object_database *odb,
 				const struct object_id *oid)
 {
@@ -1067,9 +1327,12 @@ int write_object_file(struct odb_source *source,
 	 * it out into .git/objects/??/?{38} file.
 	 */
 	write_object_file_prepare(algo, buf, len, type, oid, hdr, &hdrlen);
-	if (freshen_packed_object(source->odb, oid) ||
+	if (loose_object_write_pending(oid) ||
+	    freshen_packed_object(source->odb, oid) ||
 	    freshen_loose_object(source->odb, oid))
 		return 0;
+	if (!queue_loose_object(source, oid, hdr, hdrlen, buf, len, flags))
+		return 0;
 	if (write_loose_object(source, oid, hdr, hdrlen, buf, len, 0, flags))
 		return -1;
 	if (compat)
@@ -1077,6 +1340,42 @@ int write_object_file(struct odb_source *source,
 	return 0;
 }
 
+int write_object_file_threaded(struct odb_source *source,
+			       const void *buf, unsigned long len,
+			       enum object_type type, struct object_id *oid,
+			       unsigned flags)
+{
+	const struct git_hash_algo *algo = source->odb->repo->hash_algo;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
+	char hdr[MAX_HEADER_LEN];
+	int hdrlen = sizeof(hdr);
+	int exists, ret;
+
+	if (source->odb->repo->compat_hash_algo)
+		BUG("threaded object writes do not support a compatibility hash");
+
+	write_object_file_prepare(algo, buf, len, type, oid, hdr, &hdrlen);
+
+	obj_read_lock();
+	exists = loose_object_write_pending(oid) ||
+		 freshen_packed_object(source->odb, oid) ||
+		 freshen_loose_object(source->odb, oid);
+	obj_read_unlock();
+	if (exists)
+		return 0;
+
+	/*
+	 * Another thread may be writing the same object right now, but
+	 * finalize_object_file() copes with finding it already in place.
+	 */
+	ret = write_loose_object_to(source, oid, hdr, hdrlen, buf, len, 0,
+				    flags, &tmp_file, &filename);
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
+}
+
 int force_object_loose(struct odb_source *source,
 		       const struct object_id *oid, time_t mtime)
 {
@@ -1580,7 +1879,8 @@ int read_loose_object(struct repository *repo,
 				     repo->hash_algo) < 0)
 			goto out_inflate;
 	} else {
-		*contents = unpack_loose_rest(&stream, hdr, *size, expected_oid);
+		*contents = unpack_loose_rest(&stream, map, mapsize,
+					      hdr, *size, expected_oid);
 		if (!*contents) {
 			error(_("unable to unpack contents of %s"), path);
 			goto out_inflate;
@@ -151,6 +151,29 @@ int write_object_file(struct odb_source *source,
 		      enum object_type type, struct object_id *oid,
 		      struct object_id *compat_oid_in, unsigned flags);
 
+/*
+ * Like write_object_file(), but may be called from several threads at
+ * once while the object read lock is enabled (see enable_obj_read_lock()).
+ * The object is always written synchronously. If fsync is batched, the
+ * caller must have called prepare_loose_object_bulk_checkin() before
+ * starting the threads. Repositories with a compatibility hash are not
+ * supported.
+ */
+int write_object_file_threaded(struct odb_source *source,
+			       const void *buf, unsigned long len,
+			       enum object_type type, struct object_id *oid,
+			       unsigned flags);
+
+/*
+ * Inside an object database transaction, write_object_file() may leave
+ * writing the loose object to a pool of threads (see
+ * core.looseObjectWriteThreads). loose_object_write_pending() tells
+ * whether the object is still waiting to be written, and
+ * finish_loose_object_writes() waits until all of them are written.
+ */
+int loose_object_write_pending(const struct object_id *oid);
+void finish_loose_object_writes(void);
+
 struct input_stream {
 	const void *(*read)(struct input_stream *, unsigned long *len);
 	void *data;
@@ -2,6 +2,7 @@
 #include "abspath.h"
 #include "commit-graph.h"
 #include "config.h"
+#include "delta-base-cache.h"
 #include "dir.h"
 #include "environment.h"
 #include "gettext.h"
@@ -684,6 +685,9 @@ static int do_oid_object_info_extended(struct object_database *odb,
 		return 0;
 	}
 
+	if (loose_object_write_pending(real))
+		finish_loose_object_writes();
+
 	while (1) {
 		if (find_pack_entry(odb->repo, real, &e))
 			break;
@@ -1038,6 +1042,9 @@ void odb_clear(struct object_database *o)
 	INIT_LIST_HEAD(&o->packed_git_mru);
 	close_object_store(o);
 
+	shared_delta_base_cache_free(o->shared_delta_base_cache);
+	o->shared_delta_base_cache = NULL;
+
 	/*
 	 * `close_object_store()` only closes the packfiles, but doesn't free
 	 * them. We thus have to do this manually.
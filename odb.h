@@ -84,6 +84,7 @@ struct odb_source {
 
 struct packed_git;
 struct cached_object_entry;
+struct shared_delta_base_cache;
 
 /*
  * The object database encapsulates access to objects in a repository. It
@@ -153,6 +154,12 @@ struct object_database {
 	 */
 	struct hashmap pack_map;
 
+	/*
+	 * The delta base cache shared with other processes; see
+	 * delta-base-cache.h. Lazily opened by packfile.c.
+	 */
+	struct shared_delta_base_cache *shared_delta_base_cache;
+
 	/*
 	 * A fast, rough count of the number of objects in the repository.
 	 * These two fields are not meant for direct access. Use
@@ -789,9 +789,16 @@ static int hashwrite_ewah_helper(void *f, const void *buf, size_t len)
 /**
  * Write the bitmap index to disk
  */
-static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap)
+static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap,
+			       int roaring)
 {
-	if (ewah_serialize_to(bitmap, hashwrite_ewah_helper, f) < 0)
+	int ret;
+
+	if (roaring)
+		ret = ewah_serialize_roaring_to(bitmap, hashwrite_ewah_helper, f);
+	else
+		ret = ewah_serialize_to(bitmap, hashwrite_ewah_helper, f);
+	if (ret < 0)
 		die("Failed to write bitmap index");
 }
 
@@ -819,7 +826,7 @@ static void write_selected_commits_v1(struct bitmap_writer *writer,
 		hashwrite_u8(f, stored->xor_offset);
 		hashwrite_u8(f, stored->flags);
 
-		dump_bitmap(f, stored->write_as);
+		dump_bitmap(f, stored->write_as, writer->roaring);
 	}
 }
 
@@ -859,8 +866,9 @@ static void write_pseudo_merges(struct bitmap_writer *writer,
 
 		pseudo_merge_ofs[i] = hashfile_total(f);
 
-		dump_bitmap(f, commits_ewah);
-		dump_bitmap(f, writer->selected[base+i].write_as);
+		/* pseudo-merges are always stored as EWAH */
+		dump_bitmap(f, commits_ewah, 0);
+		dump_bitmap(f, writer->selected[base+i].write_as, 0);
 
 		ewah_free(commits_ewah);
 	}
@@ -1043,7 +1051,7 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 			  const char *filename,
 			  uint16_t options)
 {
-	static uint16_t default_version = 1;
+	uint16_t version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct hashfile *f;
@@ -1057,20 +1065,25 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 
 	if (writer->pseudo_merges_nr)
 		options |= BITMAP_OPT_PSEUDO_MERGES;
+	if (options & BITMAP_OPT_ROARING) {
+		writer->roaring = 1;
+		version = 2;
+		options &= ~BITMAP_OPT_ROARING;
+	}
 
 	f = hashfd(writer->repo->hash_algo, fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(version);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(bitmap_writer_nr_selected_commits(writer));
 	hashcpy(header.checksum, writer->pack_checksum, writer->repo->hash_algo);
 
 	hashwrite(f, &header, sizeof(header) - GIT_MAX_RAWSZ + writer->repo->hash_algo->rawsz);
-	dump_bitmap(f, writer->commits);
-	dump_bitmap(f, writer->trees);
-	dump_bitmap(f, writer->blobs);
-	dump_bitmap(f, writer->tags);
+	dump_bitmap(f, writer->commits, writer->roaring);
+	dump_bitmap(f, writer->trees, writer->roaring);
+	dump_bitmap(f, writer->blobs, writer->roaring);
+	dump_bitmap(f, writer->tags, writer->roaring);
 
 	if (options & BITMAP_OPT_LOOKUP_TABLE)
 		CALLOC_ARRAY(offsets, writer->to_pack->nr_objects);
@@ -139,6 +139,12 @@ struct bitmap_index {
 	/* "have" bitmap from the last performed walk */
 	struct bitmap *haves;
 
+	/*
+	 * Objects reachable from the left side of a symmetric range in
+	 * the last performed walk, if it was asked to tell the sides apart.
+	 */
+	struct bitmap *left;
+
 	/* Version of the bitmap index */
 	unsigned int version;
 };
@@ -194,7 +200,24 @@ struct ewah_bitmap *read_bitmap(const unsigned char *map,
  */
 static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 {
-	return read_bitmap(index->map, index->map_size, &index->map_pos);
+	struct ewah_bitmap *b;
+	ssize_t bitmap_size;
+
+	if (index->version != 2)
+		return read_bitmap(index->map, index->map_size, &index->map_pos);
+
+	b = ewah_pool_new();
+	bitmap_size = ewah_read_roaring_mmap(b, index->map + index->map_pos,
+					     index->map_size - index->map_pos);
+	if (bitmap_size < 0) {
+		error(_("failed to load bitmap index (corrupted?)"));
+		ewah_pool_free(b);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+
+	return b;
 }
 
 static uint32_t bitmap_num_objects_total(struct bitmap_index *index)
@@ -234,7 +257,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 		return error(_("corrupted bitmap index file (wrong header)"));
 
 	index->version = ntohs(header->version);
-	if (index->version != 1)
+	if (index->version != 1 && index->version != 2)
 		return error(_("unsupported version '%d' for bitmap index file"), index->version);
 
 	/* Parse known bitmap format options */
@@ -2089,9 +2112,12 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 
 	struct object_list *wants = NULL;
 	struct object_list *haves = NULL;
+	struct object_list *left_wants = NULL;
+	unsigned int wants_nr = 0, left_wants_nr = 0;
 
 	struct bitmap *wants_bitmap = NULL;
 	struct bitmap *haves_bitmap = NULL;
+	struct bitmap *left_bitmap = NULL;
 
 	struct bitmap_index *bitmap_git;
 	struct repository *repo;
@@ -2131,12 +2157,28 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 			object->flags |= (tag->object.flags & UNINTERESTING);
 		}
 
-		if (object->flags & UNINTERESTING)
+		if (object->flags & UNINTERESTING) {
 			object_list_insert(object, &haves);
-		else
+		} else {
 			object_list_insert(object, &wants);
+			wants_nr++;
+			if (object->flags & SYMMETRIC_LEFT) {
+				object_list_insert(object, &left_wants);
+				left_wants_nr++;
+			}
+		}
 	}
 
+	/*
+	 * Telling which side of a symmetric range "A...B" a commit is on
+	 * only works by reachability when the range is all we have to
+	 * look at: every commit reachable from both sides is then
+	 * reachable from one of the merge bases, too, and thus excluded.
+	 */
+	if ((revs->left_right || revs->left_only || revs->right_only) &&
+	    left_wants_nr && (left_wants_nr != 1 || wants_nr != 2))
+		goto cleanup;
+
 	use_boundary_traversal = git_env_bool(GIT_TEST_PACK_USE_BITMAP_BOUNDARY_TRAVERSAL, -1);
 	if (use_boundary_traversal < 0) {
 		prepare_repo_settings(revs->repo);
@@ -2193,6 +2235,15 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 		reset_revision_walk();
 	}
 
+	if (revs->left_right || revs->left_only || revs->right_only) {
+		left_bitmap = left_wants ?
+			find_objects(bitmap_git, revs, left_wants, haves_bitmap) :
+			bitmap_new();
+		if (!left_bitmap)
+			BUG("failed to perform bitmap walk");
+		reset_revision_walk();
+	}
+
 	wants_bitmap = find_objects(bitmap_git, revs, wants, haves_bitmap);
 
 	if (!wants_bitmap)
@@ -2211,9 +2262,11 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 
 	bitmap_git->result = wants_bitmap;
 	bitmap_git->haves = haves_bitmap;
+	bitmap_git->left = left_bitmap;
 
 	object_list_free(&wants);
 	object_list_free(&haves);
+	object_list_free(&left_wants);
 
 	trace2_data_intmax("bitmap", repo, "pseudo_merges_satisfied",
 			   pseudo_merges_satisfied_nr);
@@ -2234,6 +2287,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	free_bitmap_index(bitmap_git);
 	object_list_free(&wants);
 	object_list_free(&haves);
+	object_list_free(&left_wants);
 	return NULL;
 }
 
@@ -2590,10 +2644,10 @@ void traverse_bitmap_commit_list(struct bitmap_index *bitmap_git,
 	show_extended_objects(bitmap_git, revs, show_reachable);
 }
 
-static uint32_t count_object_type(struct bitmap_index *bitmap_git,
-				  enum object_type type)
+static uint32_t count_objects_in(struct bitmap_index *bitmap_git,
+				 struct bitmap *objects,
+				 enum object_type type)
 {
-	struct bitmap *objects = bitmap_git->result;
 	struct eindex *eindex = &bitmap_git->ext_index;
 
 	uint32_t i = 0, count = 0;
@@ -2619,6 +2673,12 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 	return count;
 }
 
+static uint32_t count_object_type(struct bitmap_index *bitmap_git,
+				  enum object_type type)
+{
+	return count_objects_in(bitmap_git, bitmap_git->result, type);
+}
+
 void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 			      uint32_t *commits, uint32_t *trees,
 			      uint32_t *blobs, uint32_t *tags)
@@ -2638,6 +2698,21 @@ void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 		*tags = count_object_type(bitmap_git, OBJ_TAG);
 }
 
+void count_bitmap_left_right(struct bitmap_index *bitmap_git,
+			     uint32_t *left, uint32_t *right)
+{
+	struct bitmap *right_only;
+
+	if (!bitmap_git->result || !bitmap_git->left)
+		BUG("count_bitmap_left_right() without sides to count");
+
+	right_only = bitmap_dup(bitmap_git->result);
+	bitmap_and_not(right_only, bitmap_git->left);
+	*right = count_objects_in(bitmap_git, right_only, OBJ_COMMIT);
+	*left = count_object_type(bitmap_git, OBJ_COMMIT) - *right;
+	bitmap_free(right_only);
+}
+
 struct bitmap_test_data {
 	struct bitmap_index *bitmap_git;
 	struct bitmap *base;
@@ -3161,6 +3236,7 @@ void free_bitmap_index(struct bitmap_index *b)
 	kh_destroy_oid_pos(b->ext_index.positions);
 	bitmap_free(b->result);
 	bitmap_free(b->haves);
+	bitmap_free(b->left);
 	if (bitmap_is_midx(b)) {
 		/*
 		 * Multi-pack bitmaps need to have resources associated with
@@ -38,6 +38,13 @@ enum pack_bitmap_opts {
 	BITMAP_OPT_HASH_CACHE = 0x4,
 	BITMAP_OPT_LOOKUP_TABLE = 0x10,
 	BITMAP_OPT_PSEUDO_MERGES = 0x20,
+
+	/*
+	 * Not stored in the header; asks the writer for a version 2
+	 * file, in which the bitmaps are stored in a roaring layout
+	 * instead of EWAH.
+	 */
+	BITMAP_OPT_ROARING = 0x8000,
 };
 
 enum pack_bitmap_flags {
@@ -76,6 +83,13 @@ int bitmap_index_contains_pack(struct bitmap_index *bitmap, struct packed_git *p
 
 void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
 			      uint32_t *trees, uint32_t *blobs, uint32_t *tags);
+/*
+ * Count the commits of a walk that prepare_bitmap_walk() was asked to
+ * do with --left-right, --left-only or --right-only by the side of the
+ * symmetric range they are on.
+ */
+void count_bitmap_left_right(struct bitmap_index *,
+			     uint32_t *left, uint32_t *right);
 void traverse_bitmap_commit_list(struct bitmap_index *,
 				 struct rev_info *revs,
 				 show_reachable_fn show_reachable);
@@ -144,6 +158,7 @@ struct bitmap_writer {
 
 	struct progress *progress;
 	int show_progress;
+	int roaring;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
 };
 
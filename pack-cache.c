@@ -0,0 +1,404 @@
+#include "git-compat-util.h"
+#include "pack-cache.h"
+#include "dir.h"
+#include "gettext.h"
+#include "hash.h"
+#include "hex.h"
+#include "odb.h"
+#include "path.h"
+#include "repository.h"
+#include "strbuf.h"
+#include "tempfile.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "wrapper.h"
+
+/*
+ * A producer touches its in-progress file at least this often, and a
+ * consumer gives up on a file that has not been touched for
+ * PACK_CACHE_STALE seconds.
+ */
+#define PACK_CACHE_HEARTBEAT 5
+#define PACK_CACHE_STALE 60
+
+/*
+ * Touches the file of a producer from a thread of its own, so that
+ * the file stays fresh while the producer is stuck writing to a slow
+ * client. Closing the write end of the pipe stops the thread.
+ */
+struct pack_cache_heartbeat {
+	pthread_t thread;
+	int stop[2];
+	char *path;
+};
+
+static char *pack_cache_dir(struct repository *r)
+{
+	return xstrfmt("%s/info/pack-cache", r->objects->sources->path);
+}
+
+static int is_stale(const struct stat *st)
+{
+	return time(NULL) - st->st_mtime > PACK_CACHE_STALE;
+}
+
+/* Is `path` still the file that is open as `fd`? */
+static int is_same_file(int fd, const char *path)
+{
+	struct stat fd_st, path_st;
+
+	return !fstat(fd, &fd_st) && !lstat(path, &path_st) &&
+	       fd_st.st_dev == path_st.st_dev &&
+	       fd_st.st_ino == path_st.st_ino;
+}
+
+/*
+ * The file of an entry in progress has two names, the one of its
+ * producer and "<key>.tmp". If it is still writable and either the
+ * producer removed its name on the way out or it has not been touched
+ * for a while, the producer is gone.
+ */
+static int is_abandoned(const struct stat *st)
+{
+	return (st->st_mode & S_IWUSR) && (st->st_nlink < 2 || is_stale(st));
+}
+
+static int open_finished(struct pack_cache_file *f, const char *path)
+{
+	f->fd = git_open(path);
+	if (f->fd < 0)
+		return -1;
+	/* bump the entry to the front of the LRU order */
+	utime(path, NULL);
+	f->path = xstrdup(path);
+	return 0;
+}
+
+static int open_in_progress(struct pack_cache_file *f, const char *path)
+{
+	struct stat st;
+
+	f->fd = git_open(path);
+	if (f->fd < 0)
+		return -1;
+	if (fstat(f->fd, &st) || is_abandoned(&st)) {
+		/*
+		 * Make room for a new producer, unless one has already
+		 * replaced the file since we opened it.
+		 */
+		if (is_same_file(f->fd, path))
+			unlink(path);
+		close(f->fd);
+		f->fd = -1;
+		return -1;
+	}
+	f->path = xstrdup(path);
+	return 0;
+}
+
+static void *heartbeat(void *data)
+{
+	struct pack_cache_heartbeat *hb = data;
+	struct pollfd pfd;
+
+	pfd.fd = hb->stop[0];
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, PACK_CACHE_HEARTBEAT * 1000) <= 0)
+		utime(hb->path, NULL);
+	return NULL;
+}
+
+static void set_cloexec(int fd)
+{
+	int flags = fcntl(fd, F_GETFD, 0);
+
+	if (flags >= 0)
+		fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+static void start_heartbeat(struct pack_cache_file *f)
+{
+	struct pack_cache_heartbeat *hb;
+
+	if (!HAVE_THREADS)
+		return;
+
+	CALLOC_ARRAY(hb, 1);
+	if (pipe(hb->stop)) {
+		free(hb);
+		return;
+	}
+	/* pack-objects must not keep the thread alive */
+	set_cloexec(hb->stop[0]);
+	set_cloexec(hb->stop[1]);
+	hb->path = xstrdup(get_tempfile_path(f->tempfile));
+	if (pthread_create(&hb->thread, NULL, heartbeat, hb)) {
+		close(hb->stop[0]);
+		close(hb->stop[1]);
+		free(hb->path);
+		free(hb);
+		return;
+	}
+	f->heartbeat = hb;
+}
+
+static void stop_heartbeat(struct pack_cache_file *f)
+{
+	struct pack_cache_heartbeat *hb = f->heartbeat;
+
+	if (!hb)
+		return;
+	close(hb->stop[1]);
+	pthread_join(hb->thread, NULL);
+	close(hb->stop[0]);
+	free(hb->path);
+	FREE_AND_NULL(f->heartbeat);
+}
+
+/*
+ * Write to a file of our own and claim the entry by linking it to
+ * "<key>.tmp". We only ever remove or rename our own name, so a
+ * producer that was wrongly taken for dead cannot harm the file of the
+ * one that replaced it.
+ */
+static int start_producing(struct pack_cache_file *f, const char *dir,
+			   const struct object_id *key, const char *tmp)
+{
+	char *template = xstrfmt("%s/%s-XXXXXX.tmp", dir, oid_to_hex(key));
+	int saved_errno;
+
+	f->tempfile = mks_tempfile_sm(template, 4, 0644);
+	free(template);
+	if (!f->tempfile)
+		return -1;
+	if (link(get_tempfile_path(f->tempfile), tmp)) {
+		saved_errno = errno;
+		delete_tempfile(&f->tempfile);
+		errno = saved_errno;
+		return -1;
+	}
+	f->fd = get_tempfile_fd(f->tempfile);
+	f->in_progress = xstrdup(tmp);
+	f->last_touched = time(NULL);
+	start_heartbeat(f);
+	return 0;
+}
+
+int pack_cache_open(struct repository *r, const struct object_id *key,
+		    struct pack_cache_file *f)
+{
+	char *dir = pack_cache_dir(r);
+	struct strbuf path = STRBUF_INIT, tmp = STRBUF_INIT;
+	int ret = -1;
+
+	strbuf_addf(&path, "%s/%s.pack", dir, oid_to_hex(key));
+	strbuf_addf(&tmp, "%s/%s.tmp", dir, oid_to_hex(key));
+	if (safe_create_leading_directories(r, path.buf) != SCLD_OK)
+		goto out;
+
+	/*
+	 * Every step may race with another process finishing, abandoning
+	 * or evicting the entry, so give it a few tries before we give up.
+	 */
+	for (int tries = 0; tries < 3; tries++) {
+		if (!open_finished(f, path.buf)) {
+			trace2_counter_add(TRACE2_COUNTER_ID_PACK_CACHE_HITS, 1);
+			ret = PACK_CACHE_HIT;
+			break;
+		}
+
+		if (!start_producing(f, dir, key, tmp.buf)) {
+			f->path = strbuf_detach(&path, NULL);
+			trace2_counter_add(TRACE2_COUNTER_ID_PACK_CACHE_MISSES, 1);
+			ret = PACK_CACHE_MISS;
+			break;
+		}
+		if (errno != EEXIST)
+			break;
+
+		if (!open_in_progress(f, tmp.buf)) {
+			trace2_counter_add(TRACE2_COUNTER_ID_PACK_CACHE_SHARED, 1);
+			ret = PACK_CACHE_SHARED;
+			break;
+		}
+	}
+
+out:
+	strbuf_release(&path);
+	strbuf_release(&tmp);
+	free(dir);
+	return ret;
+}
+
+int pack_cache_status(struct pack_cache_file *f)
+{
+	struct stat st;
+
+	if (fstat(f->fd, &st))
+		return -1;
+	if (!(st.st_mode & S_IWUSR))
+		return 1;
+	if (is_abandoned(&st))
+		return -1;
+	return 0;
+}
+
+/* Remove "<key>.tmp" if it still refers to our file. */
+static void release_in_progress(struct pack_cache_file *f)
+{
+	if (f->in_progress && is_same_file(f->fd, f->in_progress))
+		unlink(f->in_progress);
+	FREE_AND_NULL(f->in_progress);
+}
+
+void pack_cache_write(struct pack_cache_file *f, const void *buf, size_t len)
+{
+	if (!is_tempfile_active(f->tempfile))
+		return;
+	if (write_in_full(f->fd, buf, len) < 0) {
+		warning_errno(_("unable to write to pack cache"));
+		stop_heartbeat(f);
+		release_in_progress(f);
+		delete_tempfile(&f->tempfile);
+		f->fd = -1;
+		return;
+	}
+	f->last_touched = time(NULL);
+}
+
+void pack_cache_touch(struct pack_cache_file *f)
+{
+	time_t now = time(NULL);
+
+	if (f->heartbeat || !is_tempfile_active(f->tempfile) ||
+	    now - f->last_touched < PACK_CACHE_HEARTBEAT)
+		return;
+	utime(get_tempfile_path(f->tempfile), NULL);
+	f->last_touched = now;
+}
+
+struct pack_cache_entry {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_cache_entry *a = va, *b = vb;
+
+	/* newest first */
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return strcmp(a->path, b->path);
+}
+
+static void evict(const char *dir_path, unsigned long limit)
+{
+	DIR *dir = opendir(dir_path);
+	struct dirent *de;
+	struct pack_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0;
+	uint64_t total = 0;
+	int evicted = 0;
+
+	if (!dir)
+		return;
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		char *path = xstrfmt("%s/%s", dir_path, de->d_name);
+		struct stat st;
+
+		if (lstat(path, &st)) {
+			free(path);
+			continue;
+		}
+		if (ends_with(de->d_name, ".tmp") && strchr(de->d_name, '-') &&
+		    is_stale(&st) && (st.st_mode & S_IWUSR)) {
+			/*
+			 * Left behind by a producer that died. Its
+			 * "<key>.tmp" is cleaned up by the next process
+			 * that opens it.
+			 */
+			unlink(path);
+			free(path);
+			continue;
+		}
+		if (!ends_with(de->d_name, ".pack")) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = path;
+		entries[nr].mtime = st.st_mtime;
+		entries[nr].size = st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entries, nr, entry_cmp);
+	for (size_t i = 0; i < nr; i++) {
+		total += entries[i].size;
+		if (total > limit && !unlink(entries[i].path))
+			evicted++;
+		free(entries[i].path);
+	}
+	free(entries);
+
+	if (evicted)
+		trace2_data_intmax("pack-cache", NULL, "evicted", evicted);
+}
+
+void pack_cache_commit(struct pack_cache_file *f, unsigned long limit)
+{
+	char *dir;
+	int ret;
+
+	stop_heartbeat(f);
+	if (!is_tempfile_active(f->tempfile))
+		return;
+
+	/*
+	 * Consumers take a read-only file as a sign that there is no more
+	 * data to come, so do this before the file is moved into place.
+	 * Nobody takes a read-only file for abandoned, so "<key>.tmp"
+	 * cannot change hands after this.
+	 */
+	if (chmod(get_tempfile_path(f->tempfile), 0444)) {
+		warning_errno(_("unable to store pack in pack cache"));
+		pack_cache_close(f);
+		return;
+	}
+	if (f->in_progress && !is_same_file(f->fd, f->in_progress))
+		FREE_AND_NULL(f->in_progress);
+	ret = rename_tempfile(&f->tempfile, f->path);
+	if (ret) {
+		warning_errno(_("unable to store pack in pack cache"));
+		if (f->tempfile)
+			delete_tempfile(&f->tempfile);
+	}
+	f->fd = -1;
+	if (f->in_progress)
+		unlink(f->in_progress);
+	FREE_AND_NULL(f->in_progress);
+	if (ret)
+		return;
+
+	dir = xstrdup(f->path);
+	*strrchr(dir, '/') = '\0';
+	evict(dir, limit);
+	free(dir);
+}
+
+void pack_cache_close(struct pack_cache_file *f)
+{
+	stop_heartbeat(f);
+	if (f->tempfile) {
+		release_in_progress(f);
+		delete_tempfile(&f->tempfile);
+	} else if (f->fd >= 0) {
+		close(f->fd);
+	}
+	f->fd = -1;
+	FREE_AND_NULL(f->in_progress);
+	FREE_AND_NULL(f->path);
+}
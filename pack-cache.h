@@ -0,0 +1,95 @@
+#ifndef PACK_CACHE_H
+#define PACK_CACHE_H
+
+struct repository;
+struct object_id;
+struct tempfile;
+
+/*
+ * The pack cache keeps the output of earlier pack-objects runs in
+ * "$GIT_DIR/objects/info/pack-cache", named after a hash of everything
+ * that went into producing them, so that upload-pack can answer a
+ * request it has seen before (think of many CI jobs cloning the same
+ * commit) by streaming a file instead of running pack-objects again.
+ *
+ * A finished entry is "<key>.pack"; an entry that is still being
+ * written is "<key>.tmp". The first process to ask for a key creates
+ * a temporary file of its own, "<key>-XXXXXX.tmp", links it to
+ * "<key>.tmp" and becomes its producer. Anybody asking for the same
+ * key while it is being produced opens "<key>.tmp" and tails it. The
+ * producer marks the file read-only once it is complete and then
+ * renames it into place, so consumers can tell from their open
+ * descriptor alone whether more data may follow. The producer also
+ * keeps the mtime of the file fresh, from a thread of its own where
+ * threads are available; an in-progress file that is not touched for a
+ * while, or that lost the name of its producer, is considered
+ * abandoned and may be taken over by another producer.
+ *
+ * The total size of the finished entries is bounded; the entries that
+ * were least recently used (by mtime, which is bumped on every hit) are
+ * removed first.
+ */
+
+enum pack_cache_state {
+	PACK_CACHE_HIT,		/* a finished entry was opened */
+	PACK_CACHE_SHARED,	/* another process is producing the entry */
+	PACK_CACHE_MISS,	/* we are producing the entry */
+};
+
+struct pack_cache_heartbeat;
+
+struct pack_cache_file {
+	/* Descriptor to read from (consumers) or write to (producer). */
+	int fd;
+	char *path;
+
+	/* For producers: our own file, and the "<key>.tmp" linked to it. */
+	struct tempfile *tempfile;
+	char *in_progress;
+	struct pack_cache_heartbeat *heartbeat;
+	time_t last_touched;
+};
+
+#define PACK_CACHE_FILE_INIT { .fd = -1 }
+
+/*
+ * Look up the entry for `key`, becoming its producer if nobody else
+ * has started it yet. Returns one of `enum pack_cache_state`, or -1 if
+ * the cache cannot be used, in which case the caller should go ahead
+ * without it.
+ */
+int pack_cache_open(struct repository *r, const struct object_id *key,
+		    struct pack_cache_file *f);
+
+/*
+ * For consumers: return 1 if the entry is complete, 0 if it is still
+ * being written and -1 if its producer went away without finishing it.
+ */
+int pack_cache_status(struct pack_cache_file *f);
+
+/*
+ * For producers: append data to the entry. A failed write abandons
+ * the entry, which is not an error for the caller.
+ */
+void pack_cache_write(struct pack_cache_file *f, const void *buf, size_t len);
+
+/*
+ * For producers: tell consumers that we are still alive. This is only
+ * needed where there are no threads; otherwise a thread does it.
+ */
+void pack_cache_touch(struct pack_cache_file *f);
+
+/*
+ * For producers: publish the finished entry, then remove the least
+ * recently used entries until the cache is no larger than `limit`
+ * bytes.
+ */
+void pack_cache_commit(struct pack_cache_file *f, unsigned long limit);
+
+/*
+ * Close the entry. A producer that did not commit its entry discards
+ * it.
+ */
+void pack_cache_close(struct pack_cache_file *f);
+
+#endif /* PACK_CACHE_H */
@@ -2,6 +2,7 @@
 
 #include "git-compat-util.h"
 #include "environment.h"
+#include "gettext.h"
 #include "hex.h"
 #include "repository.h"
 #include "pack.h"
@@ -9,6 +10,8 @@
 #include "packfile.h"
 #include "object-file.h"
 #include "odb.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -48,54 +51,247 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * Objects are verified in shards of this many objects that are adjacent
+ * in the pack, which keeps reading the pack mostly sequential and lets
+ * delta chains benefit from the delta base cache even when several
+ * threads work on the pack.
+ */
+#define SHARD_SIZE 64
+
+/*
+ * When we pick the number of threads ourselves, only start one for every
+ * THREAD_COST objects.
+ */
+#define THREAD_COST 1000
+
+struct verify_state {
+	struct repository *r;
+	struct packed_git *p;
+	struct idx_entry *entries;
+	uint32_t nr_objects;
+	verify_fn fn;
+	struct progress *progress;
+	uint32_t base_count;
+
+	pthread_mutex_t mutex;
+	uint32_t next_shard;
+	uint32_t done;
+	int err;
+};
+
+/*
+ * Verify the i-th object in pack order. Everything that touches the pack
+ * windows or the caller's object state happens under the object read
+ * lock, which unpack_entry() drops while inflating; checking the object
+ * names happens outside of it.
+ */
+static int verify_one(struct verify_state *s, struct pack_window **w_curs,
+		      uint32_t i)
+{
+	struct repository *r = s->r;
+	struct packed_git *p = s->p;
+	struct idx_entry *entries = s->entries;
+	void *data;
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	off_t curpos;
+	int data_valid;
+	int err = 0;
+
+	if (nth_packed_object_id(&oid, p, entries[i].nr) < 0)
+		BUG("unable to get oid of object %lu from %s",
+		    (unsigned long)entries[i].nr, p->pack_name);
+
+	obj_read_lock();
+	if (p->index_version > 1) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			err = error("index CRC mismatch for object %s "
+				    "from %s at offset %"PRIuMAX"",
+				    oid_to_hex(&oid),
+				    p->pack_name, (uintmax_t)offset);
+	}
+
+	curpos = entries[i].offset;
+	type = unpack_object_header(p, w_curs, &curpos, &size);
+	unuse_pack(w_curs);
+
+	if (type == OBJ_BLOB &&
+	    repo_settings_get_big_file_threshold(r) <= size) {
+		/*
+		 * Let stream_object_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		data = NULL;
+		data_valid = 0;
+	} else {
+		data = unpack_entry(r, p, entries[i].offset, &type, &size);
+		data_valid = 1;
+	}
+	obj_read_unlock();
+
+	if (data_valid && !data)
+		err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+			    oid_to_hex(&oid), p->pack_name,
+			    (uintmax_t)entries[i].offset);
+	else if (data && check_object_signature(r, &oid, data, size,
+						type) < 0)
+		err = error("packed %s from %s is corrupt",
+			    oid_to_hex(&oid), p->pack_name);
+	else {
+		obj_read_lock();
+		if (!data && stream_object_signature(r, &oid) < 0)
+			err = error("packed %s from %s is corrupt",
+				    oid_to_hex(&oid), p->pack_name);
+		else if (s->fn) {
+			int eaten = 0;
+			err |= s->fn(&oid, type, size, data, &eaten);
+			if (eaten)
+				data = NULL;
+		}
+		obj_read_unlock();
+	}
+	free(data);
+
+	pthread_mutex_lock(&s->mutex);
+	s->done++;
+	if (((s->base_count + s->done) & 1023) == 0)
+		display_progress(s->progress, s->base_count + s->done);
+	pthread_mutex_unlock(&s->mutex);
+
+	return err;
+}
+
+static int verify_shards(struct verify_state *s)
+{
+	struct pack_window *w_curs = NULL;
+	uint32_t verified = 0;
+	int err = 0;
+
+	while (1) {
+		uint32_t start, end;
+
+		pthread_mutex_lock(&s->mutex);
+		start = s->next_shard++ * SHARD_SIZE;
+		pthread_mutex_unlock(&s->mutex);
+		if (start >= s->nr_objects)
+			break;
+
+		end = start + SHARD_SIZE;
+		if (end > s->nr_objects)
+			end = s->nr_objects;
+		for (uint32_t i = start; i < end; i++)
+			err |= verify_one(s, &w_curs, i);
+		verified += end - start;
+	}
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+
+	trace2_data_intmax("fsck", s->r, "verify-pack/objects", verified);
+	return err;
+}
+
+static void *verify_thread(void *data)
+{
+	struct verify_state *s = data;
+	int err;
+
+	trace2_thread_start("verify-pack");
+	err = verify_shards(s);
+	pthread_mutex_lock(&s->mutex);
+	s->err |= err;
+	pthread_mutex_unlock(&s->mutex);
+	trace2_thread_exit();
+	return NULL;
+}
+
+static int verify_threads(uint32_t nr_objects, int nr_threads)
+{
+	uint32_t nr_shards = DIV_ROUND_UP(nr_objects, SHARD_SIZE);
+
+	if (!HAVE_THREADS)
+		return 1;
+	if (!nr_threads) {
+		nr_threads = online_cpus();
+		if (nr_threads > nr_objects / THREAD_COST)
+			nr_threads = nr_objects / THREAD_COST;
+	}
+	if (nr_threads > nr_shards)
+		nr_threads = nr_shards;
+	return nr_threads < 1 ? 1 : nr_threads;
+}
+
+/*
+ * Hash the pack up to its trailing checksum and read the checksum. This
+ * reads the file on its own rather than through the pack windows, so
+ * that it can run while other threads verify the objects.
+ */
+static int stream_pack_checksum(struct repository *r, struct packed_git *p,
+				unsigned char *hash, unsigned char *pack_sig)
+{
+	struct git_hash_ctx ctx;
+	off_t remaining = p->pack_size - r->hash_algo->rawsz;
+	unsigned char buf[64 * 1024];
+	int fd = git_open(p->pack_name);
+
+	if (fd < 0)
+		return error_errno("unable to open %s", p->pack_name);
+
+	r->hash_algo->init_fn(&ctx);
+	while (remaining) {
+		ssize_t n = xread(fd, buf, remaining < (off_t)sizeof(buf) ?
+					   (size_t)remaining : sizeof(buf));
+		if (n <= 0) {
+			close(fd);
+			return error("unable to read %s", p->pack_name);
+		}
+		git_hash_update(&ctx, buf, n);
+		remaining -= n;
+	}
+	git_hash_final(hash, &ctx);
+
+	if (read_in_full(fd, pack_sig, r->hash_algo->rawsz) != r->hash_algo->rawsz) {
+		close(fd);
+		return error("unable to read %s", p->pack_name);
+	}
+	close(fd);
+	return 0;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
-			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
 	const unsigned char *index_base = p->index_data;
-	struct git_hash_ctx ctx;
-	unsigned char hash[GIT_MAX_RAWSZ], *pack_sig;
-	off_t offset = 0, pack_sig_ofs = 0;
+	unsigned char hash[GIT_MAX_RAWSZ], pack_sig[GIT_MAX_RAWSZ];
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
+	struct verify_state s = { 0 };
+	pthread_t *threads = NULL;
+	int use_lock = !obj_read_use_lock;
 
 	if (!is_pack_valid(p))
 		return error("packfile %s cannot be accessed", p->pack_name);
 
-	r->hash_algo->init_fn(&ctx);
-	do {
-		unsigned long remaining;
-		unsigned char *in = use_pack(p, w_curs, offset, &remaining);
-		offset += remaining;
-		if (!pack_sig_ofs)
-			pack_sig_ofs = p->pack_size - r->hash_algo->rawsz;
-		if (offset > pack_sig_ofs)
-			remaining -= (unsigned int)(offset - pack_sig_ofs);
-		git_hash_update(&ctx, in, remaining);
-	} while (offset < pack_sig_ofs);
-	git_hash_final(hash, &ctx);
-	pack_sig = use_pack(p, w_curs, pack_sig_ofs, NULL);
-	if (!hasheq(hash, pack_sig, r->hash_algo))
-		err = error("%s pack checksum mismatch",
-			    p->pack_name);
-	if (!hasheq(index_base + index_size - r->hash_algo->hexsz, pack_sig,
-		    r->hash_algo))
-		err = error("%s pack checksum does not match its index",
-			    p->pack_name);
-	unuse_pack(w_curs);
-
 	/* Make sure everything reachable from idx is valid.  Since we
 	 * have verified that nr_objects matches between idx and pack,
 	 * we do not do scan-streaming check on the pack file.
 	 */
 	nr_objects = p->num_objects;
 	ALLOC_ARRAY(entries, nr_objects + 1);
-	entries[nr_objects].offset = pack_sig_ofs;
+	entries[nr_objects].offset = p->pack_size - r->hash_algo->rawsz;
 	/* first sort entries by pack offset, since unpacking them is more efficient that way */
 	for (i = 0; i < nr_objects; i++) {
 		entries[i].offset = nth_packed_object_offset(p, i);
@@ -103,70 +299,57 @@ static int verify_packfile(struct repository *r,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		struct object_id oid;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (nth_packed_object_id(&oid, p, entries[i].nr) < 0)
-			BUG("unable to get oid of object %lu from %s",
-			    (unsigned long)entries[i].nr, p->pack_name);
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(&oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
+	s.r = r;
+	s.p = p;
+	s.entries = entries;
+	s.nr_objects = nr_objects;
+	s.fn = fn;
+	s.progress = progress;
+	s.base_count = base_count;
+	pthread_mutex_init(&s.mutex, NULL);
 
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB &&
-		    repo_settings_get_big_file_threshold(r) <= size) {
-			/*
-			 * Let stream_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
-			data_valid = 1;
-		}
+	/*
+	 * With more than one thread, the objects are verified in the
+	 * background while we check the pack checksum.
+	 */
+	nr_threads = verify_threads(nr_objects, nr_threads);
+	if (nr_threads > 1) {
+		/* initialize lazily computed settings the threads rely on */
+		repo_settings_get_big_file_threshold(r);
+		if (use_lock)
+			enable_obj_read_lock();
+		trace2_data_intmax("fsck", r, "verify-pack/threads", nr_threads);
+		CALLOC_ARRAY(threads, nr_threads);
+		for (int t = 0; t < nr_threads; t++)
+			if (pthread_create(&threads[t], NULL, verify_thread, &s))
+				die(_("unable to create thread"));
+	}
 
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(&oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (data && check_object_signature(r, &oid, data, size,
-							type) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (!data && stream_object_signature(r, &oid) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(&oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
+	if (stream_pack_checksum(r, p, hash, pack_sig))
+		err = -1;
+	else {
+		if (!hasheq(hash, pack_sig, r->hash_algo))
+			err = error("%s pack checksum mismatch",
+				    p->pack_name);
+		if (!hasheq(index_base + index_size - r->hash_algo->hexsz, pack_sig,
+			    r->hash_algo))
+			err = error("%s pack checksum does not match its index",
+				    p->pack_name);
+	}
 
+	if (threads) {
+		for (int t = 0; t < nr_threads; t++)
+			pthread_join(threads[t], NULL);
+		free(threads);
+		if (use_lock)
+			disable_obj_read_lock();
+		err |= s.err;
+	} else {
+		err |= verify_shards(&s);
 	}
-	display_progress(progress, base_count + i);
+
+	display_progress(progress, base_count + nr_objects);
+	pthread_mutex_destroy(&s.mutex);
 	free(entries);
 
 	return err;
@@ -187,17 +370,16 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count,
+		int nr_threads)
 {
 	int err = 0;
-	struct pack_window *w_curs = NULL;
 
 	err |= verify_pack_index(p);
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
-	unuse_pack(&w_curs);
+	err |= verify_packfile(r, p, fn, progress, base_count, nr_threads);
 
 	return err;
 }
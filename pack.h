@@ -95,7 +95,14 @@ const char *write_idx_file(struct repository *repo,
 			   const unsigned char *sha1);
 int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 int verify_pack_index(struct packed_git *);
-int verify_pack(struct repository *, struct packed_git *, verify_fn fn, struct progress *, uint32_t);
+/*
+ * Verify the pack and call `fn` for every object in it. The objects are
+ * verified by `nr_threads` threads, or by as many threads as seem worth
+ * it if `nr_threads` is 0. `fn` is never called by more than one thread
+ * at a time, and it may read other objects.
+ */
+int verify_pack(struct repository *, struct packed_git *, verify_fn fn,
+		struct progress *, uint32_t, int nr_threads);
 off_t write_pack_header(struct hashfile *f, uint32_t);
 void fixup_pack_header_footer(const struct git_hash_algo *, int,
 			      unsigned char *, const char *, uint32_t,
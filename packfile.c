@@ -11,6 +11,7 @@
 #include "mergesort.h"
 #include "packfile.h"
 #include "delta.h"
+#include "delta-base-cache.h"
 #include "hash-lookup.h"
 #include "commit.h"
 #include "object.h"
@@ -1071,6 +1072,29 @@ void reprepare_packed_git(struct repository *r)
 	obj_read_unlock();
 }
 
+void reload_packed_git(struct repository *r)
+{
+	struct object_database *o = r->objects;
+
+	obj_read_lock();
+	close_object_store(o);
+	clear_delta_base_cache();
+
+	for (struct packed_git *p = o->packed_git, *next; p; p = next) {
+		next = p->next;
+		free(p);
+	}
+	o->packed_git = NULL;
+	INIT_LIST_HEAD(&o->packed_git_mru);
+	hashmap_partial_clear(&o->pack_map);
+	FREE_AND_NULL(o->kept_pack_cache.packs);
+	o->kept_pack_cache.flags = 0;
+	o->commit_graph_attempted = 0;
+
+	reprepare_packed_git(r);
+	obj_read_unlock();
+}
+
 struct packed_git *get_packed_git(struct repository *r)
 {
 	prepare_packed_git(r);
@@ -1644,6 +1668,28 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	/*
+	 * If the whole entry is in the current window, try to inflate it in
+	 * one go. Anything else, including corrupt entries, is left to the
+	 * streaming loop below.
+	 */
+	if (HAVE_INFLATE_BUFFER && size) {
+		unsigned long avail;
+		size_t used;
+		int ret;
+
+		in = use_pack(p, w_curs, curpos, &avail);
+		git_inflate_buffer_init();
+		obj_read_unlock();
+		ret = git_inflate_buffer(in, avail, buffer, size, &used);
+		obj_read_lock();
+		if (!ret) {
+			buffer[size] = '\0';
+			return buffer;
+		}
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1704,7 +1750,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent small_delta_stack[UNPACK_ENTRY_STACK_PREALLOC];
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
-	int base_from_cache = 0;
+	int base_from_cache = 0, base_is_delta;
 
 	prepare_repo_settings(p->repo);
 
@@ -1764,6 +1810,20 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			break;
 		}
 
+		if (p->repo->settings.shared_delta_base_cache_limit) {
+			unsigned long expect = get_size_from_delta(p, &w_curs,
+								   curpos);
+
+			data = expect ?
+				shared_delta_base_cache_get(p, obj_offset, expect,
+							    &type, &size) :
+				NULL;
+			if (data) {
+				base_from_cache = 1;
+				break;
+			}
+		}
+
 		/* push object, proceed to base */
 		if (delta_stack_nr >= delta_stack_alloc
 		    && delta_stack == small_delta_stack) {
@@ -1802,6 +1862,12 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		      type, (uintmax_t)obj_offset, p->pack_name);
 	}
 
+	/*
+	 * Only bases we had to reconstruct from deltas are worth putting
+	 * into the shared cache; the innermost one is a plain object.
+	 */
+	base_is_delta = 0;
+
 	/* PHASE 3: apply deltas in order */
 
 	/* invariants:
@@ -1888,6 +1954,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		 * thread could free() it (e.g. to make space for another entry)
 		 * before we are done using it.
 		 */
+		if (!external_base && base_is_delta)
+			shared_delta_base_cache_put(p, base_obj_offset, type,
+						    base, base_size);
+		base_is_delta = 1;
+
 		if (!external_base)
 			add_delta_base_cache(p, base_obj_offset, base, base_size,
 					     p->repo->settings.delta_base_cache_limit,
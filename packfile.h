@@ -143,6 +143,14 @@ int for_each_packed_object(struct repository *repo, each_packed_object_fn cb,
 extern void (*report_garbage)(unsigned seen_bits, const char *path);
 
 void reprepare_packed_git(struct repository *r);
+
+/*
+ * Like reprepare_packed_git(), but start from scratch: close and forget
+ * all packs, multi-pack indexes and the commit-graph before looking for
+ * them again, so that packs which were deleted are dropped, too. Nothing
+ * may hold on to a pack across this call.
+ */
+void reload_packed_git(struct repository *r);
 void install_packed_git(struct repository *r, struct packed_git *pack);
 
 struct packed_git *get_packed_git(struct repository *r);
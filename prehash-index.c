@@ -0,0 +1,225 @@
+#include "git-compat-util.h"
+#include "prehash-index.h"
+#include "bulk-checkin.h"
+#include "config.h"
+#include "convert.h"
+#include "gettext.h"
+#include "hash.h"
+#include "object-file.h"
+#include "odb.h"
+#include "read-cache-ll.h"
+#include "repository.h"
+#include "statinfo.h"
+#include "string-list.h"
+#include "strmap.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "write-or-die.h"
+
+/*
+ * Like in preload-index.c, cap the number of threads we start on our
+ * own, and only start one for every THREAD_COST files. Reading and
+ * hashing a file costs much more than an lstat, hence the lower cost.
+ */
+#define MAX_PARALLEL (20)
+#define THREAD_COST (50)
+
+/* Files up to this size are read, larger ones are mapped; see index_core(). */
+#define SMALL_FILE_SIZE (32*1024)
+
+struct prehashed_path {
+	struct stat_data sd;
+	struct object_id oid;
+	unsigned hashed : 1;
+};
+
+struct prehash_data {
+	struct odb_source *source;
+	unsigned long big_file_threshold;
+	const struct string_list *paths;
+	struct prehashed_path *results;
+
+	pthread_mutex_t mutex;
+	size_t next;
+};
+
+static void prehash_one(struct prehash_data *d, const char *path,
+			struct prehashed_path *result)
+{
+	struct stat st;
+	size_t size;
+	void *buf = NULL;
+	int fd, ret = -1;
+
+	if (lstat(path, &st) || !S_ISREG(st.st_mode) || st.st_size < 0 ||
+	    (size_t)st.st_size > d->big_file_threshold)
+		return;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	size = xsize_t(st.st_size);
+	if (!size) {
+		ret = write_object_file_threaded(d->source, "", 0, OBJ_BLOB,
+						 &result->oid, 0);
+	} else if (size <= SMALL_FILE_SIZE) {
+		buf = xmalloc(size);
+		if (read_in_full(fd, buf, size) == (ssize_t)size)
+			ret = write_object_file_threaded(d->source, buf, size,
+							 OBJ_BLOB, &result->oid, 0);
+		free(buf);
+	} else {
+		buf = xmmap_gently(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf != MAP_FAILED) {
+			ret = write_object_file_threaded(d->source, buf, size,
+							 OBJ_BLOB, &result->oid, 0);
+			munmap(buf, size);
+		}
+	}
+	close(fd);
+
+	/*
+	 * On failure add_to_index() does the work again, which reports
+	 * the error properly.
+	 */
+	if (ret)
+		return;
+	fill_stat_data(&result->sd, &st);
+	result->hashed = 1;
+}
+
+static void *prehash_thread(void *data)
+{
+	struct prehash_data *d = data;
+
+	trace2_thread_start("prehash");
+	while (1) {
+		size_t i;
+
+		pthread_mutex_lock(&d->mutex);
+		i = d->next++;
+		pthread_mutex_unlock(&d->mutex);
+		if (i >= d->paths->nr)
+			break;
+		prehash_one(d, d->paths->items[i].string, &d->results[i]);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static int prehash_threads(struct repository *r, size_t nr)
+{
+	int is_bool, threads = 0;
+
+	if (!repo_config_get_bool_or_int(r, "index.hashthreads",
+					 &is_bool, &threads) && is_bool)
+		threads = threads ? 0 : 1;
+	if (!HAVE_THREADS || threads == 1 || threads < 0)
+		return 1;
+	if (!threads) {
+		threads = online_cpus();
+		if (threads > MAX_PARALLEL)
+			threads = MAX_PARALLEL;
+		if ((size_t)threads > nr / THREAD_COST)
+			threads = nr / THREAD_COST;
+	}
+	if ((size_t)threads > nr)
+		threads = nr;
+	return threads;
+}
+
+void prehash_index_paths(struct index_state *istate,
+			 const struct string_list *paths, int flags)
+{
+	struct repository *r = istate->repo;
+	struct string_list todo = STRING_LIST_INIT_NODUP;
+	struct prehash_data d = { 0 };
+	pthread_t *threads;
+	int nr_threads;
+	size_t hashed = 0;
+
+	clear_prehashed_paths(istate);
+	if (flags & (ADD_CACHE_PRETEND | ADD_CACHE_INTENT) ||
+	    r->compat_hash_algo)
+		return;
+	if (prehash_threads(r, paths->nr) < 2)
+		return;
+
+	/*
+	 * Looking up attributes is not thread-safe, so we decide up front
+	 * which files can be hashed as they are.
+	 */
+	for (size_t i = 0; i < paths->nr; i++)
+		if (!would_convert_to_git(istate, paths->items[i].string))
+			string_list_append(&todo, paths->items[i].string);
+	nr_threads = prehash_threads(r, todo.nr);
+	if (nr_threads < 2)
+		goto out;
+
+	trace2_region_enter("index", "prehash", r);
+
+	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+		prepare_loose_object_bulk_checkin();
+	/* initialize lazily computed settings the threads rely on */
+	repo_settings_get_shared_repository(r);
+	d.big_file_threshold = repo_settings_get_big_file_threshold(r);
+	d.source = r->objects->sources;
+	d.paths = &todo;
+	CALLOC_ARRAY(d.results, todo.nr);
+	pthread_mutex_init(&d.mutex, NULL);
+
+	enable_obj_read_lock();
+	CALLOC_ARRAY(threads, nr_threads);
+	for (int i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, prehash_thread, &d))
+			die(_("unable to create threaded hashing"));
+	for (int i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i], NULL))
+			die(_("unable to join threaded hashing"));
+	disable_obj_read_lock();
+	free(threads);
+	pthread_mutex_destroy(&d.mutex);
+
+	CALLOC_ARRAY(istate->prehashed, 1);
+	strmap_init(istate->prehashed);
+	for (size_t i = 0; i < todo.nr; i++) {
+		struct prehashed_path *p;
+
+		if (!d.results[i].hashed)
+			continue;
+		p = xmalloc(sizeof(*p));
+		*p = d.results[i];
+		strmap_put(istate->prehashed, todo.items[i].string, p);
+		hashed++;
+	}
+	free(d.results);
+
+	trace2_data_intmax("index", r, "prehash/threads", nr_threads);
+	trace2_data_intmax("index", r, "prehash/files", hashed);
+	trace2_region_leave("index", "prehash", r);
+
+out:
+	string_list_clear(&todo, 0);
+}
+
+int lookup_prehashed_path(struct index_state *istate, const char *path,
+			  struct stat *st, struct object_id *oid)
+{
+	struct prehashed_path *p;
+
+	if (!istate->prehashed)
+		return 0;
+	p = strmap_get(istate->prehashed, path);
+	if (!p || !S_ISREG(st->st_mode) || match_stat_data(&p->sd, st))
+		return 0;
+	oidcpy(oid, &p->oid);
+	return 1;
+}
+
+void clear_prehashed_paths(struct index_state *istate)
+{
+	if (!istate->prehashed)
+		return;
+	strmap_clear(istate->prehashed, 1);
+	FREE_AND_NULL(istate->prehashed);
+}
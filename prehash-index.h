@@ -0,0 +1,34 @@
+#ifndef PREHASH_INDEX_H
+#define PREHASH_INDEX_H
+
+struct index_state;
+struct object_id;
+struct stat;
+struct string_list;
+
+/*
+ * Read, hash and write the blobs for the given worktree files on a pool
+ * of threads (see index.hashThreads), ahead of the caller adding them
+ * to the index one by one with add_to_index(). Files that need to be
+ * converted on their way into the repository, and files that are not
+ * regular files, are left for add_to_index() to handle as usual.
+ *
+ * `flags` are the ADD_CACHE_* flags that will be passed to
+ * add_to_index(); nothing is done when they ask to only pretend or to
+ * record the intent to add.
+ */
+void prehash_index_paths(struct index_state *istate,
+			 const struct string_list *paths, int flags);
+
+/*
+ * If `path` was hashed by prehash_index_paths() and has not changed
+ * since according to `st`, store its object name in `oid` and return 1.
+ * Otherwise return 0.
+ */
+int lookup_prehashed_path(struct index_state *istate, const char *path,
+			  struct stat *st, struct object_id *oid);
+
+/* Forget the results of prehash_index_paths(). */
+void clear_prehashed_paths(struct index_state *istate);
+
+#endif /* PREHASH_INDEX_H */
@@ -188,6 +188,7 @@ struct index_state {
 	struct progress *progress;
 	struct repository *repo;
 	struct pattern_list *sparse_checkout_patterns;
+	struct strmap *prehashed;
 };
 
 /**
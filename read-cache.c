@@ -30,6 +30,7 @@
 #include "name-hash.h"
 #include "object-name.h"
 #include "path.h"
+#include "prehash-index.h"
 #include "preload-index.h"
 #include "read-cache.h"
 #include "repository.h"
@@ -768,7 +769,8 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 		}
 	}
 	if (!intent_only) {
-		if (index_path(istate, &ce->oid, path, st, hash_flags)) {
+		if (!lookup_prehashed_path(istate, path, st, &ce->oid) &&
+		    index_path(istate, &ce->oid, path, st, hash_flags)) {
 			discard_cache_entry(ce);
 			return error(_("unable to index file '%s'"), path);
 		}
@@ -3911,6 +3913,20 @@ static void update_callback(struct diff_queue_struct *q,
 {
 	int i;
 	struct update_callback_data *data = cbdata;
+	struct string_list paths = STRING_LIST_INIT_NODUP;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if ((p->status == DIFF_STATUS_MODIFIED ||
+		     p->status == DIFF_STATUS_TYPE_CHANGED) &&
+		    S_ISREG(p->two->mode) &&
+		    (data->include_sparse ||
+		     path_in_sparse_checkout(p->one->path, data->index)))
+			string_list_append(&paths, p->one->path);
+	}
+	prehash_index_paths(data->index, &paths, data->flags);
+	string_list_clear(&paths, 0);
 
 	for (i = 0; i < q->nr; i++) {
 		struct diff_filepair *p = q->queue[i];
@@ -3941,6 +3957,7 @@ static void update_callback(struct diff_queue_struct *q,
 			break;
 		}
 	}
+	clear_prehashed_paths(data->index);
 }
 
 int add_files_to_cache(struct repository *repo, const char *prefix,
@@ -1537,6 +1537,7 @@ static enum ref_transaction_error write_ref_to_lockfile(struct files_ref_store *
 							struct ref_lock *lock,
 							const struct object_id *oid,
 							int skip_oid_verification,
+							int *batch_fsync,
 							struct strbuf *err);
 static int commit_ref_update(struct files_ref_store *refs,
 			     struct ref_lock *lock,
@@ -1684,7 +1685,7 @@ static int files_copy_or_rename_ref(struct ref_store *ref_store,
 	}
 	oidcpy(&lock->old_oid, &orig_oid);
 
-	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, &err) ||
+	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, NULL, &err) ||
 	    commit_ref_update(refs, lock, &orig_oid, logmsg, 0, &err)) {
 		error("unable to write current sha1 into %s: %s", newrefname, err.buf);
 		strbuf_release(&err);
@@ -1702,7 +1703,7 @@ static int files_copy_or_rename_ref(struct ref_store *ref_store,
 		goto rollbacklog;
 	}
 
-	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, &err) ||
+	if (write_ref_to_lockfile(refs, lock, &orig_oid, 0, NULL, &err) ||
 	    commit_ref_update(refs, lock, &orig_oid, NULL, REF_SKIP_CREATE_REFLOG, &err)) {
 		error("unable to write current sha1 into %s: %s", oldrefname, err.buf);
 		strbuf_release(&err);
@@ -1939,14 +1940,60 @@ static int files_log_ref_write(struct files_ref_store *refs,
 	return 0;
 }
 
+/*
+ * Harden a reference lockfile before it is renamed into place. With
+ * core.fsyncMethod=batch and a non-NULL `batch_fsync`, only ask for
+ * the data to be written out and set `*batch_fsync`; the caller then
+ * has to call flush_batch_fsync() before committing the lockfile.
+ */
+static int fsync_ref_lockfile(int fd, int *batch_fsync)
+{
+	if (batch_fsync && batch_fsync_enabled(FSYNC_COMPONENT_REFERENCE)) {
+		if (git_fsync(fd, FSYNC_WRITEOUT_ONLY) >= 0) {
+			*batch_fsync = 1;
+			return 0;
+		}
+		if (errno == ENOSYS)
+			warning(_("core.fsyncMethod = batch is unsupported on this platform"));
+	}
+	return fsync_component(FSYNC_COMPONENT_REFERENCE, fd);
+}
+
+/*
+ * Issue a single full flush that makes all lockfiles written out by
+ * fsync_ref_lockfile() durable, by fsyncing a dummy file. This acts as
+ * a barrier for the disk writeback cache, like flush_batch_fsync() in
+ * bulk-checkin.c does for loose objects.
+ */
+static int flush_batch_fsync(struct files_ref_store *refs, struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *temp;
+	int ret = 0;
+
+	strbuf_addf(&path, "%s/bulk_fsync_XXXXXX", refs->gitcommondir);
+	temp = mks_tempfile(path.buf);
+	if (!temp || git_fsync(get_tempfile_fd(temp), FSYNC_HARDWARE_FLUSH) < 0) {
+		strbuf_addf(err, "unable to flush reference updates: %s",
+			    strerror(errno));
+		ret = -1;
+	}
+	delete_tempfile(&temp);
+	strbuf_release(&path);
+	return ret;
+}
+
 /*
  * Write oid into the open lockfile, then close the lockfile. On
  * errors, rollback the lockfile, fill in *err and return -1.
+ *
+ * See fsync_ref_lockfile() for the meaning of `batch_fsync`.
  */
 static enum ref_transaction_error write_ref_to_lockfile(struct files_ref_store *refs,
 							struct ref_lock *lock,
 							const struct object_id *oid,
 							int skip_oid_verification,
+							int *batch_fsync,
 							struct strbuf *err)
 {
 	static char term = '\n';
@@ -1975,7 +2022,7 @@ static enum ref_transaction_error write_ref_to_lockfile(struct files_ref_store *
 	fd = get_lock_file_fd(&lock->lk);
 	if (write_in_full(fd, oid_to_hex(oid), refs->base.repo->hash_algo->hexsz) < 0 ||
 	    write_in_full(fd, &term, 1) < 0 ||
-	    fsync_component(FSYNC_COMPONENT_REFERENCE, get_lock_file_fd(&lock->lk)) < 0 ||
+	    fsync_ref_lockfile(fd, batch_fsync) < 0 ||
 	    close_ref_gently(lock) < 0) {
 		strbuf_addf(err,
 			    "couldn't write '%s'", get_lock_file_path(&lock->lk));
@@ -2545,6 +2592,7 @@ static enum ref_transaction_error check_old_oid(struct ref_update *update,
 struct files_transaction_backend_data {
 	struct ref_transaction *packed_transaction;
 	int packed_refs_locked;
+	int batch_fsync;
 	struct strmap ref_locks;
 };
 
@@ -2743,7 +2791,7 @@ static enum ref_transaction_error lock_ref_for_update(struct files_ref_store *re
 			ret = write_ref_to_lockfile(
 				refs, lock, &update->new_oid,
 				update->flags & REF_SKIP_OID_VERIFICATION,
-				err);
+				&backend_data->batch_fsync, err);
 			if (ret) {
 				char *write_err = strbuf_detach(err, NULL);
 
@@ -3218,6 +3266,11 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	backend_data = transaction->backend_data;
 	packed_transaction = backend_data->packed_transaction;
 
+	if (backend_data->batch_fsync && flush_batch_fsync(refs, err)) {
+		ret = REF_TRANSACTION_ERROR_GENERIC;
+		goto cleanup;
+	}
+
 	/* Perform updates first so live commits remain referenced */
 	for (i = 0; i < transaction->nr; i++) {
 		struct ref_update *update = transaction->updates[i];
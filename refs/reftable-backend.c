@@ -21,6 +21,7 @@
 #include "../reftable/reftable-error.h"
 #include "../reftable/reftable-iterator.h"
 #include "../repo-settings.h"
+#include "../run-command.h"
 #include "../setup.h"
 #include "../strmap.h"
 #include "../trace2.h"
@@ -141,6 +142,18 @@ struct reftable_ref_store {
 	struct strmap worktree_backends;
 	struct reftable_write_options write_options;
 
+	/*
+	 * When to compact the stacks after appending a table to them. With
+	 * `REFTABLE_AUTO_COMPACTION_DETACH`, the writer spawns a detached
+	 * `git pack-refs --auto` instead of compacting the stack itself, so
+	 * that it does not have to wait for the compaction to finish.
+	 */
+	enum {
+		REFTABLE_AUTO_COMPACTION_INLINE,
+		REFTABLE_AUTO_COMPACTION_DETACH,
+		REFTABLE_AUTO_COMPACTION_NONE,
+	} auto_compaction;
+
 	unsigned int store_flags;
 	enum log_refs_config log_all_ref_updates;
 	int err;
@@ -315,9 +328,10 @@ static void fill_reftable_log_record(struct reftable_log_record *log, const stru
 
 static int reftable_be_config(const char *var, const char *value,
 			      const struct config_context *ctx,
-			      void *_opts)
+			      void *_refs)
 {
-	struct reftable_write_options *opts = _opts;
+	struct reftable_ref_store *refs = _refs;
+	struct reftable_write_options *opts = &refs->write_options;
 
 	if (!strcmp(var, "reftable.blocksize")) {
 		unsigned long block_size = git_config_ulong(var, value, ctx->kvi);
@@ -343,6 +357,16 @@ static int reftable_be_config(const char *var, const char *value,
 		if (lock_timeout < 0 && lock_timeout != -1)
 			die("reftable lock timeout does not support negative values other than -1");
 		opts->lock_timeout_ms = lock_timeout;
+	} else if (!strcmp(var, "reftable.autocompaction")) {
+		int v = git_parse_maybe_bool(value);
+		if (value && !strcmp(value, "detach"))
+			refs->auto_compaction = REFTABLE_AUTO_COMPACTION_DETACH;
+		else if (v < 0)
+			die(_("invalid value for '%s': '%s'"),
+			    "reftable.autoCompaction", value);
+		else
+			refs->auto_compaction = v ? REFTABLE_AUTO_COMPACTION_INLINE :
+						    REFTABLE_AUTO_COMPACTION_NONE;
 	}
 
 	return 0;
@@ -381,12 +405,15 @@ static struct ref_store *reftable_be_init(struct repository *repo,
 		BUG("unknown hash algorithm %d", repo->hash_algo->format_id);
 	}
 	refs->write_options.default_permissions = calc_shared_perm(the_repository, 0666 & ~mask);
-	refs->write_options.disable_auto_compact =
-		!git_env_bool("GIT_TEST_REFTABLE_AUTOCOMPACTION", 1);
 	refs->write_options.lock_timeout_ms = 100;
 	refs->write_options.fsync = reftable_be_fsync;
 
-	repo_config(the_repository, reftable_be_config, &refs->write_options);
+	repo_config(the_repository, reftable_be_config, refs);
+
+	if (!git_env_bool("GIT_TEST_REFTABLE_AUTOCOMPACTION", 1))
+		refs->auto_compaction = REFTABLE_AUTO_COMPACTION_NONE;
+	refs->write_options.disable_auto_compact =
+		refs->auto_compaction != REFTABLE_AUTO_COMPACTION_INLINE;
 
 	/*
 	 * It is somewhat unfortunate that we have to mirror the default block
@@ -1655,14 +1682,63 @@ static int write_transaction_table(struct reftable_writer *writer, void *cb_data
 	return ret;
 }
 
-static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
+/*
+ * Report the tables merged and bytes rewritten by compacting `stack` since
+ * `before` was taken.
+ */
+static void trace_compaction_stats(struct reftable_stack *stack,
+				   const struct reftable_compaction_stats *before)
+{
+	struct reftable_compaction_stats *after = reftable_stack_compaction_stats(stack);
+
+	if (after->tables == before->tables)
+		return;
+	trace2_counter_add(TRACE2_COUNTER_ID_REFTABLE_TABLES_COMPACTED,
+			   after->tables - before->tables);
+	trace2_counter_add(TRACE2_COUNTER_ID_REFTABLE_BYTES_COMPACTED,
+			   after->bytes - before->bytes);
+}
+
+/*
+ * Spawn a detached `git pack-refs --auto` if any of the stacks written to
+ * by the transaction has grown out of its geometric sequence.
+ */
+static void maybe_detach_compaction(struct reftable_ref_store *refs,
+				    struct reftable_transaction_data *tx_data)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	size_t i;
+
+	for (i = 0; i < tx_data->args_nr; i++)
+		if (reftable_stack_compaction_required(tx_data->args[i].be->stack) > 0)
+			break;
+	if (i == tx_data->args_nr)
+		return;
+
+	trace2_region_enter("reftable", "detach-compaction", refs->base.repo);
+	cmd.git_cmd = 1;
+	cmd.no_stdin = 1;
+	cmd.no_stdout = 1;
+	strvec_pushl(&cmd.args, "pack-refs", "--auto", "--detach", NULL);
+	if (run_command(&cmd))
+		warning(_("unable to start background compaction of references"));
+	trace2_region_leave("reftable", "detach-compaction", refs->base.repo);
+}
+
+static int reftable_be_transaction_finish(struct ref_store *ref_store,
 					  struct ref_transaction *transaction,
 					  struct strbuf *err)
 {
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "transaction_finish");
 	struct reftable_transaction_data *tx_data = transaction->backend_data;
 	int ret = 0;
 
 	for (size_t i = 0; i < tx_data->args_nr; i++) {
+		struct reftable_stack *stack = tx_data->args[i].be->stack;
+		struct reftable_compaction_stats before =
+			*reftable_stack_compaction_stats(stack);
+
 		tx_data->args[i].max_index = transaction->max_index;
 
 		ret = reftable_addition_add(tx_data->args[i].addition,
@@ -1671,10 +1747,14 @@ static int reftable_be_transaction_finish(struct ref_store *ref_store UNUSED,
 			goto done;
 
 		ret = reftable_addition_commit(tx_data->args[i].addition);
+		trace_compaction_stats(stack, &before);
 		if (ret < 0)
 			goto done;
 	}
 
+	if (refs->auto_compaction == REFTABLE_AUTO_COMPACTION_DETACH)
+		maybe_detach_compaction(refs, tx_data);
+
 done:
 	assert(ret != REFTABLE_API_ERROR);
 	free_transaction_data(tx_data);
@@ -1693,6 +1773,7 @@ static int reftable_be_pack_refs(struct ref_store *ref_store,
 {
 	struct reftable_ref_store *refs =
 		reftable_be_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB, "pack_refs");
+	struct reftable_compaction_stats before;
 	struct reftable_stack *stack;
 	int ret;
 
@@ -1703,10 +1784,12 @@ static int reftable_be_pack_refs(struct ref_store *ref_store,
 	if (!stack)
 		stack = refs->main_backend.stack;
 
+	before = *reftable_stack_compaction_stats(stack);
 	if (opts->flags & PACK_REFS_AUTO)
 		ret = reftable_stack_auto_compact(stack);
 	else
 		ret = reftable_stack_compact_all(stack, NULL);
+	trace_compaction_stats(stack, &before);
 	if (ret < 0) {
 		ret = error(_("unable to compact stack: %s"),
 			    reftable_error_str(ret));
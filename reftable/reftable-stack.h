@@ -123,6 +123,13 @@ int reftable_stack_compact_all(struct reftable_stack *st,
 /* heuristically compact unbalanced table stack. */
 int reftable_stack_auto_compact(struct reftable_stack *st);
 
+/*
+ * Return 1 if reftable_stack_auto_compact() would compact some tables of
+ * the stack, 0 if the stack is already a geometric sequence, or a
+ * negative error code.
+ */
+int reftable_stack_compaction_required(struct reftable_stack *st);
+
 /* delete stale .ref tables. */
 int reftable_stack_clean(struct reftable_stack *st);
 
@@ -141,6 +148,7 @@ struct reftable_compaction_stats {
 	uint64_t bytes; /* total number of bytes written */
 	uint64_t entries_written; /* total number of entries written, including
 				     failures. */
+	uint64_t tables; /* total number of tables merged */
 	int attempts; /* how often we tried to compact */
 	int failures; /* failures happen on concurrent updates */
 };
@@ -1088,6 +1088,7 @@ static int stack_write_compact(struct reftable_stack *st,
 
 	for (size_t i = first; i <= last; i++)
 		st->stats.bytes += st->tables[i]->size;
+	st->stats.tables += subtabs_len;
 	err = reftable_writer_set_limits(wr, st->tables[first]->min_update_index,
 					 st->tables[last]->max_update_index);
 	if (err < 0)
@@ -1660,11 +1661,12 @@ static uint64_t *stack_table_sizes_for_compaction(struct reftable_stack *st)
 	return sizes;
 }
 
-int reftable_stack_auto_compact(struct reftable_stack *st)
+static int stack_suggest_compaction(struct reftable_stack *st,
+				    struct segment *seg)
 {
-	struct segment seg;
 	uint64_t *sizes;
 
+	memset(seg, 0, sizeof(*seg));
 	if (st->merged->tables_len < 2)
 		return 0;
 
@@ -1672,10 +1674,22 @@ int reftable_stack_auto_compact(struct reftable_stack *st)
 	if (!sizes)
 		return REFTABLE_OUT_OF_MEMORY_ERROR;
 
-	seg = suggest_compaction_segment(sizes, st->merged->tables_len,
-					 st->opts.auto_compaction_factor);
+	*seg = suggest_compaction_segment(sizes, st->merged->tables_len,
+					  st->opts.auto_compaction_factor);
 	reftable_free(sizes);
 
+	return 0;
+}
+
+int reftable_stack_auto_compact(struct reftable_stack *st)
+{
+	struct segment seg;
+	int err;
+
+	err = stack_suggest_compaction(st, &seg);
+	if (err < 0)
+		return err;
+
 	if (segment_size(&seg) > 0)
 		return stack_compact_range(st, seg.start, seg.end - 1,
 					   NULL, STACK_COMPACT_RANGE_BEST_EFFORT);
@@ -1683,6 +1697,18 @@ int reftable_stack_auto_compact(struct reftable_stack *st)
 	return 0;
 }
 
+int reftable_stack_compaction_required(struct reftable_stack *st)
+{
+	struct segment seg;
+	int err;
+
+	err = stack_suggest_compaction(st, &seg);
+	if (err < 0)
+		return err;
+
+	return segment_size(&seg) > 0;
+}
+
 struct reftable_compaction_stats *
 reftable_stack_compaction_stats(struct reftable_stack *st)
 {
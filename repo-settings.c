@@ -139,6 +139,9 @@ void prepare_repo_settings(struct repository *r)
 	if (!repo_config_get_ulong(r, "core.deltabasecachelimit", &ulongval))
 		r->settings.delta_base_cache_limit = ulongval;
 
+	if (!repo_config_get_ulong(r, "core.shareddeltabasecachelimit", &ulongval))
+		r->settings.shared_delta_base_cache_limit = ulongval;
+
 	if (!repo_config_get_ulong(r, "core.packedgitwindowsize", &ulongval)) {
 		int pgsz_x2 = getpagesize() * 2;
 
@@ -63,6 +63,7 @@ struct repo_settings {
 	int warn_ambiguous_refs; /* lazily loaded via accessor */
 
 	size_t delta_base_cache_limit;
+	size_t shared_delta_base_cache_limit;
 	size_t packed_git_window_size;
 	size_t packed_git_limit;
 	unsigned long big_file_threshold;
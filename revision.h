@@ -64,6 +64,7 @@ struct string_list;
 struct saved_parents;
 struct bloom_keyvec;
 struct bloom_filter_settings;
+struct strmap;
 struct option;
 struct parse_opt_ctx_t;
 define_shared_commit_slab(revision_sources, char *);
@@ -344,6 +345,8 @@ struct rev_info {
 
 	/* line level range that we are chasing */
 	struct decoration line_log_data;
+	/* bloom filter keys for the paths of those ranges, by path */
+	struct strmap *line_log_bloom_keys;
 
 	/* copies of the parent lists, for --full-diff display */
 	struct saved_parents *saved_parents_slab;
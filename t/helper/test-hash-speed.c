@@ -1,5 +1,7 @@
 #include "test-tool.h"
+#include "csum-file.h"
 #include "hash.h"
+#include "trace.h"
 
 #define NUM_SECONDS 3
 
@@ -10,6 +12,40 @@ static inline void compute_hash(const struct git_hash_algo *algo, struct git_has
 	git_hash_final(final, ctx);
 }
 
+/*
+ * Write data through a hashfile to /dev/null in chunks of the given sizes,
+ * optionally with the helper thread, and report the wall-clock throughput.
+ */
+static void hashfile_speed(const struct git_hash_algo *algo, int thread)
+{
+	unsigned bufsizes[] = { 1024, 8192, 65536 };
+	const size_t total = 256 * 1024 * 1024;
+
+	printf("algo: %s (hashfile%s)\n", algo->name, thread ? ", thread" : "");
+
+	for (size_t i = 0; i < ARRAY_SIZE(bufsizes); i++) {
+		unsigned char hash[GIT_MAX_RAWSZ];
+		struct hashfile *f;
+		uint64_t start, elapsed;
+		void *p = xcalloc(1, bufsizes[i]);
+		int fd = xopen("/dev/null", O_WRONLY);
+
+		start = getnanotime();
+		f = hashfd(algo, fd, "/dev/null");
+		if (thread)
+			hashfile_start_thread(f);
+		for (size_t n = 0; n < total; n += bufsizes[i])
+			hashwrite(f, p, bufsizes[i]);
+		finalize_hashfile(f, hash, FSYNC_COMPONENT_NONE, CSUM_CLOSE);
+		elapsed = getnanotime() - start;
+
+		printf("size %u: %lu KiB; %0.2f KiB/s\n", bufsizes[i],
+		       (unsigned long)(total / 1024),
+		       total / 1024.0 / (elapsed / 1e9));
+		free(p);
+	}
+}
+
 int cmd__hash_speed(int ac, const char **av)
 {
 	struct git_hash_ctx ctx;
@@ -18,6 +54,18 @@ int cmd__hash_speed(int ac, const char **av)
 	unsigned bufsizes[] = { 64, 256, 1024, 8192, 16384 };
 	void *p;
 	const struct git_hash_algo *algo = NULL;
+	int hashfile = 0, thread = 0;
+
+	if (ac > 1 && !strcmp(av[1], "--hashfile")) {
+		hashfile = 1;
+		ac--;
+		av++;
+		if (ac > 1 && !strcmp(av[1], "--thread")) {
+			thread = 1;
+			ac--;
+			av++;
+		}
+	}
 
 	if (ac == 2) {
 		for (size_t i = 1; i < GIT_HASH_NALGOS; i++) {
@@ -28,7 +76,12 @@ int cmd__hash_speed(int ac, const char **av)
 		}
 	}
 	if (!algo)
-		die("usage: test-tool hash-speed algo_name");
+		die("usage: test-tool hash-speed [--hashfile [--thread]] algo_name");
+
+	if (hashfile) {
+		hashfile_speed(algo, thread);
+		return 0;
+	}
 
 	/* Use this as an offset to make overflow less likely. */
 	initial = clock();
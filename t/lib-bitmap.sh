@@ -147,6 +147,19 @@ rev_list_tests_head () {
 		test_cmp expect actual
 	'
 
+	test_expect_success "counting sides of non-linear history ($state, $branch)" '
+		for range in other...second "other...second $branch~2" \
+			     "other...second ^$branch~3" "other second"
+		do
+			for opt in --left-right --left-only --right-only
+			do
+				git rev-list --count $opt $range >expect &&
+				git rev-list --use-bitmap-index --count $opt $range >actual &&
+				test_cmp expect actual || return 1
+			done || return 1
+		done
+	'
+
 	test_expect_success "counting commits with limiting ($state, $branch)" '
 		git rev-list --count $branch -- 1.t >expect &&
 		git rev-list --use-bitmap-index --count $branch -- 1.t >actual &&
@@ -159,6 +172,16 @@ rev_list_tests_head () {
 		test_cmp expect actual
 	'
 
+	test_expect_success "counting objects of one side ($state, $branch)" '
+		for opt in --left-only --right-only
+		do
+			git rev-list --count --objects $opt other...second >expect &&
+			git rev-list --use-bitmap-index --count --objects $opt \
+				other...second >actual &&
+			test_cmp expect actual || return 1
+		done
+	'
+
 	test_expect_success "enumerate commits ($state, $branch)" '
 		git rev-list --use-bitmap-index $branch >actual &&
 		git rev-list $branch >expect &&
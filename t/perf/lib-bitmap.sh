@@ -25,6 +25,21 @@ test_full_bitmap () {
 		git rev-list --all --use-bitmap-index --objects >/dev/null
 	'
 
+	test_perf 'rev-list count (objects)' '
+		git rev-list --all --use-bitmap-index --count --objects >/dev/null
+	'
+
+	test_perf 'rev-list count (left-right)' '
+		git rev-list --use-bitmap-index --count --left-right \
+			HEAD~100...HEAD >/dev/null
+	'
+
+	test_perf 'rev-list count (left-right, side branch)' '
+		side=$(git rev-list -1 --merges HEAD~100) &&
+		git rev-list --use-bitmap-index --count --left-right \
+			$side^2...HEAD >/dev/null
+	'
+
 	test_perf 'rev-list with tag negated via --not --all (objects)' '
 		git rev-list perf-tag --not --all --use-bitmap-index --objects >/dev/null
 	'
@@ -14,6 +14,9 @@ depth of 50.
 The setting of core.deltaBaseCacheLimit in the source repository is also
 relevant (depending on the size of your test repo), so be sure it is consistent
 between runs.
+
+The last tests emulate a server with many concurrent, short-lived readers,
+with and without core.sharedDeltaBaseCacheLimit.
 '
 . ./perf-lib.sh
 
@@ -28,4 +31,37 @@ test_perf 'log -S' '
 	git log --raw -Sfoo >/dev/null
 '
 
+test_expect_success 'split deltified blobs among readers' '
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(deltabase)" |
+	awk "\$2 == \"blob\" && \$3 !~ /^0+\$/ { print \$1 }" |
+	head -n 4000 >blobs &&
+	for i in 0 1 2 3 4 5 6 7
+	do
+		awk "NR % 8 == $i" blobs >blobs.$i || return 1
+	done
+'
+
+for limit in 0 256m
+do
+	test_perf --setup "rm -f \"\$(git rev-parse --git-path objects/info/delta-base-cache)\"" \
+		"8 concurrent readers (shared cache: $limit, cold)" "
+		for i in 0 1 2 3 4 5 6 7
+		do
+			git -c core.sharedDeltaBaseCacheLimit=$limit \
+				cat-file --batch <blobs.\$i >/dev/null &
+		done &&
+		wait
+	"
+
+	test_perf "8 concurrent readers (shared cache: $limit, warm)" "
+		for i in 0 1 2 3 4 5 6 7
+		do
+			git -c core.sharedDeltaBaseCacheLimit=$limit \
+				cat-file --batch <blobs.\$i >/dev/null &
+		done &&
+		wait
+	"
+done
+
 test_done
@@ -32,19 +32,30 @@ setup_repo () {
 test_perf_fsync_cfgs () {
 	local method &&
 	local cfg &&
-	for method in none fsync batch writeout-only
+	local label &&
+	for method in none fsync batch writeout-only batch-threads none-threads
 	do
+		label="fsyncMethod=$method" &&
 		case $method in
 		none)
 			cfg="-c core.fsync=none"
 			;;
+		batch-threads)
+			label="fsyncMethod=batch, looseObjectWriteThreads=0" &&
+			cfg="-c core.fsync=loose-object -c core.fsyncMethod=batch" &&
+			cfg="$cfg -c core.looseObjectWriteThreads=0"
+			;;
+		none-threads)
+			label="fsyncMethod=none, looseObjectWriteThreads=0" &&
+			cfg="-c core.fsync=none -c core.looseObjectWriteThreads=0"
+			;;
 		*)
 			cfg="-c core.fsync=loose-object -c core.fsyncMethod=$method"
 		esac &&
 
 		# Set GIT_TEST_FSYNC=1 explicitly since fsync is normally
 		# disabled by t/test-lib.sh.
-		if ! test_perf "$1 (fsyncMethod=$method)" \
+		if ! test_perf "$1 ($label)" \
 						--setup "$2" \
 						"GIT_TEST_FSYNC=1 git $cfg $3"
 		then
@@ -9,4 +9,41 @@ test_perf 'cat-file --batch-check' '
 	git cat-file --batch-all-objects --batch-check
 '
 
+test_expect_success 'setup list of objects' '
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >objects
+'
+
+test_perf 'cat-file --batch' '
+	git cat-file --batch --buffer <objects >/dev/null
+'
+
+test_perf 'cat-file --batch --read-ahead' '
+	git cat-file --batch --read-ahead=4096 <objects >/dev/null
+'
+
+test_perf 'cat-file --batch --parallel' '
+	git cat-file --batch --parallel=0 <objects >/dev/null
+'
+
+test_perf 'cat-file --batch --parallel --read-ahead' '
+	git cat-file --batch --parallel=0 --read-ahead=4096 <objects >/dev/null
+'
+
+# The cases below inflate every object exactly once, which makes them the
+# ones to look at when comparing builds with and without USE_LIBDEFLATE.
+test_expect_success 'setup loose objects' '
+	git init --bare loose.git &&
+	head -n 20000 objects |
+	git pack-objects --stdout >subset.pack &&
+	git -C loose.git unpack-objects <subset.pack
+'
+
+test_perf 'cat-file --batch (packed, unordered)' '
+	git cat-file --batch-all-objects --batch --unordered >/dev/null
+'
+
+test_perf 'cat-file --batch (loose)' '
+	git -C loose.git cat-file --batch-all-objects --batch >/dev/null
+'
+
 test_done
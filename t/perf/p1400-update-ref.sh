@@ -14,7 +14,11 @@ test_expect_success "setup" '
 		printf "start\ncreate refs/heads/%d PRE\ncommit\n" $i &&
 		printf "start\nupdate refs/heads/%d POST PRE\ncommit\n" $i &&
 		printf "start\ndelete refs/heads/%d POST\ncommit\n" $i || return 1
-	done >instructions
+	done >instructions &&
+	for i in $(test_seq 5000)
+	do
+		echo "create refs/heads/batch/$i PRE" || return 1
+	done >batch
 '
 
 test_perf "update-ref" '
@@ -30,4 +34,18 @@ test_perf "update-ref --stdin" '
 	git update-ref --stdin <instructions >/dev/null
 '
 
+# Set GIT_TEST_FSYNC=1 explicitly since fsync is normally disabled by
+# t/test-lib.sh.
+for method in fsync batch
+do
+	test_perf "update-ref --stdin, one transaction (fsyncMethod=$method)" \
+		--setup '
+		git for-each-ref --format="delete %(refname)" refs/heads/batch/ |
+		git update-ref --stdin
+	' "
+		GIT_TEST_FSYNC=1 git -c core.fsync=reference \
+			-c core.fsyncMethod=$method update-ref --stdin <batch
+	"
+done
+
 test_done
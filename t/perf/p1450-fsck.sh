@@ -10,4 +10,11 @@ test_perf 'fsck' '
 	git fsck
 '
 
+for threads in 1 2 4 8
+do
+	test_perf "fsck with $threads threads" "
+		git fsck --threads=$threads
+	"
+done
+
 test_done
@@ -78,4 +78,29 @@ test_perf 'is-base check: git for-each-ref (disjoint-base)' '
 	git for-each-ref --format="%(is-base:refs/heads/disjoint-base)" --stdin <refs
 '
 
+test_expect_success 'setup many refs' '
+	git rev-list HEAD | head -n 50000 >commits &&
+	for n in 10000 50000
+	do
+		awk -v n=$n "{ c[NR] = \$0 }
+			END { for (i = 0; i < n; i++)
+				print \"create refs/many-\" n \"/\" i, c[i % NR + 1] }" \
+			commits | git update-ref --stdin || return 1
+	done &&
+	git pack-refs --all
+'
+
+for n in 10000 50000
+do
+	test_perf "ahead-behind counts: git for-each-ref ($n refs, 1 thread)" "
+		git -c core.aheadBehindThreads=1 for-each-ref \
+			--format='%(ahead-behind:HEAD)' refs/many-$n/ >/dev/null
+	"
+
+	test_perf "ahead-behind counts: git for-each-ref ($n refs, threads)" "
+		git -c core.aheadBehindThreads=0 for-each-ref \
+			--format='%(ahead-behind:HEAD)' refs/many-$n/ >/dev/null
+	"
+done
+
 test_done
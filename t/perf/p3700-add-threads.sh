@@ -0,0 +1,24 @@
+#!/bin/sh
+
+test_description="Test adding a whole worktree with multiple hashing threads"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'set up a worktree outside of the repository' '
+	mkdir fresh &&
+	git archive HEAD | tar -C fresh -xf -
+'
+
+for threads in 1 2 4 8
+do
+	test_perf "add with $threads threads" --setup "
+		rm -rf fresh/.git &&
+		git init -q fresh
+	" "
+		git -C fresh -c index.hashThreads=$threads add .
+	"
+done
+
+test_done
@@ -26,4 +26,16 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_expect_success 'setup large generated files' '
+	test_seq 400000 | sed "s/.*/	value_& = compute(&, &&&);/" >large.old &&
+	awk -v s=" // changed" "NR % 50 == 0 { \$0 = \$0 s } 1" <large.old >large.new
+'
+
+for opt in "" -w --ignore-space-change --ignore-space-at-eol
+do
+	test_perf "diff --no-index $opt (large file)" "
+		test_expect_code 1 git diff --no-index $opt large.old large.new >/dev/null
+	"
+done
+
 test_done
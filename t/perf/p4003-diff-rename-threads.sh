@@ -0,0 +1,37 @@
+#!/bin/sh
+
+test_description="Test inexact rename detection with multiple threads"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+nr_files=${GIT_PERF_RENAME_FILES:-2000}
+
+test_expect_success "setup a commit that renames and edits $nr_files files" '
+	git ls-tree -r HEAD |
+	sed -n "s/^100644 blob \([0-9a-f]*\)	/\1 /p" |
+	head -n $nr_files >blobs &&
+	while read oid path
+	do
+		new=$({ git cat-file blob $oid && echo edited; } |
+		      git hash-object -w --stdin) &&
+		printf "0 %s\t%s\n" $ZERO_OID "$path" &&
+		printf "100644 %s\tmoved/%s.renamed\n" $new \
+			"$(echo "$path" | tr / _)" || return 1
+	done <blobs >index-info &&
+	GIT_INDEX_FILE=renamed-index git read-tree HEAD &&
+	GIT_INDEX_FILE=renamed-index git update-index --index-info <index-info &&
+	tree=$(GIT_INDEX_FILE=renamed-index git write-tree) &&
+	git commit-tree -p HEAD -m renamed $tree >renamed-commit
+'
+
+for threads in 1 2 4 8
+do
+	test_perf "diff -M with $threads threads" "
+		git -c diff.renameThreads=$threads diff --raw -M -l0 \
+			HEAD \$(cat renamed-commit) >/dev/null
+	"
+done
+
+test_done
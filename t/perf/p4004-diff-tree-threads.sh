@@ -0,0 +1,25 @@
+#!/bin/sh
+
+test_description="Test recursive tree diffs with multiple threads"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup an empty tree to diff against' '
+	git hash-object -t tree -w /dev/null >empty-tree
+'
+
+for threads in 1 2 4 8
+do
+	test_perf "diff-tree -r of the whole tree with $threads threads" "
+		git -c diff.treeThreads=$threads diff-tree -r \
+			\$(cat empty-tree) HEAD >/dev/null
+	"
+
+	test_perf "log --raw with $threads threads" "
+		git -c diff.treeThreads=$threads log --raw -100 >/dev/null
+	"
+done
+
+test_done
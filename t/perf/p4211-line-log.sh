@@ -31,6 +31,31 @@ test_perf 'git log -L (renames on)' '
 	git log -M -L 1:"$file" >/dev/null
 '
 
+test_perf 'git blame (renames on)' '
+	git blame -- "$file" >/dev/null
+'
+
+test_expect_success 'write commit-graph with changed-path Bloom filters' '
+	git commit-graph write --reachable --changed-paths
+'
+
+test_perf 'git log -L (renames off, Bloom filters)' '
+	git log --no-renames -L 1:"$file" >/dev/null
+'
+
+test_perf 'git log -L (renames on, Bloom filters)' '
+	git log -M -L 1:"$file" >/dev/null
+'
+
+test_perf 'git blame (renames on, Bloom filters)' '
+	git blame -- "$file" >/dev/null
+'
+
+test_expect_success 'remove commit-graph' '
+	rm -f .git/objects/info/commit-graph &&
+	rm -rf .git/objects/info/commit-graphs
+'
+
 test_perf 'git log --oneline --raw --parents' '
 	git log --oneline --raw --parents >/dev/null
 '
@@ -47,4 +47,34 @@ test_perf 'index-pack default number of threads' \
 	GIT_DIR=repo.git git index-pack --stdin < $PACK
 '
 
+# Writing out a pack that is mostly reused is dominated by hashing and
+# writing, which pack.hashThread moves off the main thread.
+for v in false true
+do
+	test_perf "pack-objects (pack.hashThread=$v)" \
+		--setup 'rm -f tmp-*.pack tmp-*.idx' "
+		git -c pack.hashThread=$v pack-objects --revs --all tmp </dev/null
+	"
+done
+
+# Long delta chains make resolve_deltas() dominate, which is where the
+# threads are supposed to pay off.
+test_expect_success 'repack with long delta chains' '
+	git repack -adf --depth=250 --window=50 &&
+	DEEP_PACK=$(ls .git/objects/pack/*.pack | head -n1) &&
+	test -f "$DEEP_PACK" &&
+	export DEEP_PACK
+'
+
+for t in $threads
+do
+	THREADS=$t
+	export THREADS
+	test_perf "index-pack $t threads (long delta chains)" \
+		--setup 'rm -rf repo.git && git init --bare repo.git' '
+		GIT_DIR=repo.git GIT_FORCE_THREADS=1 \
+		git index-pack --threads=$THREADS --stdin <$DEEP_PACK
+	'
+done
+
 test_done
@@ -31,10 +31,26 @@ test_lookup_pack_bitmap () {
 		git config pack.writeBitmapLookupTable '"$1"'
 	'
 
+	test_expect_success "use roaring bitmaps: ${2:-false}" '
+		git config pack.writeBitmapRoaring '"${2:-false}"'
+	'
+
 	test_pack_bitmap
+
+	test_size "bitmap size (lookup=$1, roaring=${2:-false})" '
+		test_file_size .git/objects/pack/pack-*.bitmap
+	'
+
+	# HEAD~100 is the tip of the bitmapped pack, so this mostly
+	# measures loading the bitmaps
+	test_perf "load bitmaps (lookup=$1, roaring=${2:-false})" '
+		git rev-list --use-bitmap-index --count HEAD~100 >/dev/null
+	'
 }
 
 test_lookup_pack_bitmap false
 test_lookup_pack_bitmap true
+test_lookup_pack_bitmap false true
+test_lookup_pack_bitmap true true
 
 test_done
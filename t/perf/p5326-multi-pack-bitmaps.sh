@@ -6,8 +6,9 @@ test_description='Tests performance using midx bitmaps'
 
 test_bitmap () {
 	local enabled="$1"
+	local roaring="${2:-false}"
 
-	test_expect_success "remove existing repo (lookup=$enabled)" '
+	test_expect_success "remove existing repo (lookup=$enabled, roaring=$roaring)" '
 		rm -fr * .git
 	'
 
@@ -23,14 +24,22 @@ test_bitmap () {
 		git config pack.writeBitmapLookupTable '"$enabled"'
 	'
 
+	test_expect_success "use roaring bitmaps: $roaring" '
+		git config pack.writeBitmapRoaring '"$roaring"'
+	'
+
 	test_expect_success "start with bitmapped pack (lookup=$enabled)" '
 		git repack -adb
 	'
 
-	test_perf "setup multi-pack index (lookup=$enabled)" '
+	test_perf "setup multi-pack index (lookup=$enabled, roaring=$roaring)" '
 		git multi-pack-index write --bitmap
 	'
 
+	test_size "midx bitmap size (lookup=$enabled, roaring=$roaring)" '
+		test_file_size .git/objects/pack/multi-pack-index-*.bitmap
+	'
+
 	test_expect_success "drop pack bitmap (lookup=$enabled)" '
 		rm -f .git/objects/pack/pack-*.bitmap
 	'
@@ -63,5 +72,6 @@ test_bitmap () {
 
 test_bitmap false
 test_bitmap true
+test_bitmap true true
 
 test_done
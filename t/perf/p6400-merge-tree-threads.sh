@@ -0,0 +1,75 @@
+#!/bin/sh
+
+test_description='Test merge-tree on a wide tree with multiple threads'
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+nr_dirs=${GIT_PERF_MERGE_DIRS:-500}
+nr_files=${GIT_PERF_MERGE_FILES:-100}
+
+# Print the contents of a generated file as fast-import inline data.
+# Side 1 renames and edits one file in every directory and modifies
+# another one; side 2 modifies a third one and adds a new file.
+generate_history () {
+	awk -v dirs=$nr_dirs -v files=$nr_files '
+	function file(path, extra,    i) {
+		print "M 100644 inline " path
+		print "data <<EOF"
+		for (i = 0; i < 20; i++)
+			print path " line " i
+		if (extra != "")
+			print extra
+		print "EOF"
+	}
+	function commit(ref, from, msg) {
+		print "commit " ref
+		if (from == "")
+			print "mark :1"
+		print "committer C O Mitter <committer@example.com> 1112912053 -0700"
+		print "data <<EOF"
+		print msg
+		print "EOF"
+		if (from != "")
+			print "from " from
+	}
+	BEGIN {
+		commit("refs/heads/base", "", "base")
+		for (d = 0; d < dirs; d++)
+			for (f = 0; f < files; f++)
+				file("dir" d "/sub/file" f, "")
+
+		commit("refs/heads/side1", ":1", "side1")
+		for (d = 0; d < dirs; d++) {
+			print "D dir" d "/sub/file1"
+			file("dir" d "/sub/moved1", "side1 edit")
+			file("dir" d "/sub/file3", "side1 edit")
+		}
+
+		commit("refs/heads/side2", ":1", "side2")
+		for (d = 0; d < dirs; d++) {
+			file("dir" d "/sub/file2", "side2 edit")
+			file("dir" d "/sub/new", "")
+		}
+	}'
+}
+
+test_expect_success "setup $nr_dirs directories of $nr_files files" '
+	generate_history | git fast-import --quiet &&
+	git merge-tree --write-tree side1 side2 >expect
+'
+
+for threads in 1 2 4 8
+do
+	test_perf "merge-tree --write-tree with $threads threads" "
+		git -c merge.threads=$threads merge-tree --write-tree \
+			side1 side2 >actual
+	"
+
+	test_expect_success "result with $threads threads is unchanged" '
+		test_cmp expect actual
+	'
+done
+
+test_done
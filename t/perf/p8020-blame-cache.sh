@@ -0,0 +1,35 @@
+#!/bin/sh
+
+test_description="Test git blame with and without blame.cache"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup' '
+	# the file touched by the most of the last 1000 commits
+	file=$(git log --format= --name-only -1000 HEAD |
+	       sort | uniq -c | sort -nr | sed -n "1s/^ *[0-9]* //p") &&
+	echo "$file" >blamed-path &&
+	test -n "$file" &&
+	git rev-list -n 1 HEAD -- "$file" >tip &&
+	git rev-list -n 20 HEAD -- "$file" | sed -n "\$p" >older &&
+	git -c blame.cache=true blame $(cat older) -- "$file" >/dev/null &&
+	mv .git/blame-cache warm-cache
+'
+
+test_perf 'blame without a cache' '
+	git blame $(cat tip) -- "$(cat blamed-path)" >/dev/null
+'
+
+test_perf 'blame with a cached result 20 changes back' '
+	rm -rf .git/blame-cache &&
+	cp -R warm-cache .git/blame-cache &&
+	git -c blame.cache=true blame $(cat tip) -- "$(cat blamed-path)" >/dev/null
+'
+
+test_perf 'blame with a cached result at the same commit' '
+	git -c blame.cache=true blame $(cat tip) -- "$(cat blamed-path)" >/dev/null
+'
+
+test_done
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+test_description="Test git blame -C with and without threads"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup' '
+	# the file touched by the most of the last 100 commits
+	file=$(git log --format= --name-only -100 HEAD |
+	       sort | uniq -c | sort -nr | sed -n "1s/^ *[0-9]* //p") &&
+	echo "$file" >blamed-path &&
+	test -n "$file" &&
+	git rev-list -n 10 HEAD -- "$file" | sed -n "\$p" >bottom
+'
+
+test_perf 'blame -C -C with blame.threads=1' '
+	git -c blame.threads=1 blame -C -C \
+		$(cat bottom).. -- "$(cat blamed-path)" >/dev/null
+'
+
+test_perf 'blame -C -C with blame.threads=0' '
+	git -c blame.threads=0 blame -C -C \
+		$(cat bottom).. -- "$(cat blamed-path)" >/dev/null
+'
+
+test_perf 'blame -C -C -C with blame.threads=1' '
+	git -c blame.threads=1 blame -C -C -C \
+		$(cat bottom).. -- "$(cat blamed-path)" >/dev/null
+'
+
+test_perf 'blame -C -C -C with blame.threads=0' '
+	git -c blame.threads=0 blame -C -C -C \
+		$(cat bottom).. -- "$(cat blamed-path)" >/dev/null
+'
+
+test_done
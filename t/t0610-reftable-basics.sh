@@ -355,6 +355,70 @@ test_expect_success 'ref transaction: env var disables compaction' '
 	test_line_count -lt $expected repo/.git/reftable/tables.list
 '
 
+test_expect_success 'ref transaction: reftable.autoCompaction=false defers compaction' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	git -C repo config reftable.autoCompaction false &&
+
+	start=$(wc -l <repo/.git/reftable/tables.list) &&
+	iterations=5 &&
+	expected=$((start + iterations)) &&
+
+	for i in $(test_seq $iterations)
+	do
+		git -C repo update-ref branch-$i HEAD || return 1
+	done &&
+	test_line_count = $expected repo/.git/reftable/tables.list &&
+
+	git -C repo pack-refs --auto &&
+	test_line_count -lt $expected repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: reftable.autoCompaction=detach compacts in the background' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	git -C repo config reftable.autoCompaction detach &&
+
+	git -C repo update-ref branch-1 HEAD &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref branch-2 HEAD &&
+	test_subcommand git pack-refs --auto --detach <trace2.txt &&
+
+	# Wait for the background compaction to finish.
+	for i in $(test_seq 30)
+	do
+		if test $(wc -l <repo/.git/reftable/tables.list) = 1
+		then
+			break
+		fi &&
+		sleep 1 || return 1
+	done &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: invalid reftable.autoCompaction' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	test_must_fail git -C repo -c reftable.autoCompaction=sometimes \
+		update-ref refs/heads/foo HEAD 2>err &&
+	test_grep "invalid value for .reftable.autoCompaction." err
+'
+
+test_expect_success 'ref transaction: compaction is reported via trace2' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo --no-tag A &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/foo HEAD &&
+	grep "\"category\":\"reftable\",\"name\":\"tables_compacted\",\"count\":2" trace2.txt &&
+	grep "\"category\":\"reftable\",\"name\":\"bytes_compacted\"" trace2.txt
+'
+
 test_expect_success 'ref transaction: alternating table sizes are compacted' '
 	test_when_finished "rm -rf repo" &&
 
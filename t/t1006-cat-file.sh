@@ -1446,4 +1446,67 @@ test_objects_filter "object:type=commit"
 test_objects_filter "object:type=tag"
 test_objects_filter "object:type=tree"
 
+test_expect_success 'setup requests for --parallel' '
+	git -C repo rev-list --objects --no-object-names --all >requests &&
+	cat >>requests <<-EOF &&
+	$(test_oid deadbeef)
+	HEAD:large.1000 with rest
+	HEAD:does-not-exist
+	HEAD
+	EOF
+	git -C repo cat-file --batch <requests >expect.contents &&
+	git -C repo cat-file \
+		--batch-check="%(objectname) %(objecttype) %(objectsize) %(rest)" \
+		<requests >expect.info
+'
+
+for opts in "--parallel=3" "--read-ahead=4" "--parallel=2 --read-ahead=5" "--parallel=0"
+do
+	test_expect_success "--batch $opts" '
+		git -C repo cat-file --batch $opts <requests >actual &&
+		test_cmp expect.contents actual
+	'
+
+	test_expect_success "--batch-check $opts" '
+		git -C repo cat-file $opts \
+			--batch-check="%(objectname) %(objecttype) %(objectsize) %(rest)" \
+			<requests >actual &&
+		test_cmp expect.info actual
+	'
+done
+
+test_expect_success '--parallel streams large blobs' '
+	git -C repo -c core.bigFileThreshold=2k \
+		cat-file --batch --parallel=3 <requests >actual &&
+	test_cmp expect.contents actual
+'
+
+test_expect_success '--parallel with objects filter' '
+	git -C repo cat-file --batch --filter=blob:limit=1k <requests >expect &&
+	git -C repo cat-file --batch --parallel=3 --filter=blob:limit=1k \
+		<requests >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--parallel with -Z' '
+	tr "\n" "\0" <requests >requests.nul &&
+	git -C repo cat-file --batch -Z <requests.nul >expect &&
+	git -C repo cat-file --batch -Z --parallel=3 <requests.nul >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--parallel is incompatible with some options' '
+	test_must_fail git -C repo cat-file --batch-command --parallel=2 \
+		</dev/null 2>err &&
+	test_grep "cannot be used together" err &&
+	test_must_fail git -C repo cat-file --batch --batch-all-objects \
+		--read-ahead=2 2>err &&
+	test_grep "cannot be used together" err &&
+	test_must_fail git -C repo cat-file --batch --use-mailmap \
+		--parallel=2 </dev/null 2>err &&
+	test_grep "cannot be used together" err &&
+	test_must_fail git -C repo cat-file -e --parallel=2 HEAD 2>err &&
+	test_grep "requires a batch mode" err
+'
+
 test_done
@@ -2368,4 +2368,53 @@ test_expect_success REFFILES 'empty directories are pruned when not committing'
 	test_path_is_missing .git/refs/heads/nested
 '
 
+check_fsync_events () {
+	local trace="$1" &&
+	shift &&
+
+	cat >expect &&
+	sed -n \
+		-e '/^{"event":"counter",.*"category":"fsync",/ {
+			s/.*"category":"fsync",//;
+			s/}$//;
+			p;
+		}' \
+		<"$trace" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success REFFILES 'core.fsyncMethod=batch flushes a transaction once' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	test_commit -C repo initial &&
+	for i in 1 2 3
+	do
+		echo "create refs/heads/batch-$i HEAD" || return 1
+	done >instructions &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+	GIT_TEST_FSYNC=true \
+		git -C repo -c core.fsync=reference -c core.fsyncMethod=batch \
+		update-ref --stdin <instructions &&
+	if grep "core.fsyncMethod = batch is unsupported" trace2.txt
+	then
+		flush_count=3
+	else
+		flush_count=1
+	fi &&
+	check_fsync_events trace2.txt <<-EOF &&
+	"name":"writeout-only","count":3
+	"name":"hardware-flush","count":$flush_count
+	EOF
+
+	git -C repo rev-parse HEAD >expect &&
+	for i in 1 2 3
+	do
+		git -C repo rev-parse batch-$i || return 1
+	done >actual.raw &&
+	sort -u actual.raw >actual &&
+	test_cmp expect actual &&
+	ls repo/.git >files &&
+	! grep bulk_fsync files
+'
+
 test_done
@@ -814,6 +814,36 @@ test_expect_success 'fsck fails on corrupt packfile' '
 	test_grep "checksum mismatch" out
 '
 
+test_expect_success 'fsck verifies packs with several threads' '
+	git init threaded &&
+	(
+		cd threaded &&
+		for i in $(test_seq 300)
+		do
+			echo "blob $i" >file &&
+			git hash-object -w file || return 1
+		done >blobs &&
+		git commit-tree -m one $(git mktree </dev/null) >commits &&
+		pack=$(cat blobs commits | git pack-objects .git/objects/pack/pack) &&
+		git prune-packed &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace" git fsck --threads=4 2>out &&
+		! grep -e error -e corrupt out &&
+		grep "\"key\":\"verify-pack/threads\",\"value\":\"4\"" trace &&
+
+		# corrupt an object in the middle of the pack
+		offset=$(git show-index <.git/objects/pack/pack-$pack.idx |
+			 sort -n | sed -n "150s/ .*//p") &&
+		chmod a+w .git/objects/pack/pack-$pack.pack &&
+		printf "\377" |
+		dd of=.git/objects/pack/pack-$pack.pack bs=1 conv=notrunc \
+			seek=$((offset + 2)) &&
+		test_must_fail git fsck --threads=4 2>out &&
+		test_grep "checksum mismatch" out &&
+		test_grep "index CRC mismatch" out
+	)
+'
+
 test_expect_success 'fsck finds problems in duplicate loose objects' '
 	rm -rf broken-duplicate &&
 	git init broken-duplicate &&
@@ -71,6 +71,18 @@ test_expect_success 'git update-index: core.fsyncmethod=batch' "
 	test_cmp added_files2_oids added_files2_actual
 "
 
+test_expect_success 'git add: core.looseObjectWriteThreads' "
+	test_create_unique_files 2 4 files_base_dir3 &&
+	GIT_TEST_FSYNC=1 git $BATCH_CONFIGURATION \
+		-c core.looseObjectWriteThreads=4 add -- ./files_base_dir3/ &&
+	git ls-files --stage files_base_dir3/ |
+	test_parse_ls_files_stage_oids >added_files3_oids &&
+	test_line_count = 8 added_files3_oids &&
+	git cat-file --batch-check='%(objectname)' <added_files3_oids >added_files3_actual &&
+	test_cmp added_files3_oids added_files3_actual &&
+	git fsck --connectivity-only --no-dangling
+"
+
 test_expect_success \
 	'git add: Test that executable bit is not used if core.filemode=0' \
 	'git config core.filemode 0 &&
@@ -541,6 +553,39 @@ test_expect_success 'all statuses changed in folder if . is given' '
 	)
 '
 
+test_expect_success 'git add: index.hashThreads' '
+	git init hash-threads &&
+	(
+		cd hash-threads &&
+		test_create_unique_files 2 4 files &&
+		printf "line\r\n" >files/crlf.crlf &&
+		echo "*.crlf text eol=lf" >.gitattributes &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace" \
+			git -c index.hashThreads=4 add . &&
+		grep "\"key\":\"prehash/files\",\"value\":\"9\"" ../trace &&
+		printf "line\n" >../expect &&
+		git cat-file blob :files/crlf.crlf >../actual &&
+		test_cmp ../expect ../actual &&
+
+		for f in files/*/*
+		do
+			git hash-object "$f" >../expect &&
+			git rev-parse ":$f" >../actual &&
+			test_cmp ../expect ../actual || return 1
+		done &&
+
+		for f in files/*/*
+		do
+			echo more >>"$f" || return 1
+		done &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace.update" \
+			git -c index.hashThreads=4 add -u &&
+		grep "\"key\":\"prehash/files\"" ../trace.update &&
+		git diff-files --exit-code &&
+		git fsck --no-dangling
+	)
+'
+
 test_expect_success CASE_INSENSITIVE_FS 'path is case-insensitive' '
 	path="$(pwd)/BLUB" &&
 	touch "$path" &&
@@ -309,4 +309,38 @@ test_expect_success 'last line matters too' '
 	test_cmp expected actual.munged
 '
 
+test_expect_success 'threaded rename detection matches serial result' '
+	mkdir threads &&
+	for i in $(test_seq 100)
+	do
+		test_seq $i $((i + 50)) >threads/file$i || return 1
+	done &&
+	git add threads &&
+	git commit -m "add files for threaded rename detection" &&
+	for i in $(test_seq 100)
+	do
+		echo edited >>threads/file$i &&
+		git mv threads/file$i threads/moved$((i % 7))-$i || return 1
+	done &&
+	cp threads/moved1-1 threads/copy &&
+	git add threads &&
+	git commit -m "move and edit files" &&
+	git -c diff.renameThreads=1 diff-tree -r -M -C -C -l0 \
+		--name-status HEAD^ HEAD >expect &&
+	grep "^R" expect &&
+	grep "^C" expect &&
+	for threads in 0 2 4 8
+	do
+		git -c diff.renameThreads=$threads diff-tree -r -M -C -C -l0 \
+			--name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'invalid diff.renameThreads is rejected' '
+	test_must_fail git -c diff.renameThreads=-1 diff-tree -r -M \
+		HEAD^ HEAD 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 test_done
@@ -410,4 +410,53 @@ test_expect_success 'diff can read from stdin' '
 	test_cmp .test-a .test-b
 '
 
+test_expect_success 'diff-tree -r with diff.treeThreads' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in 1 2 3 4 5 6
+		do
+			for j in a b c d
+			do
+				mkdir -p d$i/$j/x d$i/$j/y &&
+				echo $i$j >d$i/$j/x/file &&
+				echo $i$j >d$i/$j/y/file &&
+				echo $i$j >d$i/$j-file || return 1
+			done
+		done &&
+		git add . &&
+		git commit -m one &&
+		for i in 1 3 4 6
+		do
+			echo changed >>d$i/a/x/file &&
+			rm -r d$i/b/y &&
+			echo new >d$i/c/new &&
+			echo new >d$i/e || return 1
+		done &&
+		git add -A &&
+		git commit -m two &&
+
+		for args in "-r HEAD^ HEAD" "-r -t HEAD^ HEAD" "-r -R HEAD^ HEAD" \
+			"-r --root HEAD^" "-r --stdin"
+		do
+			git rev-list HEAD >revs &&
+			git -c diff.treeThreads=1 diff-tree $args <revs >expect &&
+			git -c diff.treeThreads=4 diff-tree $args <revs >actual &&
+			test_cmp expect actual || return 1
+		done &&
+
+		git -c diff.treeThreads=1 log --raw >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace" \
+			git -c diff.treeThreads=4 log --raw >actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"tree-diff/threads\"" ../trace
+	)
+'
+
+test_expect_success 'invalid diff.treeThreads is rejected' '
+	test_must_fail git -C threads -c diff.treeThreads=-1 diff-tree -r \
+		HEAD^ HEAD 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 test_done
@@ -184,6 +184,37 @@ test_expect_success 'git log with path contains various magic signatures' '
 	test_bloom_filters_used "-- \:\(attr\:text\)A"
 '
 
+# Check that a line-log or blame with Bloom filters gives the same
+# output as one without, and that the filters ruled out some commits.
+test_line_level_bloom () {
+	rm -f "$TRASH_DIRECTORY/trace.event" &&
+	git -c core.commitGraph=false "$@" >out_wo_bloom &&
+	GIT_TRACE2_EVENT="$TRASH_DIRECTORY/trace.event" \
+		git -c core.commitGraph=true "$@" >out_w_bloom &&
+	test_cmp out_wo_bloom out_w_bloom &&
+	grep "\"key\":\"bloom/response-no\",\"value\":\"[1-9]" \
+		"$TRASH_DIRECTORY/trace.event"
+}
+
+test_expect_success 'git log -L uses Bloom filters' '
+	test_line_level_bloom log --oneline -L 1,1:A/file1 &&
+	test_line_level_bloom log --oneline -L 1,1:A/B/C/file3
+'
+
+test_expect_success 'git log -L uses Bloom filters for merges' '
+	test_line_level_bloom log --graph --parents -s -L 1,1:A/file1 &&
+	test_line_level_bloom log --oneline --parents -s -L 1,1:file4
+'
+
+test_expect_success 'git log -L uses Bloom filters across renames' '
+	test_line_level_bloom log --oneline -L 1,1:file5_renamed
+'
+
+test_expect_success 'git blame uses Bloom filters' '
+	test_line_level_bloom blame A/file1 &&
+	test_line_level_bloom blame file5_renamed
+'
+
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
 	test_commit c14 A/anotherFile2 &&
 	test_commit c15 A/B/anotherFile2 &&
@@ -1027,4 +1027,49 @@ test_expect_success 'error out on missing commits as well' '
 	test_must_be_empty actual
 '
 
+test_expect_success 'merge.threads does not change the result' '
+	git init threads &&
+	(
+		cd threads &&
+		for d in a b c d e
+		do
+			mkdir -p $d/sub &&
+			for f in 1 2 3 4 5
+			do
+				test_seq 10 | sed "s/^/$d$f /" >$d/sub/file$f || return 1
+			done || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		git branch side &&
+		git checkout -b ours &&
+
+		git mv a/sub b/renamed &&
+		echo change >>c/sub/file1 &&
+		echo change >>d/sub/file2 &&
+		git rm -r e &&
+		git commit -a -m ours &&
+
+		git checkout side &&
+		echo new >a/sub/new &&
+		echo other change >>c/sub/file1 &&
+		echo change >>d/sub/file3 &&
+		git mv e/sub/file1 d/moved &&
+		git add . &&
+		git commit -m side &&
+
+		test_expect_code 1 git -c merge.threads=1 \
+			merge-tree --write-tree ours side >expect &&
+		test_grep "CONFLICT (content)" expect &&
+		test_grep "CONFLICT (rename/delete)" expect &&
+		test_grep "CONFLICT (file location)" expect &&
+		for threads in 2 4 8
+		do
+			test_expect_code 1 git -c merge.threads=$threads \
+				merge-tree --write-tree ours side >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
 test_done
@@ -197,6 +197,29 @@ test_expect_success 'unpack with REF_DELTA' '
 	check_unpack test-2-${packname_2} obj-list
 '
 
+test_expect_success 'pack.hashThread does not change the pack' '
+	packname_thread=$(git -c pack.hashThread=true \
+		pack-objects test-thread <obj-list) &&
+	packname_nothread=$(git -c pack.hashThread=false \
+		pack-objects test-nothread <obj-list) &&
+	test "$packname_thread" = "$packname_2" &&
+	test "$packname_nothread" = "$packname_2" &&
+	test_cmp_bin test-2-$packname_2.pack test-thread-$packname_thread.pack
+'
+
+test_expect_success 'pack.hashThread with --max-pack-size' '
+	git -c pack.hashThread=false pack-objects --max-pack-size=1m \
+		test-split-nothread <obj-list >split-expect &&
+	git -c pack.hashThread=true pack-objects --max-pack-size=1m \
+		test-split-thread <obj-list >split-actual &&
+	test_cmp split-expect split-actual &&
+	test_line_count -gt 1 split-actual &&
+	for p in $(cat split-actual)
+	do
+		git verify-pack test-split-thread-$p.pack || return 1
+	done
+'
+
 test_expect_success 'unpack with REF_DELTA (core.fsyncmethod=batch)' '
        check_unpack test-2-${packname_2} obj-list "$BATCH_CONFIGURATION"
 '
@@ -607,4 +607,41 @@ test_expect_success 'truncated bitmap fails gracefully (lookup table)' '
 	test_grep corrupted.bitmap.index stderr
 '
 
+test_expect_success 'pack.writeBitmapRoaring writes version 2 bitmaps' '
+	test_config pack.writeBitmapRoaring true &&
+	git repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	echo 0002 >expect &&
+	od -A n -t x1 -j 4 -N 2 $bitmap | tr -d " \n" >actual &&
+	echo >>actual &&
+	test_cmp expect actual &&
+	git rev-list --test-bitmap HEAD &&
+
+	git rev-list --objects --all --no-object-names >expect.raw &&
+	git rev-list --use-bitmap-index --objects --all \
+		--no-object-names >actual.raw &&
+	sort expect.raw >expect &&
+	sort actual.raw >actual &&
+	test_cmp expect actual &&
+
+	git rev-list --count other...HEAD >expect &&
+	git rev-list --use-bitmap-index --count other...HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'truncated bitmap fails gracefully (roaring)' '
+	test_config pack.writeBitmapRoaring true &&
+	test_config pack.writebitmaphashcache false &&
+	test_config pack.writebitmaplookuptable false &&
+	git repack -adb &&
+	git rev-list --use-bitmap-index --count --all >expect &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_when_finished "rm -f $bitmap" &&
+	test_copy_bytes 256 <$bitmap >$bitmap.tmp &&
+	mv -f $bitmap.tmp $bitmap &&
+	git rev-list --use-bitmap-index --count --all >actual 2>stderr &&
+	test_cmp expect actual &&
+	test_grep corrupt.roaring.bitmap stderr
+'
+
 test_done
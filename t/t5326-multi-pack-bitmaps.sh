@@ -582,4 +582,32 @@ test_expect_success 'remove one packfile between MIDX bitmap writes' '
 	)
 '
 
+test_expect_success 'midx bitmaps with pack.writeBitmapRoaring' '
+	git init midx-roaring &&
+	(
+		cd midx-roaring &&
+
+		test_commit_bulk 100 &&
+		git repack -d &&
+		test_commit_bulk --start=101 100 &&
+		git repack -d &&
+
+		git -c pack.writeBitmapRoaring=true \
+			multi-pack-index write --bitmap &&
+		bitmap=$(ls .git/objects/pack/multi-pack-index-*.bitmap) &&
+		echo 0002 >expect &&
+		od -A n -t x1 -j 4 -N 2 $bitmap | tr -d " \n" >actual &&
+		echo >>actual &&
+		test_cmp expect actual &&
+
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --objects --all --no-object-names >expect.raw &&
+		git rev-list --use-bitmap-index --objects --all \
+			--no-object-names >actual.raw &&
+		sort expect.raw >expect &&
+		sort actual.raw >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -0,0 +1,105 @@
+#!/bin/sh
+
+test_description='delta base cache shared between processes'
+
+. ./test-lib.sh
+
+cache=.git/objects/info/delta-base-cache
+
+# Check that the trace2 event log in $1 reports a nonzero count for
+# the cache statistic $2.
+cache_count_nonzero () {
+	grep "\"category\":\"delta-base-cache\",\"key\":\"$2\",\"value\":\"[1-9]" "$1"
+}
+
+# Print the write position from the header of the cache file.
+cache_head () {
+	od -A n -t x1 -j 16 -N 8 "$cache" | tr -d " \n"
+}
+
+test_expect_success 'setup repository with long delta chains' '
+	test_seq 1000 >file &&
+	git add file &&
+	git commit -m base &&
+	for i in $(test_seq 20)
+	do
+		sed "$((i * 40))s/\$/ changed $i/" file >file.new &&
+		mv file.new file &&
+		git commit -q -a -m "change $i" || return 1
+	done &&
+	git repack -a -d -f --depth=50 &&
+	git rev-list --objects --all |
+	awk "\$2 == \"file\" { print \$1 }" >blobs &&
+	test_line_count = 21 blobs &&
+	git cat-file --batch <blobs >expect
+'
+
+test_expect_success 'no cache is written by default' '
+	git cat-file --batch <blobs >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing $cache
+'
+
+test_expect_success 'cache is created and filled' '
+	git -c core.sharedDeltaBaseCacheLimit=2m \
+		-c core.deltaBaseCacheLimit=0 cat-file --batch <blobs >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $cache &&
+	test "$(cache_head)" != 0000000000000000
+'
+
+test_expect_success 'objects are read correctly from a warm cache' '
+	for blob in $(cat blobs)
+	do
+		git -c core.sharedDeltaBaseCacheLimit=2m \
+			cat-file --batch <<-EOF || return 1
+		$blob
+		EOF
+	done >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bases are taken from the cache' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.warm" \
+		git -c core.sharedDeltaBaseCacheLimit=2m \
+		-c core.deltaBaseCacheLimit=0 cat-file --batch <blobs >actual &&
+	test_cmp expect actual &&
+	cache_count_nonzero trace.warm hits
+'
+
+test_expect_success 'corrupted cache entries are ignored' '
+	# With a 2m limit, there are 64 sets of 4 slots of 16 bytes after
+	# the 64-byte header, and the first record has a 64-byte header.
+	# Damage the data of that record.
+	printf "garbage" | dd of=$cache bs=1 seek=$((64 + 64 * 4 * 16 + 64)) \
+		conv=notrunc &&
+	git -c core.sharedDeltaBaseCacheLimit=2m \
+		-c core.deltaBaseCacheLimit=0 cat-file --batch <blobs >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'records with a damaged header are ignored' '
+	rm -f $cache &&
+	git -c core.sharedDeltaBaseCacheLimit=2m \
+		-c core.deltaBaseCacheLimit=0 cat-file --batch <blobs >actual &&
+	# Turn the type of the first record into OBJ_OFS_DELTA. The type
+	# is the last byte of a 4-byte field 16 bytes after the pack
+	# checksum, which takes up 32 bytes.
+	printf "\006" | dd of=$cache bs=1 seek=$((64 + 64 * 4 * 16 + 32 + 16 + 3)) \
+		conv=notrunc &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.damaged" \
+		git -c core.sharedDeltaBaseCacheLimit=2m \
+		-c core.deltaBaseCacheLimit=0 cat-file --batch <blobs >actual &&
+	test_cmp expect actual &&
+	cache_count_nonzero trace.damaged hits
+'
+
+test_expect_success 'cache is recreated when its size changes' '
+	git -c core.sharedDeltaBaseCacheLimit=3m cat-file --batch <blobs >actual &&
+	test_cmp expect actual &&
+	test_file_size $cache >size &&
+	echo 3145728 >expect.size &&
+	test_cmp expect.size size
+'
+
+test_done
@@ -0,0 +1,213 @@
+#!/bin/sh
+
+test_description='upload-pack pack cache'
+
+. ./test-lib.sh
+
+cache=.git/objects/info/pack-cache
+
+# Check the value of the given pack cache counter in a trace2 event log.
+counter () {
+	grep "\"category\":\"pack-cache\",\"name\":\"$2\",\"count\":$3}" "$1"
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	test_commit three
+'
+
+test_expect_success 'no cache is used by default' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . default.git &&
+	test_path_is_missing $cache &&
+	! grep "\"category\":\"pack-cache\"" trace
+'
+
+test_expect_success 'first clone fills the cache' '
+	test_config uploadpack.packCacheLimit 1m &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.miss" git clone --no-local . miss.git &&
+	counter trace.miss misses 1 &&
+	ls $cache >entries &&
+	test_line_count = 1 entries &&
+	grep "\.pack$" entries &&
+	git -C miss.git fsck
+'
+
+test_expect_success 'second clone is served from the cache' '
+	test_config uploadpack.packCacheLimit 1m &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.hit" git clone --no-local . hit.git &&
+	counter trace.hit hits 1 &&
+	! grep "\"argv\":\[\"git\",\"pack-objects\"" trace.hit &&
+	git -C hit.git fsck &&
+	git -C miss.git rev-parse --all >expect &&
+	git -C hit.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a fetch with different haves misses' '
+	test_config uploadpack.packCacheLimit 1m &&
+	git clone --no-local . fetch.git &&
+	test_commit four &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.fetch" git -C fetch.git fetch origin &&
+	counter trace.fetch misses 1 &&
+	! counter trace.fetch hits 1
+'
+
+test_expect_success 'new tags change the cache key' '
+	test_config uploadpack.packCacheLimit 1m &&
+	git tag -m annotated annotated one &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.tag" git clone --no-local . tag.git &&
+	counter trace.tag misses 1 &&
+	git -C tag.git cat-file tag annotated
+'
+
+test_expect_success 'least recently used entries are evicted' '
+	test_config uploadpack.packCacheLimit 1m &&
+	rm -rf $cache &&
+	git clone --no-local --no-tags --single-branch \
+		--branch one . a.git &&
+	test-tool chmtime -100 $cache/*.pack &&
+	git clone --no-local . b.git &&
+	ls $cache >entries &&
+	test_line_count = 2 entries &&
+	newest=$(ls -t $cache | head -n 1) &&
+
+	test_config uploadpack.packCacheLimit 1 &&
+	git clone --no-local --no-tags . c.git &&
+	ls $cache >entries &&
+	test_line_count = 0 entries &&
+
+	test_config uploadpack.packCacheLimit 1m &&
+	git clone --no-local . d.git &&
+	test_path_is_file $cache/$newest
+'
+
+test_expect_success 'requests share an entry that is being written' '
+	test_config uploadpack.packCacheLimit 1m &&
+	entry=$(ls $cache/*.pack) &&
+	tmp=${entry%.pack}.tmp &&
+	producer=${entry%.pack}-123456.tmp &&
+	mv $entry full &&
+	test_copy_bytes 100 <full >$producer &&
+	chmod 644 $producer &&
+	ln $producer $tmp &&
+
+	{
+		GIT_TRACE2_EVENT="$(pwd)/trace.shared" \
+			git clone --no-local . shared.git &
+		echo $! >pid
+	} &&
+	sleep 1 &&
+	tail -c +101 full >>$tmp &&
+	chmod 444 $tmp &&
+	wait $(cat pid) &&
+	counter trace.shared shared 1 &&
+	git -C shared.git fsck &&
+	rm $producer &&
+	mv $tmp $entry
+'
+
+test_expect_success 'entries whose producer went away are produced again' '
+	test_config uploadpack.packCacheLimit 1m &&
+	entry=$(ls $cache/*.pack) &&
+	tmp=${entry%.pack}.tmp &&
+	mv $entry full &&
+	test_copy_bytes 100 <full >$tmp &&
+	chmod 644 $tmp &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace.gone" \
+		git clone --no-local . gone.git &&
+	counter trace.gone misses 1 &&
+	git -C gone.git fsck &&
+	test_path_is_missing $tmp &&
+	test_path_is_file $entry
+'
+
+test_expect_success 'abandoned entries are produced again' '
+	test_config uploadpack.packCacheLimit 1m &&
+	entry=$(ls $cache/*.pack) &&
+	tmp=${entry%.pack}.tmp &&
+	mv $entry full &&
+	test_copy_bytes 100 <full >$tmp &&
+	chmod 644 $tmp &&
+	test-tool chmtime -120 $tmp &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace.abandoned" \
+		git clone --no-local . abandoned.git &&
+	counter trace.abandoned misses 1 &&
+	git -C abandoned.git fsck &&
+	test_path_is_missing $tmp &&
+	test_path_is_file $entry
+'
+
+# Serve the request in "request" with an upload-pack that writes its
+# pid to "pid.<name>" and blocks on a full pipe until "go.<name>"
+# appears. Its output ends up in "out.<name>".
+start_producer () {
+	sh -c "echo \$\$ >pid.$1 && exec git upload-pack ." <request |
+	{
+		while ! test -f go.$1
+		do
+			sleep 0.1
+		done
+		cat >out.$1
+	} &
+}
+
+# Wait until there are $1 producer files in the cache.
+wait_for_producers () {
+	i=0 &&
+	while test $(ls $cache | grep -c -e "-.*\.tmp$") != $1 &&
+	      test $i -lt 100
+	do
+		sleep 0.1 &&
+		i=$((i + 1)) || return 1
+	done &&
+	test $(ls $cache | grep -c -e "-.*\.tmp$") = $1
+}
+
+test_expect_success !MINGW 'a stalled producer leaves the entry of its successor alone' '
+	test_config uploadpack.packCacheLimit 10m &&
+	rm -rf $cache &&
+	test-tool genrandom big 1048576 >big &&
+	git add big &&
+	test_commit big &&
+	test-tool pkt-line pack >request <<-EOF &&
+	want $(git rev-parse HEAD) side-band-64k
+	0000
+	done
+	EOF
+	test_when_finished "
+		kill -CONT \$(cat pid.A) 2>/dev/null
+		touch go.A go.B
+		wait
+	" &&
+
+	start_producer A &&
+	wait_for_producers 1 &&
+	kill -STOP $(cat pid.A) &&
+	tmp=$(ls $cache | grep -v -e - | grep "\.tmp$") &&
+	test-tool chmtime -120 $cache/$tmp &&
+
+	start_producer B &&
+	wait_for_producers 2 &&
+	test_path_is_file $cache/$tmp &&
+
+	kill -CONT $(cat pid.A) &&
+	touch go.A &&
+	wait_for_producers 1 &&
+	test_path_is_file $cache/${tmp%.tmp}.pack &&
+	test_path_is_file $cache/$tmp &&
+
+	touch go.B &&
+	wait &&
+	test_path_is_missing $cache/$tmp &&
+	ls $cache >entries &&
+	test_line_count = 1 entries &&
+	cp $cache/${tmp%.tmp}.pack check.pack &&
+	git index-pack check.pack &&
+	test $(test_file_size out.A) -gt 1048576 &&
+	test $(test_file_size out.B) -gt 1048576
+'
+
+test_done
@@ -0,0 +1,141 @@
+#!/bin/sh
+
+test_description='upload-pack serving connections from a unix socket'
+
+. ./test-lib.sh
+
+test -z "$NO_UNIX_SOCKETS" || {
+	skip_all='skipping upload-pack --listen tests, unix sockets not available'
+	test_done
+}
+if test_have_prereq MINGW
+then
+	skip_all='skipping upload-pack --listen tests, fork() not available'
+	test_done
+fi
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git repack -a -d &&
+	git init --bare other.git
+'
+
+test_expect_success 'start server' '
+	{
+		git upload-pack --listen="$(pwd)/sock" . 2>server.err &
+		echo $! >server.pid
+	} &&
+	i=0 &&
+	while ! test -S sock && test $i -lt 50
+	do
+		sleep 0.1 &&
+		i=$((i + 1)) || return 1
+	done &&
+	test -S sock
+'
+
+test_atexit '
+	test ! -e server.pid ||
+	kill "$(cat server.pid)"
+'
+
+test_expect_success 'clone is served by the server' '
+	test_config uploadpack.serverSocket "$(pwd)/sock" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.clone" \
+		git clone --no-local . clone.git &&
+	grep "\"key\":\"server\"" trace.clone &&
+	git -C clone.git fsck &&
+	git rev-parse HEAD >expect &&
+	git -C clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'server picks up repacked objects' '
+	test_config uploadpack.serverSocket "$(pwd)/sock" &&
+	test_commit three &&
+	git repack -a -d &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.fetch" \
+		git -C clone.git fetch origin &&
+	grep "\"key\":\"server\"" trace.fetch &&
+	git rev-parse HEAD >expect &&
+	git -C clone.git rev-parse origin/HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'stateless requests are served by the server' '
+	test-tool pkt-line pack >request <<-\EOF &&
+	command=ls-refs
+	0000
+	EOF
+	GIT_PROTOCOL=version=2 git upload-pack --stateless-rpc . \
+		<request >expect &&
+	test_config uploadpack.serverSocket "$(pwd)/sock" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.stateless" GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc . <request >actual &&
+	grep "\"key\":\"server\"" trace.stateless &&
+	test_cmp expect actual
+'
+
+test_expect_success 'namespaced requests are served by the server' '
+	git update-ref refs/namespaces/ns/refs/heads/main one &&
+	test-tool pkt-line pack >request <<-\EOF &&
+	command=ls-refs
+	0000
+	EOF
+	env GIT_NAMESPACE=ns GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc . <request >expect &&
+	test-tool pkt-line unpack <expect >refs &&
+	test_grep "$(git rev-parse one) refs/heads/main" refs &&
+	test_config uploadpack.serverSocket "$(pwd)/sock" &&
+	env GIT_TRACE2_EVENT="$(pwd)/trace.namespace" GIT_NAMESPACE=ns \
+		GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc . <request >actual &&
+	grep "\"key\":\"server\"" trace.namespace &&
+	test_cmp expect actual
+'
+
+test_expect_success 'requests with --strict and --timeout are served by the server' '
+	test-tool pkt-line pack >request <<-\EOF &&
+	command=ls-refs
+	0000
+	EOF
+	env GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc . <request >expect &&
+	test_config uploadpack.serverSocket "$(pwd)/sock" &&
+	env GIT_TRACE2_EVENT="$(pwd)/trace.daemon" GIT_PROTOCOL=version=2 \
+		git upload-pack --strict --timeout=60 --stateless-rpc \
+		"$(pwd)/.git" <request >actual &&
+	grep "\"key\":\"server\"" trace.daemon &&
+	test_cmp expect actual
+'
+
+test_expect_success '--timeout is enforced while relaying' '
+	test_config uploadpack.serverSocket "$(pwd)/sock" &&
+	sleep 3 |
+	test_must_fail env GIT_PROTOCOL=version=2 \
+		git upload-pack --timeout=1 . >out 2>err &&
+	test_grep "timed out after 1 seconds" err
+'
+
+test_expect_success 'server does not serve other repositories' '
+	test_config -C other.git uploadpack.serverSocket "$(pwd)/sock" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.other" \
+		git clone --no-local other.git other-clone.git &&
+	grep "\"key\":\"server-refused\"" trace.other
+'
+
+test_expect_success 'requests are served locally without a server' '
+	test_config uploadpack.serverSocket "$(pwd)/missing" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.missing" \
+		git clone --no-local . missing.git &&
+	grep "\"key\":\"server-unavailable\"" trace.missing &&
+	git -C missing.git fsck
+'
+
+test_expect_success '--listen is incompatible with --stateless-rpc' '
+	test_must_fail git upload-pack --listen=sock2 --stateless-rpc . 2>err &&
+	test_grep "cannot be used together" err
+'
+
+test_done
@@ -529,6 +529,24 @@ test_expect_success 'for-each-ref ahead-behind:none' '
 		--format="%(refname) %(ahead-behind:commit-8-4)" --stdin
 '
 
+test_expect_success 'for-each-ref ahead-behind with threads' '
+	git for-each-ref --format="%(refname)" refs/heads refs/tags >input &&
+	git -c core.aheadBehindThreads=1 for-each-ref --stdin \
+		--format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:commit-6-9)" \
+		<input >expect &&
+	run_all_modes env GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -c core.aheadBehindThreads=3 for-each-ref \
+		--format="%(refname) %(ahead-behind:commit-9-6) %(ahead-behind:commit-6-9)" \
+		--stdin &&
+	grep "\"key\":\"ahead-behind/threads\",\"value\":\"3\"" trace.txt
+'
+
+test_expect_success 'negative core.aheadBehindThreads is rejected' '
+	test_must_fail git -c core.aheadBehindThreads=-1 for-each-ref \
+		--format="%(ahead-behind:commit-9-6)" refs/heads/commit-1-1 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 test_expect_success 'for-each-ref merged:linear' '
 	cat >input <<-\EOF &&
 	refs/heads/commit-1-1
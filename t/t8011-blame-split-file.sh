@@ -115,4 +115,36 @@ do
 	'
 done
 
+test_expect_success 'copies from many files are found the same with threads' '
+	for i in $(test_seq 20)
+	do
+		for j in $(test_seq 8)
+		do
+			echo "line $j of the source file number $i" || return 1
+		done >source$i || return 1
+	done &&
+	for i in $(test_seq 20)
+	do
+		echo "line $i of the collected file" || return 1
+	done >collected &&
+	git add source* collected &&
+	test_commit many-sources &&
+	for i in $(test_seq 20)
+	do
+		sed -n "3,6p" source$i &&
+		echo "line $i of the collected file" || return 1
+	done >collected &&
+	git add collected &&
+	test_commit collected &&
+	git -c blame.threads=1 blame -C -C -C --porcelain collected >expect &&
+	git -c blame.threads=4 blame -C -C -C --porcelain collected >actual &&
+	test_cmp expect actual &&
+	grep "^filename source20$" expect
+'
+
+test_expect_success 'negative blame.threads is rejected' '
+	test_must_fail git -c blame.threads=-1 blame collected 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 test_done
@@ -0,0 +1,179 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+
+. ./test-lib.sh
+
+cache=.git/blame-cache
+
+# Check the number of cache hits in a trace2 event log.
+hits () {
+	grep "\"key\":\"cache/hits\",\"value\":\"$2\"" "$1"
+}
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m one &&
+	for i in 2 3 4 5 6 7
+	do
+		sed "s/^$i\$/$i changed/" file >file.new &&
+		mv file.new file &&
+		test_tick &&
+		git commit -a -m "change $i" || return 1
+	done &&
+	git tag old &&
+	git mv file renamed &&
+	test_tick &&
+	git commit -m rename &&
+	git checkout -b side HEAD~2 &&
+	echo side >>file &&
+	test_tick &&
+	git commit -a -m side &&
+	git checkout - &&
+	git mv renamed file &&
+	test_tick &&
+	git commit -m "rename back" &&
+	git merge -m merge side &&
+	echo 11 >>file &&
+	test_tick &&
+	git commit -a -m eleven &&
+	git blame --porcelain HEAD -- file >expect
+'
+
+test_expect_success 'no cache is used by default' '
+	git blame --porcelain HEAD -- file >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing $cache
+'
+
+test_expect_success 'blame fills the cache' '
+	git -c blame.cache=true blame old -- file >/dev/null &&
+	ls $cache >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'blame at a later commit uses the cached result' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.later" \
+		git -c blame.cache=true blame --porcelain HEAD -- file >actual &&
+	test_cmp expect actual &&
+	hits trace.later 1 &&
+	ls $cache >entries &&
+	test_line_count = 2 entries
+'
+
+test_expect_success 'blame at a cached commit uses the cached result' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.same" \
+		git -c blame.cache=true blame --porcelain HEAD -- file >actual &&
+	test_cmp expect actual &&
+	hits trace.same 1 &&
+	git -c blame.cache=true blame --line-porcelain HEAD -- file >actual &&
+	git blame --line-porcelain HEAD -- file >expect.line &&
+	test_cmp expect.line actual &&
+	git -c blame.cache=true blame -L 3,5 HEAD -- file >actual &&
+	git blame -L 3,5 HEAD -- file >expect.range &&
+	test_cmp expect.range actual
+'
+
+test_expect_success 'options that change the result use their own entries' '
+	for opts in -w --root --first-parent
+	do
+		git blame $opts HEAD -- file >expect.opts &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.opts" \
+			git -c blame.cache=true blame $opts HEAD -- file >actual &&
+		test_cmp expect.opts actual &&
+		hits trace.opts 0 || return 1
+	done
+'
+
+test_expect_success 'partial blames are not stored' '
+	rm -rf $cache &&
+	git -c blame.cache=true blame -L 1,3 HEAD -- file >/dev/null &&
+	test_path_is_missing $cache
+'
+
+test_expect_success 'cache is not used with copy detection or a bottom' '
+	git -c blame.cache=true blame -C HEAD -- file >/dev/null &&
+	git -c blame.cache=true blame old.. -- file >/dev/null &&
+	test_path_is_missing $cache
+'
+
+test_expect_success 'mailmap changes show up in cached results' '
+	git -c blame.cache=true blame -e HEAD -- file >/dev/null &&
+	echo "New Name <new@example.com> <author@example.com>" >.mailmap &&
+	git blame -e HEAD -- file >expect.mailmap &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.mailmap" \
+		git -c blame.cache=true blame -e HEAD -- file >actual &&
+	test_cmp expect.mailmap actual &&
+	hits trace.mailmap 1 &&
+	grep new@example.com actual &&
+	rm .mailmap
+'
+
+test_expect_success 'replace refs invalidate the cache' '
+	git -c blame.cache=true blame HEAD -- file >/dev/null &&
+	git cat-file commit old >commit &&
+	sed "s/^author A U Thor/author Replaced/" commit >replaced &&
+	git replace old $(git hash-object -t commit -w replaced) &&
+	git blame --porcelain HEAD -- file >expect.replace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.replace" \
+		git -c blame.cache=true blame --porcelain HEAD -- file >actual &&
+	test_cmp expect.replace actual &&
+	hits trace.replace 0 &&
+	git replace -d old
+'
+
+test_expect_success 'corrupt entries are ignored' '
+	rm -rf $cache &&
+	git -c blame.cache=true blame HEAD -- file >/dev/null &&
+	entry=$(ls $cache) &&
+	head -n 2 $cache/$entry >truncated &&
+	mv truncated $cache/$entry &&
+	git -c blame.cache=true blame --porcelain HEAD -- file >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "ignoring corrupt blame cache entry" err
+'
+
+test_expect_success 'least recently used entries are pruned' '
+	rm -rf $cache &&
+	git -c blame.cache=true blame HEAD -- file >/dev/null &&
+	head_entry=$(ls $cache) &&
+	head_size=$(test_file_size $cache/$head_entry) &&
+	rm -rf $cache &&
+	git -c blame.cache=true blame old -- file >/dev/null &&
+	git -c blame.cache=true blame HEAD~3 -- renamed >/dev/null &&
+	ls $cache >entries &&
+	test_line_count = 2 entries &&
+	test-tool chmtime =-100 $cache/* &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.used" \
+		git -c blame.cache=true blame old -- file >/dev/null &&
+	hits trace.used 1 &&
+	used=$(ls -t $cache | head -n 1) &&
+	size=$(test_file_size $cache/$used) &&
+	git -c blame.cache=true -c blame.cacheLimit=$((size + head_size)) \
+		blame HEAD -- file >/dev/null &&
+	printf "%s\n" $used $head_entry | sort >expect.entries &&
+	ls $cache | sort >actual.entries &&
+	test_cmp expect.entries actual.entries
+'
+
+test_expect_success 'an entry is kept even if it alone is over the limit' '
+	rm -rf $cache &&
+	git -c blame.cache=true blame old -- file >/dev/null &&
+	git -c blame.cache=true -c blame.cacheLimit=1 \
+		blame HEAD -- file >/dev/null &&
+	ls $cache >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'a limit of 0 keeps all entries' '
+	rm -rf $cache &&
+	git -c blame.cache=true blame old -- file >/dev/null &&
+	git -c blame.cache=true -c blame.cacheLimit=0 \
+		blame HEAD -- file >/dev/null &&
+	ls $cache >entries &&
+	test_line_count = 2 entries
+'
+
+test_done
@@ -0,0 +1,207 @@
+#include "unit-test.h"
+#include "ewah/ewok.h"
+
+#define NR_WORDS 1000
+
+static uint64_t rand_state;
+
+static uint64_t next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return rand_state >> 11 ^ rand_state << 31;
+}
+
+/*
+ * Fill a bitmap with stretches of empty words, full words and random
+ * words, so that its EWAH form has runs of both kinds as well as
+ * literal words.
+ */
+static struct bitmap *random_bitmap(size_t nr)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(nr);
+	size_t i = 0;
+
+	while (i < nr) {
+		size_t len = next_rand() % 20 + 1;
+		int kind = next_rand() % 3;
+
+		for (; len && i < nr; len--, i++)
+			bitmap->words[i] = kind == 0 ? 0 :
+					   kind == 1 ? ~(eword_t)0 :
+					   next_rand();
+	}
+	return bitmap;
+}
+
+static size_t naive_popcount(struct bitmap *bitmap)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < bitmap->word_alloc * BITS_IN_EWORD; i++)
+		count += bitmap_get(bitmap, i);
+	return count;
+}
+
+void test_ewah__initialize(void)
+{
+	rand_state = 42;
+}
+
+void test_ewah__to_bitmap_roundtrip(void)
+{
+	for (int n = 0; n < 20; n++) {
+		struct bitmap *bitmap = random_bitmap(NR_WORDS);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+		struct bitmap *expanded = ewah_to_bitmap(ewah);
+
+		cl_assert(bitmap_equals(bitmap, expanded));
+		cl_assert(bitmap_equals_ewah(bitmap, ewah));
+
+		bitmap_free(expanded);
+		ewah_free(ewah);
+		bitmap_free(bitmap);
+	}
+}
+
+void test_ewah__popcount(void)
+{
+	for (int n = 0; n < 20; n++) {
+		struct bitmap *bitmap = random_bitmap(NR_WORDS + n);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+		size_t expect = naive_popcount(bitmap);
+
+		cl_assert_equal_i(expect, bitmap_popcount(bitmap));
+		cl_assert_equal_i(expect, ewah_bitmap_popcount(ewah));
+
+		ewah_free(ewah);
+		bitmap_free(bitmap);
+	}
+}
+
+void test_ewah__or_ewah(void)
+{
+	for (int n = 0; n < 20; n++) {
+		struct bitmap *a = random_bitmap(NR_WORDS);
+		struct bitmap *b = random_bitmap(NR_WORDS / 2 + n * 50);
+		struct ewah_bitmap *ewah = bitmap_to_ewah(b);
+		struct bitmap *expect = bitmap_dup(a);
+
+		bitmap_or(expect, b);
+		bitmap_or_ewah(a, ewah);
+		cl_assert(bitmap_equals(expect, a));
+
+		bitmap_free(expect);
+		ewah_free(ewah);
+		bitmap_free(b);
+		bitmap_free(a);
+	}
+}
+
+void test_ewah__and_not(void)
+{
+	struct bitmap *a = random_bitmap(NR_WORDS);
+	struct bitmap *b = random_bitmap(NR_WORDS / 2);
+
+	bitmap_and_not(a, b);
+	for (size_t i = 0; i < NR_WORDS * BITS_IN_EWORD; i++)
+		cl_assert(!bitmap_get(a, i) || !bitmap_get(b, i));
+
+	bitmap_free(b);
+	bitmap_free(a);
+}
+
+static int naive_is_subset(struct bitmap *self, struct bitmap *other)
+{
+	for (size_t i = 0; i < self->word_alloc * BITS_IN_EWORD; i++)
+		if (bitmap_get(self, i) && !bitmap_get(other, i))
+			return 0;
+	return 1;
+}
+
+void test_ewah__is_subset(void)
+{
+	for (int n = 0; n < 20; n++) {
+		struct bitmap *a = random_bitmap(NR_WORDS);
+		struct bitmap *b = random_bitmap(NR_WORDS);
+		struct bitmap *shorter = bitmap_word_alloc(NR_WORDS / 2);
+		struct ewah_bitmap *ewah;
+
+		/* make `a` a subset of `b`, except every other time */
+		bitmap_or(b, a);
+		if (n % 2)
+			bitmap_unset(b, next_rand() % (NR_WORDS * BITS_IN_EWORD));
+		COPY_ARRAY(shorter->words, b->words, shorter->word_alloc);
+
+		ewah = bitmap_to_ewah(a);
+		cl_assert_equal_i(naive_is_subset(a, b),
+				  ewah_bitmap_is_subset(ewah, b));
+		cl_assert_equal_i(naive_is_subset(a, shorter),
+				  ewah_bitmap_is_subset(ewah, shorter));
+
+		ewah_free(ewah);
+		bitmap_free(shorter);
+		bitmap_free(b);
+		bitmap_free(a);
+	}
+}
+
+/*
+ * Set a few bits in every container of 2^16 bits, so that the roaring
+ * form of the bitmap uses array containers.
+ */
+static struct bitmap *sparse_bitmap(size_t nr)
+{
+	struct bitmap *bitmap = bitmap_word_alloc(nr);
+
+	for (size_t i = 0; i < nr * BITS_IN_EWORD / 1000; i++)
+		bitmap_set(bitmap, next_rand() % (nr * BITS_IN_EWORD));
+	return bitmap;
+}
+
+static void check_roaring_roundtrip(struct ewah_bitmap *ewah)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct ewah_bitmap *read = ewah_new();
+	struct ewah_bitmap *truncated = ewah_new();
+	struct bitmap *expect = ewah_to_bitmap(ewah);
+	struct bitmap *actual;
+	int len = ewah_serialize_roaring_strbuf(ewah, &sb);
+
+	cl_assert_equal_i(len, sb.len);
+	cl_assert(ewah_read_roaring_mmap(truncated, sb.buf, sb.len - 1) < 0);
+	cl_assert_equal_i(len, ewah_read_roaring_mmap(read, sb.buf, sb.len));
+	cl_assert_equal_i(ewah->bit_size, read->bit_size);
+
+	actual = ewah_to_bitmap(read);
+	cl_assert(bitmap_equals(expect, actual));
+
+	bitmap_free(actual);
+	bitmap_free(expect);
+	ewah_free(truncated);
+	ewah_free(read);
+	strbuf_release(&sb);
+}
+
+void test_ewah__roaring_roundtrip(void)
+{
+	struct ewah_bitmap *ewah;
+
+	for (int n = 0; n < 10; n++) {
+		struct bitmap *bitmap = n % 2 ? random_bitmap(NR_WORDS * 3 + n) :
+						sparse_bitmap(NR_WORDS * 3 + n);
+
+		ewah = bitmap_to_ewah(bitmap);
+		check_roaring_roundtrip(ewah);
+
+		ewah_free(ewah);
+		bitmap_free(bitmap);
+	}
+
+	/* a bit size that is not a multiple of the word size */
+	ewah = ewah_new();
+	ewah_set(ewah, 1);
+	ewah_set(ewah, 70000);
+	ewah_set(ewah, 200004);
+	check_roaring_roundtrip(ewah);
+	ewah_free(ewah);
+}
@@ -1009,6 +1009,29 @@ void test_reftable_stack__auto_compaction_factor(void)
 	clear_dir(dir);
 }
 
+void test_reftable_stack__compaction_required(void)
+{
+	struct reftable_write_options opts = {
+		.disable_auto_compact = 1,
+	};
+	struct reftable_stack *st = NULL;
+	char *dir = get_tmp_dir(__LINE__);
+
+	cl_assert_equal_i(reftable_new_stack(&st, dir, &opts), 0);
+	cl_assert_equal_i(reftable_stack_compaction_required(st), 0);
+
+	write_n_ref_tables(st, 5);
+	cl_assert_equal_i(reftable_stack_compaction_required(st), 1);
+	cl_assert_equal_i(st->stats.tables, 0);
+
+	cl_assert_equal_i(reftable_stack_auto_compact(st), 0);
+	cl_assert_equal_i(reftable_stack_compaction_required(st), 0);
+	cl_assert_equal_i(st->stats.tables, 5);
+
+	reftable_stack_destroy(st);
+	clear_dir(dir);
+}
+
 void test_reftable_stack__auto_compaction_with_locked_tables(void)
 {
 	struct reftable_write_options opts = {
@@ -555,11 +555,18 @@ enum trace2_counter_id {
 
 	TRACE2_COUNTER_ID_PACKED_REFS_JUMPS, /* counts number of jumps */
 	TRACE2_COUNTER_ID_REFTABLE_RESEEKS, /* counts number of re-seeks */
+	TRACE2_COUNTER_ID_REFTABLE_TABLES_COMPACTED, /* counts tables merged */
+	TRACE2_COUNTER_ID_REFTABLE_BYTES_COMPACTED, /* counts bytes rewritten */
 
 	/* counts number of fsyncs */
 	TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY,
 	TRACE2_COUNTER_ID_FSYNC_HARDWARE_FLUSH,
 
+	/* counts upload-pack pack cache lookups by outcome */
+	TRACE2_COUNTER_ID_PACK_CACHE_HITS,
+	TRACE2_COUNTER_ID_PACK_CACHE_SHARED,
+	TRACE2_COUNTER_ID_PACK_CACHE_MISSES,
+
 	/* Add additional counter definitions before here. */
 	TRACE2_NUMBER_OF_COUNTERS
 };
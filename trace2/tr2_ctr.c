@@ -36,6 +36,16 @@ static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTER
 		.name = "reseeks_made",
 		.want_per_thread_events = 0,
 	},
+	[TRACE2_COUNTER_ID_REFTABLE_TABLES_COMPACTED] = {
+		.category = "reftable",
+		.name = "tables_compacted",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_REFTABLE_BYTES_COMPACTED] = {
+		.category = "reftable",
+		.name = "bytes_compacted",
+		.want_per_thread_events = 0,
+	},
 	[TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY] = {
 		.category = "fsync",
 		.name = "writeout-only",
@@ -46,6 +56,21 @@ static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTER
 		.name = "hardware-flush",
 		.want_per_thread_events = 0,
 	},
+	[TRACE2_COUNTER_ID_PACK_CACHE_HITS] = {
+		.category = "pack-cache",
+		.name = "hits",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_PACK_CACHE_SHARED] = {
+		.category = "pack-cache",
+		.name = "shared",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_PACK_CACHE_MISSES] = {
+		.category = "pack-cache",
+		.name = "misses",
+		.want_per_thread_events = 0,
+	},
 
 	/* Add additional metadata before here. */
 };
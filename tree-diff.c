@@ -14,6 +14,11 @@
 #include "environment.h"
 #include "repository.h"
 #include "dir.h"
+#include "config.h"
+#include "gettext.h"
+#include "odb.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 /*
  * Some mode bits are also used internally for computations.
@@ -116,11 +121,18 @@ static int should_recurse(const struct strbuf *name, struct diff_options *opt)
 	return check_recursion_depth(name, &opt->pathspec, opt->max_depth);
 }
 
+struct tree_diff_task;
+
 static void ll_diff_tree_paths(
 	struct combine_diff_path ***tail, const struct object_id *oid,
 	const struct object_id **parents_oid, int nparent,
 	struct strbuf *base, struct diff_options *opt,
-	int depth);
+	int depth, struct tree_diff_task *task);
+static int queue_subtree(struct tree_diff_task *task,
+			 struct combine_diff_path **at,
+			 const struct object_id *oid,
+			 const struct object_id *parent_oid,
+			 const struct strbuf *base, int depth);
 static void ll_diff_tree_oid(const struct object_id *old_oid,
 			     const struct object_id *new_oid,
 			     struct strbuf *base, struct diff_options *opt);
@@ -205,7 +217,7 @@ static int emit_diff_first_parent_only(struct diff_options *opt, struct combine_
 static void emit_path(struct combine_diff_path ***tail,
 		      struct strbuf *base, struct diff_options *opt,
 		      int nparent, struct tree_desc *t, struct tree_desc *tp,
-		      int imin, int depth)
+		      int imin, int depth, struct tree_diff_task *task)
 {
 	unsigned short mode;
 	const char *path;
@@ -311,8 +323,11 @@ static void emit_path(struct combine_diff_path ***tail,
 
 		strbuf_add(base, path, pathlen);
 		strbuf_addch(base, '/');
-		ll_diff_tree_paths(tail, oid, parents_oid, nparent, base, opt,
-				   depth + 1);
+		if (!task ||
+		    queue_subtree(task, *tail, oid, parents_oid[0], base,
+				  depth + 1))
+			ll_diff_tree_paths(tail, oid, parents_oid, nparent,
+					   base, opt, depth + 1, task);
 		FAST_ARRAY_FREE(parents_oid, nparent);
 	}
 
@@ -433,7 +448,7 @@ static void ll_diff_tree_paths(
 	struct combine_diff_path ***tail, const struct object_id *oid,
 	const struct object_id **parents_oid, int nparent,
 	struct strbuf *base, struct diff_options *opt,
-	int depth)
+	int depth, struct tree_diff_task *task)
 {
 	struct tree_desc t, *tp;
 	void *ttree, **tptree;
@@ -455,8 +470,12 @@ static void ll_diff_tree_paths(
 		tptree[i] = fill_tree_descriptor(opt->repo, &tp[i], parents_oid[i]);
 	ttree = fill_tree_descriptor(opt->repo, &t, oid);
 
-	/* Enable recursion indefinitely */
-	opt->pathspec.recursive = opt->flags.recursive;
+	/*
+	 * Enable recursion indefinitely. Only write when needed, as
+	 * other threads may be reading it (see diff_tree_paths_threaded()).
+	 */
+	if (opt->pathspec.recursive != opt->flags.recursive)
+		opt->pathspec.recursive = opt->flags.recursive;
 
 	for (;;) {
 		int imin, cmp;
@@ -535,7 +554,7 @@ static void ll_diff_tree_paths(
 
 			/* D += {δ(t,pi) if pi=p[imin];  "+a" if pi > p[imin]} */
 			emit_path(tail, base, opt, nparent,
-				  &t, tp, imin, depth);
+				  &t, tp, imin, depth, task);
 
 		skip_emit_t_tp:
 			/* t↓,  ∀ pi=p[imin]  pi↓ */
@@ -547,7 +566,7 @@ static void ll_diff_tree_paths(
 		else if (cmp < 0) {
 			/* D += "+t" */
 			emit_path(tail, base, opt, nparent,
-				  &t, /*tp=*/NULL, -1, depth);
+				  &t, /*tp=*/NULL, -1, depth, task);
 
 			/* t↓ */
 			update_tree_entry(&t);
@@ -563,7 +582,7 @@ static void ll_diff_tree_paths(
 			}
 
 			emit_path(tail, base, opt, nparent,
-				  /*t=*/NULL, tp, imin, depth);
+				  /*t=*/NULL, tp, imin, depth, task);
 
 		skip_emit_tp:
 			/* ∀ pi=p[imin]  pi↓ */
@@ -584,7 +603,272 @@ struct combine_diff_path *diff_tree_paths(
 	struct strbuf *base, struct diff_options *opt)
 {
 	struct combine_diff_path *head = NULL, **tail = &head;
-	ll_diff_tree_paths(&tail, oid, parents_oid, nparent, base, opt, 0);
+	ll_diff_tree_paths(&tail, oid, parents_oid, nparent, base, opt, 0, NULL);
+	return head;
+}
+
+/*
+ * Threaded tree diff
+ * ------------------
+ *
+ * For large two-tree diffs, the subtrees that need to be descended into
+ * are compared by a pool of threads. Whenever a thread finds such a
+ * subtree and the queue of pending subtrees is running low, it queues
+ * the subtree as a new task instead of descending into it, and notes
+ * where the paths of that task belong in its own list of paths. Idle
+ * threads take the most recently queued task, which tends to be the
+ * deepest and keeps the queue short.
+ *
+ * Once all tasks are done, the lists of paths are spliced together in
+ * the order a single thread would have produced them, and only then are
+ * they handed to opt->pathchange() by the calling thread, so the result
+ * does not depend on the number of threads.
+ */
+#define MAX_TREE_DIFF_THREADS 32
+
+struct tree_diff_walk;
+
+struct tree_diff_child {
+	/* where the paths of the child go in the parent's list */
+	struct combine_diff_path **at;
+	struct tree_diff_task *task;
+};
+
+struct tree_diff_task {
+	struct tree_diff_walk *walk;
+	struct object_id oid, parent_oid;
+	unsigned has_oid : 1,
+		 has_parent : 1;
+	char *base;
+	int depth;
+
+	struct combine_diff_path *paths, **tail;
+	struct tree_diff_child *children;
+	size_t children_nr, children_alloc;
+
+	struct tree_diff_task *next;
+};
+
+struct tree_diff_walk {
+	struct diff_options *opt;
+	int nr_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct tree_diff_task *queue;
+	int queued, busy;
+	pthread_t *threads;
+	int threads_nr;
+};
+
+static int tree_diff_threads(struct diff_options *opt)
+{
+	int nr = 1;
+
+	if (!HAVE_THREADS)
+		return 1;
+	repo_config_get_int(opt->repo, "diff.treethreads", &nr);
+	if (nr < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr, "diff.treeThreads");
+	if (!nr)
+		nr = online_cpus();
+	return nr < MAX_TREE_DIFF_THREADS ? nr : MAX_TREE_DIFF_THREADS;
+}
+
+static void run_tree_diff_task(struct tree_diff_task *task)
+{
+	struct strbuf base = STRBUF_INIT;
+	const struct object_id *parent_oid =
+		task->has_parent ? &task->parent_oid : NULL;
+
+	strbuf_addstr(&base, task->base);
+	task->tail = &task->paths;
+	ll_diff_tree_paths(&task->tail, task->has_oid ? &task->oid : NULL,
+			   &parent_oid, 1, &base, task->walk->opt,
+			   task->depth, task);
+	strbuf_release(&base);
+}
+
+/* Run queued tasks until there are none left and no thread is busy. */
+static void run_tree_diff_tasks(struct tree_diff_walk *walk)
+{
+	pthread_mutex_lock(&walk->mutex);
+	while (1) {
+		struct tree_diff_task *task;
+
+		while (!walk->queue && walk->busy)
+			pthread_cond_wait(&walk->cond, &walk->mutex);
+		task = walk->queue;
+		if (!task)
+			break;
+		walk->queue = task->next;
+		walk->queued--;
+		walk->busy++;
+		pthread_mutex_unlock(&walk->mutex);
+
+		run_tree_diff_task(task);
+
+		pthread_mutex_lock(&walk->mutex);
+		walk->busy--;
+		if (!walk->busy && !walk->queue)
+			pthread_cond_broadcast(&walk->cond);
+	}
+	pthread_mutex_unlock(&walk->mutex);
+}
+
+static void *tree_diff_thread(void *data)
+{
+	trace2_thread_start("tree-diff");
+	run_tree_diff_tasks(data);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Called by emit_path() for a subtree that needs to be descended into.
+ * Returns 0 if the subtree was queued, or non-zero if the caller should
+ * descend into it itself.
+ */
+static int queue_subtree(struct tree_diff_task *task,
+			 struct combine_diff_path **at,
+			 const struct object_id *oid,
+			 const struct object_id *parent_oid,
+			 const struct strbuf *base, int depth)
+{
+	struct tree_diff_walk *walk = task->walk;
+	struct tree_diff_task *child;
+
+	pthread_mutex_lock(&walk->mutex);
+	if (walk->queued >= 2 * walk->nr_threads) {
+		pthread_mutex_unlock(&walk->mutex);
+		return -1;
+	}
+
+	CALLOC_ARRAY(child, 1);
+	child->walk = walk;
+	if (oid) {
+		oidcpy(&child->oid, oid);
+		child->has_oid = 1;
+	}
+	if (parent_oid) {
+		oidcpy(&child->parent_oid, parent_oid);
+		child->has_parent = 1;
+	}
+	child->base = xstrdup(base->buf);
+	child->depth = depth;
+
+	child->next = walk->queue;
+	walk->queue = child;
+	walk->queued++;
+	/* start the threads only once there is something to share */
+	if (walk->threads_nr < walk->nr_threads - 1) {
+		if (pthread_create(&walk->threads[walk->threads_nr], NULL,
+				   tree_diff_thread, walk))
+			die(_("unable to create thread"));
+		walk->threads_nr++;
+	}
+	pthread_cond_signal(&walk->cond);
+	pthread_mutex_unlock(&walk->mutex);
+
+	ALLOC_GROW(task->children, task->children_nr + 1, task->children_alloc);
+	task->children[task->children_nr].at = at;
+	task->children[task->children_nr].task = child;
+	task->children_nr++;
+	return 0;
+}
+
+/*
+ * Splice the paths of the children of a finished task into its own list
+ * and return the result. `tailp` is set to the next pointer of the last
+ * path. The task is freed.
+ */
+static struct combine_diff_path *finish_tree_diff_task(
+	struct tree_diff_task *task,
+	struct combine_diff_path ***tailp)
+{
+	struct combine_diff_path *head, **tail = task->tail;
+
+	/*
+	 * Going backwards, children that belong at the same spot end up
+	 * in the order they were found in.
+	 */
+	for (size_t i = task->children_nr; i > 0; i--) {
+		struct tree_diff_child *c = &task->children[i - 1];
+		struct combine_diff_path *child_head, **child_tail;
+
+		child_head = finish_tree_diff_task(c->task, &child_tail);
+		if (!child_head)
+			continue;
+		*child_tail = *c->at;
+		*c->at = child_head;
+		if (c->at == tail)
+			tail = child_tail;
+	}
+
+	head = task->paths;
+	*tailp = tail;
+	free(task->children);
+	free(task->base);
+	free(task);
+	return head;
+}
+
+static struct combine_diff_path *diff_tree_paths_threaded(
+	const struct object_id *oid, const struct object_id *parent_oid,
+	struct strbuf *base, struct diff_options *opt, int nr_threads)
+{
+	struct tree_diff_walk walk = { 0 };
+	struct tree_diff_task *root;
+	struct combine_diff_path *head, **tail;
+	pathchange_fn_t pathchange = opt->pathchange;
+	int use_lock = !obj_read_use_lock;
+
+	walk.opt = opt;
+	walk.nr_threads = nr_threads;
+	pthread_mutex_init(&walk.mutex, NULL);
+	pthread_cond_init(&walk.cond, NULL);
+	CALLOC_ARRAY(walk.threads, nr_threads - 1);
+	if (use_lock)
+		enable_obj_read_lock();
+
+	/* the paths are handed to opt->pathchange() once they are sorted */
+	opt->pathchange = NULL;
+	opt->pathspec.recursive = opt->flags.recursive;
+
+	CALLOC_ARRAY(root, 1);
+	root->walk = &walk;
+	if (oid) {
+		oidcpy(&root->oid, oid);
+		root->has_oid = 1;
+	}
+	if (parent_oid) {
+		oidcpy(&root->parent_oid, parent_oid);
+		root->has_parent = 1;
+	}
+	root->base = xstrdup(base->buf);
+
+	/*
+	 * The calling thread starts with the root and then works along
+	 * with the threads started by queue_subtree().
+	 */
+	walk.queue = root;
+	walk.queued = 1;
+	run_tree_diff_tasks(&walk);
+
+	for (int i = 0; i < walk.threads_nr; i++)
+		pthread_join(walk.threads[i], NULL);
+	if (walk.threads_nr)
+		trace2_data_intmax("diff", opt->repo, "tree-diff/threads",
+				   walk.threads_nr + 1);
+	free(walk.threads);
+	if (use_lock)
+		disable_obj_read_lock();
+	pthread_cond_destroy(&walk.cond);
+	pthread_mutex_destroy(&walk.mutex);
+	opt->pathchange = pathchange;
+
+	head = finish_tree_diff_task(root, &tail);
 	return head;
 }
 
@@ -703,9 +987,19 @@ static void ll_diff_tree_oid(const struct object_id *old_oid,
 {
 	struct combine_diff_path *paths, *p;
 	pathchange_fn_t pathchange_old = opt->pathchange;
+	int nr_threads;
 
 	opt->pathchange = emit_diff_first_parent_only;
-	paths = diff_tree_paths(new_oid, &old_oid, 1, base, opt);
+	if (opt->flags.recursive && !opt->pathspec.nr && !opt->max_changes &&
+	    !opt->flags.quick &&
+	    (nr_threads = tree_diff_threads(opt)) > 1) {
+		paths = diff_tree_paths_threaded(new_oid, old_oid, base, opt,
+						 nr_threads);
+		for (p = paths; p; p = p->next)
+			emit_diff_first_parent_only(opt, p);
+	} else {
+		paths = diff_tree_paths(new_oid, &old_oid, 1, base, opt);
+	}
 
 	for (p = paths; p;) {
 		struct combine_diff_path *pprev = p;
@@ -441,15 +441,18 @@ int traverse_trees(struct index_state *istate,
 	struct strbuf base = STRBUF_INIT;
 	int interesting = 1;
 	char *traverse_path;
+	int *depth = info->depth ? info->depth : &traverse_trees_cur_depth;
 
-	if (traverse_trees_cur_depth > max_allowed_tree_depth)
+	if (*depth > max_allowed_tree_depth)
 		return error("exceeded maximum allowed tree depth");
 
-	traverse_trees_count++;
-	traverse_trees_cur_depth++;
+	(*depth)++;
 
-	if (traverse_trees_cur_depth > traverse_trees_max_depth)
-		traverse_trees_max_depth = traverse_trees_cur_depth;
+	if (!info->depth) {
+		traverse_trees_count++;
+		if (traverse_trees_cur_depth > traverse_trees_max_depth)
+			traverse_trees_max_depth = traverse_trees_cur_depth;
+	}
 
 	ALLOC_ARRAY(entry, n);
 	ALLOC_ARRAY(tx, n);
@@ -553,7 +556,7 @@ int traverse_trees(struct index_state *istate,
 	info->traverse_path = NULL;
 	strbuf_release(&base);
 
-	traverse_trees_cur_depth--;
+	(*depth)--;
 	return ret;
 }
 
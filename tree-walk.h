@@ -173,6 +173,14 @@ struct traverse_info {
 
 	/* tells whether to stop at the first error or not. */
 	int show_all_errors;
+
+	/*
+	 * If set, nested traverse_trees() calls are counted here rather
+	 * than in a global counter when enforcing core.maxTreeDepth. This
+	 * lets a caller traverse disjoint subtrees in several threads at
+	 * once; such traversals are not included in the trace2 statistics.
+	 */
+	int *depth;
 };
 
 /**
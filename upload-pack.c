@@ -13,6 +13,7 @@
 #include "odb.h"
 #include "oid-array.h"
 #include "object.h"
+#include "pack-cache.h"
 #include "commit.h"
 #include "diff.h"
 #include "revision.h"
@@ -99,6 +100,7 @@ struct upload_pack_data {
 	struct packet_writer writer;
 
 	char *pack_objects_hook;
+	unsigned long pack_cache_limit;
 
 	unsigned stateless_rpc : 1;				/* v0 only */
 	unsigned no_done : 1;					/* v0 only */
@@ -215,6 +217,9 @@ struct output_state {
 	int used;
 	unsigned packfile_uris_started : 1;
 	unsigned packfile_started : 1;
+
+	/* if set, a copy of everything read is stored in the pack cache */
+	struct pack_cache_file *cache;
 };
 
 static int relay_pack_data(int pack_objects_out, struct output_state *os,
@@ -237,6 +242,8 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	if (readsz < 0) {
 		return readsz;
 	}
+	if (os->cache)
+		pack_cache_write(os->cache, os->buffer + os->used, readsz);
 	os->used += readsz;
 
 	while (!os->packfile_started) {
@@ -282,16 +289,139 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	return readsz;
 }
 
+static int add_shallow_to_key(const struct commit_graft *graft, void *cb_data)
+{
+	struct strbuf *key = cb_data;
+	if (graft->nr_parent == -1)
+		strbuf_addf(key, "--shallow %s\n", oid_to_hex(&graft->oid));
+	return 0;
+}
+
+static int add_tag_to_key(const char *refname, const char *referent UNUSED,
+			  const struct object_id *oid, int flag UNUSED,
+			  void *cb_data)
+{
+	strbuf_addf(cb_data, "%s %s\n", oid_to_hex(oid), refname);
+	return 0;
+}
+
+static void add_objects_to_key(struct strbuf *key,
+			       const struct object_array *objects)
+{
+	struct string_list hexes = STRING_LIST_INIT_DUP;
+
+	for (size_t i = 0; i < objects->nr; i++)
+		string_list_append(&hexes,
+				   oid_to_hex(&objects->objects[i].item->oid));
+	string_list_sort(&hexes);
+	string_list_remove_duplicates(&hexes, 0);
+	for (size_t i = 0; i < hexes.nr; i++)
+		strbuf_addf(key, "%s\n", hexes.items[i].string);
+	string_list_clear(&hexes, 0);
+}
+
+/*
+ * Compute the name of the pack cache entry for a request: a hash of the
+ * pack-objects command line and of its input, with the object lists
+ * sorted so that the order in which the client sent them does not
+ * matter. Progress output is not cached, so "--progress" is left out.
+ */
+static void pack_cache_key(struct upload_pack_data *pack_data,
+			   const struct strvec *args, struct object_id *oid)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct object_array edges = OBJECT_ARRAY_INIT;
+	struct git_hash_ctx ctx;
+
+	strbuf_addstr(&key, "pack-cache v1\n");
+	for (size_t i = 0; i < args->nr; i++)
+		if (strcmp(args->v[i], "--progress"))
+			strbuf_add(&key, args->v[i], strlen(args->v[i]) + 1);
+	strbuf_addch(&key, '\n');
+
+	if (pack_data->shallow_nr)
+		for_each_commit_graft(add_shallow_to_key, &key);
+	add_objects_to_key(&key, &pack_data->want_obj);
+	strbuf_addstr(&key, "--not\n");
+	for (size_t i = 0; i < pack_data->have_obj.nr; i++)
+		add_object_array(pack_data->have_obj.objects[i].item, NULL,
+				 &edges);
+	for (size_t i = 0; i < pack_data->extra_edge_obj.nr; i++)
+		add_object_array(pack_data->extra_edge_obj.objects[i].item,
+				 NULL, &edges);
+	add_objects_to_key(&key, &edges);
+
+	/*
+	 * Which tags are included depends on the tags we have, not just
+	 * on the request.
+	 */
+	if (pack_data->use_include_tag) {
+		strbuf_addstr(&key, "tags\n");
+		refs_for_each_tag_ref(get_main_ref_store(the_repository),
+				      add_tag_to_key, &key);
+	}
+
+	the_hash_algo->init_fn(&ctx);
+	git_hash_update(&ctx, key.buf, key.len);
+	git_hash_final_oid(oid, &ctx);
+
+	object_array_clear(&edges);
+	strbuf_release(&key);
+}
+
+/*
+ * Stream an entry of the pack cache to the client. If the entry is
+ * still being produced, follow it until it is complete. Returns -1 if
+ * the producer went away before finishing it.
+ */
+static int send_cached_pack(struct upload_pack_data *pack_data,
+			    struct pack_cache_file *cache,
+			    struct output_state *os)
+{
+	time_t last_sent = time(NULL);
+
+	while (1) {
+		int status = pack_cache_status(cache);
+		int result;
+
+		if (status < 0)
+			return -1;
+
+		reset_timeout(pack_data->timeout);
+		result = relay_pack_data(cache->fd, os,
+					 pack_data->use_sideband, 0);
+		if (result < 0)
+			return -1;
+		if (result > 0) {
+			last_sent = time(NULL);
+			continue;
+		}
+		/* no more data, and none was coming when we looked */
+		if (status > 0)
+			return 0;
+
+		/* see the keepalive in create_pack_file() */
+		if (pack_data->keepalive >= 0 && pack_data->use_sideband &&
+		    time(NULL) - last_sent >= pack_data->keepalive) {
+			static const char buf[] = "0005\1";
+			write_or_die(1, buf, 5);
+			last_sent = time(NULL);
+		}
+		sleep_millisec(100);
+	}
+}
+
 static void create_pack_file(struct upload_pack_data *pack_data,
 			     const struct string_list *uri_protocols)
 {
+	struct pack_cache_file cache = PACK_CACHE_FILE_INIT;
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
 	struct output_state *output_state = xcalloc(1, sizeof(struct output_state));
 	char progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
 	ssize_t sz;
-	int i;
+	int i, quiet_ms = 0;
 	FILE *pipe_fd;
 
 	if (!pack_data->pack_objects_hook)
@@ -333,6 +463,36 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 					 uri_protocols->items[i].string);
 	}
 
+	/*
+	 * The hook may do its own caching, and packfile URIs are not
+	 * part of the cached data.
+	 */
+	if (pack_data->pack_cache_limit && !pack_data->pack_objects_hook &&
+	    !uri_protocols) {
+		struct object_id key;
+
+		pack_cache_key(pack_data, &pack_objects.args, &key);
+		switch (pack_cache_open(the_repository, &key, &cache)) {
+		case PACK_CACHE_HIT:
+		case PACK_CACHE_SHARED:
+			if (!send_cached_pack(pack_data, &cache, output_state)) {
+				pack_cache_close(&cache);
+				child_process_clear(&pack_objects);
+				goto flush;
+			}
+			pack_cache_close(&cache);
+			/* we can still start over if nothing was sent */
+			if (output_state->used || output_state->packfile_started) {
+				child_process_clear(&pack_objects);
+				goto fail;
+			}
+			break;
+		case PACK_CACHE_MISS:
+			output_state->cache = &cache;
+			break;
+		}
+	}
+
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
@@ -393,8 +553,14 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		polltimeout = pack_data->keepalive < 0
 			? -1
 			: 1000 * pack_data->keepalive;
+		/* wake up in time to show consumers of the cache we are alive */
+		if (output_state->cache &&
+		    (polltimeout < 0 || polltimeout > 1000))
+			polltimeout = 1000;
 
 		ret = poll(pfd, pollsize, polltimeout);
+		if (output_state->cache)
+			pack_cache_touch(output_state->cache);
 
 		if (ret < 0) {
 			if (errno != EINTR) {
@@ -403,6 +569,7 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 			}
 			continue;
 		}
+		quiet_ms = ret ? 0 : quiet_ms + polltimeout;
 		if (0 <= pe && (pfd[pe].revents & (POLLIN|POLLHUP))) {
 			/* Status ready; we ship that in the side-band
 			 * or dump to the standard error.
@@ -445,9 +612,12 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		 * protocol to say anything, so those clients are just out of
 		 * luck.
 		 */
-		if (!ret && pack_data->use_sideband) {
+		if (!ret && pack_data->use_sideband &&
+		    pack_data->keepalive >= 0 &&
+		    quiet_ms >= 1000 * pack_data->keepalive) {
 			static const char buf[] = "0005\1";
 			write_or_die(1, buf, 5);
+			quiet_ms = 0;
 		}
 	}
 
@@ -455,7 +625,13 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		error("git upload-pack: git-pack-objects died with error.");
 		goto fail;
 	}
+	if (output_state->cache) {
+		pack_cache_commit(output_state->cache,
+				  pack_data->pack_cache_limit);
+		pack_cache_close(output_state->cache);
+	}
 
+ flush:
 	/* flush the data */
 	if (output_state->used > 0) {
 		send_client_data(1, output_state->buffer, output_state->used,
@@ -468,6 +644,8 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	return;
 
  fail:
+	if (output_state->cache)
+		pack_cache_close(output_state->cache);
 	free(output_state);
 	send_client_data(3, abort_msg, strlen(abort_msg),
 			 pack_data->use_sideband);
@@ -1381,6 +1559,8 @@ static int upload_pack_config(const char *var, const char *value,
 		data->keepalive = git_config_int(var, value, ctx->kvi);
 		if (!data->keepalive)
 			data->keepalive = -1;
+	} else if (!strcmp("uploadpack.packcachelimit", var)) {
+		data->pack_cache_limit = git_config_ulong(var, value, ctx->kvi);
 	} else if (!strcmp("uploadpack.allowfilter", var)) {
 		data->allow_filter = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowrefinwant", var)) {
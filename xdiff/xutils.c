@@ -249,20 +249,108 @@ int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
 	return 1;
 }
 
+/*
+ * Lines are hashed a word at a time rather than byte by byte: eight
+ * bytes are loaded at once, checked for a newline (or, when ignoring
+ * whitespace, for any byte that might be a space) and folded into the
+ * hash with a single multiplication.  Bytes that cannot be consumed a
+ * whole word at a time are shifted into a partial word instead.  We
+ * never read past `top`.
+ */
+#define XDL_HASH_ONES		((uint64_t)0x0101010101010101)
+#define XDL_HASH_HIGHS		((uint64_t)0x8080808080808080)
+#define XDL_HASH_NEWLINES	((uint64_t)0x0a0a0a0a0a0a0a0a)
+#define XDL_HASH_SEED		((uint64_t)5381)
+#define XDL_HASH_MULT		((uint64_t)0x9e3779b97f4a7c15)
+
+/* Non-zero iff one of the bytes in `w` is zero. */
+#define XDL_HAS_ZERO_BYTE(w)	(((w) - XDL_HASH_ONES) & ~(w) & XDL_HASH_HIGHS)
+/* Non-zero iff one of the bytes in `w` is less than `n` (n <= 128). */
+#define XDL_HAS_LESS_BYTE(w, n)	(((w) - XDL_HASH_ONES * (n)) & ~(w) & XDL_HASH_HIGHS)
+
+struct xdl_hash_state {
+	uint64_t ha;
+	uint64_t word;
+	unsigned int shift;
+	unsigned long len;
+};
+
+static inline uint64_t xdl_load_word(char const *ptr)
+{
+	uint64_t word;
+
+	memcpy(&word, ptr, sizeof(word));
+#if GIT_BYTE_ORDER == GIT_BIG_ENDIAN
+	word = default_bswap64(word);
+#endif
+	return word;
+}
+
+static inline uint64_t xdl_hash_mix(uint64_t ha, uint64_t word)
+{
+	ha = (ha ^ word) * XDL_HASH_MULT;
+	return ha ^ (ha >> 29);
+}
+
+static inline void xdl_hash_byte(struct xdl_hash_state *hs, unsigned char c)
+{
+	hs->word |= (uint64_t)c << hs->shift;
+	hs->shift += 8;
+	hs->len++;
+	if (hs->shift == 64) {
+		hs->ha = xdl_hash_mix(hs->ha, hs->word);
+		hs->word = 0;
+		hs->shift = 0;
+	}
+}
+
+static inline void xdl_hash_word(struct xdl_hash_state *hs, uint64_t word)
+{
+	hs->len += 8;
+	if (!hs->shift) {
+		hs->ha = xdl_hash_mix(hs->ha, word);
+		return;
+	}
+	hs->ha = xdl_hash_mix(hs->ha, hs->word | (word << hs->shift));
+	hs->word = word >> (64 - hs->shift);
+}
+
+static inline unsigned long xdl_hash_finish(struct xdl_hash_state *hs)
+{
+	uint64_t ha = xdl_hash_mix(hs->ha, hs->word);
+
+	ha = xdl_hash_mix(ha, hs->len);
+	return (unsigned long)(ha ^ (ha >> 32));
+}
+
 static unsigned long xdl_hash_record_with_whitespace(char const **data,
 		char const *top, long flags) {
-	unsigned long ha = 5381;
+	struct xdl_hash_state hs = { .ha = XDL_HASH_SEED };
 	char const *ptr = *data;
 	int cr_at_eol_only = (flags & XDF_WHITESPACE_FLAGS) == XDF_IGNORE_CR_AT_EOL;
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
+	while (ptr < top && *ptr != '\n') {
+		/* all spaces are below '!', but not all bytes below it are spaces */
+		if (top - ptr >= 8) {
+			uint64_t word = xdl_load_word(ptr);
+			if (!XDL_HAS_LESS_BYTE(word, '!')) {
+				xdl_hash_word(&hs, word);
+				ptr += 8;
+				continue;
+			}
+		}
+		if (!XDL_ISSPACE(*ptr)) {
+			xdl_hash_byte(&hs, *ptr++);
+			continue;
+		}
+
 		if (cr_at_eol_only) {
 			/* do not ignore CR at the end of an incomplete line */
-			if (*ptr == '\r' &&
-			    (ptr + 1 < top && ptr[1] == '\n'))
-				continue;
+			if (!(*ptr == '\r' &&
+			      (ptr + 1 < top && ptr[1] == '\n')))
+				xdl_hash_byte(&hs, *ptr);
 		}
-		else if (XDL_ISSPACE(*ptr)) {
+		else {
 			const char *ptr2 = ptr;
 			int at_eol;
 			while (ptr + 1 < top && XDL_ISSPACE(ptr[1])
@@ -272,42 +360,40 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 			if (flags & XDF_IGNORE_WHITESPACE)
 				; /* already handled */
 			else if (flags & XDF_IGNORE_WHITESPACE_CHANGE
-				 && !at_eol) {
-				ha += (ha << 5);
-				ha ^= (unsigned long) ' ';
-			}
+				 && !at_eol)
+				xdl_hash_byte(&hs, ' ');
 			else if (flags & XDF_IGNORE_WHITESPACE_AT_EOL
 				 && !at_eol) {
-				while (ptr2 != ptr + 1) {
-					ha += (ha << 5);
-					ha ^= (unsigned long) *ptr2;
-					ptr2++;
-				}
+				while (ptr2 != ptr + 1)
+					xdl_hash_byte(&hs, *ptr2++);
 			}
-			continue;
 		}
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+		ptr++;
 	}
 	*data = ptr < top ? ptr + 1: ptr;
 
-	return ha;
+	return xdl_hash_finish(&hs);
 }
 
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
+	struct xdl_hash_state hs = { .ha = XDL_HASH_SEED };
 	char const *ptr = *data;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+	for (; top - ptr >= 8; ptr += 8) {
+		uint64_t word = xdl_load_word(ptr);
+		if (XDL_HAS_ZERO_BYTE(word ^ XDL_HASH_NEWLINES))
+			break;
+		xdl_hash_word(&hs, word);
 	}
+	/* the newline, if any, is within the next eight bytes */
+	for (; ptr < top && *ptr != '\n'; ptr++)
+		xdl_hash_byte(&hs, *ptr);
 	*data = ptr < top ? ptr + 1: ptr;
 
-	return ha;
+	return xdl_hash_finish(&hs);
 }
 
 unsigned int xdl_hashbits(unsigned int size) {